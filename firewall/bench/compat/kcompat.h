@@ -0,0 +1,417 @@
+/*************************************************************************************************
+ * Userspace stand-ins for the kernel APIs the firewall's data structures use, so their sources
+ * compile unchanged into the benchmarks. Only what those files need -- this is not a kernel.
+ ************************************************************************************************/
+#ifndef _KCOMPAT_H
+#define _KCOMPAT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <linux/types.h>
+
+/* ===============================================================================================
+ * memory
+ * ===============================================================================================*/
+#define GFP_KERNEL          0
+#define GFP_ATOMIC          0
+#define kmalloc(n, gfp)     malloc(n)
+#define kzalloc(n, gfp)     calloc(1, n)
+#define kcalloc(n, s, gfp)  calloc(n, s)
+#define kfree(p)            free(p)
+#define vmalloc(n)          malloc(n)
+#define vzalloc(n)          calloc(1, n)
+#define vfree(p)            free(p)
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+#define printk              printf
+#define KERN_INFO           ""
+#define likely(x)           __builtin_expect(!!(x), 1)
+#define unlikely(x)         __builtin_expect(!!(x), 0)
+#define __read_mostly
+#define U16_MAX             0xffffU
+#define U32_MAX             0xffffffffU
+#define __force
+#define ARRAY_SIZE(a)       (sizeof(a) / sizeof((a)[0]))
+#define DIV_ROUND_UP(n, d)  (((n) + (d) - 1) / (d))
+#define min(a, b)           ((a) < (b) ? (a) : (b))
+#define max(a, b)           ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)      ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b)      ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define clamp(v, lo, hi)    min(max(v, lo), hi)
+#define BUILD_BUG_ON(c)     _Static_assert(!(c), #c)
+#define swap(a, b)          do { typeof(a) __tmp = (a); (a) = (b); (b) = __tmp; } while(0)
+#define container_of(p, t, m) ((t *)((char *)(p) - offsetof(t, m)))
+
+static inline void sort(void *base, size_t num, size_t size, int (*cmp)(const void *, const void *),
+                        void (*swap)(void *, void *, int)) {
+    qsort(base, num, size, cmp);
+}
+
+static inline void get_random_bytes(void *buf, size_t len) {
+    unsigned char *p = buf;
+
+    while(len--) { *p++ = rand(); }
+}
+
+static inline unsigned long roundup_pow_of_two(unsigned long n) {
+    return n <= 1 ? 1 : 1UL << (sizeof(long) * 8 - __builtin_clzl(n - 1));
+}
+
+static inline unsigned long rounddown_pow_of_two(unsigned long n) {
+    return 1UL << (sizeof(long) * 8 - 1 - __builtin_clzl(n));
+}
+
+static inline bool is_power_of_2(unsigned long n) {
+    return n && !(n & (n - 1));
+}
+
+/* ===============================================================================================
+ * bitops
+ * ===============================================================================================*/
+#define BITS_PER_LONG       (sizeof(long) * 8)
+#define BITS_TO_LONGS(n)    (((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static inline bool test_bit(unsigned long nr, const unsigned long *addr) {
+    return (addr[nr / BITS_PER_LONG] >> (nr % BITS_PER_LONG)) & 1;
+}
+
+static inline unsigned long __ffs64(u64 word) {
+    return __builtin_ctzll(word);
+}
+
+static inline int fls64(u64 x) {
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static inline void __set_bit(unsigned long nr, unsigned long *addr) {
+    addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline bool __test_and_set_bit(unsigned long nr, unsigned long *addr) {
+    bool old = test_bit(nr, addr);
+
+    __set_bit(nr, addr);
+    return old;
+}
+
+static inline void bitmap_zero(unsigned long *dst, unsigned int nbits) {
+    memset(dst, 0, BITS_TO_LONGS(nbits) * sizeof(unsigned long));
+}
+
+static inline void bitmap_set(unsigned long *map, unsigned int start, unsigned int len) {
+    while(len--) { __set_bit(start++, map); }
+}
+
+/* ===============================================================================================
+ * concurrency -- the benchmarks are single threaded on one "CPU", so per-CPU data is one copy,
+ * RCU readers never wait and locks are free
+ * ===============================================================================================*/
+#define __percpu
+#define __rcu
+#define ____cacheline_aligned           __attribute__((aligned(64)))
+#define alloc_percpu(type)              ((type *)calloc(1, sizeof(type)))
+#define free_percpu(p)                  free(p)
+#define this_cpu_ptr(p)                 (p)
+#define per_cpu_ptr(p, cpu)             ((void)(cpu), (p))
+#define get_cpu_ptr(p)                  (p)
+#define put_cpu_ptr(p)                  do { } while(0)
+#define for_each_possible_cpu(cpu)      for((cpu) = 0; (cpu) < 1; (cpu)++)
+#define num_possible_cpus()             1U
+#define local_bh_disable()              do { } while(0)
+#define local_bh_enable()               do { } while(0)
+
+#define READ_ONCE(x)                    (*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, v)                (*(volatile typeof(x) *)&(x) = (v))
+#define smp_load_acquire(p)             __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v)         __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+#define rcu_read_lock()                 do { } while(0)
+#define rcu_read_unlock()               do { } while(0)
+#define rcu_dereference(p)              (p)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_assign_pointer(p, v)        ((p) = (v))
+#define RCU_INIT_POINTER(p, v)          ((p) = (v))
+#define synchronize_rcu()               do { } while(0)
+#define kfree_rcu(p, f)                 free(p)
+
+struct rcu_head { void *unused; };
+
+struct mutex { int unused; };
+#define DEFINE_MUTEX(m)                 struct mutex m
+#define mutex_lock(m)                   ((void)(m))
+#define mutex_unlock(m)                 ((void)(m))
+#define lockdep_is_held(m)              1
+
+typedef struct { int unused; } spinlock_t;
+#define DEFINE_SPINLOCK(l)              spinlock_t l
+#define spin_lock_bh(l)                 ((void)(l))
+#define spin_unlock_bh(l)               ((void)(l))
+
+/* one thread, so a reader never sees a write in progress */
+typedef struct { unsigned int sequence; } seqcount_t;
+#define seqcount_init(s)                ((s)->sequence = 0)
+#define read_seqcount_begin(s)          ((s)->sequence)
+#define read_seqcount_retry(s, start)   ((s)->sequence != (start))
+#define write_seqcount_begin(s)         ((s)->sequence++)
+#define write_seqcount_end(s)           ((s)->sequence++)
+
+/* the benchmark advances jiffies itself, e.g. once per replayed batch */
+#define HZ                              1000
+extern unsigned long jiffies;
+
+/* the clock follows jiffies, so limits measured against it advance with the replay */
+#define NSEC_PER_SEC                    1000000000ULL
+#define ktime_get_mono_fast_ns()        ((u64)jiffies * (NSEC_PER_SEC / HZ))
+#define ktime_get_seconds()             ((s64)(jiffies / HZ))
+#define div_u64(n, d)                   ((u64)(n) / (u32)(d))
+#define div64_u64(n, d)                 ((u64)(n) / (u64)(d))
+
+typedef struct { int counter; } atomic_t;
+typedef struct { s64 counter; } atomic64_t;
+#define atomic_read(a)                  ((a)->counter)
+#define atomic_set(a, v)                ((a)->counter = (v))
+#define atomic_inc_return(a)            (++(a)->counter)
+#define atomic64_read(a)                ((a)->counter)
+#define atomic64_set(a, v)              ((a)->counter = (v))
+
+static inline s64 atomic64_cmpxchg(atomic64_t *a, s64 old, s64 new) {
+    s64 seen = a->counter;
+
+    if(seen == old) { a->counter = new; }
+    return seen;
+}
+
+/* ===============================================================================================
+ * module, debugfs and seq_file -- accepted and ignored, the benchmarks report their own numbers
+ * ===============================================================================================*/
+#define THIS_MODULE                     NULL
+#define module_param(n, t, p)
+#define module_param_array(n, t, c, p)
+#define MODULE_PARM_DESC(n, d)
+#define EXPORT_SYMBOL(s)
+
+struct inode { void *i_private; };
+struct dentry;
+struct file { void *private_data; unsigned int f_mode; };
+struct seq_file { void *private; };
+
+struct file_operations {
+    void *owner;
+    int (*open)(struct inode *, struct file *);
+    ssize_t (*read)(struct file *, char *, size_t, loff_t *);
+    ssize_t (*write)(struct file *, const char *, size_t, loff_t *);
+    loff_t (*llseek)(struct file *, loff_t, int);
+    int (*release)(struct inode *, struct file *);
+};
+
+struct seq_operations {
+    void *(*start)(struct seq_file *, loff_t *);
+    void *(*next)(struct seq_file *, void *, loff_t *);
+    void (*stop)(struct seq_file *, void *);
+    int (*show)(struct seq_file *, void *);
+};
+
+#define SEQ_START_TOKEN                 ((void *)1)
+
+static inline struct dentry *debugfs_create_file(const char *name, int mode, struct dentry *parent,
+                                                 void *data, const struct file_operations *fops) {
+    return NULL;
+}
+static inline ssize_t seq_read(struct file *f, char *buf, size_t n, loff_t *pos) { return 0; }
+static inline loff_t seq_lseek(struct file *f, loff_t off, int whence) { return 0; }
+static inline int single_open(struct file *f, int (*show)(struct seq_file *, void *), void *data) { return 0; }
+static inline int single_release(struct inode *i, struct file *f) { return 0; }
+static inline int seq_open(struct file *f, const struct seq_operations *ops) { return 0; }
+static inline int seq_release(struct inode *i, struct file *f) { return 0; }
+static inline void seq_printf(struct seq_file *m, const char *fmt, ...) { }
+
+/* ===============================================================================================
+ * skb -- a linear buffer starting at the IP header; skb_seq_read hands the payload out in
+ * SKB_FRAG_SIZE pieces so scans resume across fragment edges as they do on paged skbs
+ * ===============================================================================================*/
+#define SKB_FRAG_SIZE                   256
+#define IFNAMSIZ                        16
+
+struct sk_buff {
+    unsigned char *data;
+    unsigned int len;
+    __be16 protocol;
+};
+
+struct skb_seq_state {
+    const unsigned char *data;
+    unsigned int len;               // bytes from the start offset to the end offset
+};
+
+struct net_device {
+    char name[IFNAMSIZ];
+    int ifindex;
+};
+
+/* the benchmarks have no network devices and their names never resolve; fw-compile makes up the
+ * ones its rules name */
+struct net {
+    struct net_device *devs;
+    unsigned int ndevs;
+};
+extern struct net init_net;
+
+static inline struct net_device *dev_get_by_name_rcu(struct net *net, const char *name) {
+    unsigned int i;
+
+    for(i = 0; i < net->ndevs; i++) {
+        if(!strcmp(net->devs[i].name, name)) { return &net->devs[i]; }
+    }
+    return NULL;
+}
+
+static inline int skb_network_offset(const struct sk_buff *skb) {
+    return 0;
+}
+
+static inline void *skb_header_pointer(const struct sk_buff *skb, int offset, int len, void *buffer) {
+    return offset >= 0 && len >= 0 && (unsigned int)offset + len <= skb->len ? skb->data + offset : NULL;
+}
+
+static inline void skb_prepare_seq_read(struct sk_buff *skb, unsigned int from, unsigned int to,
+                                        struct skb_seq_state *st) {
+    st->data = skb->data + from;
+    st->len = to - from;
+}
+
+static inline unsigned int skb_seq_read(unsigned int consumed, const u8 **data, struct skb_seq_state *st) {
+    if(consumed >= st->len) { return 0; }
+
+    *data = st->data + consumed;
+    return min(st->len - consumed, (unsigned int)SKB_FRAG_SIZE);
+}
+
+static inline void skb_abort_seq_read(struct skb_seq_state *st) {
+}
+
+#define NF_DROP                         0
+#define NF_ACCEPT                       1
+#define NFPROTO_IPV4                    2
+#define NFPROTO_IPV6                    10
+
+/* ===============================================================================================
+ * inet
+ * ===============================================================================================*/
+static inline int in4_pton(const char *src, int srclen, u8 *dst, int delim, const char **end) {
+    char buf[16];
+    int i;
+
+    if(srclen < 0) { srclen = strlen(src); }
+    for(i = 0; i < srclen && src[i] != delim && i < (int)sizeof(buf) - 1; i++) { buf[i] = src[i]; }
+    buf[i] = '\0';
+    if(end) { *end = src + i; }
+
+    return inet_pton(AF_INET, buf, dst) == 1;
+}
+
+static inline int in6_pton(const char *src, int srclen, u8 *dst, int delim, const char **end) {
+    char buf[48];
+    int i;
+
+    if(srclen < 0) { srclen = strlen(src); }
+    for(i = 0; i < srclen && src[i] != delim && i < (int)sizeof(buf) - 1; i++) { buf[i] = src[i]; }
+    buf[i] = '\0';
+    if(end) { *end = src + i; }
+
+    return inet_pton(AF_INET6, buf, dst) == 1;
+}
+
+#define ICMPV6_PKT_TOOBIG               2
+#define NDISC_ROUTER_SOLICITATION       133
+#define NDISC_REDIRECT                  137
+
+static inline int kstrtouint(const char *s, unsigned int base, unsigned int *res) {
+    char *end;
+    unsigned long v;
+
+    errno = 0;
+    v = strtoul(s, &end, base);
+    if(!*s || *end || errno || v > UINT_MAX) { return -EINVAL; }
+    *res = v;
+
+    return 0;
+}
+
+/* ===============================================================================================
+ * jhash -- Bob Jenkins' lookup3 final mix, same results as <linux/jhash.h>
+ * ===============================================================================================*/
+#define JHASH_INITVAL       0xdeadbeef
+#define jhash_rol32(x, k)   (((x) << (k)) | ((x) >> (32 - (k))))
+
+#define __jhash_final(a, b, c) {            \
+    c ^= b; c -= jhash_rol32(b, 14);        \
+    a ^= c; a -= jhash_rol32(c, 11);        \
+    b ^= a; b -= jhash_rol32(a, 25);        \
+    c ^= b; c -= jhash_rol32(b, 16);        \
+    a ^= c; a -= jhash_rol32(c, 4);         \
+    b ^= a; b -= jhash_rol32(a, 14);        \
+    c ^= b; c -= jhash_rol32(b, 24);        \
+}
+
+static inline u32 jhash_3words(u32 a, u32 b, u32 c, u32 initval) {
+    initval += JHASH_INITVAL + (3 << 2);
+    a += initval;
+    b += initval;
+    c += initval;
+    __jhash_final(a, b, c);
+
+    return c;
+}
+
+static inline u32 jhash_2words(u32 a, u32 b, u32 initval) {
+    return jhash_3words(a, b, 0, initval);
+}
+
+static inline u32 jhash_1word(u32 a, u32 initval) {
+    return jhash_3words(a, 0, 0, initval);
+}
+
+/* ===============================================================================================
+ * crc32 -- the reflected polynomial 0xedb88320 eight bytes at a time, like the kernel's default
+ * crc32_le() in <linux/crc32.h>, so images are checked about as fast as the module does it
+ * ===============================================================================================*/
+static inline u32 crc32_le(u32 crc, const unsigned char *p, size_t len) {
+    static u32 table[8][256];
+    u32 c, lo, hi;
+    int i, k;
+
+    if(!table[0][1]) {
+        for(i = 0; i < 256; i++) {
+            for(c = i, k = 0; k < 8; k++) { c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1; }
+            table[0][i] = c;
+        }
+        for(i = 0; i < 256; i++) {
+            for(k = 1; k < 8; k++) { table[k][i] = table[0][table[k - 1][i] & 0xff] ^ (table[k - 1][i] >> 8); }
+        }
+    }
+
+    /* little-endian only, like the rest of the shims */
+    for(; len >= 8; len -= 8, p += 8) {
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+              table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff] ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+    }
+    while(len--) { crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8); }
+
+    return crc;
+}
+
+#endif /* _KCOMPAT_H */
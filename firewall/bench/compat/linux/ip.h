@@ -0,0 +1,2 @@
+#include <netinet/ip.h>
+#include "../kcompat.h"
@@ -0,0 +1,12 @@
+#include "../kcompat.h"
+
+/* as in <linux/ipv6.h>, little-endian bitfield order like the rest of the shims */
+struct ipv6hdr {
+    __u8 priority:4, version:4;
+    __u8 flow_lbl[3];
+    __be16 payload_len;
+    __u8 nexthdr;
+    __u8 hop_limit;
+    struct in6_addr saddr;
+    struct in6_addr daddr;
+};
@@ -0,0 +1,2 @@
+#include <netinet/tcp.h>
+#include "../kcompat.h"
@@ -0,0 +1,16 @@
+/* kernel-internal type names on top of the uapi <linux/types.h> */
+#ifndef _KCOMPAT_LINUX_TYPES_H
+#define _KCOMPAT_LINUX_TYPES_H
+
+#include_next <linux/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s32 s32;
+typedef __s64 s64;
+
+#endif
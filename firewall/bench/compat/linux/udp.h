@@ -0,0 +1,2 @@
+#include <netinet/udp.h>
+#include "../kcompat.h"
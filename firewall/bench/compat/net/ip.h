@@ -0,0 +1,4 @@
+#include <netinet/ip.h>
+#include "../kcompat.h"
+
+#define IP_OFFSET IP_OFFMASK
@@ -0,0 +1,7 @@
+#include <string.h>
+#include <netinet/in.h>
+#include "../kcompat.h"
+
+static inline bool ipv6_addr_equal(const struct in6_addr *a1, const struct in6_addr *a2) {
+    return !memcmp(a1, a2, sizeof(*a1));
+}
@@ -0,0 +1,87 @@
+#!/bin/sh
+#*************************************************************************************************
+# Multi-queue scaling benchmark -- drives the firewall hook from 1..N cores at once and reports
+# the packets/sec the hook handled for each core count.
+#
+# pktgen runs one kernel thread per core, each transmitting into one end of a veth pair. veth hands
+# every packet to netif_rx() on the transmitting core, so the receive side (and the PRE_ROUTING
+# hook) runs on N cores in parallel with no RSS hardware needed. With the hook free of shared
+# writable state the rate should grow roughly linearly with the core count.
+#
+# usage: mq-scaling.sh [max_cores] [seconds]     (as root, with netfilter-firewall.ko loaded)
+#   SRC=10.0.0.1      source address of generated traffic; the default falls in the blocked
+#                     208.80.154.0/24 so every packet is classified and dropped by the hook
+#*************************************************************************************************
+set -e
+
+MAX_CORES=${1:-$(nproc)}
+SECONDS_PER_RUN=${2:-5}
+SRC=${SRC:-208.80.154.10}
+DST=${DST:-192.0.2.1}
+DEV=fwbench0
+PEER=fwbench1
+PG=/proc/net/pktgen
+
+pgset() {
+    echo "$2" > "$1"
+    if ! grep -q "Result: OK" "$1" 2>/dev/null && [ "$1" != "$PG/pgctrl" ]; then
+        echo "pktgen: '$2' > $1 failed" >&2
+        grep "Result:" "$1" >&2
+        exit 1
+    fi
+}
+
+rx_packets() {
+    cat /sys/class/net/$PEER/statistics/rx_packets
+}
+
+cleanup() {
+    echo stop > $PG/pgctrl 2>/dev/null || true
+    for t in $PG/kpktgend_*; do echo rem_device_all > "$t" 2>/dev/null || true; done
+    ip link del $DEV 2>/dev/null || true
+}
+trap cleanup EXIT INT TERM
+
+modprobe pktgen
+ip link add $DEV type veth peer name $PEER
+ip link set $DEV up
+ip link set $PEER up
+PEER_MAC=$(cat /sys/class/net/$PEER/address)
+
+printf "%-6s %14s %14s\n" cores pps pps/core
+
+cores=1
+while [ $cores -le $MAX_CORES ]; do
+    for t in $PG/kpktgend_*; do pgset "$t" "rem_device_all"; done
+
+    cpu=0
+    while [ $cpu -lt $cores ]; do
+        pgset $PG/kpktgend_$cpu "add_device $DEV@$cpu"
+        f=$PG/$DEV@$cpu
+        pgset $f "count 0"
+        pgset $f "clone_skb 0"
+        pgset $f "pkt_size 60"
+        pgset $f "delay 0"
+        pgset $f "src_min $SRC"
+        pgset $f "src_max $SRC"
+        pgset $f "dst $DST"
+        pgset $f "dst_mac $PEER_MAC"
+        pgset $f "udp_src_min 1024"
+        pgset $f "udp_src_max 65535"
+        pgset $f "flag UDPSRC_RND"
+        cpu=$((cpu + 1))
+    done
+
+    echo start > $PG/pgctrl &
+    sleep 1                                 # let every thread reach full rate
+    before=$(rx_packets)
+    sleep $SECONDS_PER_RUN
+    after=$(rx_packets)
+    echo stop > $PG/pgctrl
+    wait
+
+    pps=$(( (after - before) / SECONDS_PER_RUN ))
+    printf "%-6d %14d %14d\n" $cores $pps $((pps / cores))
+
+    cores=$((cores * 2 > MAX_CORES && cores < MAX_CORES ? MAX_CORES : cores * 2))
+done
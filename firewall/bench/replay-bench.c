@@ -0,0 +1,616 @@
+/*************************************************************************************************
+ * replay-bench -- replays packet traces through the firewall's packet path in userspace and
+ * reports ns/packet, packets/sec, the verdict breakdown and the top sources.
+ *
+ * fw-judge.c and everything it depends on (ruleset, flow and fragment caches, stream state,
+ * counters, heavy hitters, dynamic blocks, LPM, rule classifier, signature matcher, domain trie)
+ * are built unchanged against the shims in compat/, so what is timed is the code the PRE_ROUTING
+ * hook runs, minus netfilter itself and the event log. Packets come from pcap files (Ethernet,
+ * Linux cooked or raw IP, IPv4 and IPv6 alike) or, without any, from a synthetic IPv4 trace of TCP,
+ * UDP and ICMP flows with some blocked sources, HTTP payloads and DNS queries mixed in. Everything
+ * is judged by the ruleset of one namespace, as the module does in init_net.
+ *
+ * The ruleset starts out as the module's default (208.80.154.0/24 blocked, the default policy,
+ * "fragmentation needed" accepted and the "HTTP" signature); -r applies a file in `fwctl load`
+ * syntax on top, e.g.
+ *
+ *   add prefix 10.0.0.0/8
+ *   add prefix 2001:db8:bad::/48
+ *   add rule proto tcp dst 192.0.2.0/24 dport 22 drop
+ *   add sig GET\x20/admin drop
+ *   add domain *.zone7.test drop
+ *   add icmp 0 accept rate 1000
+ *   policy icmp accept
+ *
+ *   make bench [PCAP=trace.pcap]    or    ./replay-bench [-r rules.txt] [-n passes] [trace.pcap ...]
+ ************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "fw-judge.h"
+#include "fw-ratelimit.h"
+#include "fw-dynblock.h"
+#include "fw-ruleset.h"
+#include "fw-flow.h"
+#include "fw-frag.h"
+#include "fw-stream.h"
+#include "fw-stats.h"
+#include "fw-top.h"
+
+#define MAX_PACKETS     (4 << 20)       // packets kept from all traces together
+#define SNAPLEN         2048            // bytes kept per packet
+#define SYNTH_PACKETS   1000000
+#define SYNTH_FLOWS     20000
+
+struct trace_pkt {
+    unsigned char *data;            // starts at the IP header
+    unsigned int len;
+    u32 ms;                         // capture time relative to the first packet
+};
+
+unsigned long jiffies;              // driven from the trace's timestamps
+struct net init_net;
+static struct fw_net bench_net = { .net = &init_net, .id = 1 };
+
+static struct trace_pkt *trace;
+static unsigned int ntrace;
+
+static const char *reason_names[FW_REASON_MAX] = {
+    [FW_REASON_NONE]        = "none",
+    [FW_REASON_BLOCKLIST]   = "blocklist",
+    [FW_REASON_TCP]         = "tcp",
+    [FW_REASON_SIGNATURE]   = "signature",
+    [FW_REASON_UDP]         = "udp",
+    [FW_REASON_DNS]         = "dns",
+    [FW_REASON_ICMP]        = "icmp",
+    [FW_REASON_IFACE]       = "iface",
+    [FW_REASON_OTHER]       = "other",
+    [FW_REASON_RULE]        = "rule",
+    [FW_REASON_RATELIMIT]   = "ratelimit",
+    [FW_REASON_DOMAIN]      = "domain",
+    [FW_REASON_DYNBLOCK]    = "dynblock",
+    [FW_REASON_EXTHDRS]     = "exthdrs",
+    [FW_REASON_MALFORMED]   = "malformed",
+};
+
+static const char *policy_names[FW_POLICY_MAX] = {
+    [FW_POLICY_TCP] = "tcp", [FW_POLICY_UDP] = "udp", [FW_POLICY_DNS] = "dns",
+    [FW_POLICY_ICMP] = "icmp", [FW_POLICY_OTHER] = "other",
+};
+
+/* xorshift32, rand() is too slow to fill a million payloads */
+static u32 rnd(void) {
+    static u32 x = 2463534242U;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void trace_add(const unsigned char *ip, unsigned int len, u32 ms) {
+    struct trace_pkt *p;
+
+    if(ntrace == MAX_PACKETS) { return; }
+    p = &trace[ntrace++];
+    p->len = len < SNAPLEN ? len : SNAPLEN;
+    p->data = malloc(p->len);
+    memcpy(p->data, ip, p->len);
+    p->ms = ms;
+}
+
+/* ===============================================================================================
+ * pcap
+ * ===============================================================================================*/
+struct pcap_file_hdr {
+    u32 magic;
+    u16 major, minor;
+    s32 thiszone;
+    u32 sigfigs, snaplen, linktype;
+};
+
+struct pcap_rec_hdr {
+    u32 sec, frac, caplen, len;
+};
+
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW        101
+#define LINKTYPE_RAW_OLD    12
+#define LINKTYPE_LINUX_SLL  113
+
+static u32 bswap_if(u32 v, bool swapped) {
+    return swapped ? __builtin_bswap32(v) : v;
+}
+
+/* Function for appending the IPv4 and IPv6 packets of a classic pcap file to the trace */
+static int load_pcap(const char *path) {
+    struct pcap_file_hdr fh;
+    struct pcap_rec_hdr rh;
+    unsigned char *buf;
+    bool swapped, nsec;
+    u32 linktype, first = 0, ms;
+    unsigned int off, before = ntrace;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if(!f) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if(fread(&fh, sizeof(fh), 1, f) != 1) { goto bad; }
+
+    swapped = fh.magic == 0xd4c3b2a1 || fh.magic == 0x4d3cb2a1;
+    nsec = fh.magic == 0xa1b23c4d || fh.magic == 0x4d3cb2a1;
+    if(!swapped && fh.magic != 0xa1b2c3d4 && !nsec) { goto bad; }
+    linktype = bswap_if(fh.linktype, swapped);
+
+    buf = malloc(65536);
+    while(fread(&rh, sizeof(rh), 1, f) == 1) {
+        u32 caplen = bswap_if(rh.caplen, swapped);
+        u16 ethertype;
+
+        if(caplen > 65536 || fread(buf, 1, caplen, f) != caplen) { break; }
+
+        ms = bswap_if(rh.sec, swapped) * 1000 + bswap_if(rh.frac, swapped) / (nsec ? 1000000 : 1000);
+        if(ntrace == before) { first = ms; }
+
+        switch(linktype) {
+            case LINKTYPE_ETHERNET:
+                off = 14;
+                if(caplen < off) { continue; }
+                ethertype = buf[12] << 8 | buf[13];
+                /* skip VLAN tags */
+                while((ethertype == 0x8100 || ethertype == 0x88a8) && caplen >= off + 4) {
+                    ethertype = buf[off + 2] << 8 | buf[off + 3];
+                    off += 4;
+                }
+                if(ethertype != 0x0800 && ethertype != 0x86dd) { continue; }
+                break;
+            case LINKTYPE_LINUX_SLL:
+                off = 16;
+                ethertype = caplen < off ? 0 : buf[14] << 8 | buf[15];
+                if(ethertype != 0x0800 && ethertype != 0x86dd) { continue; }
+                break;
+            case LINKTYPE_RAW:
+            case LINKTYPE_RAW_OLD:
+                off = 0;
+                break;
+            default:
+                fprintf(stderr, "%s: unsupported link type %u\n", path, linktype);
+                free(buf);
+                fclose(f);
+                return -1;
+        }
+
+        if(caplen > off && (buf[off] >> 4 == 4 || buf[off] >> 4 == 6)) {
+            trace_add(buf + off, caplen - off, ms - first);
+        }
+    }
+    free(buf);
+    fclose(f);
+
+    printf("%s: %u IP packets\n", path, ntrace - before);
+    return 0;
+
+bad:
+    fprintf(stderr, "%s: not a pcap file\n", path);
+    fclose(f);
+    return -1;
+}
+
+/* ===============================================================================================
+ * synthetic trace
+ * ===============================================================================================*/
+struct synth_flow {
+    u32 saddr, daddr;
+    u16 sport, dport;
+    u8 proto;
+    u32 seq;
+};
+
+static u16 ip_checksum(const void *data, unsigned int len) {
+    const u16 *p = data;
+    u32 sum = 0;
+
+    while(len > 1) { sum += *p++; len -= 2; }
+    while(sum >> 16) { sum = (sum & 0xffff) + (sum >> 16); }
+
+    return ~sum;
+}
+
+/* Function for writing a DNS query for host<N>.zone<M>.test, one of 64 zones, into buf
+ * returns its length, at most 40 bytes
+ * */
+static unsigned int synth_dns(unsigned char *buf, u32 r) {
+    char name[32], *label, *save = NULL;
+    unsigned int len = 12;
+
+    snprintf(name, sizeof(name), "host%u.zone%u.test", r % 1000, (r >> 10) % 64);
+
+    memset(buf, 0, 12);
+    *(u16 *)buf = r;
+    buf[2] = 0x01;                  // RD
+    buf[5] = 1;                     // one question
+    for(label = strtok_r(name, ".", &save); label; label = strtok_r(NULL, ".", &save)) {
+        buf[len] = strlen(label);
+        memcpy(buf + len + 1, label, buf[len]);
+        len += 1 + buf[len];
+    }
+    buf[len++] = 0;
+    memcpy(buf + len, "\x00\x01\x00\x01", 4);   // type A, class IN
+
+    return len + 4;
+}
+
+/* Function for building one packet of a flow into buf, returns its length */
+static unsigned int synth_packet(const struct synth_flow *fl, unsigned char *buf, unsigned int payload) {
+    static const char http[] = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n\r\n";
+    unsigned int l4 = fl->proto == IPPROTO_TCP ? 20 : 8, len = 20 + l4 + payload, i;
+
+    memset(buf, 0, 20 + l4);
+    buf[0] = 0x45;
+    *(u16 *)(buf + 2) = htons(len);
+    buf[8] = 64;
+    buf[9] = fl->proto;
+    *(u32 *)(buf + 12) = htonl(fl->saddr);
+    *(u32 *)(buf + 16) = htonl(fl->daddr);
+    *(u16 *)(buf + 10) = ip_checksum(buf, 20);
+
+    *(u16 *)(buf + 20) = htons(fl->sport);
+    *(u16 *)(buf + 22) = htons(fl->dport);
+    if(fl->proto == IPPROTO_TCP) {
+        *(u32 *)(buf + 24) = htonl(fl->seq);
+        buf[32] = 5 << 4;
+        buf[33] = 0x18;             // PSH|ACK
+    } else if(fl->proto == IPPROTO_UDP) {
+        *(u16 *)(buf + 24) = htons(8 + payload);
+    }
+
+    for(i = 0; i < payload; i++) { buf[20 + l4 + i] = 'a' + rnd() % 26; }
+    /* a few TCP payloads carry the default "HTTP" signature */
+    if(fl->proto == IPPROTO_TCP && payload >= sizeof(http) && rnd() % 50 == 0) {
+        memcpy(buf + 20 + l4, http, sizeof(http) - 1);
+    }
+    /* DNS flows carry a query where it fits, the rest of the payload stays random */
+    if(fl->proto == IPPROTO_UDP && fl->dport == 53 && payload >= 40) { synth_dns(buf + 20 + l4, rnd()); }
+
+    return len;
+}
+
+/* Function for filling the trace with packets of SYNTH_FLOWS flows: 60% TCP with 0-1400 byte
+ * payloads, 30% UDP of which a third DNS queries, 10% ICMP, and 2% of flows from the blocked
+ * 208.80.154.0/24 */
+static void load_synthetic(void) {
+    struct synth_flow *flows = calloc(SYNTH_FLOWS, sizeof(*flows));
+    unsigned char buf[SNAPLEN];
+    unsigned int i, len, payload;
+
+    for(i = 0; i < SYNTH_FLOWS; i++) {
+        struct synth_flow *fl = &flows[i];
+        u32 r = rnd() % 100;
+
+        fl->saddr = rnd() % 50 == 0 ? 0xd0509a00 | (rnd() & 0xff) : rnd();
+        fl->daddr = 0xc0000200 | (rnd() & 0xff);
+        fl->sport = 1024 + rnd() % 64512;
+        fl->proto = r < 60 ? IPPROTO_TCP : r < 90 ? IPPROTO_UDP : IPPROTO_ICMP;
+        fl->dport = fl->proto == IPPROTO_TCP ? (rnd() & 1 ? 80 : 443) :
+                    fl->proto == IPPROTO_UDP ? (r < 70 ? 53 : 1024 + rnd() % 64512) : 0;
+        if(fl->proto == IPPROTO_ICMP) { fl->sport = 0; }
+        fl->seq = rnd();
+    }
+
+    for(i = 0; i < SYNTH_PACKETS; i++) {
+        struct synth_flow *fl = &flows[rnd() % SYNTH_FLOWS];
+
+        payload = fl->proto == IPPROTO_TCP ? rnd() % 1401 : fl->proto == IPPROTO_UDP ? 32 + rnd() % 480 : 56;
+        len = synth_packet(fl, buf, payload);
+        fl->seq += payload;
+        trace_add(buf, len, i / 1000);
+    }
+    free(flows);
+
+    printf("synthetic: %u packets in %u flows\n", ntrace, SYNTH_FLOWS);
+}
+
+/* ===============================================================================================
+ * rules file
+ * ===============================================================================================*/
+
+/* Function for parsing "P" or "P-Q" */
+static int parse_ports(const char *s, u16 *min, u16 *max) {
+    char *end;
+    long lo, hi;
+
+    lo = strtol(s, &end, 10);
+    hi = lo;
+    if(*end == '-') { hi = strtol(end + 1, &end, 10); }
+    if(*end || lo < 0 || hi > 65535 || lo > hi) { return -1; }
+
+    *min = lo;
+    *max = hi;
+    return 0;
+}
+
+/* Function for parsing the action a rule or policy takes, returns it or -1 */
+static int parse_action(const char *s) {
+    if(!strcmp(s, "accept")) { return FW_ACTION_ACCEPT; }
+    if(!strcmp(s, "drop")) { return FW_ACTION_DROP; }
+    if(!strcmp(s, "ratelimit")) { return FW_ACTION_RATELIMIT; }
+    return -1;
+}
+
+static int parse_rule(int argc, char **argv, struct fw_rule *r) {
+    struct lpm_prefix p;
+    int i;
+
+    memset(r, 0, sizeof(*r));
+    r->sport_max = r->dport_max = 65535;
+
+    for(i = 0; i + 1 < argc; i += 2) {
+        if(!strcmp(argv[i], "proto")) {
+            r->proto = !strcmp(argv[i + 1], "tcp") ? 6 : !strcmp(argv[i + 1], "udp") ? 17 :
+                       !strcmp(argv[i + 1], "icmp") ? 1 : atoi(argv[i + 1]);
+        } else if(!strcmp(argv[i], "src") || !strcmp(argv[i], "dst")) {
+            if(lpm_parse_prefix(argv[i + 1], strlen(argv[i + 1]), &p) < 0) { return -1; }
+            if(argv[i][0] == 's') {
+                r->src = p.addr;
+                r->src_len = p.len;
+            } else {
+                r->dst = p.addr;
+                r->dst_len = p.len;
+            }
+        } else if(!strcmp(argv[i], "sport")) {
+            if(parse_ports(argv[i + 1], &r->sport_min, &r->sport_max) < 0) { return -1; }
+        } else if(!strcmp(argv[i], "dport")) {
+            if(parse_ports(argv[i + 1], &r->dport_min, &r->dport_max) < 0) { return -1; }
+        } else {
+            return -1;
+        }
+    }
+    if(i != argc - 1 || parse_action(argv[i]) < 0) { return -1; }
+    r->action = parse_action(argv[i]);
+
+    return 0;
+}
+
+/* Function for decoding a signature with \xHH and \\ escapes, returns its length or -1 */
+static int parse_pattern(const char *s, u8 *out) {
+    int len = 0;
+
+    while(*s) {
+        if(len == FW_SIG_MAXLEN) { return -1; }
+
+        if(*s != '\\') {
+            out[len++] = *s++;
+        } else if(s[1] == '\\') {
+            out[len++] = '\\';
+            s += 2;
+        } else if(s[1] == 'x' && isxdigit((unsigned char)s[2]) && isxdigit((unsigned char)s[3])) {
+            char hex[3] = { s[2], s[3], '\0' };
+
+            out[len++] = strtoul(hex, NULL, 16);
+            s += 4;
+        } else {
+            return -1;
+        }
+    }
+
+    return len ? len : -1;
+}
+
+/* Function for applying one command of a rules file to a draft */
+static int apply_line(struct fw_draft *d, int argc, char **argv) {
+    struct lpm_prefix p;
+    struct lpm6_prefix p6;
+    struct fw_rule r;
+    u8 pattern[FW_SIG_MAXLEN];
+    long type, code;
+    char *end;
+    int i, len;
+
+    if(argc == 2 && !strcmp(argv[0], "flush")) {
+        if(!strcmp(argv[1], "prefix")) { fw_draft_flush_prefixes(d); return 0; }
+        if(!strcmp(argv[1], "rule")) { fw_draft_flush_rules(d); return 0; }
+        if(!strcmp(argv[1], "sig")) { fw_draft_flush_signatures(d); return 0; }
+        if(!strcmp(argv[1], "domain")) { fw_draft_flush_domains(d); return 0; }
+        if(!strcmp(argv[1], "icmp")) { fw_draft_flush_icmp(d); return 0; }
+    } else if(argc >= 3 && !strcmp(argv[0], "add") && !strcmp(argv[1], "prefix") && strchr(argv[2], ':')) {
+        if(lpm6_parse_prefix(argv[2], strlen(argv[2]), &p6) < 0) { return -EINVAL; }
+        return fw_draft_prefix6(d, &p6, true);
+    } else if(argc >= 3 && !strcmp(argv[0], "add") && !strcmp(argv[1], "prefix")) {
+        if(lpm_parse_prefix(argv[2], strlen(argv[2]), &p) < 0) { return -EINVAL; }
+        return fw_draft_prefix(d, &p, true);
+    } else if(argc >= 3 && !strcmp(argv[0], "add") && !strcmp(argv[1], "rule")) {
+        if(parse_rule(argc - 2, argv + 2, &r) < 0) { return -EINVAL; }
+        return fw_draft_rule(d, &r, true);
+    } else if(argc == 4 && !strcmp(argv[0], "add") && !strcmp(argv[1], "sig")) {
+        len = parse_pattern(argv[2], pattern);
+        if(len < 0) { return -EINVAL; }
+        return fw_draft_signature(d, pattern, len, !strcmp(argv[3], "drop") ? FW_ACTION_DROP :
+                                  !strcmp(argv[3], "accept") ? FW_ACTION_ACCEPT : FW_ACTION_FLAG, true);
+    } else if(argc == 4 && !strcmp(argv[0], "add") && !strcmp(argv[1], "domain")) {
+        return fw_draft_domain(d, argv[2], !strcmp(argv[3], "drop") ? FW_ACTION_DROP :
+                               !strcmp(argv[3], "accept") ? FW_ACTION_ACCEPT : FW_ACTION_FLAG, true);
+    } else if((argc == 4 || argc == 6) && !strcmp(argv[0], "add") &&
+              (!strcmp(argv[1], "icmp") || !strcmp(argv[1], "icmpv6"))) {
+        if(parse_action(argv[3]) < 0 || (argc == 6 && strcmp(argv[4], "rate"))) { return -EINVAL; }
+        type = strtol(argv[2], &end, 10);
+        code = *end == '/' ? strtol(end + 1, &end, 10) : FW_ICMP_ANY_CODE;
+        if(*end || type < 0 || type > 255 || code < 0) { return -EINVAL; }
+        return fw_draft_icmp(d, argv[1][4] == 'v' ? NFPROTO_IPV6 : NFPROTO_IPV4, type, code, parse_action(argv[3]),
+                             argc == 6 ? atoi(argv[5]) : 0, true);
+    } else if(argc == 3 && !strcmp(argv[0], "policy")) {
+        for(i = 0; i < FW_POLICY_MAX && strcmp(argv[1], policy_names[i]); i++);
+        if(i == FW_POLICY_MAX) { return -EINVAL; }
+        if(!strcmp(argv[2], "default")) { return fw_draft_policy_default(d, i); }
+        if(parse_action(argv[2]) < 0) { return -EINVAL; }
+        return fw_draft_policy(d, i, parse_action(argv[2]));
+    }
+
+    return -EINVAL;
+}
+
+/* Function for seeding the ruleset like the module does at load time, then applying a rules file */
+static int load_rules(const char *path) {
+    struct fw_draft *d;
+    struct lpm_prefix p;
+    char line[512];
+    unsigned long lineno = 0;
+    FILE *f = NULL;
+    int err;
+
+    err = fw_ruleset_net_init(&bench_net);
+    if(err) { return err; }
+
+    d = fw_draft_begin(&bench_net);
+    if(!d) { return -ENOMEM; }
+    lpm_parse_prefix("208.80.154.0/24", 15, &p);
+    fw_draft_prefix(d, &p, true);
+    fw_draft_icmp(d, NFPROTO_IPV4, 3, 4, FW_ACTION_ACCEPT, 0, true);
+
+    if(path) {
+        f = fopen(path, "r");
+        if(!f) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            fw_draft_abort(d);
+            return -errno;
+        }
+    }
+
+    while(f && fgets(line, sizeof(line), f)) {
+        char *argv[16], *tok, *save = NULL;
+        int argc = 0;
+
+        lineno++;
+        for(tok = strtok_r(line, " \t\r\n", &save); tok && argc < 16; tok = strtok_r(NULL, " \t\r\n", &save)) {
+            argv[argc++] = tok;
+        }
+        if(!argc || argv[0][0] == '#') { continue; }
+
+        err = apply_line(d, argc, argv);
+        if(err) {
+            fprintf(stderr, "%s:%lu: %s\n", path, lineno, strerror(-err));
+            fclose(f);
+            fw_draft_abort(d);
+            return err;
+        }
+    }
+    if(f) { fclose(f); }
+
+    return fw_draft_commit(d);
+}
+
+/* ===============================================================================================
+ * replay
+ * ===============================================================================================*/
+static void replay(unsigned int passes) {
+    struct net_device dev = { .name = "bench0", .ifindex = 1 };
+    unsigned long long totals[2][FW_REASON_MAX] = { { 0 } };
+    struct fw_top_entry top[5];
+    unsigned long long bytes = 0, unparsed = 0, n = 0;
+    u32 span = ntrace ? trace[ntrace - 1].ms + 1 : 1;
+    double t0, elapsed;
+    unsigned int pass, i;
+    int k;
+
+    t0 = now_ns();
+    for(pass = 0; pass < passes; pass++) {
+        for(i = 0; i < ntrace; i++) {
+            struct sk_buff skb = { .data = trace[i].data, .len = trace[i].len };
+            bool ipv6 = trace[i].data[0] >> 4 == 6;
+            struct fw_pkt pkt;
+            unsigned int verdict;
+            u8 reason;
+
+            jiffies = (unsigned long)pass * span + trace[i].ms;
+
+            if(ipv6 ? !fw_parse_packet6(&skb, &pkt) : !fw_parse_packet(&skb, &pkt)) {
+                unparsed++;
+                continue;
+            }
+            pkt.ifindex = dev.ifindex;
+
+            verdict = fw_judge(&bench_net, &skb, &pkt, &dev, false, &reason);
+            fw_stats_packet(&bench_net, &pkt, ipv6 ? FW_HOOK_PRE_ROUTING6 : FW_HOOK_PRE_ROUTING, verdict, reason, 0);
+            fw_top_packet(&pkt);
+
+            totals[verdict == NF_ACCEPT][reason]++;
+            bytes += pkt.len;
+        }
+    }
+    elapsed = now_ns() - t0;
+    n = (unsigned long long)ntrace * passes;
+
+    printf("\n%llu packets in %.3f s: %.1f ns/packet, %.3f Mpps, %.2f Gbit/s of IP\n", n, elapsed / 1e9,
+           elapsed / n, n * 1e3 / elapsed, bytes * 8 / elapsed);
+    if(unparsed) { printf("%llu packets not parsed (accepted without a verdict)\n", unparsed); }
+
+    printf("\n%-12s %14s %14s %8s\n", "reason", "accepted", "dropped", "share");
+    for(i = 0; i < FW_REASON_MAX; i++) {
+        if(!totals[0][i] && !totals[1][i]) { continue; }
+        printf("%-12s %14llu %14llu %7.2f%%\n", reason_names[i], totals[1][i], totals[0][i],
+               100.0 * (totals[0][i] + totals[1][i]) / n);
+    }
+
+    /* heavy hitters of the last window of the replay's clock */
+    k = fw_top_read(FW_TOP_SRC, false, top, ARRAY_SIZE(top));
+    if(k > 0) { printf("\n%-18s %14s %16s\n", "top source", "packets", "bytes"); }
+    for(i = 0; i < k; i++) {
+        struct in_addr a = { htonl(top[i].key) };
+
+        printf("%-18s %14llu %16llu\n", inet_ntoa(a), top[i].packets, top[i].bytes);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *rules = NULL;
+    unsigned int passes = 10;
+    int opt, i;
+
+    while((opt = getopt(argc, argv, "r:n:")) != -1) {
+        switch(opt) {
+            case 'r': rules = optarg; break;
+            case 'n': passes = strtoul(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "Usage:  %s [-r rules.txt] [-n passes] [trace.pcap ...]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    trace = calloc(MAX_PACKETS, sizeof(*trace));
+    if(!trace || fw_flow_init(NULL) || fw_frag_init(NULL) || fw_stream_init(NULL) || fw_stats_net_init(&bench_net) ||
+       fw_ratelimit_init(NULL) || fw_dynblock_init(NULL) || fw_top_init(NULL)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if(load_rules(rules)) { return 1; }
+
+    for(i = optind; i < argc; i++) {
+        if(load_pcap(argv[i]) < 0) { return 1; }
+    }
+    if(optind == argc) { load_synthetic(); }
+    if(!ntrace) {
+        fprintf(stderr, "No IP packets to replay\n");
+        return 1;
+    }
+
+    /* one untimed pass warms the flow cache and the tables, like a module that has been running */
+    replay(1);
+    replay(passes);
+
+    return 0;
+}
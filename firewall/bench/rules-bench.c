@@ -0,0 +1,222 @@
+/*************************************************************************************************
+ * rules-bench -- compares the compiled rule classifiers (fw-rules.c) against evaluating the rule
+ * list one rule at a time, at 10, 1k and 100k rules of each family.
+ *
+ * Rules are drawn from the shapes real policies use: host, /24, /16 or /8 prefixes or any on
+ * either side (host, /64, /48, /32 or any for IPv6), single well-known ports, the ephemeral range
+ * or any port, TCP/UDP/ICMP or any protocol. Half of the packets are built to hit a random rule,
+ * the other half are random. Every verdict of the classifier is checked against the linear scan
+ * before anything is timed.
+ *
+ *   make run            or          ./rules-bench [packets]
+ ************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "fw-rules.h"
+
+typedef u32 (*classify_fn)(const struct fw_classifier *c, const struct fw_pkt *pkt);
+
+static const unsigned int rule_counts[] = { 10, 1000, 100000 };
+static const u8 prefix_lens[] = { 0, 8, 16, 24, 32 };
+static const u8 prefix6_lens[] = { 0, 32, 48, 64, 128 };
+static const u16 ports[] = { 22, 25, 53, 80, 123, 443, 3306, 5432, 8080, 8443 };
+static const u8 protos[] = { 0, 6, 17, 1 };
+
+static u32 rnd(void) {
+    return ((u32)rand() << 16) ^ (u32)rand();
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Function for drawing a port range: a well-known port, the ephemeral range or anything */
+static void random_ports(u16 *min, u16 *max) {
+    switch(rnd() % 4) {
+        case 0:
+        case 1:
+            *min = *max = ports[rnd() % (sizeof(ports) / sizeof(ports[0]))];
+            break;
+        case 2:
+            *min = 1024;
+            *max = 65535;
+            break;
+        default:
+            *min = 0;
+            *max = 65535;
+    }
+}
+
+static void random_addr6(struct in6_addr *a) {
+    unsigned int i;
+
+    for(i = 0; i < 4; i++) { a->s6_addr32[i] = rnd(); }
+}
+
+/* Function for putting a prefix over the low bits of an address, a 32-bit word at a time */
+static void prefix6_fill(struct in6_addr *a, const struct in6_addr *prefix, unsigned int len) {
+    unsigned int i, n;
+    u32 mask;
+
+    for(i = 0; i < 4; i++, len -= n) {
+        n = len < 32 ? len : 32;
+        mask = htonl(n ? ~0U << (32 - n) : 0);
+        a->s6_addr32[i] = (prefix->s6_addr32[i] & mask) | (a->s6_addr32[i] & ~mask);
+    }
+}
+
+static void random_rule(struct fw_rule *r, u8 family) {
+    const u8 *lens = family == NFPROTO_IPV6 ? prefix6_lens : prefix_lens;
+
+    memset(r, 0, sizeof(*r));
+
+    if(family == NFPROTO_IPV6) {
+        r->family = family;
+        random_addr6(&r->src6);
+        random_addr6(&r->dst6);
+    } else {
+        r->src = rnd();
+        r->dst = rnd();
+    }
+    /* every rule names at least one of its addresses */
+    do {
+        r->src_len = lens[rnd() % sizeof(prefix_lens)];
+        r->dst_len = lens[rnd() % sizeof(prefix_lens)];
+    } while(!r->src_len && !r->dst_len);
+    r->proto = protos[rnd() % sizeof(protos)];
+    r->action = rnd() & 1;
+    r->sport_min = 0;
+    r->sport_max = 65535;
+    r->dport_min = 0;
+    r->dport_max = 65535;
+    if(r->proto != 1) {
+        random_ports(&r->dport_min, &r->dport_max);
+        if(rnd() % 4 == 0) { random_ports(&r->sport_min, &r->sport_max); }
+    }
+    r->ifindex = rnd() % 8 == 0 ? 1 + rnd() % 4 : 0;
+}
+
+/* Function for building a packet, either random or inside a given rule */
+static void random_pkt(struct fw_pkt *pkt, const struct fw_rule *r, u8 family) {
+    u32 src = rnd(), dst = rnd();
+
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->family = family;
+    pkt->proto = protos[1 + rnd() % 3];
+    pkt->sport = rnd();
+    pkt->dport = rnd();
+    pkt->ifindex = 1 + rnd() % 4;
+
+    if(r) {
+        if(r->proto) { pkt->proto = r->proto; }
+        pkt->sport = r->sport_min + rnd() % (r->sport_max - r->sport_min + 1);
+        pkt->dport = r->dport_min + rnd() % (r->dport_max - r->dport_min + 1);
+        if(r->ifindex) { pkt->ifindex = r->ifindex; }
+    }
+    if(pkt->proto == 1) { pkt->sport = pkt->dport = 0; }
+
+    if(family == NFPROTO_IPV6) {
+        random_addr6(&pkt->saddr6);
+        random_addr6(&pkt->daddr6);
+        if(r) {
+            prefix6_fill(&pkt->saddr6, &r->src6, r->src_len);
+            prefix6_fill(&pkt->daddr6, &r->dst6, r->dst_len);
+        }
+        return;
+    }
+    if(r) {
+        u32 smask = r->src_len ? ~0U << (32 - r->src_len) : 0;    // IPv4 lengths only, up to 32
+        u32 dmask = r->dst_len ? ~0U << (32 - r->dst_len) : 0;
+
+        src = (r->src & smask) | (src & ~smask);
+        dst = (r->dst & dmask) | (dst & ~dmask);
+    }
+    pkt->saddr = htonl(src);
+    pkt->daddr = htonl(dst);
+}
+
+static int bench(unsigned int nrules, unsigned int npkts, u8 family) {
+    classify_fn classify = family == NFPROTO_IPV6 ? fw_classify6 : fw_classify;
+    struct fw_classifier *c;
+    struct fw_rule *rules;
+    struct fw_pkt *pkts;
+    unsigned int i, nlinear, matched = 0;
+    double t0, t_build, t_tss, t_linear;
+    volatile u32 sink = 0;
+    int err;
+
+    rules = malloc(sizeof(*rules) * nrules);
+    pkts = malloc(sizeof(*pkts) * npkts);
+    if(!rules || !pkts) { return -ENOMEM; }
+
+    for(i = 0; i < nrules; i++) { random_rule(&rules[i], family); }
+    for(i = 0; i < npkts; i++) { random_pkt(&pkts[i], i & 1 ? &rules[rnd() % nrules] : NULL, family); }
+
+    t0 = now_ns();
+    err = fw_classifier_build(rules, nrules, family, &c);
+    t_build = now_ns() - t0;
+    if(err) { return err; }
+
+    /* the linear scan gets as many packets as it can handle in reasonable time */
+    nlinear = npkts < 200000000 / nrules ? npkts : 200000000 / nrules;
+    if(nlinear < 1000) { nlinear = 1000; }
+
+    for(i = 0; i < nlinear; i++) {
+        u32 a = classify(c, &pkts[i]), b = fw_classify_linear(rules, nrules, &pkts[i]);
+
+        if(a != b) {
+            fprintf(stderr, "mismatch on packet %u: classifier %d, linear %d\n", i, (int)a, (int)b);
+            return -EINVAL;
+        }
+        matched += a != FW_RULE_NONE;
+    }
+
+    t0 = now_ns();
+    for(i = 0; i < npkts; i++) { sink += classify(c, &pkts[i]); }
+    t_tss = (now_ns() - t0) / npkts;
+
+    t0 = now_ns();
+    for(i = 0; i < nlinear; i++) { sink += fw_classify_linear(rules, nrules, &pkts[i]); }
+    t_linear = (now_ns() - t0) / nlinear;
+
+    printf("%6s %8u %10u %9.1f %9zu %10.1f %12.1f %8.1fx %7.1f%%\n", family == NFPROTO_IPV6 ? "ipv6" : "ipv4",
+           nrules, fw_classifier_subtables(c),
+           t_build / 1e6, fw_classifier_memory(c) >> 10, t_tss, t_linear, t_linear / t_tss,
+           100.0 * matched / nlinear);
+
+    fw_classifier_free(c);
+    free(pkts);
+    free(rules);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int npkts = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000, i, f;
+    static const u8 families[] = { NFPROTO_IPV4, NFPROTO_IPV6 };
+
+    srand(1);
+
+    printf("%6s %8s %10s %9s %9s %10s %12s %9s %8s\n",
+           "family", "rules", "subtables", "build ms", "mem KB", "ns/pkt", "linear ns/pkt", "speedup", "matched");
+
+    for(f = 0; f < sizeof(families); f++) {
+        for(i = 0; i < sizeof(rule_counts) / sizeof(rule_counts[0]); i++) {
+            if(bench(rule_counts[i], npkts, families[f]) < 0) {
+                fprintf(stderr, "Benchmark at %u rules failed\n", rule_counts[i]);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*************************************************************************************************
+ * Multi-pattern matcher -- builds the Aho-Corasick DFA used for payload signatures.
+ *
+ * The bytes the patterns use each get an alphabet class of their own and every other byte shares
+ * class 0, so a row of the transition table is only as wide as the patterns' alphabet. Failure
+ * links are resolved at build time: every state has a transition for every class and a scan costs
+ * exactly one table load per byte. States are numbered breadth first, so the shallow states nearly
+ * every byte passes through sit together at the front of the table. Up to 32768 states the table
+ * uses u16 entries, halving its cache footprint. The top bit of an entry flags a target state that
+ * ends a pattern, so the scan loop never touches the match array until there is a hit.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+
+#include "fw-ac.h"
+
+#define AC_NARROW_STATES    (1 << 15)   // most states u16 entries can address
+#define AC_MAX_STATES       (1 << 24)
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+
+/* Function for assigning alphabet classes to the bytes the patterns use
+ * returns the number of classes
+ * */
+static unsigned int ac_classes(struct fw_ac *ac, const struct fw_ac_pattern *patterns, unsigned int count) {
+    bool used[256] = { false };
+    unsigned int i, j, n = 1;
+
+    for(i = 0; i < count; i++) {
+        for(j = 0; j < patterns[i].len; j++) {
+            used[patterns[i].data[j]] = true;
+        }
+    }
+
+    for(i = 0; i < 256; i++) {
+        ac->class[i] = used[i] ? n++ : 0;
+    }
+
+    /* with all 256 bytes in use class 0 would be empty, fold it into the last byte's class */
+    if(n == 257) {
+        ac->class[255] = 0;
+        n = 256;
+    }
+
+    return n;
+}
+
+/* ===============================================================================================
+ * automaton functions
+ * ===============================================================================================*/
+
+/* Function for compiling patterns into an automaton
+ * @param patterns: patterns to match, their index is what a scan reports
+ * @param count: number of patterns
+ * @param out: set to the new automaton
+ * returns 0, -EINVAL for an empty pattern, -E2BIG when the table would be too large or -ENOMEM
+ * */
+int fw_ac_build(const struct fw_ac_pattern *patterns, unsigned int count, struct fw_ac **out) {
+    struct fw_ac *ac;
+    u32 *trie = NULL, *fail = NULL, *queue = NULL, *order = NULL, *delta;
+    unsigned long total = 1;
+    unsigned int nc, i, j, head, tail, s, c;
+    int err = -ENOMEM;
+
+    for(i = 0; i < count; i++) {
+        if(!patterns[i].len) { return -EINVAL; }
+        total += patterns[i].len;
+    }
+    if(total > AC_MAX_STATES) { return -E2BIG; }
+
+    ac = kzalloc(sizeof(*ac), GFP_KERNEL);
+    if(!ac) { return -ENOMEM; }
+
+    nc = ac->nclasses = ac_classes(ac, patterns, count);
+    if(total * nc * sizeof(u32) > FW_AC_MAX_TABLE) {
+        err = -E2BIG;
+        goto fail;
+    }
+
+    /* trie in insertion order; 0 means no edge since nothing points back at the root */
+    trie = vzalloc(sizeof(*trie) * total * nc);
+    ac->match = vmalloc(sizeof(*ac->match) * total);
+    fail = vmalloc(sizeof(*fail) * total);
+    queue = vmalloc(sizeof(*queue) * total);
+    order = vmalloc(sizeof(*order) * total);
+    if(!trie || !ac->match || !fail || !queue || !order) { goto fail; }
+
+    ac->nstates = 1;
+    ac->match[0] = FW_AC_NOMATCH;
+    for(i = 0; i < count; i++) {
+        for(j = 0, s = 0; j < patterns[i].len; j++) {
+            u32 *edge = &trie[s * nc + ac->class[patterns[i].data[j]]];
+
+            if(!*edge) {
+                *edge = ac->nstates;
+                ac->match[ac->nstates++] = FW_AC_NOMATCH;
+            }
+            s = *edge;
+        }
+        if(ac->match[s] == FW_AC_NOMATCH) { ac->match[s] = i; }
+    }
+
+    /* breadth first: resolve failure links into full rows and inherit matches through them. A
+     * state's failure state is shallower, so its row is complete by the time it is needed. */
+    head = tail = 0;
+    queue[tail++] = 0;
+    fail[0] = 0;
+    while(head < tail) {
+        s = queue[head];
+        order[s] = head++;
+
+        for(c = 0; c < nc; c++) {
+            u32 t = trie[s * nc + c];
+
+            if(!t) {
+                trie[s * nc + c] = s ? trie[fail[s] * nc + c] : 0;
+                continue;
+            }
+
+            fail[t] = s ? trie[fail[s] * nc + c] : 0;
+            if(ac->match[fail[t]] < ac->match[t]) { ac->match[t] = ac->match[fail[t]]; }
+            queue[tail++] = t;
+        }
+    }
+
+    /* renumber states in breadth first order and flag transitions into matching states */
+    ac->wide = ac->nstates > AC_NARROW_STATES;
+    delta = vmalloc((ac->wide ? sizeof(u32) : sizeof(u16)) * ac->nstates * nc);
+    if(!delta) { goto fail; }
+
+    for(s = 0; s < ac->nstates; s++) {
+        for(c = 0; c < nc; c++) {
+            u32 t = trie[queue[s] * nc + c];
+            u32 e = order[t] | (ac->match[t] != FW_AC_NOMATCH ? 0x80000000 : 0);
+
+            if(ac->wide) {
+                ((u32 *)delta)[s * nc + c] = e;
+            } else {
+                ((u16 *)delta)[s * nc + c] = (e & 0x7fff) | (e >> 16 & 0x8000);
+            }
+        }
+        fail[s] = ac->match[queue[s]];
+    }
+    swap(ac->match, fail);
+
+    if(ac->wide) {
+        ac->delta32 = delta;
+    } else {
+        ac->delta16 = (u16 *)delta;
+    }
+    ac->memory = sizeof(*ac) + (ac->wide ? sizeof(u32) : sizeof(u16)) * ac->nstates * nc +
+                 sizeof(*ac->match) * total;
+
+    vfree(trie);
+    vfree(fail);
+    vfree(queue);
+    vfree(order);
+
+    *out = ac;
+    return 0;
+
+fail:
+    vfree(trie);
+    vfree(fail);
+    vfree(queue);
+    vfree(order);
+    fw_ac_free(ac);
+    return err;
+}
+
+/* Function for releasing an automaton; callers must have waited out an RCU grace period first */
+void fw_ac_free(struct fw_ac *ac) {
+    if(!ac) { return; }
+
+    if(ac->wide) {
+        vfree(ac->delta32);
+    } else {
+        vfree(ac->delta16);
+    }
+    vfree(ac->match);
+    kfree(ac);
+}
+
+// EOF
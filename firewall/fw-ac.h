@@ -0,0 +1,86 @@
+/*************************************************************************************************
+ * Multi-pattern matcher -- an Aho-Corasick automaton compiled into a flat DFA. Like the LPM table
+ * it is built once from the full pattern list and never modified, so readers only need the
+ * RCU-protected pointer to it. Scanning is resumable: the caller owns the state and can feed a
+ * payload in as many pieces as it arrives in.
+ ************************************************************************************************/
+#ifndef _FW_AC_H
+#define _FW_AC_H
+
+#include <linux/types.h>
+
+/* ===============================================================================================
+ * defines
+ * ===============================================================================================*/
+#define FW_AC_START         0           // state to start a scan in
+#define FW_AC_NOMATCH       0xffffffff  // no pattern found
+#define FW_AC_MAX_TABLE     (64 << 20)  // largest transition table in bytes
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct fw_ac_pattern {
+    const u8 *data;
+    unsigned int len;               // 1 or more bytes
+};
+
+struct fw_ac {
+    u8 class[256];                  // byte to alphabet class; bytes no pattern uses share class 0
+    unsigned int nclasses;          // row length of the transition table
+    unsigned int nstates;
+    bool wide;                      // u32 transitions, otherwise u16
+    union {
+        u16 *delta16;               // next state, bit 15 set if it ends a pattern
+        u32 *delta32;               // next state, bit 31 set if it ends a pattern
+    };
+    u32 *match;                     // lowest pattern index ending in each state, FW_AC_NOMATCH if none
+    size_t memory;
+};
+
+/* ===============================================================================================
+ * functions
+ * ===============================================================================================*/
+int fw_ac_build(const struct fw_ac_pattern *patterns, unsigned int count, struct fw_ac **out);
+void fw_ac_free(struct fw_ac *ac);
+
+/* Function for running a chunk of data through the automaton
+ * @param ac: automaton
+ * @param state: scan state, FW_AC_START for a new scan; updated so the next chunk carries on
+ * @param data: bytes to scan
+ * @param len: number of bytes
+ * returns the index of the pattern found, or FW_AC_NOMATCH once the chunk is exhausted. The scan
+ * stops at the first byte that ends a pattern; of several patterns ending there the one with the
+ * lowest index is reported.
+ * */
+static inline u32 fw_ac_scan(const struct fw_ac *ac, u32 *state, const u8 *data, unsigned int len) {
+    const unsigned int stride = ac->nclasses;
+    unsigned int i;
+    u32 s = *state;
+
+    if(!ac->wide) {
+        for(i = 0; i < len; i++) {
+            u16 e = ac->delta16[s * stride + ac->class[data[i]]];
+
+            s = e & 0x7fff;
+            if(e & 0x8000) {
+                *state = s;
+                return ac->match[s];
+            }
+        }
+    } else {
+        for(i = 0; i < len; i++) {
+            u32 e = ac->delta32[s * stride + ac->class[data[i]]];
+
+            s = e & 0x7fffffff;
+            if(e & 0x80000000) {
+                *state = s;
+                return ac->match[s];
+            }
+        }
+    }
+    *state = s;
+
+    return FW_AC_NOMATCH;
+}
+
+#endif /* _FW_AC_H */
@@ -0,0 +1,269 @@
+/*************************************************************************************************
+ * DNS query names -- builds the label trie of a ruleset's domains and looks the question of DNS
+ * packets up in it.
+ *
+ * The question is read with skb_header_pointer, so a name in the skb's page fragments is copied
+ * out rather than the packet linearized. Every label length is checked against the bytes actually
+ * present before the label is used; names that are truncated, use compression or have a label
+ * over 63 bytes are not matched at all, and the packet goes on to its ordinary verdict.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/skbuff.h>
+#include <linux/udp.h>
+
+#include "fw-dns.h"
+
+#define DNS_MAXNAME     255             // longest name in wire format
+#define DNS_MAXLABEL    63              // longest label
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct dns_hdr {
+    __be16 id;
+    __be16 flags;
+    __be16 qdcount;                 // entries in the question section
+    __be16 ancount;
+    __be16 nscount;
+    __be16 arcount;
+};
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+
+/* Function for hashing a label under its parent node, ignoring case like DNS does */
+static inline u32 label_hash(u32 seed, u32 parent, const u8 *label, unsigned int len) {
+    u32 h = seed ^ (parent * 0x9e3779b1);
+    unsigned int i;
+
+    for(i = 0; i < len; i++) { h = (h ^ tolower(label[i])) * 0x01000193; }
+
+    return h ^ (h >> 16);
+}
+
+/* Function for finding the child of a node with the given label
+ * returns the child's node number, 0 if there is none
+ * */
+static u32 trie_find(const struct fw_dns_trie *t, u32 parent, const u8 *label, unsigned int len) {
+    const struct fw_dns_node *node;
+    u32 i = label_hash(t->seed, parent, label, len) & t->mask, n;
+    unsigned int j;
+
+    while((n = t->slots[i]) != 0) {
+        node = &t->nodes[n];
+        if(node->parent == parent && node->len == len) {
+            for(j = 0; j < len && tolower(label[j]) == t->names[node->label + j]; j++);
+            if(j == len) { return n; }
+        }
+        i = (i + 1) & t->mask;
+    }
+
+    return 0;
+}
+
+/* Function for adding a node to the trie, below parent with the label at names + label */
+static u32 trie_add(struct fw_dns_trie *t, u32 parent, u32 label, unsigned int len) {
+    struct fw_dns_node *node = &t->nodes[t->nnodes];
+    u32 i = label_hash(t->seed, parent, (const u8 *)t->names + label, len) & t->mask;
+
+    node->parent = parent;
+    node->label = label;
+    node->len = len;
+    node->exact = FW_DNS_NOMATCH;
+    node->below = FW_DNS_NOMATCH;
+
+    while(t->slots[i]) { i = (i + 1) & t->mask; }
+    t->slots[i] = t->nnodes;
+
+    return t->nnodes++;
+}
+
+/* ===============================================================================================
+ * trie functions
+ * ===============================================================================================*/
+
+/* Function for checking a domain and bringing it into the form the trie is built from: lowercase,
+ * without a trailing dot, labels of letters, digits, '-' and '_', and "*." only at the start
+ * @param name: domain as given, e.g. "*.Example.COM."
+ * @param out: FW_DOMAIN_MAXLEN + 1 bytes, set to the NUL terminated canonical name
+ * returns the length of the canonical name, or -EINVAL
+ * */
+int fw_dns_canonical(const char *name, char *out) {
+    unsigned int len = strnlen(name, FW_DOMAIN_MAXLEN + 2), start = 0, label = 0, i;
+
+    if(len && name[len - 1] == '.') { len--; }
+    if(len > FW_DOMAIN_MAXLEN) { return -EINVAL; }
+
+    if(len > 2 && name[0] == '*' && name[1] == '.') {
+        out[0] = '*';
+        out[1] = '.';
+        start = 2;
+    }
+    if(len == start || len - start > FW_DOMAIN_MAXLEN - 2) { return -EINVAL; }
+
+    for(i = start; i < len; i++) {
+        if(name[i] == '.') {
+            if(!label) { return -EINVAL; }
+            label = 0;
+        } else if(isalnum(name[i]) || name[i] == '-' || name[i] == '_') {
+            if(++label > DNS_MAXLABEL) { return -EINVAL; }
+        } else {
+            return -EINVAL;
+        }
+        out[i] = tolower(name[i]);
+    }
+    if(!label) { return -EINVAL; }
+    out[len] = '\0';
+
+    return len;
+}
+
+/* Function for building the trie of a list of canonical domains
+ * @param domains: domains, each name at most once
+ * @param n: number of domains
+ * @param names: the names the domains point into; must stay around as long as the trie
+ * @param trie: set to the trie, NULL if there are no domains
+ * */
+int fw_dns_build(const struct fw_domain *domains, unsigned int n, const char *names, struct fw_dns_trie **trie) {
+    struct fw_dns_trie *t;
+    unsigned long maxnodes = 1;
+    unsigned int i, j, start, end, dot;
+    const char *s;
+    u32 node, child;
+
+    *trie = NULL;
+    if(!n) { return 0; }
+
+    /* at most one node per label */
+    for(i = 0; i < n; i++) {
+        for(j = 0; j < domains[i].len; j++) { maxnodes += names[domains[i].name + j] == '.'; }
+        maxnodes++;
+    }
+
+    t = kzalloc(sizeof(*t), GFP_KERNEL);
+    if(!t) { return -ENOMEM; }
+    t->nodes = vmalloc(sizeof(*t->nodes) * maxnodes);
+    t->slots = vzalloc(sizeof(*t->slots) * roundup_pow_of_two(maxnodes * 2));
+    if(!t->nodes || !t->slots) {
+        fw_dns_free(t);
+        return -ENOMEM;
+    }
+    t->mask = roundup_pow_of_two(maxnodes * 2) - 1;
+    t->names = names;
+    get_random_bytes(&t->seed, sizeof(t->seed));
+
+    /* the root stands for the empty name and is never in a slot */
+    t->nodes[0].exact = FW_DNS_NOMATCH;
+    t->nodes[0].below = FW_DNS_NOMATCH;
+    t->nnodes = 1;
+
+    for(i = 0; i < n; i++) {
+        s = names + domains[i].name;
+        start = s[0] == '*' ? 2 : 0;
+        end = domains[i].len;
+        node = 0;
+
+        /* labels from the right, each one level further down */
+        while(end > start) {
+            for(dot = end; dot > start && s[dot - 1] != '.'; dot--);
+
+            child = trie_find(t, node, (const u8 *)s + dot, end - dot);
+            if(!child) { child = trie_add(t, node, domains[i].name + dot, end - dot); }
+            node = child;
+
+            end = dot > start ? dot - 1 : start;
+        }
+
+        if(start) {
+            t->nodes[node].below = domains[i].action;
+        } else {
+            t->nodes[node].exact = domains[i].action;
+        }
+    }
+
+    *trie = t;
+
+    return 0;
+}
+
+void fw_dns_free(struct fw_dns_trie *t) {
+    if(!t) { return; }
+
+    vfree(t->slots);
+    vfree(t->nodes);
+    kfree(t);
+}
+
+/* Function for reporting the bytes a trie occupies, not counting the names */
+size_t fw_dns_memory(const struct fw_dns_trie *t) {
+    if(!t) { return 0; }
+
+    return sizeof(*t) + sizeof(*t->nodes) * t->nnodes + sizeof(*t->slots) * ((size_t)t->mask + 1);
+}
+
+/* ===============================================================================================
+ * match function
+ * ===============================================================================================*/
+
+/* Function for matching the first question of a DNS packet, query or response
+ * @param skb: packet being handled
+ * @param pkt: parsed UDP packet
+ * @param t: domain trie of the live ruleset
+ * */
+u8 fw_dns_match(const struct sk_buff *skb, const struct fw_pkt *pkt, const struct fw_dns_trie *t) {
+    struct dns_hdr _hdr;
+    const struct dns_hdr *hdr;
+    u8 _name[DNS_MAXNAME];
+    const u8 *name;
+    u8 starts[DNS_MAXNAME / 2];         // offset of every label, each takes two bytes or more
+    unsigned int off, end, len, pos, n = 0;
+    const struct fw_dns_node *node;
+    u32 cur = 0;
+    u8 action = FW_DNS_NOMATCH;
+
+    off = skb_network_offset(skb) + pkt->iphlen + sizeof(struct udphdr);
+    end = skb_network_offset(skb) + min_t(unsigned int, pkt->len, skb->len - skb_network_offset(skb));
+    if(end <= off + sizeof(_hdr)) { return FW_DNS_NOMATCH; }
+
+    hdr = skb_header_pointer(skb, off, sizeof(_hdr), &_hdr);
+    if(!hdr || !hdr->qdcount) { return FW_DNS_NOMATCH; }
+
+    off += sizeof(_hdr);
+    len = min_t(unsigned int, end - off, DNS_MAXNAME);
+    name = skb_header_pointer(skb, off, len, _name);
+    if(!name) { return FW_DNS_NOMATCH; }
+
+    /* length-prefixed labels up to the empty root label; the first name of a message has nothing
+     * to point back to, so a compression pointer (or anything else over 63) is malformed here */
+    for(pos = 0; ; pos += 1 + name[pos]) {
+        if(pos >= len || name[pos] > DNS_MAXLABEL) { return FW_DNS_NOMATCH; }
+        if(!name[pos]) { break; }
+        starts[n++] = pos;
+    }
+
+    /* walk down from the TLD, the deepest domain that matches wins */
+    while(n--) {
+        cur = trie_find(t, cur, name + starts[n] + 1, name[starts[n]]);
+        if(!cur) { break; }
+
+        node = &t->nodes[cur];
+        if(n && node->below != FW_DNS_NOMATCH) {
+            action = node->below;
+        } else if(!n && node->exact != FW_DNS_NOMATCH) {
+            action = node->exact;
+        }
+    }
+
+    return action;
+}
+
+// EOF
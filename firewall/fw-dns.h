@@ -0,0 +1,63 @@
+/*************************************************************************************************
+ * DNS query names -- matches the question of DNS packets against the domains of a ruleset.
+ *
+ * Domains are kept as a trie of labels read from the right, so "www.example.com" is com, then
+ * example, then www. A node's children are not stored with it: every node sits in one open-
+ * addressing hash table under the hash of its parent and its label, and a lookup costs one probe
+ * per label of the query name, however many domains the ruleset holds. "example.com" matches that
+ * name only, "*.example.com" every name below it; the most specific domain that matches wins.
+ ************************************************************************************************/
+#ifndef _FW_DNS_H
+#define _FW_DNS_H
+
+#include <linux/types.h>
+
+#include "fw.h"
+#include "fw-uapi.h"
+
+/* ===============================================================================================
+ * defines
+ * ===============================================================================================*/
+#define FW_DNS_NOMATCH      0xff        // fw_dns_match() result when no domain matches
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct fw_domain {
+    u32 name;                       // offset of the name in the names it belongs to
+    u8 len;                         // bytes in the name, lowercase, "*." first for a wildcard
+    u8 action;                      // enum fw_action: drop, accept or flag
+};
+
+struct fw_dns_node {
+    u32 parent;                     // node of the enclosing domain, 0 (the root) below the TLDs
+    u32 label;                      // offset of the label in names
+    u8 len;                         // bytes in the label
+    u8 exact;                       // enum fw_action for the name itself, FW_DNS_NOMATCH if none
+    u8 below;                       // enum fw_action for names below it, FW_DNS_NOMATCH if none
+};
+
+struct fw_dns_trie {
+    struct fw_dns_node *nodes;      // node 0 is the root
+    unsigned int nnodes;
+    u32 *slots;                     // node numbers by hash of (parent, label), 0 for an empty slot
+    u32 mask;                       // slots - 1
+    u32 seed;                       // hash seed
+    const char *names;              // names the labels point into, owned by the ruleset
+};
+
+struct sk_buff;
+
+/* ===============================================================================================
+ * functions
+ * ===============================================================================================*/
+int fw_dns_canonical(const char *name, char *out);
+int fw_dns_build(const struct fw_domain *domains, unsigned int n, const char *names, struct fw_dns_trie **trie);
+void fw_dns_free(struct fw_dns_trie *t);
+size_t fw_dns_memory(const struct fw_dns_trie *t);
+
+/* returns the enum fw_action of the domain matching the packet's query name, FW_DNS_NOMATCH if
+ * none does or the packet carries no well formed question */
+u8 fw_dns_match(const struct sk_buff *skb, const struct fw_pkt *pkt, const struct fw_dns_trie *t);
+
+#endif /* _FW_DNS_H */
@@ -0,0 +1,477 @@
+/*************************************************************************************************
+ * Dynamic blocks -- two shared set-associative tables of dynblock_entries hosts each, one for
+ * IPv4 hosts and one for IPv6 /64s. An entry holds the host, the namespace that blocked it and the
+ * second it expires at; a set is three entries and a sequence count in one cache line, and readers
+ * retry a set's lookup when the count says a writer got in between.
+ *
+ * Entries expire lazily: a lookup compares the expiry with the clock and an expired entry is simply
+ * a free way for the next insert. There is no timer and no sweep, so neither the packet path nor
+ * any background work grows with the number of live blocks. When all ways of a set are live, the
+ * entry closest to its end makes room.
+ *
+ * IPv6 hosts are blocked by /64, the unit the rate limiter counts them in: a host picks its
+ * addresses from the whole /64, so blocking one of them would stop nothing.
+ *
+ * Every entry belongs to one namespace and only blocks that namespace's packets, so a container
+ * that blocks a host, or whose ratelimit rules do, leaves every other namespace alone. The tables
+ * are shared so that namespaces that never block anything cost nothing; the namespace's id is part
+ * of the key and of the hash.
+ *
+ * Writers -- fwctl through netlink, and the ratelimit action from softirq -- serialize on one
+ * spinlock. Blocking is rare next to checking, and a write is a handful of stores.
+ *
+ *   dynblocks          live entries of a namespace and the seconds they have left, per namespace
+ *   dynblock_stats     table size, live entries, adds and evictions of all namespaces
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/atomic.h>
+#include <linux/spinlock.h>
+#include <linux/timekeeping.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/in6.h>
+
+#include "fw-dynblock.h"
+#include "fw-net.h"
+
+#define DB_WAYS 3                   // entries per set
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct db_entry {
+    u64 key;                        // IPv4 address, or the first 64 bits of an IPv6 one, as in memory
+    u32 expires;                    // ktime_get_seconds(), 0 for an unused way
+    u32 net;                        // struct fw_net id of the namespace the block is for
+};
+
+struct db_set {
+    seqcount_t seq;                 // bumped around every write to the set
+    struct db_entry way[DB_WAYS];
+} ____cacheline_aligned;
+
+struct db_table {
+    struct db_set *sets;
+    u32 mask;                       // number of sets - 1
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static unsigned int dynblock_entries = 65536;           // hosts per family, sets rounded up to a power of two
+static struct db_table db4;                             // IPv4 hosts
+static struct db_table db6;                             // IPv6 /64s
+static u32 db_seed __read_mostly;                       // hash seed
+static bool db_active;                                  // a namespace may have a live entry
+static DEFINE_SPINLOCK(db_lock);                        // serializes writers
+static u64 db_added;                                    // under db_lock
+static u64 db_evicted;                                  // live entries pushed out of a full set, under db_lock
+
+module_param(dynblock_entries, uint, 0444);
+MODULE_PARM_DESC(dynblock_entries, "Hosts that can be blocked for a limited time, IPv4 and IPv6 /64s each");
+
+/* ===============================================================================================
+ * table functions
+ * ===============================================================================================*/
+static inline u32 db_now(void) {
+    return (u32)ktime_get_seconds();
+}
+
+static inline u64 db4_key(__be32 addr) {
+    return (__force u32)addr;
+}
+
+static inline u64 db6_key(const struct in6_addr *addr) {
+    u64 key;
+
+    memcpy(&key, addr->s6_addr, sizeof(key));
+    return key;
+}
+
+static inline struct db_set *db_set_of(const struct db_table *t, u64 key, u32 net) {
+    return &t->sets[jhash_3words((u32)key, (u32)(key >> 32), net, db_seed) & t->mask];
+}
+
+/* Function for checking whether a key has a live entry of a namespace
+ * @param t: table of the key's family
+ * @param key: db4_key() or db6_key()
+ * @param net: namespace id
+ * */
+static bool db_lookup(const struct db_table *t, u64 key, u32 net) {
+    const struct db_set *set;
+    unsigned int seq;
+    bool blocked;
+    u32 now;
+    int i;
+
+    if(!READ_ONCE(db_active)) { return false; }
+
+    set = db_set_of(t, key, net);
+    now = db_now();
+    do {
+        seq = read_seqcount_begin(&set->seq);
+        blocked = false;
+        for(i = 0; i < DB_WAYS; i++) {
+            if(set->way[i].key == key && set->way[i].net == net && set->way[i].expires > now) { blocked = true; }
+        }
+    } while(read_seqcount_retry(&set->seq, seq));
+
+    return blocked;
+}
+
+/* Function for adding an entry, or changing how long an existing one lasts
+ * @param ttl: seconds from now, at least 1
+ * */
+static void db_add(struct db_table *t, u64 key, u32 net, u32 ttl) {
+    struct db_set *set = db_set_of(t, key, net);
+    struct db_entry *victim = NULL, *w;
+    u32 now = db_now(), expires = min_t(u64, (u64)now + max(ttl, 1U), U32_MAX), end, victim_end = 0;
+    int i;
+
+    spin_lock_bh(&db_lock);
+
+    /* the key's own way if it has one, else the way that ends soonest; a free way ended already */
+    for(i = 0; i < DB_WAYS; i++) {
+        w = &set->way[i];
+        end = w->expires > now ? w->expires : 0;
+        if(end && w->key == key && w->net == net) {
+            victim = w;
+            break;
+        }
+        if(!victim || end < victim_end) {
+            victim = w;
+            victim_end = end;
+        }
+    }
+    if(i == DB_WAYS && victim_end) { db_evicted++; }
+
+    write_seqcount_begin(&set->seq);
+    victim->key = key;
+    victim->net = net;
+    victim->expires = expires;
+    write_seqcount_end(&set->seq);
+    WRITE_ONCE(db_active, true);
+    db_added++;
+
+    spin_unlock_bh(&db_lock);
+}
+
+/* Function for removing the live entry of a key
+ * returns true if there was one
+ * */
+static bool db_del(struct db_table *t, u64 key, u32 net) {
+    struct db_set *set = db_set_of(t, key, net);
+    u32 now = db_now();
+    bool found = false;
+    int i;
+
+    spin_lock_bh(&db_lock);
+    for(i = 0; i < DB_WAYS; i++) {
+        if(set->way[i].key == key && set->way[i].net == net && set->way[i].expires > now) {
+            write_seqcount_begin(&set->seq);
+            set->way[i].expires = 0;
+            write_seqcount_end(&set->seq);
+            found = true;
+        }
+    }
+    spin_unlock_bh(&db_lock);
+
+    return found;
+}
+
+/* Function for removing every entry of a namespace from a table, called with db_lock held
+ * returns the number of live entries of other namespaces left in the table
+ * */
+static unsigned int db_flush(struct db_table *t, u32 net, u32 now) {
+    struct db_set *set;
+    unsigned int i, j, left = 0;
+
+    for(i = 0; i <= t->mask; i++) {
+        set = &t->sets[i];
+        for(j = 0; j < DB_WAYS; j++) {
+            if(set->way[j].expires <= now) { continue; }
+            if(set->way[j].net != net) {
+                left++;
+                continue;
+            }
+
+            write_seqcount_begin(&set->seq);
+            set->way[j].expires = 0;
+            write_seqcount_end(&set->seq);
+        }
+    }
+
+    return left;
+}
+
+/* Function for counting the live entries of a table, of one namespace or of all of them
+ * @param fn: namespace, NULL for all
+ * */
+static unsigned int db_count(const struct db_table *t, const struct fw_net *fn) {
+    const struct db_entry *w;
+    unsigned int i, n = 0;
+    u32 now = db_now();
+
+    for(i = 0; i < (t->mask + 1) * DB_WAYS; i++) {
+        w = &t->sets[i / DB_WAYS].way[i % DB_WAYS];
+        if(READ_ONCE(w->expires) > now && (!fn || READ_ONCE(w->net) == fn->id)) { n++; }
+    }
+
+    return n;
+}
+
+/* ===============================================================================================
+ * block functions
+ * ===============================================================================================*/
+
+/* Function for checking whether a host is blocked in a namespace
+ * @param fn: namespace
+ * @param addr: address, network byte order
+ * returns true while the host has a live entry
+ * */
+bool fw_dynblock_lookup(const struct fw_net *fn, __be32 addr) {
+    return db_lookup(&db4, db4_key(addr), fn->id);
+}
+
+/* Function for checking whether the /64 of an IPv6 host is blocked in a namespace
+ * @param fn: namespace
+ * @param addr: address
+ * returns true while the /64 has a live entry
+ * */
+bool fw_dynblock_lookup6(const struct fw_net *fn, const struct in6_addr *addr) {
+    return db_lookup(&db6, db6_key(addr), fn->id);
+}
+
+/* Function for blocking a host in a namespace, or changing how long an existing block lasts
+ * @param fn: namespace
+ * @param addr: address, network byte order
+ * @param ttl: seconds from now, at least 1
+ * */
+void fw_dynblock_add(const struct fw_net *fn, __be32 addr, u32 ttl) {
+    db_add(&db4, db4_key(addr), fn->id, ttl);
+}
+
+/* Function for blocking the /64 of an IPv6 host in a namespace, or changing how long an existing
+ * block lasts
+ * @param fn: namespace
+ * @param addr: address, the bits past the /64 are ignored
+ * @param ttl: seconds from now, at least 1
+ * */
+void fw_dynblock_add6(const struct fw_net *fn, const struct in6_addr *addr, u32 ttl) {
+    db_add(&db6, db6_key(addr), fn->id, ttl);
+}
+
+/* Function for lifting the block of a host in a namespace
+ * @param fn: namespace
+ * @param addr: address, network byte order
+ * returns true if the host was blocked
+ * */
+bool fw_dynblock_del(const struct fw_net *fn, __be32 addr) {
+    return db_del(&db4, db4_key(addr), fn->id);
+}
+
+/* Function for lifting the block of an IPv6 host's /64 in a namespace
+ * @param fn: namespace
+ * @param addr: address, the bits past the /64 are ignored
+ * returns true if the /64 was blocked
+ * */
+bool fw_dynblock_del6(const struct fw_net *fn, const struct in6_addr *addr) {
+    return db_del(&db6, db6_key(addr), fn->id);
+}
+
+/* Function for lifting every block of a namespace, both families; walks the whole tables */
+void fw_dynblock_flush(const struct fw_net *fn) {
+    u32 now = db_now();
+    unsigned int left;
+
+    spin_lock_bh(&db_lock);
+    left = db_flush(&db4, fn->id, now);
+    left += db_flush(&db6, fn->id, now);
+
+    /* lookups skip the tables altogether while no namespace has a block */
+    if(!left) { WRITE_ONCE(db_active, false); }
+    spin_unlock_bh(&db_lock);
+}
+
+/* Function for counting the live entries of a namespace, both families; walks the whole tables */
+unsigned int fw_dynblock_count(const struct fw_net *fn) {
+    return db_count(&db4, fn) + db_count(&db6, fn);
+}
+
+/* ===============================================================================================
+ * dynblocks file -- one line per live entry of the file's namespace. Position 0 is the header,
+ * position n way n - 1 of the IPv4 table and, past its end, of the IPv6 one; the iterator is the
+ * position plus one, which makes the header SEQ_START_TOKEN. Expired ways and those of other
+ * namespaces print nothing.
+ * ===============================================================================================*/
+static void *dynblocks_at(loff_t pos) {
+    return pos <= (loff_t)(db4.mask + 1) * DB_WAYS + (loff_t)(db6.mask + 1) * DB_WAYS ?
+           (void *)(unsigned long)(pos + 1) : NULL;
+}
+
+static void *dynblocks_start(struct seq_file *m, loff_t *pos) {
+    return dynblocks_at(*pos);
+}
+
+static void *dynblocks_next(struct seq_file *m, void *v, loff_t *pos) {
+    return dynblocks_at(++*pos);
+}
+
+static void dynblocks_stop(struct seq_file *m, void *v) {
+}
+
+static int dynblocks_show(struct seq_file *m, void *v) {
+    const struct fw_net *fn = m->private;
+    unsigned long way;
+    const struct db_table *t = &db4;
+    const struct db_set *set;
+    struct db_entry e;
+    struct in6_addr addr6 = { 0 };
+    __be32 addr;
+    u32 now = db_now();
+    unsigned int seq;
+    char buf[48];
+
+    if(v == SEQ_START_TOKEN) {
+        seq_printf(m, "%-24s %10s\n", "address", "seconds");
+        return 0;
+    }
+
+    way = (unsigned long)v - 2;
+    if(way >= (db4.mask + 1) * DB_WAYS) {
+        way -= (db4.mask + 1) * DB_WAYS;
+        t = &db6;
+    }
+    set = &t->sets[way / DB_WAYS];
+    do {
+        seq = read_seqcount_begin(&set->seq);
+        e = set->way[way % DB_WAYS];
+    } while(read_seqcount_retry(&set->seq, seq));
+    if(e.expires <= now || e.net != fn->id) { return 0; }
+
+    if(t == &db4) {
+        addr = (__force __be32)(u32)e.key;
+        snprintf(buf, sizeof(buf), "%pI4", &addr);
+    } else {
+        memcpy(addr6.s6_addr, &e.key, sizeof(e.key));
+        snprintf(buf, sizeof(buf), "%pI6c/64", &addr6);
+    }
+
+    seq_printf(m, "%-24s %10u\n", buf, e.expires - now);
+
+    return 0;
+}
+
+static const struct seq_operations dynblocks_seq_ops = {
+    .start      = dynblocks_start,
+    .next       = dynblocks_next,
+    .stop       = dynblocks_stop,
+    .show       = dynblocks_show,
+};
+
+static int dynblocks_open(struct inode *inode, struct file *file) {
+    int err = seq_open(file, &dynblocks_seq_ops);
+
+    if(!err) { ((struct seq_file *)file->private_data)->private = inode->i_private; }
+
+    return err;
+}
+
+static const struct file_operations dynblocks_fops = {
+    .owner      = THIS_MODULE,
+    .open       = dynblocks_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = seq_release,
+};
+
+/* ===============================================================================================
+ * stats file
+ * ===============================================================================================*/
+static int dynblock_stats_show(struct seq_file *m, void *v) {
+    u64 added, evicted;
+
+    spin_lock_bh(&db_lock);
+    added = db_added;
+    evicted = db_evicted;
+    spin_unlock_bh(&db_lock);
+
+    seq_printf(m, "entries: %u ipv4, %u ipv6\nlive: %u\nadded: %llu\nevicted: %llu\nmemory: %zu KB\n",
+               (db4.mask + 1) * DB_WAYS, (db6.mask + 1) * DB_WAYS, db_count(&db4, NULL) + db_count(&db6, NULL),
+               added, evicted, ((size_t)(db4.mask + 1 + db6.mask + 1) * sizeof(struct db_set)) >> 10);
+
+    return 0;
+}
+
+static int dynblock_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, dynblock_stats_show, NULL);
+}
+
+static const struct file_operations dynblock_stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = dynblock_stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+
+/* Function for allocating a table of at least entries ways */
+static int db_table_init(struct db_table *t, unsigned int entries) {
+    unsigned int nsets = roundup_pow_of_two(max(entries / DB_WAYS, 1U)), i;
+
+    t->sets = vzalloc(sizeof(struct db_set) * nsets);
+    if(!t->sets) { return -ENOMEM; }
+    t->mask = nsets - 1;
+    for(i = 0; i < nsets; i++) { seqcount_init(&t->sets[i].seq); }
+
+    return 0;
+}
+
+int fw_dynblock_init(struct dentry *dir) {
+    BUILD_BUG_ON(sizeof(struct db_entry) != 16);
+
+    if(db_table_init(&db4, dynblock_entries) || db_table_init(&db6, dynblock_entries)) {
+        fw_dynblock_exit();
+        return -ENOMEM;
+    }
+
+    get_random_bytes(&db_seed, sizeof(db_seed));
+
+    debugfs_create_file("dynblock_stats", 0444, dir, NULL, &dynblock_stats_fops);
+
+    return 0;
+}
+
+void fw_dynblock_exit(void) {
+    vfree(db4.sets);
+    vfree(db6.sets);
+    db4.sets = NULL;
+    db6.sets = NULL;
+    db_active = false;
+}
+
+/* Function for adding the dynblocks file of a namespace to its debugfs directory */
+void fw_dynblock_net_init(struct fw_net *fn) {
+    debugfs_create_file("dynblocks", 0444, fn->dir, fn, &dynblocks_fops);
+}
+
+/* Function for lifting the blocks of a namespace that goes away, which frees their ways right
+ * away rather than when they expire; its hooks must already be unregistered and its debugfs files
+ * removed */
+void fw_dynblock_net_exit(struct fw_net *fn) {
+    fw_dynblock_flush(fn);
+}
+
+// EOF
@@ -0,0 +1,32 @@
+/*************************************************************************************************
+ * Dynamic blocks -- single IPv4 hosts or IPv6 /64s dropped for a limited time, fail2ban style,
+ * added by fwctl or by the ratelimit action when a source keeps sending over its rate. They live outside the ruleset:
+ * adding or removing one takes effect right away, without a new generation. A block only applies
+ * to the namespace it was made in.
+ ************************************************************************************************/
+#ifndef _FW_DYNBLOCK_H
+#define _FW_DYNBLOCK_H
+
+#include <linux/types.h>
+#include <linux/in6.h>
+
+struct dentry;
+struct fw_net;
+
+int fw_dynblock_init(struct dentry *dir);
+void fw_dynblock_exit(void);
+void fw_dynblock_net_init(struct fw_net *fn);
+void fw_dynblock_net_exit(struct fw_net *fn);
+
+/* Lookups are lock-free and safe from any context; changes take a spinlock with bottom halves
+ * disabled, so both the control path and the packet path (ratelimit triggers) may make them. */
+bool fw_dynblock_lookup(const struct fw_net *fn, __be32 addr);
+void fw_dynblock_add(const struct fw_net *fn, __be32 addr, u32 ttl);
+bool fw_dynblock_del(const struct fw_net *fn, __be32 addr);
+bool fw_dynblock_lookup6(const struct fw_net *fn, const struct in6_addr *addr);
+void fw_dynblock_add6(const struct fw_net *fn, const struct in6_addr *addr, u32 ttl);
+bool fw_dynblock_del6(const struct fw_net *fn, const struct in6_addr *addr);
+void fw_dynblock_flush(const struct fw_net *fn);
+unsigned int fw_dynblock_count(const struct fw_net *fn);
+
+#endif /* _FW_DYNBLOCK_H */
@@ -0,0 +1,216 @@
+/*************************************************************************************************
+ * Verdict event log -- one struct fw_event per verdict, written to a relay channel.
+ *
+ * relay keeps one buffer per CPU and relay_write() only touches the local CPU's buffer, so the
+ * hook never takes a lock or shares a cache line to log. The channel runs in no-overwrite mode:
+ * when a CPU's buffer is full new events are dropped and counted rather than waiting on the
+ * reader. A per-CPU token bucket caps the event rate on top of that, so a flood costs at most a
+ * couple of compares per packet.
+ *
+ * The channel is shared by every network namespace; each record names the namespace of its
+ * interface, so a reader in the initial namespace can tell the containers' traffic apart.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/relay.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <net/net_namespace.h>
+
+#include "fw-events.h"
+
+#define EVENT_SUBBUF_SIZE   (64 * 1024)     // multiple of sizeof(struct fw_event), so records never straddle
+#define EVENT_N_SUBBUFS     8               // sub-buffers per CPU
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+struct event_cpu {
+    u64 tokens;                     // events this CPU may still log, scaled by NSEC_PER_SEC
+    u64 last_ns;                    // last token refill
+    u64 logged;                     // events handed to relay
+    u64 ratelimited;                // events suppressed by the token bucket
+    u64 dropped;                    // events lost because the relay buffer was full
+};
+
+static bool log_events = true;                          // log a record per verdict
+static unsigned int event_rate = 10000;                 // events/sec allowed per CPU, 0 = unlimited
+static struct rchan *event_chan;                        // relay channel, one buffer per CPU
+static struct event_cpu __percpu *event_cpus;           // per-CPU rate limiter and counters
+
+module_param(log_events, bool, 0644);
+MODULE_PARM_DESC(log_events, "Log a binary event per verdict to the relay channel");
+module_param(event_rate, uint, 0644);
+MODULE_PARM_DESC(event_rate, "Maximum events per second per CPU (0 = unlimited)");
+
+/* ===============================================================================================
+ * relay callbacks
+ * ===============================================================================================*/
+
+/* Called when relay moves on to a new sub-buffer; returning 0 drops the event instead of
+ * overwriting data the reader has not consumed yet. Runs on the CPU that owns the buffer. */
+static int subbuf_start(struct rchan_buf *buf, void *subbuf, void *prev_subbuf, size_t prev_padding) {
+    if(relay_buf_full(buf)) {
+        this_cpu_inc(event_cpus->dropped);
+        return 0;
+    }
+
+    return 1;
+}
+
+static struct dentry *create_buf_file(const char *filename, struct dentry *parent, umode_t mode,
+                                      struct rchan_buf *buf, int *is_global) {
+    return debugfs_create_file(filename, mode, parent, buf, &relay_file_operations);
+}
+
+static int remove_buf_file(struct dentry *dentry) {
+    debugfs_remove(dentry);
+    return 0;
+}
+
+static struct rchan_callbacks relay_callbacks = {
+    .subbuf_start       = subbuf_start,
+    .create_buf_file    = create_buf_file,
+    .remove_buf_file    = remove_buf_file,
+};
+
+/* ===============================================================================================
+ * stats file
+ * ===============================================================================================*/
+static int events_stats_show(struct seq_file *m, void *v) {
+    u64 logged = 0, ratelimited = 0, dropped = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct event_cpu *ec = per_cpu_ptr(event_cpus, cpu);
+
+        logged += ec->logged;
+        ratelimited += ec->ratelimited;
+        dropped += ec->dropped;
+    }
+
+    seq_printf(m, "logged: %llu\nratelimited: %llu\ndropped: %llu\n", logged, ratelimited, dropped);
+
+    return 0;
+}
+
+static int events_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, events_stats_show, NULL);
+}
+
+static const struct file_operations events_stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = events_stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* ===============================================================================================
+ * event functions
+ * ===============================================================================================*/
+
+/* Function for taking one token from this CPU's bucket
+ * @param ec: this CPU's state
+ * @param now: current time in ns
+ * */
+static bool event_allowed(struct event_cpu *ec, u64 now) {
+    u64 rate = READ_ONCE(event_rate);
+    u64 cap = rate * NSEC_PER_SEC;  // allow a burst of one second's worth of events
+    u64 elapsed = min_t(u64, now - ec->last_ns, NSEC_PER_SEC);
+
+    if(!rate) { return true; }
+
+    ec->tokens = min(cap, ec->tokens + elapsed * rate);
+    ec->last_ns = now;
+
+    if(ec->tokens < NSEC_PER_SEC) { return false; }
+    ec->tokens -= NSEC_PER_SEC;
+
+    return true;
+}
+
+/* Function for logging a verdict
+ * @param pkt: parsed packet
+ * @param dev: input device, output device at FW_HOOK_LOCAL_OUT*, may be NULL
+ * @param hook: enum fw_hook the verdict was taken at
+ * @param verdict: NF_ACCEPT or NF_DROP
+ * @param reason: enum fw_reason
+ * */
+void fw_events_log(const struct fw_pkt *pkt, const struct net_device *dev, u8 hook, unsigned int verdict, u8 reason) {
+    struct fw_event ev;
+    struct event_cpu *ec;
+    u64 now;
+
+    if(!READ_ONCE(log_events) || !event_chan) { return; }
+
+    now = ktime_get_ns();
+
+    /* a softirq interrupting process context on this CPU can at worst skew the bucket slightly */
+    ec = get_cpu_ptr(event_cpus);
+    if(!event_allowed(ec, now)) {
+        ec->ratelimited++;
+        put_cpu_ptr(event_cpus);
+        return;
+    }
+    ec->logged++;
+    put_cpu_ptr(event_cpus);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.ts_ns = now;
+    if(pkt->family == NFPROTO_IPV6) {
+        memcpy(ev.saddr, &pkt->saddr6, sizeof(ev.saddr));
+        memcpy(ev.daddr, &pkt->daddr6, sizeof(ev.daddr));
+    } else {
+        memcpy(ev.saddr, &pkt->saddr, sizeof(pkt->saddr));
+        memcpy(ev.daddr, &pkt->daddr, sizeof(pkt->daddr));
+    }
+    ev.sport = pkt->sport;
+    ev.dport = pkt->dport;
+    ev.ifindex = dev ? dev->ifindex : 0;
+    ev.netns = dev ? dev_net(dev)->ns.inum : 0;
+    ev.len = pkt->len;
+    ev.proto = pkt->proto;
+    ev.verdict = verdict;
+    ev.reason = reason;
+    ev.hook = hook;
+    ev.family = pkt->family;
+
+    relay_write(event_chan, &ev, sizeof(ev));
+}
+
+/* Function for creating the relay channel and stats file under the module's debugfs directory
+ * @param dir: debugfs directory
+ * */
+int fw_events_init(struct dentry *dir) {
+    BUILD_BUG_ON(sizeof(struct fw_event) != 64);
+    BUILD_BUG_ON(EVENT_SUBBUF_SIZE % sizeof(struct fw_event));
+
+    event_cpus = alloc_percpu(struct event_cpu);
+    if(!event_cpus) { return -ENOMEM; }
+
+    event_chan = relay_open("events", dir, EVENT_SUBBUF_SIZE, EVENT_N_SUBBUFS, &relay_callbacks, NULL);
+    if(!event_chan) {
+        free_percpu(event_cpus);
+        return -ENOMEM;
+    }
+
+    debugfs_create_file("events_stats", 0444, dir, NULL, &events_stats_fops);
+
+    return 0;
+}
+
+/* Function for tearing down the channel; the hook must already be unregistered */
+void fw_events_exit(void) {
+    relay_close(event_chan);
+    event_chan = NULL;
+    free_percpu(event_cpus);
+}
+
+// EOF
@@ -0,0 +1,20 @@
+/*************************************************************************************************
+ * Verdict event log -- fixed-size binary records written to per-CPU relay buffers instead of
+ * printk, drained in batches by a userspace reader.
+ ************************************************************************************************/
+#ifndef _FW_EVENTS_H
+#define _FW_EVENTS_H
+
+#include <linux/types.h>
+
+#include "fw.h"
+#include "fw-uapi.h"
+
+struct dentry;
+struct net_device;
+
+int fw_events_init(struct dentry *dir);
+void fw_events_exit(void);
+void fw_events_log(const struct fw_pkt *pkt, const struct net_device *dev, u8 hook, unsigned int verdict, u8 reason);
+
+#endif /* _FW_EVENTS_H */
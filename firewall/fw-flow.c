@@ -0,0 +1,366 @@
+/*************************************************************************************************
+ * Flow verdict cache -- per-CPU, 4-way set-associative tables keyed on
+ * (saddr, daddr, sport, dport, proto, ifindex), one for IPv4 and one for IPv6.
+ *
+ * Every CPU owns its tables outright, so neither lookups nor inserts lock or write a shared cache
+ * line; with RSS the packets of a flow land on the same CPU anyway. An IPv4 set is one 128-byte
+ * pair of cache lines, an IPv6 set four lines, most of it the full addresses: a key folded down to
+ * fewer bits could hand one flow's verdict to another. A full set evicts its least recently used
+ * way. Entries are stamped with the ruleset generation they were computed under and only hit for
+ * packets judged by that generation, so a commit invalidates its namespace's entries without
+ * touching them, namespaces never see each other's verdicts, and entries idle for longer than
+ * flow_timeout seconds are treated as misses.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/jiffies.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/netfilter.h>
+#include <net/ipv6.h>
+
+#include "fw-flow.h"
+
+#define FLOW_WAYS 4                 // entries per set, either family
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct flow_entry {
+    __be32 saddr;
+    __be32 daddr;
+    u16 sport;
+    u16 dport;
+    u8 proto;
+    u8 verdict;
+    u8 reason;
+    u8 pad;
+    u32 gen;                        // ruleset generation, 0 marks an empty way
+    u32 last_seen;                  // jiffies of the last hit
+    u32 ifindex;                    // input interface, rules may match on it
+    u32 rule;                       // filter rule behind the verdict, for its counters
+};
+
+struct flow6_entry {
+    struct in6_addr saddr;
+    struct in6_addr daddr;
+    u16 sport;                      // the rest as in struct flow_entry
+    u16 dport;
+    u8 proto;
+    u8 verdict;
+    u8 reason;
+    u8 pad;
+    u32 gen;
+    u32 last_seen;
+    u32 ifindex;
+    u32 rule;
+};
+
+struct flow_set {
+    struct flow_entry way[FLOW_WAYS];
+} ____cacheline_aligned;
+
+struct flow6_set {
+    struct flow6_entry way[FLOW_WAYS];
+} ____cacheline_aligned;
+
+struct flow_table {
+    struct flow_set *sets;          // this CPU's IPv4 sets
+    struct flow6_set *sets6;        // this CPU's IPv6 sets
+    u32 mask;                       // number of IPv4 sets - 1
+    u32 mask6;                      // number of IPv6 sets - 1
+    u64 hits;
+    u64 misses;
+    u64 inserts;
+    u64 evictions;                  // live entries pushed out by a full set
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static bool flow_cache = true;                          // consult the cache at all
+static unsigned int flow_entries = 16384;               // entries per CPU and family, rounded up to a power of two
+static unsigned int flow_timeout = 30;                  // seconds an idle entry stays valid
+static struct flow_table __percpu *flow_tables;         // one table per CPU
+static u32 flow_seed __read_mostly;                     // hash seed
+
+module_param(flow_cache, bool, 0644);
+MODULE_PARM_DESC(flow_cache, "Cache verdicts per 5-tuple");
+module_param(flow_entries, uint, 0444);
+MODULE_PARM_DESC(flow_entries, "Flow cache entries per CPU, for each of IPv4 and IPv6");
+module_param(flow_timeout, uint, 0644);
+MODULE_PARM_DESC(flow_timeout, "Seconds before an idle flow cache entry expires");
+
+/* ===============================================================================================
+ * cache functions
+ * ===============================================================================================*/
+static inline struct flow_set *flow_set_of(struct flow_table *t, const struct fw_pkt *pkt) {
+    u32 h = jhash_3words(pkt->saddr, pkt->daddr, ((u32)pkt->sport << 16) | pkt->dport, flow_seed ^ pkt->proto);
+
+    return &t->sets[h & t->mask];
+}
+
+static inline bool flow_match(const struct flow_entry *e, const struct fw_pkt *pkt) {
+    return e->saddr == pkt->saddr && e->daddr == pkt->daddr &&
+           e->sport == pkt->sport && e->dport == pkt->dport && e->proto == pkt->proto &&
+           e->ifindex == pkt->ifindex;
+}
+
+static inline struct flow6_set *flow6_set_of(struct flow_table *t, const struct fw_pkt *pkt) {
+    const __be32 *s = pkt->saddr6.s6_addr32, *d = pkt->daddr6.s6_addr32;
+    u32 h;
+
+    h = jhash_3words((__force u32)s[0], (__force u32)s[1], (__force u32)s[2], flow_seed ^ pkt->proto);
+    h = jhash_3words((__force u32)s[3], (__force u32)d[0], (__force u32)d[1], h);
+    h = jhash_3words((__force u32)d[2], (__force u32)d[3], ((u32)pkt->sport << 16) | pkt->dport, h);
+
+    return &t->sets6[h & t->mask6];
+}
+
+static inline bool flow6_match(const struct flow6_entry *e, const struct fw_pkt *pkt) {
+    return e->sport == pkt->sport && e->dport == pkt->dport && e->proto == pkt->proto &&
+           e->ifindex == pkt->ifindex && ipv6_addr_equal(&e->saddr, &pkt->saddr6) &&
+           ipv6_addr_equal(&e->daddr, &pkt->daddr6);
+}
+
+/* Function for looking up the cached verdict of an IPv6 packet's flow, see fw_flow_lookup() */
+static bool flow6_lookup(struct flow_table *t, const struct fw_pkt *pkt, u32 gen, u32 now, u32 timeout,
+                         struct fw_flow_res *res) {
+    struct flow6_set *set = flow6_set_of(t, pkt);
+    int i;
+
+    for(i = 0; i < FLOW_WAYS; i++) {
+        struct flow6_entry *e = &set->way[i];
+
+        if(e->gen == gen && flow6_match(e, pkt) && now - e->last_seen <= timeout) {
+            e->last_seen = now;
+            res->verdict = e->verdict;
+            res->reason = e->reason;
+            res->rule = e->rule;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Function for caching the verdict taken for an IPv6 packet's flow, see fw_flow_insert()
+ * returns true if a live entry was evicted
+ * */
+static bool flow6_insert(struct flow_table *t, const struct fw_pkt *pkt, u32 gen, u32 now, u32 timeout, u8 verdict,
+                         u8 reason, u32 rule) {
+    struct flow6_set *set = flow6_set_of(t, pkt);
+    struct flow6_entry *victim = NULL, *e;
+    int i;
+
+    for(i = 0; i < FLOW_WAYS; i++) {
+        e = &set->way[i];
+
+        if(e->gen != gen || flow6_match(e, pkt) || now - e->last_seen > timeout) {
+            victim = e;
+            break;
+        }
+        if(!victim || now - e->last_seen > now - victim->last_seen) {
+            victim = e;
+        }
+    }
+
+    victim->saddr = pkt->saddr6;
+    victim->daddr = pkt->daddr6;
+    victim->sport = pkt->sport;
+    victim->dport = pkt->dport;
+    victim->proto = pkt->proto;
+    victim->ifindex = pkt->ifindex;
+    victim->verdict = verdict;
+    victim->reason = reason;
+    victim->rule = rule;
+    victim->last_seen = now;
+    victim->gen = gen;
+
+    return i == FLOW_WAYS;
+}
+
+/* Function for looking up the cached verdict of a packet's flow
+ * @param pkt: parsed packet
+ * @param gen: generation of the ruleset the packet is judged by
+ * @param res: set to the cached verdict on a hit
+ * returns true on a hit
+ * */
+bool fw_flow_lookup(const struct fw_pkt *pkt, u32 gen, struct fw_flow_res *res) {
+    struct flow_table *t = this_cpu_ptr(flow_tables);
+    struct flow_set *set;
+    u32 now = (u32)jiffies;
+    u32 timeout = flow_timeout * HZ;
+    int i;
+
+    if(!READ_ONCE(flow_cache)) { return false; }
+
+    if(pkt->family == NFPROTO_IPV6) {
+        if(flow6_lookup(t, pkt, gen, now, timeout, res)) {
+            t->hits++;
+            return true;
+        }
+        t->misses++;
+        return false;
+    }
+
+    set = flow_set_of(t, pkt);
+    for(i = 0; i < FLOW_WAYS; i++) {
+        struct flow_entry *e = &set->way[i];
+
+        if(e->gen == gen && flow_match(e, pkt) && now - e->last_seen <= timeout) {
+            e->last_seen = now;
+            res->verdict = e->verdict;
+            res->reason = e->reason;
+            res->rule = e->rule;
+            t->hits++;
+            return true;
+        }
+    }
+    t->misses++;
+
+    return false;
+}
+
+/* Function for caching the verdict taken for a packet's flow
+ * @param pkt: parsed packet
+ * @param gen: generation of the ruleset the verdict was taken by
+ * @param verdict: verdict taken
+ * @param reason: enum fw_reason behind it
+ * @param rule: filter rule that decided it, FW_RULE_NONE if none
+ * */
+void fw_flow_insert(const struct fw_pkt *pkt, u32 gen, u8 verdict, u8 reason, u32 rule) {
+    struct flow_table *t = this_cpu_ptr(flow_tables);
+    struct flow_set *set;
+    struct flow_entry *victim = NULL, *e;
+    u32 now = (u32)jiffies;
+    u32 timeout = flow_timeout * HZ;
+    int i;
+
+    if(!READ_ONCE(flow_cache)) { return; }
+
+    t->inserts++;
+    if(pkt->family == NFPROTO_IPV6) {
+        if(flow6_insert(t, pkt, gen, now, timeout, verdict, reason, rule)) { t->evictions++; }
+        return;
+    }
+
+    /* prefer a way that is empty, stale or expired, otherwise evict the least recently used */
+    set = flow_set_of(t, pkt);
+    for(i = 0; i < FLOW_WAYS; i++) {
+        e = &set->way[i];
+
+        if(e->gen != gen || flow_match(e, pkt) || now - e->last_seen > timeout) {
+            victim = e;
+            break;
+        }
+        if(!victim || now - e->last_seen > now - victim->last_seen) {
+            victim = e;
+        }
+    }
+    if(i == FLOW_WAYS) { t->evictions++; }
+
+    victim->saddr = pkt->saddr;
+    victim->daddr = pkt->daddr;
+    victim->sport = pkt->sport;
+    victim->dport = pkt->dport;
+    victim->proto = pkt->proto;
+    victim->ifindex = pkt->ifindex;
+    victim->verdict = verdict;
+    victim->reason = reason;
+    victim->rule = rule;
+    victim->last_seen = now;
+    victim->gen = gen;
+}
+
+/* ===============================================================================================
+ * stats file
+ * ===============================================================================================*/
+static int flow_stats_show(struct seq_file *m, void *v) {
+    u64 hits = 0, misses = 0, inserts = 0, evictions = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct flow_table *t = per_cpu_ptr(flow_tables, cpu);
+
+        hits += t->hits;
+        misses += t->misses;
+        inserts += t->inserts;
+        evictions += t->evictions;
+    }
+
+    seq_printf(m, "entries/cpu: %u ipv4, %u ipv6\nhits: %llu\nmisses: %llu\ninserts: %llu\nevictions: %llu\n",
+               (per_cpu_ptr(flow_tables, 0)->mask + 1) * FLOW_WAYS, (per_cpu_ptr(flow_tables, 0)->mask6 + 1) * FLOW_WAYS,
+               hits, misses, inserts, evictions);
+    seq_printf(m, "hit ratio: %llu.%02llu%%\n", hits * 100 / max(hits + misses, 1ULL),
+               hits * 10000 / max(hits + misses, 1ULL) % 100);
+
+    return 0;
+}
+
+static int flow_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, flow_stats_show, NULL);
+}
+
+static const struct file_operations flow_stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = flow_stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+int fw_flow_init(struct dentry *dir) {
+    unsigned int nsets = roundup_pow_of_two(max(flow_entries / FLOW_WAYS, 1U));
+    int cpu;
+
+    BUILD_BUG_ON(sizeof(struct flow_entry) != 32);
+    BUILD_BUG_ON(sizeof(struct flow6_entry) * FLOW_WAYS > 4 * 64);
+
+    flow_tables = alloc_percpu(struct flow_table);
+    if(!flow_tables) { return -ENOMEM; }
+
+    get_random_bytes(&flow_seed, sizeof(flow_seed));
+
+    for_each_possible_cpu(cpu) {
+        struct flow_table *t = per_cpu_ptr(flow_tables, cpu);
+
+        t->sets = vzalloc(sizeof(struct flow_set) * nsets);
+        t->sets6 = vzalloc(sizeof(struct flow6_set) * nsets);
+        if(!t->sets || !t->sets6) {
+            fw_flow_exit();
+            return -ENOMEM;
+        }
+        t->mask = nsets - 1;
+        t->mask6 = nsets - 1;
+    }
+
+    debugfs_create_file("flow_stats", 0444, dir, NULL, &flow_stats_fops);
+
+    return 0;
+}
+
+void fw_flow_exit(void) {
+    int cpu;
+
+    if(!flow_tables) { return; }
+
+    for_each_possible_cpu(cpu) {
+        vfree(per_cpu_ptr(flow_tables, cpu)->sets);
+        vfree(per_cpu_ptr(flow_tables, cpu)->sets6);
+    }
+    free_percpu(flow_tables);
+    flow_tables = NULL;
+}
+
+// EOF
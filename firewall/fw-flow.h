@@ -0,0 +1,30 @@
+/*************************************************************************************************
+ * Flow verdict cache -- remembers the verdict taken for a 5-tuple so later packets of the same
+ * flow skip rule evaluation entirely.
+ ************************************************************************************************/
+#ifndef _FW_FLOW_H
+#define _FW_FLOW_H
+
+#include <linux/types.h>
+
+#include "fw.h"
+
+struct dentry;
+
+/* Result of a cache hit */
+struct fw_flow_res {
+    u8 verdict;                     // cached verdict, valid on a hit
+    u8 reason;                      // cached enum fw_reason, valid on a hit
+    u32 rule;                       // cached filter rule index or FW_RULE_NONE, valid on a hit
+};
+
+int fw_flow_init(struct dentry *dir);
+void fw_flow_exit(void);
+
+/* Callers run with bottom halves disabled (any netfilter hook on the receive path) since each
+ * CPU's table is only ever touched by that CPU. gen is the generation of the ruleset the verdict
+ * is taken by: entries of any other generation, older or of another namespace, never hit. */
+bool fw_flow_lookup(const struct fw_pkt *pkt, u32 gen, struct fw_flow_res *res);
+void fw_flow_insert(const struct fw_pkt *pkt, u32 gen, u8 verdict, u8 reason, u32 rule);
+
+#endif /* _FW_FLOW_H */
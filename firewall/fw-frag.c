@@ -0,0 +1,354 @@
+/*************************************************************************************************
+ * Fragment verdict cache -- per-CPU set-associative tables keyed the way IP reassembly keys
+ * datagrams: (saddr, daddr, IP id, proto) for IPv4, 3 ways a set, and (saddr, daddr, fragment id)
+ * for IPv6, 4 ways a set.
+ *
+ * Only the first fragment of a datagram carries the transport header, so it is judged in full and
+ * its verdict recorded here; the later fragments look it up and follow it, and a datagram is let
+ * through or dropped as a whole without being reassembled. Fragments of one datagram hash to one
+ * CPU under RSS and RPS alike, which hash fragments on their addresses only, so the tables are per
+ * CPU like the flow cache and never locked. An IPv4 set is one cache line, an IPv6 set three, their
+ * addresses taking up most of it. An entry lives for frag_timeout seconds from its first fragment,
+ * as the datagram would in the reassembly queue; a full set evicts its oldest entry.
+ *
+ * A first fragment too short to hold its ports would get past every port rule (RFC 1858), so the
+ * judge drops it and its verdict goes in here like any other. A later fragment that arrives before
+ * its first fragment, or after the entry was evicted or expired, finds nothing. It is judged on
+ * what it does carry, the addresses and protocol, which is all the blocklist and the policies
+ * need; filter rules see it without ports. Whatever happens to it, its datagram only completes if
+ * the first fragment gets through as well, and that one has been judged with its ports.
+ *
+ * Entries carry the ruleset generation that judged the first fragment, so a datagram forwarded from
+ * one namespace into another is judged afresh by the second, and a generation of 0, which is never
+ * handed out, marks an empty way. The IPv6 key leaves out the protocol: a later fragment's
+ * fragment header names the first header after it, which need not be the transport header the
+ * first fragment was judged on.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/jiffies.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/netfilter.h>
+#include <net/ipv6.h>
+
+#include "fw-frag.h"
+#include "fw-uapi.h"
+
+#define FRAG_WAYS 3                 // entries per IPv4 set
+#define FRAG6_WAYS 4                // entries per IPv6 set
+#define FRAG_ACCEPTED 0x80          // result bit: the first fragment was accepted
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct frag_entry {
+    __be32 saddr;
+    __be32 daddr;
+    u32 gen;                        // ruleset generation of the first fragment's verdict, 0 marks an empty way
+    u32 seen;                       // jiffies the first fragment was judged
+    u16 id;                         // IP identification, host byte order
+    u8 proto;
+    u8 result;                      // enum fw_reason, plus FRAG_ACCEPTED for NF_ACCEPT
+};
+
+struct frag6_entry {
+    struct in6_addr saddr;
+    struct in6_addr daddr;
+    u32 gen;                        // as in struct frag_entry
+    u32 seen;
+    u32 id;                         // fragment header identification, host byte order
+    u8 result;
+};
+
+struct frag_set {
+    struct frag_entry way[FRAG_WAYS];
+} ____cacheline_aligned;
+
+struct frag6_set {
+    struct frag6_entry way[FRAG6_WAYS];
+} ____cacheline_aligned;
+
+struct frag_table {
+    struct frag_set *sets;          // this CPU's IPv4 sets
+    struct frag6_set *sets6;        // this CPU's IPv6 sets
+    u32 mask;                       // number of IPv4 sets - 1
+    u32 mask6;                      // number of IPv6 sets - 1
+    u64 hits;                       // later fragments that found their first fragment's verdict
+    u64 orphans;                    // later fragments that did not
+    u64 inserts;
+    u64 evictions;                  // live entries pushed out by a full set
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static unsigned int frag_entries = 3072;                // entries per CPU and family, sets rounded up to a power of two
+static unsigned int frag_timeout = 30;                  // seconds an entry stays valid, like ipfrag_time
+static struct frag_table __percpu *frag_tables;         // one table per CPU
+static u32 frag_seed __read_mostly;                     // hash seed
+
+module_param(frag_entries, uint, 0444);
+MODULE_PARM_DESC(frag_entries, "Fragment verdict cache entries per CPU, for each of IPv4 and IPv6");
+module_param(frag_timeout, uint, 0644);
+MODULE_PARM_DESC(frag_timeout, "Seconds the verdict of a first fragment applies to the rest of its datagram");
+
+/* ===============================================================================================
+ * cache functions
+ * ===============================================================================================*/
+static inline struct frag_set *frag_set_of(struct frag_table *t, const struct fw_pkt *pkt) {
+    u32 h = jhash_3words(pkt->saddr, pkt->daddr, pkt->ip_id, frag_seed ^ pkt->proto);
+
+    return &t->sets[h & t->mask];
+}
+
+static inline bool frag_match(const struct frag_entry *e, const struct fw_pkt *pkt, u32 gen) {
+    return e->gen == gen && e->saddr == pkt->saddr && e->daddr == pkt->daddr && e->id == pkt->ip_id &&
+           e->proto == pkt->proto;
+}
+
+static inline struct frag6_set *frag6_set_of(struct frag_table *t, const struct fw_pkt *pkt) {
+    const __be32 *s = pkt->saddr6.s6_addr32, *d = pkt->daddr6.s6_addr32;
+    u32 h;
+
+    h = jhash_3words((__force u32)s[0], (__force u32)s[1], (__force u32)s[2], frag_seed);
+    h = jhash_3words((__force u32)s[3], (__force u32)d[0], (__force u32)d[1], h);
+    h = jhash_3words((__force u32)d[2], (__force u32)d[3], pkt->ip_id, h);
+
+    return &t->sets6[h & t->mask6];
+}
+
+static inline bool frag6_match(const struct frag6_entry *e, const struct fw_pkt *pkt, u32 gen) {
+    return e->gen == gen && e->id == pkt->ip_id && ipv6_addr_equal(&e->saddr, &pkt->saddr6) &&
+           ipv6_addr_equal(&e->daddr, &pkt->daddr6);
+}
+
+static inline void frag_res_of(u8 result, struct fw_frag_res *res) {
+    res->verdict = result & FRAG_ACCEPTED ? NF_ACCEPT : NF_DROP;
+    res->reason = result & ~FRAG_ACCEPTED;
+}
+
+/* Function for looking up the verdict of a later IPv6 fragment's datagram, see fw_frag_lookup() */
+static bool frag6_lookup(struct frag_table *t, const struct fw_pkt *pkt, u32 gen, u32 now, u32 timeout,
+                         struct fw_frag_res *res) {
+    struct frag6_set *set = frag6_set_of(t, pkt);
+    int i;
+
+    for(i = 0; i < FRAG6_WAYS; i++) {
+        struct frag6_entry *e = &set->way[i];
+
+        if(frag6_match(e, pkt, gen) && now - e->seen <= timeout) {
+            frag_res_of(e->result, res);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Function for recording the verdict taken on the first IPv6 fragment of a datagram, see
+ * fw_frag_insert()
+ * returns true if a live entry was evicted
+ * */
+static bool frag6_insert(struct frag_table *t, const struct fw_pkt *pkt, u32 gen, u32 now, u32 timeout, u8 result) {
+    struct frag6_set *set = frag6_set_of(t, pkt);
+    struct frag6_entry *victim = NULL, *e;
+    int i;
+
+    for(i = 0; i < FRAG6_WAYS; i++) {
+        e = &set->way[i];
+
+        if(!e->gen || frag6_match(e, pkt, gen) || now - e->seen > timeout) {
+            victim = e;
+            break;
+        }
+        if(!victim || now - e->seen > now - victim->seen) {
+            victim = e;
+        }
+    }
+
+    victim->saddr = pkt->saddr6;
+    victim->daddr = pkt->daddr6;
+    victim->id = pkt->ip_id;
+    victim->result = result;
+    victim->gen = gen;
+    victim->seen = now;
+
+    return i == FRAG6_WAYS;
+}
+
+/* Function for looking up the verdict of a later fragment's datagram
+ * @param pkt: parsed later fragment
+ * @param gen: generation of the ruleset the fragment is judged by
+ * @param res: set to the verdict of the first fragment on a hit
+ * returns true on a hit
+ * */
+bool fw_frag_lookup(const struct fw_pkt *pkt, u32 gen, struct fw_frag_res *res) {
+    struct frag_table *t = this_cpu_ptr(frag_tables);
+    struct frag_set *set;
+    u32 now = (u32)jiffies;
+    u32 timeout = READ_ONCE(frag_timeout) * HZ;
+    int i;
+
+    if(pkt->family == NFPROTO_IPV6) {
+        if(frag6_lookup(t, pkt, gen, now, timeout, res)) {
+            t->hits++;
+            return true;
+        }
+        t->orphans++;
+        return false;
+    }
+
+    set = frag_set_of(t, pkt);
+    for(i = 0; i < FRAG_WAYS; i++) {
+        struct frag_entry *e = &set->way[i];
+
+        if(frag_match(e, pkt, gen) && now - e->seen <= timeout) {
+            frag_res_of(e->result, res);
+            t->hits++;
+            return true;
+        }
+    }
+    t->orphans++;
+
+    return false;
+}
+
+/* Function for recording the verdict taken on the first fragment of a datagram
+ * @param pkt: parsed first fragment
+ * @param gen: generation of the ruleset the verdict was taken by
+ * @param verdict: NF_ACCEPT or NF_DROP
+ * @param reason: enum fw_reason behind it
+ * */
+void fw_frag_insert(const struct fw_pkt *pkt, u32 gen, u8 verdict, u8 reason) {
+    struct frag_table *t = this_cpu_ptr(frag_tables);
+    struct frag_set *set;
+    struct frag_entry *victim = NULL, *e;
+    u32 now = (u32)jiffies;
+    u32 timeout = READ_ONCE(frag_timeout) * HZ;
+    u8 result = reason | (verdict == NF_ACCEPT ? FRAG_ACCEPTED : 0);
+    int i;
+
+    t->inserts++;
+    if(pkt->family == NFPROTO_IPV6) {
+        if(frag6_insert(t, pkt, gen, now, timeout, result)) { t->evictions++; }
+        return;
+    }
+
+    set = frag_set_of(t, pkt);
+    /* prefer a way that is empty, expired or a retransmitted first fragment's, otherwise evict the
+     * oldest */
+    for(i = 0; i < FRAG_WAYS; i++) {
+        e = &set->way[i];
+
+        if(!e->gen || frag_match(e, pkt, gen) || now - e->seen > timeout) {
+            victim = e;
+            break;
+        }
+        if(!victim || now - e->seen > now - victim->seen) {
+            victim = e;
+        }
+    }
+    if(i == FRAG_WAYS) { t->evictions++; }
+
+    victim->saddr = pkt->saddr;
+    victim->daddr = pkt->daddr;
+    victim->id = pkt->ip_id;
+    victim->proto = pkt->proto;
+    victim->result = result;
+    victim->gen = gen;
+    victim->seen = now;
+}
+
+/* ===============================================================================================
+ * stats file
+ * ===============================================================================================*/
+static int frag_stats_show(struct seq_file *m, void *v) {
+    u64 hits = 0, orphans = 0, inserts = 0, evictions = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct frag_table *t = per_cpu_ptr(frag_tables, cpu);
+
+        hits += t->hits;
+        orphans += t->orphans;
+        inserts += t->inserts;
+        evictions += t->evictions;
+    }
+
+    seq_printf(m, "entries/cpu: %u ipv4, %u ipv6\ntimeout: %us\nfirst fragments: %llu\nlater fragments: %llu\n"
+               "orphans: %llu\nevictions: %llu\n", (per_cpu_ptr(frag_tables, 0)->mask + 1) * FRAG_WAYS,
+               (per_cpu_ptr(frag_tables, 0)->mask6 + 1) * FRAG6_WAYS, READ_ONCE(frag_timeout), inserts,
+               hits + orphans, orphans, evictions);
+
+    return 0;
+}
+
+static int frag_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, frag_stats_show, NULL);
+}
+
+static const struct file_operations frag_stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = frag_stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+int fw_frag_init(struct dentry *dir) {
+    unsigned int nsets = roundup_pow_of_two(max(frag_entries / FRAG_WAYS, 1U));
+    unsigned int nsets6 = roundup_pow_of_two(max(frag_entries / FRAG6_WAYS, 1U));
+    int cpu;
+
+    BUILD_BUG_ON(sizeof(struct frag_entry) * FRAG_WAYS > 64);
+    BUILD_BUG_ON(sizeof(struct frag6_entry) * FRAG6_WAYS > 3 * 64);
+    BUILD_BUG_ON(FW_REASON_MAX > FRAG_ACCEPTED);
+
+    frag_tables = alloc_percpu(struct frag_table);
+    if(!frag_tables) { return -ENOMEM; }
+
+    get_random_bytes(&frag_seed, sizeof(frag_seed));
+
+    for_each_possible_cpu(cpu) {
+        struct frag_table *t = per_cpu_ptr(frag_tables, cpu);
+
+        t->sets = vzalloc(sizeof(struct frag_set) * nsets);
+        t->sets6 = vzalloc(sizeof(struct frag6_set) * nsets6);
+        if(!t->sets || !t->sets6) {
+            fw_frag_exit();
+            return -ENOMEM;
+        }
+        t->mask = nsets - 1;
+        t->mask6 = nsets6 - 1;
+    }
+
+    debugfs_create_file("frag_stats", 0444, dir, NULL, &frag_stats_fops);
+
+    return 0;
+}
+
+void fw_frag_exit(void) {
+    int cpu;
+
+    if(!frag_tables) { return; }
+
+    for_each_possible_cpu(cpu) {
+        vfree(per_cpu_ptr(frag_tables, cpu)->sets);
+        vfree(per_cpu_ptr(frag_tables, cpu)->sets6);
+    }
+    free_percpu(frag_tables);
+    frag_tables = NULL;
+}
+
+// EOF
@@ -0,0 +1,29 @@
+/*************************************************************************************************
+ * Fragment verdict cache -- remembers the verdict taken on the first fragment of an IP datagram so
+ * its later fragments, which carry no transport header to judge, get the same one.
+ ************************************************************************************************/
+#ifndef _FW_FRAG_H
+#define _FW_FRAG_H
+
+#include <linux/types.h>
+
+#include "fw.h"
+
+struct dentry;
+
+/* Result of a cache hit */
+struct fw_frag_res {
+    u8 verdict;                     // verdict of the datagram's first fragment
+    u8 reason;                      // enum fw_reason behind it
+};
+
+int fw_frag_init(struct dentry *dir);
+void fw_frag_exit(void);
+
+/* Callers run with bottom halves disabled since each CPU's table is only ever touched by that CPU.
+ * fw_frag_lookup() takes a later fragment, fw_frag_insert() the first one. gen is the generation of
+ * the ruleset the fragment is judged by, as for the flow cache. */
+bool fw_frag_lookup(const struct fw_pkt *pkt, u32 gen, struct fw_frag_res *res);
+void fw_frag_insert(const struct fw_pkt *pkt, u32 gen, u8 verdict, u8 reason);
+
+#endif /* _FW_FRAG_H */
@@ -0,0 +1,124 @@
+/*************************************************************************************************
+ * Exact-match IPv4 address set -- builds the bucketed hash table and Bloom filter the blocklist
+ * uses for single hosts.
+ *
+ * An address goes into the first bucket with a free slot, starting at its hash and moving on to
+ * the next bucket when one is full. The table has at least twice as many slots as addresses, so
+ * nearly every address lands in its home bucket and a search stops at the first bucket that still
+ * has an empty slot. The Bloom filter gets 16 bits per address, which with 8 bits set per address
+ * in 512-bit blocks lets well under 1% of the addresses outside the set through to the table.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+
+#include "fw-hostset.h"
+
+#define HOSTSET_BLOOM_BITS  16          // Bloom bits per address
+
+/* ===============================================================================================
+ * set functions
+ * ===============================================================================================*/
+
+/* Function for searching the table for an address that passed the Bloom filter
+ * @param s: set to search
+ * @param addr: nonzero address in host byte order
+ * @param h: fw_hostset_hash() of addr
+ * */
+bool fw_hostset_find(const struct fw_hostset *s, u32 addr, u64 h) {
+    u32 b = (u32)h & s->mask;
+    const u32 *bucket;
+    bool found, open;
+    int i;
+
+    for(;;) {
+        bucket = &s->slots[b * FW_HOSTSET_SLOTS];
+        found = open = false;
+
+        /* no early exit, a fixed-length loop over one cache line compiles to vector compares */
+        for(i = 0; i < FW_HOSTSET_SLOTS; i++) {
+            found |= bucket[i] == addr;
+            open |= !bucket[i];
+        }
+
+        /* addresses only move on past full buckets */
+        if(found || open) { return found; }
+        b = (b + 1) & s->mask;
+    }
+}
+
+/* Function for building a set from a list of addresses
+ * @param addrs: addresses in host byte order, without duplicates
+ * @param count: number of addresses
+ * returns the new set, or NULL when out of memory
+ * */
+struct fw_hostset *fw_hostset_build(const u32 *addrs, unsigned int count) {
+    struct fw_hostset *s;
+    unsigned long nbuckets, nblocks;
+    unsigned int i, j, bit, b;
+    u32 *bucket;
+    u64 h;
+
+    s = kzalloc(sizeof(*s), GFP_KERNEL);
+    if(!s) { return NULL; }
+
+    nbuckets = roundup_pow_of_two(max(DIV_ROUND_UP((unsigned long)count * 2, FW_HOSTSET_SLOTS), 1UL));
+    nblocks = roundup_pow_of_two(max(DIV_ROUND_UP((unsigned long)count * HOSTSET_BLOOM_BITS, FW_HOSTSET_BLOCK), 1UL));
+
+    s->slots = vzalloc(sizeof(u32) * FW_HOSTSET_SLOTS * nbuckets);
+    s->bloom = vzalloc(FW_HOSTSET_BLOCK / 8 * nblocks);
+    if(!s->slots || !s->bloom) {
+        fw_hostset_free(s);
+        return NULL;
+    }
+    s->mask = nbuckets - 1;
+    s->bloom_mask = nblocks - 1;
+    s->count = count;
+    get_random_bytes(&s->seed, sizeof(s->seed));
+
+    for(i = 0; i < count; i++) {
+        if(!addrs[i]) {
+            s->zero = true;
+            continue;
+        }
+        h = fw_hostset_hash(s, addrs[i]);
+
+        for(b = (u32)h & s->mask; ; b = (b + 1) & s->mask) {
+            bucket = &s->slots[b * FW_HOSTSET_SLOTS];
+            for(j = 0; j < FW_HOSTSET_SLOTS && bucket[j]; j++);
+            if(j < FW_HOSTSET_SLOTS) { break; }
+        }
+        bucket[j] = addrs[i];
+
+        /* same bit positions fw_hostset_may_contain() tests */
+        for(j = 0; j < FW_HOSTSET_PROBES; j++) {
+            u64 *block = &s->bloom[((u32)h & s->bloom_mask) * (FW_HOSTSET_BLOCK / 64)];
+
+            bit = ((u32)(h >> 32) + j * ((u32)(h >> 41) | 1)) % FW_HOSTSET_BLOCK;
+            block[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+
+    return s;
+}
+
+/* Function for releasing a set; callers must have waited out an RCU grace period first */
+void fw_hostset_free(struct fw_hostset *s) {
+    if(!s) { return; }
+
+    vfree(s->bloom);
+    vfree(s->slots);
+    kfree(s);
+}
+
+/* Function for reporting the bytes a set occupies */
+size_t fw_hostset_memory(const struct fw_hostset *s) {
+    return sizeof(*s) + sizeof(u32) * FW_HOSTSET_SLOTS * ((size_t)s->mask + 1) +
+           FW_HOSTSET_BLOCK / 8 * ((size_t)s->bloom_mask + 1);
+}
+
+// EOF
@@ -0,0 +1,80 @@
+/*************************************************************************************************
+ * Exact-match IPv4 address set -- for blocklists of millions of single hosts, which would give the
+ * LPM table a child table per address. Addresses sit in an open-addressing table of 64-byte buckets
+ * of 16 slots, kept at most half full, so a lookup nearly always reads one bucket. A blocked Bloom
+ * filter goes in front: every address sets 8 bits in one 64-byte block, so the common case of an
+ * address that is not in the set costs a single cache line read from a filter a quarter the size
+ * of the table. Like the LPM table the set is built once and never modified; readers only need the
+ * RCU-protected pointer to it and never write to it, so it is read from every CPU without sharing.
+ ************************************************************************************************/
+#ifndef _FW_HOSTSET_H
+#define _FW_HOSTSET_H
+
+#include <linux/types.h>
+
+/* ===============================================================================================
+ * defines
+ * ===============================================================================================*/
+#define FW_HOSTSET_SLOTS    16          // addresses per bucket, one cache line
+#define FW_HOSTSET_PROBES   8           // Bloom bits per address
+#define FW_HOSTSET_BLOCK    512         // bits per Bloom block, one cache line
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct fw_hostset {
+    u32 *slots;                     // buckets of FW_HOSTSET_SLOTS addresses, 0 for an empty slot
+    u32 mask;                       // buckets - 1
+    u64 *bloom;                     // Bloom blocks of FW_HOSTSET_BLOCK bits
+    u32 bloom_mask;                 // blocks - 1
+    u64 seed;                       // hash seed
+    bool zero;                      // 0.0.0.0 is in the set, it cannot go in a slot
+    unsigned int count;             // addresses in the set
+};
+
+/* ===============================================================================================
+ * functions
+ * ===============================================================================================*/
+struct fw_hostset *fw_hostset_build(const u32 *addrs, unsigned int count);
+void fw_hostset_free(struct fw_hostset *s);
+size_t fw_hostset_memory(const struct fw_hostset *s);
+bool fw_hostset_find(const struct fw_hostset *s, u32 addr, u64 h);
+
+/* Function for hashing an address: the low 32 bits pick the bucket and Bloom block, the high 32
+ * bits the bits within the block */
+static inline u64 fw_hostset_hash(const struct fw_hostset *s, u32 addr) {
+    u64 h = (addr ^ s->seed) * 0x9e3779b97f4a7c15ULL;
+
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 32);
+}
+
+/* Function for testing the Bloom filter; false means the address is certainly not in the set */
+static inline bool fw_hostset_may_contain(const struct fw_hostset *s, u64 h) {
+    const u64 *block = &s->bloom[((u32)h & s->bloom_mask) * (FW_HOSTSET_BLOCK / 64)];
+    u32 a = h >> 32, b = (h >> 41) | 1, bit;
+    int i;
+
+    for(i = 0; i < FW_HOSTSET_PROBES; i++) {
+        bit = (a + i * b) % FW_HOSTSET_BLOCK;
+        if(!(block[bit / 64] & (1ULL << (bit % 64)))) { return false; }
+    }
+
+    return true;
+}
+
+/* Function for looking an address up in the set
+ * @param s: set to search
+ * @param addr: address in host byte order
+ * */
+static inline bool fw_hostset_contains(const struct fw_hostset *s, u32 addr) {
+    u64 h;
+
+    if(!addr) { return s->zero; }
+
+    h = fw_hostset_hash(s, addr);
+    return fw_hostset_may_contain(s, h) && fw_hostset_find(s, addr, h);
+}
+
+#endif /* _FW_HOSTSET_H */
@@ -0,0 +1,554 @@
+/*************************************************************************************************
+ * Ruleset images -- loading a ruleset compiled offline.
+ *
+ * A commit of a million prefixes spends its time parsing, sorting, merging and building the LPM
+ * table and host set. An image has all of that done already: its lists are sorted and unique and
+ * its prefix structures are laid out the way the hook reads them, so loading one is a CRC and a
+ * pass that checks each section and copies it into place. The IPv6 prefix table, the classifier,
+ * the signature automaton, the domain trie and the ICMP tables are still built here, as a commit
+ * builds them. What bounds that work is the per-ruleset limits in fw-uapi.h, not the image: at
+ * most 65536 IPv6 prefixes, 131072 rules, 1024 signatures and 262144 domains, against four
+ * million IPv4 prefixes.
+ *
+ * Filter rules name their input interface. The names are looked up in the loading namespace, and
+ * an image with a rule on an interface that does not exist is refused, as fwctl's rule would be.
+ *
+ * Nothing in an image is taken on trust where the hook's safety depends on it. Every count, offset
+ * and child index is checked against the bounds the lookups rely on, every list must be in the
+ * order and form a commit leaves it in, and a CRC catches images damaged on the way. Whether the
+ * rules say what their author meant is up to the compiler, as it is up to fwctl for a commit. An
+ * image that fails any check is refused as a whole and the live ruleset stays.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/crc32.h>
+#include <linux/netdevice.h>
+#include <net/ipv6.h>
+
+#include "fw-image.h"
+#include "fw-ruleset.h"
+
+#define IMAGE_LPM_ROOT      (1 << 16)   // entries in the LPM root table, as in fw-lpm.c
+#define IMAGE_LPM_CHILD     (1 << 8)    // entries in an LPM child table
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct image {
+    const u8 *base;
+    size_t size;
+    const struct fw_image_section *sec[FW_IMAGE_MAX]; // NULL for a section the image does not have
+    unsigned int nnets;             // prefixes shorter than /32
+    unsigned int nhosts;            // /32 prefixes
+};
+
+/* bytes per record of each section, 0 where the size is worked out separately */
+static const size_t record_size[FW_IMAGE_MAX] = {
+    [FW_IMAGE_POLICY]       = 1,
+    [FW_IMAGE_PREFIXES]     = sizeof(struct fw_image_prefix),
+    [FW_IMAGE_RULES]        = sizeof(struct fw_image_rule),
+    [FW_IMAGE_SIGNATURES]   = sizeof(struct fw_image_signature),
+    [FW_IMAGE_IFACES]       = sizeof(struct fw_image_iface),
+    [FW_IMAGE_DOMAINS]      = sizeof(struct fw_image_domain),
+    [FW_IMAGE_DOMAIN_NAMES] = 1,
+    [FW_IMAGE_ICMP]         = sizeof(struct fw_image_icmp),
+    [FW_IMAGE_PREFIXES6]    = sizeof(struct fw_image_prefix6),
+    [FW_IMAGE_ICMP6]        = sizeof(struct fw_image_icmp),
+};
+
+/* most records of each section a ruleset may have */
+static const u32 max_count[FW_IMAGE_MAX] = {
+    [FW_IMAGE_POLICY]       = FW_POLICY_MAX,
+    [FW_IMAGE_PREFIXES]     = FW_MAX_PREFIXES,
+    [FW_IMAGE_LPM]          = LPM_INDEX + 1,
+    [FW_IMAGE_HOSTSET]      = FW_MAX_PREFIXES,
+    [FW_IMAGE_RULES]        = FW_MAX_RULES,
+    [FW_IMAGE_SIGNATURES]   = FW_MAX_SIGNATURES,
+    [FW_IMAGE_IFACES]       = FW_MAX_IFACES,
+    [FW_IMAGE_DOMAINS]      = FW_MAX_DOMAINS,
+    [FW_IMAGE_DOMAIN_NAMES] = FW_MAX_DOMAINS * FW_DOMAIN_MAXLEN,
+    [FW_IMAGE_ICMP]         = FW_MAX_ICMP,
+    [FW_IMAGE_PREFIXES6]    = FW_MAX_PREFIXES6,
+    [FW_IMAGE_ICMP6]        = FW_MAX_ICMP,
+};
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+static inline const void *section_data(const struct image *img, int type) {
+    return img->sec[type] ? img->base + img->sec[type]->offset : NULL;
+}
+
+static inline u32 section_count(const struct image *img, int type) {
+    return img->sec[type] ? img->sec[type]->count : 0;
+}
+
+static inline u32 prefix_mask(u8 len) {
+    return len ? ~0U << (32 - len) : 0;
+}
+
+/* Function for reading a filter rule of an image */
+static void image_rule(const struct fw_image_rule *r, struct fw_rule *rule) {
+    memset(rule, 0, sizeof(*rule));
+    rule->src = r->src;
+    rule->dst = r->dst;
+    rule->src_len = r->src_len;
+    rule->dst_len = r->dst_len;
+    rule->proto = r->proto;
+    rule->action = r->action;
+    rule->sport_min = r->sport_min;
+    rule->sport_max = r->sport_max;
+    rule->dport_min = r->dport_min;
+    rule->dport_max = r->dport_max;
+    rule->family = r->family;
+    memcpy(&rule->src6, r->src6, sizeof(rule->src6));
+    memcpy(&rule->dst6, r->dst6, sizeof(rule->dst6));
+}
+
+/* Function for presenting the prebuilt LPM table of an image as a table, without copying it */
+static void image_lpm_view(const struct image *img, struct lpm_table *t) {
+    t->root = (u32 *)section_data(img, FW_IMAGE_LPM);
+    t->tbl = t->root + IMAGE_LPM_ROOT;
+    t->ntbl = t->maxtbl = section_count(img, FW_IMAGE_LPM);
+    t->nprefixes = img->nnets;
+}
+
+/* Function for presenting the prebuilt host set of an image as a set, without copying it */
+static void image_hostset_view(const struct image *img, struct fw_hostset *s) {
+    const struct fw_image_hostset *h = section_data(img, FW_IMAGE_HOSTSET);
+
+    s->slots = (u32 *)(h + 1);
+    s->mask = h->buckets - 1;
+    s->bloom = (u64 *)(s->slots + (size_t)FW_HOSTSET_SLOTS * h->buckets);
+    s->bloom_mask = h->blocks - 1;
+    s->seed = h->seed;
+    s->zero = h->zero;
+    s->count = section_count(img, FW_IMAGE_HOSTSET);
+}
+
+/* ===============================================================================================
+ * checks
+ * ===============================================================================================*/
+
+/* Function for checking the header and section table and finding the sections
+ * returns 0 or -EINVAL
+ * */
+static int image_sections(struct image *img) {
+    const struct fw_image_header *hdr = (const void *)img->base;
+    const struct fw_image_section *sec;
+    const struct fw_image_hostset *h;
+    size_t table;
+    u64 expect;
+    unsigned int i;
+
+    if(img->size < sizeof(*hdr) || hdr->magic != FW_IMAGE_MAGIC || hdr->version != FW_IMAGE_VERSION ||
+       hdr->size != img->size) {
+        return -EINVAL;
+    }
+
+    table = sizeof(*hdr) + sizeof(*sec) * hdr->nsections;
+    if(table > img->size) { return -EINVAL; }
+
+    if((crc32_le(~0U, img->base + sizeof(*hdr), img->size - sizeof(*hdr)) ^ ~0U) != hdr->crc) { return -EINVAL; }
+
+    for(i = 0; i < hdr->nsections; i++) {
+        sec = (const struct fw_image_section *)(img->base + sizeof(*hdr)) + i;
+
+        if(sec->type >= FW_IMAGE_MAX || img->sec[sec->type] || sec->count > max_count[sec->type]) { return -EINVAL; }
+        if(sec->offset % FW_IMAGE_ALIGN || sec->offset < table || (u64)sec->offset + sec->size > img->size) {
+            return -EINVAL;
+        }
+        img->sec[sec->type] = sec;
+
+        switch(sec->type) {
+            case FW_IMAGE_LPM:
+                expect = sizeof(u32) * (IMAGE_LPM_ROOT + (u64)IMAGE_LPM_CHILD * sec->count);
+                break;
+            case FW_IMAGE_HOSTSET:
+                if(sec->size < sizeof(*h)) { return -EINVAL; }
+                h = section_data(img, FW_IMAGE_HOSTSET);
+                if(!is_power_of_2(h->buckets) || !is_power_of_2(h->blocks) || h->zero > 1) { return -EINVAL; }
+                expect = sizeof(*h) + sizeof(u32) * FW_HOSTSET_SLOTS * (u64)h->buckets +
+                         FW_HOSTSET_BLOCK / 8 * (u64)h->blocks;
+                break;
+            default:
+                expect = record_size[sec->type] * (u64)sec->count;
+                break;
+        }
+        if(sec->size != expect) { return -EINVAL; }
+    }
+
+    /* the prefix structures are prebuilt together or not at all */
+    if(!img->sec[FW_IMAGE_POLICY] || section_count(img, FW_IMAGE_POLICY) != FW_POLICY_MAX ||
+       !img->sec[FW_IMAGE_LPM] != !img->sec[FW_IMAGE_HOSTSET]) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Function for checking that the prebuilt host set holds as many addresses as there are /32
+ * prefixes and has an empty slot somewhere, which ends every search for an address it does not
+ * hold. The LPM table is checked as it is copied. */
+static int image_check_hostset(const struct image *img) {
+    const struct fw_image_hostset *h = section_data(img, FW_IMAGE_HOSTSET);
+    const u32 *slots;
+    size_t i, n, filled = 0;
+
+    if(!h) { return 0; }
+
+    slots = (const u32 *)(h + 1);
+    n = (size_t)FW_HOSTSET_SLOTS * h->buckets;
+    for(i = 0; i < n; i++) {
+        filled += !!slots[i];
+    }
+    if(filled == n || filled + h->zero != img->nhosts || img->nhosts != section_count(img, FW_IMAGE_HOSTSET)) {
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/* Function for checking the blocked prefixes: sorted, unique, host bits clear */
+static int image_check_prefixes(struct image *img) {
+    const struct fw_image_prefix *p = section_data(img, FW_IMAGE_PREFIXES);
+    u32 i, n = section_count(img, FW_IMAGE_PREFIXES);
+
+    for(i = 0; i < n; i++) {
+        if(p[i].len > 32 || p[i].addr & ~prefix_mask(p[i].len)) { return -EINVAL; }
+        if(i && (p[i].addr < p[i - 1].addr || (p[i].addr == p[i - 1].addr && p[i].len <= p[i - 1].len))) {
+            return -EINVAL;
+        }
+
+        if(p[i].len == 32) {
+            img->nhosts++;
+        } else {
+            img->nnets++;
+        }
+    }
+
+    return 0;
+}
+
+/* Function for checking the blocked IPv6 prefixes: sorted, unique, host bits clear */
+static int image_check_prefixes6(const struct image *img) {
+    const struct fw_image_prefix6 *p = section_data(img, FW_IMAGE_PREFIXES6);
+    u32 i, n = section_count(img, FW_IMAGE_PREFIXES6);
+    struct in6_addr masked;
+    int c;
+
+    for(i = 0; i < n; i++) {
+        if(p[i].len > 128) { return -EINVAL; }
+
+        memcpy(&masked, p[i].addr, sizeof(masked));
+        lpm6_mask(&masked, p[i].len);
+        if(memcmp(&masked, p[i].addr, sizeof(masked))) { return -EINVAL; }
+
+        if(i) {
+            c = memcmp(p[i - 1].addr, p[i].addr, sizeof(p[i].addr));
+            if(c > 0 || (!c && p[i].len <= p[i - 1].len)) { return -EINVAL; }
+        }
+    }
+
+    return 0;
+}
+
+/* Function for checking the policies, filter rules, signatures and interfaces */
+static int image_check_lists(const struct image *img) {
+    const u8 *policy = section_data(img, FW_IMAGE_POLICY);
+    const struct fw_image_rule *r = section_data(img, FW_IMAGE_RULES);
+    const struct fw_image_signature *sig = section_data(img, FW_IMAGE_SIGNATURES);
+    const struct fw_image_iface *iface = section_data(img, FW_IMAGE_IFACES);
+    struct in6_addr src6, dst6;
+    struct fw_rule rule;
+    u32 i, j;
+
+    for(i = 0; i < FW_POLICY_MAX; i++) {
+        if(policy[i] >= FW_ACTION_MAX || policy[i] == FW_ACTION_FLAG) { return -EINVAL; }
+    }
+
+    for(i = 0; i < section_count(img, FW_IMAGE_RULES); i++) {
+        image_rule(&r[i], &rule);
+
+        /* in the form a commit leaves it in, family spelled out */
+        if(fw_rule_validate(&rule) || rule.family != fw_rule_family(&rule)) { return -EINVAL; }
+        if(rule.family == NFPROTO_IPV6) {
+            src6 = rule.src6;
+            dst6 = rule.dst6;
+            lpm6_mask(&src6, rule.src_len);
+            lpm6_mask(&dst6, rule.dst_len);
+            if(!ipv6_addr_equal(&src6, &rule.src6) || !ipv6_addr_equal(&dst6, &rule.dst6)) { return -EINVAL; }
+        } else if(rule.src & ~prefix_mask(rule.src_len) || rule.dst & ~prefix_mask(rule.dst_len)) {
+            return -EINVAL;
+        }
+        if(strnlen(r[i].iif, IFNAMSIZ) == IFNAMSIZ) { return -EINVAL; }
+    }
+
+    for(i = 0; i < section_count(img, FW_IMAGE_SIGNATURES); i++) {
+        if(!sig[i].len || sig[i].len > FW_SIG_MAXLEN || sig[i].action > FW_ACTION_FLAG) { return -EINVAL; }
+    }
+
+    for(i = 0; i < section_count(img, FW_IMAGE_IFACES); i++) {
+        if(!iface[i].name[0] || strnlen(iface[i].name, IFNAMSIZ) == IFNAMSIZ) { return -EINVAL; }
+        if(iface[i].mode == FW_IFACE_FILTER || iface[i].mode >= FW_IFACE_MAX) { return -EINVAL; }
+
+        for(j = 0; j < i; j++) {
+            if(!strcmp(iface[j].name, iface[i].name)) { return -EINVAL; }
+        }
+    }
+
+    return 0;
+}
+
+/* Function for checking the DNS domains of an image: canonical, sorted by name, unique */
+static int image_check_dns(const struct image *img) {
+    const struct fw_image_domain *dom = section_data(img, FW_IMAGE_DOMAINS);
+    const char *names = section_data(img, FW_IMAGE_DOMAIN_NAMES), *prev = NULL;
+    u32 nnames = section_count(img, FW_IMAGE_DOMAIN_NAMES);
+    char name[FW_DOMAIN_MAXLEN + 1], canon[FW_DOMAIN_MAXLEN + 1];
+    u32 i;
+    int c;
+
+    for(i = 0; i < section_count(img, FW_IMAGE_DOMAINS); i++) {
+        if(!dom[i].len || dom[i].name > nnames || dom[i].len > nnames - dom[i].name) { return -EINVAL; }
+        if(dom[i].action > FW_ACTION_FLAG) { return -EINVAL; }
+
+        memcpy(name, names + dom[i].name, dom[i].len);
+        name[dom[i].len] = '\0';
+        if(fw_dns_canonical(name, canon) != dom[i].len || memcmp(name, canon, dom[i].len)) { return -EINVAL; }
+
+        if(prev) {
+            c = memcmp(prev, name, min(dom[i - 1].len, dom[i].len));
+            if(c > 0 || (!c && dom[i - 1].len >= dom[i].len)) { return -EINVAL; }
+        }
+        prev = names + dom[i].name;
+    }
+
+    return 0;
+}
+
+/* Function for checking the ICMP or ICMPv6 entries of an image: valid, sorted by (type, code), unique */
+static int image_check_icmp(const struct image *img, int type) {
+    const struct fw_image_icmp *icmp = section_data(img, type);
+    u32 i, key, prevkey = 0;
+
+    for(i = 0; i < section_count(img, type); i++) {
+        if(icmp[i].code > FW_ICMP_ANY_CODE || (icmp[i].rate && icmp[i].code != FW_ICMP_ANY_CODE)) { return -EINVAL; }
+        if(icmp[i].action >= FW_ACTION_MAX || icmp[i].action == FW_ACTION_FLAG) { return -EINVAL; }
+
+        key = (u32)icmp[i].type << 9 | icmp[i].code;
+        if(i && key <= prevkey) { return -EINVAL; }
+        prevkey = key;
+    }
+
+    return 0;
+}
+
+/* ===============================================================================================
+ * ruleset
+ * ===============================================================================================*/
+
+/* Function for copying LPM entries and checking them on the way, so the table is read only once.
+ * Any entry may end up being read at any level, so no child index may point past the pool.
+ * returns 0 or -EINVAL
+ * */
+static int lpm_copy_checked(u32 *dst, const u32 *src, size_t n, u32 ntbl) {
+    size_t i;
+    u32 e;
+
+    for(i = 0; i < n; i++) {
+        e = src[i];
+        if((e & LPM_CHILD) && ((e & ~(LPM_CHILD | LPM_INDEX)) || (e & LPM_INDEX) >= ntbl)) { return -EINVAL; }
+        dst[i] = e;
+    }
+
+    return 0;
+}
+
+/* Function for copying the prebuilt LPM table and host set of a checked image into place */
+static int image_copy_structures(const struct image *img, struct fw_ruleset *rs) {
+    struct lpm_table lpm;
+    struct fw_hostset hosts;
+    size_t nslots, nbloom;
+
+    image_lpm_view(img, &lpm);
+    image_hostset_view(img, &hosts);
+    nslots = (size_t)FW_HOSTSET_SLOTS * (hosts.mask + 1);
+    nbloom = (size_t)FW_HOSTSET_BLOCK / 64 * (hosts.bloom_mask + 1);
+
+    rs->blocklist = kzalloc(sizeof(*rs->blocklist), GFP_KERNEL);
+    rs->hosts = kzalloc(sizeof(*rs->hosts), GFP_KERNEL);
+    if(!rs->blocklist || !rs->hosts) { return -ENOMEM; }
+
+    *rs->blocklist = lpm;
+    rs->blocklist->root = vmalloc(sizeof(u32) * IMAGE_LPM_ROOT);
+    rs->blocklist->tbl = lpm.ntbl ? vmalloc(sizeof(u32) * IMAGE_LPM_CHILD * lpm.ntbl) : NULL;
+    *rs->hosts = hosts;
+    rs->hosts->slots = vmalloc(sizeof(u32) * nslots);
+    rs->hosts->bloom = vmalloc(sizeof(u64) * nbloom);
+    if(!rs->blocklist->root || (lpm.ntbl && !rs->blocklist->tbl) || !rs->hosts->slots || !rs->hosts->bloom) {
+        return -ENOMEM;
+    }
+
+    if(lpm_copy_checked(rs->blocklist->root, lpm.root, IMAGE_LPM_ROOT, lpm.ntbl) ||
+       lpm_copy_checked(rs->blocklist->tbl, lpm.tbl, (size_t)IMAGE_LPM_CHILD * lpm.ntbl, lpm.ntbl)) {
+        return -EINVAL;
+    }
+    memcpy(rs->hosts->slots, hosts.slots, sizeof(u32) * nslots);
+    memcpy(rs->hosts->bloom, hosts.bloom, sizeof(u64) * nbloom);
+
+    return 0;
+}
+
+/* Function for copying the lists of a checked image into a ruleset */
+static int image_copy_lists(const struct image *img, struct fw_ruleset *rs) {
+    const struct fw_image_prefix *p = section_data(img, FW_IMAGE_PREFIXES);
+    const struct fw_image_rule *r = section_data(img, FW_IMAGE_RULES);
+    const struct fw_image_signature *sig = section_data(img, FW_IMAGE_SIGNATURES);
+    const struct fw_image_iface *iface = section_data(img, FW_IMAGE_IFACES);
+    const struct fw_image_domain *dom = section_data(img, FW_IMAGE_DOMAINS);
+    const struct fw_image_icmp *icmp = section_data(img, FW_IMAGE_ICMP);
+    const struct fw_image_prefix6 *p6 = section_data(img, FW_IMAGE_PREFIXES6);
+    const struct fw_image_icmp *icmp6 = section_data(img, FW_IMAGE_ICMP6);
+    u32 i;
+
+    rs->nprefixes = section_count(img, FW_IMAGE_PREFIXES);
+    rs->nprefixes6 = section_count(img, FW_IMAGE_PREFIXES6);
+    rs->nrules = section_count(img, FW_IMAGE_RULES);
+    rs->nsigs = section_count(img, FW_IMAGE_SIGNATURES);
+    rs->nifaces = section_count(img, FW_IMAGE_IFACES);
+    rs->ndomains = section_count(img, FW_IMAGE_DOMAINS);
+    rs->domain_names_len = section_count(img, FW_IMAGE_DOMAIN_NAMES);
+    rs->nicmp = section_count(img, FW_IMAGE_ICMP);
+    rs->nicmp6 = section_count(img, FW_IMAGE_ICMP6);
+
+    if((rs->nprefixes && !(rs->prefixes = vmalloc(sizeof(*rs->prefixes) * rs->nprefixes))) ||
+       (rs->nprefixes6 && !(rs->prefixes6 = vmalloc(sizeof(*rs->prefixes6) * rs->nprefixes6))) ||
+       (rs->nrules && !(rs->rules = vzalloc(sizeof(*rs->rules) * rs->nrules))) ||
+       (rs->nsigs && !(rs->sigs = vzalloc(sizeof(*rs->sigs) * rs->nsigs))) ||
+       (rs->nifaces && !(rs->ifaces = vzalloc(sizeof(*rs->ifaces) * rs->nifaces))) ||
+       (rs->ndomains && !(rs->domains = vmalloc(sizeof(*rs->domains) * rs->ndomains))) ||
+       (rs->domain_names_len && !(rs->domain_names = vmalloc(rs->domain_names_len))) ||
+       (rs->nicmp && !(rs->icmp = vmalloc(sizeof(*rs->icmp) * rs->nicmp))) ||
+       (rs->nicmp6 && !(rs->icmp6 = vmalloc(sizeof(*rs->icmp6) * rs->nicmp6)))) {
+        return -ENOMEM;
+    }
+
+    memcpy(rs->policy, section_data(img, FW_IMAGE_POLICY), FW_POLICY_MAX);
+
+    for(i = 0; i < rs->nprefixes; i++) {
+        rs->prefixes[i].addr = p[i].addr;
+        rs->prefixes[i].len = p[i].len;
+        rs->prefixes[i].value = 1;
+    }
+    for(i = 0; i < rs->nprefixes6; i++) {
+        memcpy(&rs->prefixes6[i].addr, p6[i].addr, sizeof(p6[i].addr));
+        rs->prefixes6[i].len = p6[i].len;
+        rs->prefixes6[i].value = 1;
+    }
+    for(i = 0; i < rs->nrules; i++) { image_rule(&r[i], &rs->rules[i]); }
+    for(i = 0; i < rs->nsigs; i++) {
+        rs->sigs[i].action = sig[i].action;
+        rs->sigs[i].len = sig[i].len;
+        memcpy(rs->sigs[i].pattern, sig[i].pattern, sig[i].len);
+    }
+    for(i = 0; i < rs->nifaces; i++) {
+        memcpy(rs->ifaces[i].name, iface[i].name, IFNAMSIZ);
+        rs->ifaces[i].mode = iface[i].mode;
+    }
+    for(i = 0; i < rs->ndomains; i++) {
+        rs->domains[i].name = dom[i].name;
+        rs->domains[i].len = dom[i].len;
+        rs->domains[i].action = dom[i].action;
+    }
+    if(rs->domain_names_len) { memcpy(rs->domain_names, section_data(img, FW_IMAGE_DOMAIN_NAMES), rs->domain_names_len); }
+    for(i = 0; i < rs->nicmp; i++) {
+        rs->icmp[i].type = icmp[i].type;
+        rs->icmp[i].code = icmp[i].code;
+        rs->icmp[i].action = icmp[i].action;
+        rs->icmp[i].rate = icmp[i].rate;
+    }
+    for(i = 0; i < rs->nicmp6; i++) {
+        rs->icmp6[i].type = icmp6[i].type;
+        rs->icmp6[i].code = icmp6[i].code;
+        rs->icmp6[i].action = icmp6[i].action;
+        rs->icmp6[i].rate = icmp6[i].rate;
+    }
+
+    return 0;
+}
+
+/* Function for looking up the input interfaces of the filter rules in the loading namespace
+ * returns 0, or -ENODEV if one does not exist
+ * */
+static int image_resolve_ifaces(const struct fw_net *fn, const struct image *img, struct fw_ruleset *rs) {
+    const struct fw_image_rule *r = section_data(img, FW_IMAGE_RULES);
+    struct net_device *dev;
+    u32 i;
+    int err = 0;
+
+    rcu_read_lock();
+    for(i = 0; i < rs->nrules && !err; i++) {
+        if(!r[i].iif[0]) { continue; }
+
+        dev = dev_get_by_name_rcu(fn->net, r[i].iif);
+        if(dev) {
+            rs->rules[i].ifindex = dev->ifindex;
+            err = fw_rule_validate(&rs->rules[i]);
+        } else {
+            err = -ENODEV;
+        }
+    }
+    rcu_read_unlock();
+
+    return err;
+}
+
+/* ===============================================================================================
+ * load
+ * ===============================================================================================*/
+
+/* Function for replacing the live ruleset of a namespace with the one in an image
+ * @param fn: namespace
+ * @param image: image as written by tools/fw-compile, 8-byte aligned
+ * @param size: bytes in image
+ * returns 0, -EINVAL for an image that fails a check, -ENODEV for a rule on a missing interface,
+ * -EAGAIN if a commit landed meanwhile, or another error
+ * */
+int fw_image_load(struct fw_net *fn, const void *image, size_t size) {
+    struct image img = { .base = image, .size = size };
+    struct fw_ruleset *rs;
+    int err;
+
+    if(size > FW_IMAGE_MAXSIZE) { return -EFBIG; }
+
+    err = image_sections(&img);
+    if(!err) { err = image_check_prefixes(&img); }
+    if(!err) { err = image_check_prefixes6(&img); }
+    if(!err) { err = image_check_hostset(&img); }
+    if(!err) { err = image_check_lists(&img); }
+    if(!err) { err = image_check_dns(&img); }
+    if(!err) { err = image_check_icmp(&img, FW_IMAGE_ICMP); }
+    if(!err) { err = image_check_icmp(&img, FW_IMAGE_ICMP6); }
+    if(err) { return err; }
+
+    rs = kzalloc(sizeof(*rs), GFP_KERNEL);
+    if(!rs) { return -ENOMEM; }
+
+    err = image_copy_lists(&img, rs);
+    if(!err) { err = image_resolve_ifaces(fn, &img, rs); }
+    if(!err && img.sec[FW_IMAGE_LPM]) { err = image_copy_structures(&img, rs); }
+    if(err) {
+        fw_ruleset_free(rs);
+        return err;
+    }
+
+    return fw_ruleset_replace(fn, rs);
+}
+
+// EOF
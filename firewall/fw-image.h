@@ -0,0 +1,15 @@
+/*************************************************************************************************
+ * Ruleset images -- whole rulesets compiled offline by tools/fw-compile (format in fw-uapi.h),
+ * checked in one pass and swapped in as a new generation, like a commit of the same rules.
+ ************************************************************************************************/
+#ifndef _FW_IMAGE_H
+#define _FW_IMAGE_H
+
+#include <linux/types.h>
+
+#include "fw-net.h"
+
+/* The image stays the caller's; everything the ruleset needs is copied out of it. */
+int fw_image_load(struct fw_net *fn, const void *image, size_t size);
+
+#endif /* _FW_IMAGE_H */
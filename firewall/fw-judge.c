@@ -0,0 +1,504 @@
+/*************************************************************************************************
+ * Packet judgement -- everything the hooks decide a verdict with, kept apart from the netfilter
+ * glue in fw-main.c: header parsing, interface modes, dynamic blocks, the blocklist, filter rules
+ * and per-class policy behind the flow and fragment caches, the ICMP and ICMPv6 type/code tables,
+ * DNS query names and the payload signatures. Only skb accessors are used on the packet, so the
+ * same code also builds against the userspace shims in bench/compat for the replay benchmark.
+ *
+ * IPv6 packets take the same path once their extension headers are walked: the blocklist, the
+ * filter rules, the caches, the stream state and the dynamic blocks each have IPv6 tables of their
+ * own, keyed on the full addresses (the dynamic blocks on the /64).
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/icmpv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/rcupdate.h>
+#include <net/ip.h>
+#include <net/ndisc.h>
+
+#include "fw-judge.h"
+#include "fw-lpm.h"
+#include "fw-ruleset.h"
+#include "fw-flow.h"
+#include "fw-frag.h"
+#include "fw-stream.h"
+#include "fw-stats.h"
+#include "fw-ratelimit.h"
+#include "fw-dynblock.h"
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+
+/* Function for running the TCP payload of a packet through the signature matcher. The payload is
+ * walked fragment by fragment with skb_seq_read, so paged and fragmented skbs are scanned in full
+ * without being linearized.
+ * @param skb: packet being handled
+ * @param pkt: parsed packet with a payload
+ * @param ac: signature automaton of the live ruleset
+ * @param state: automaton state to start in, set to the state the scan ended in
+ * returns the index of the first signature found, FW_AC_NOMATCH if none
+ * */
+static u32 scan_payload(struct sk_buff *skb, const struct fw_pkt *pkt, const struct fw_ac *ac, u32 *state) {
+    struct skb_seq_state seq;
+    unsigned int from = skb_network_offset(skb) + pkt->payload_off, consumed = 0, len;
+    const u8 *data;
+    u32 sig;
+
+    skb_prepare_seq_read(skb, from, from + pkt->payload_len, &seq);
+    while((len = skb_seq_read(consumed, &data, &seq)) != 0) {
+        sig = fw_ac_scan(ac, state, data, len);
+        if(sig != FW_AC_NOMATCH) {
+            /* stopping early leaves a fragment mapped */
+            skb_abort_seq_read(&seq);
+            return sig;
+        }
+        consumed += len;
+    }
+
+    return FW_AC_NOMATCH;
+}
+
+/* Function for telling whether an IPv6 next header value is an extension header the parser walks */
+static inline bool ipv6_exthdr(u8 nexthdr) {
+    return nexthdr == IPPROTO_HOPOPTS || nexthdr == IPPROTO_ROUTING || nexthdr == IPPROTO_DSTOPTS ||
+           nexthdr == IPPROTO_AH || nexthdr == IPPROTO_FRAGMENT;
+}
+
+/* Function for telling whether a verdict stands against payload matches: a blocked host or a
+ * source over its rate is dropped whatever its payload says */
+static inline bool verdict_final(u8 reason) {
+    return reason == FW_REASON_BLOCKLIST || reason == FW_REASON_DYNBLOCK || reason == FW_REASON_RATELIMIT;
+}
+
+/* Function for checking the dynamic blocks of a namespace for a packet's source, or its
+ * destination if it is locally generated */
+static inline bool dynblocked(const struct fw_net *fn, const struct fw_pkt *pkt, bool egress) {
+    if(pkt->family == NFPROTO_IPV6) { return fw_dynblock_lookup6(fn, egress ? &pkt->daddr6 : &pkt->saddr6); }
+    return fw_dynblock_lookup(fn, egress ? pkt->daddr : pkt->saddr);
+}
+
+/* Function for deciding what to do with a packet
+ * @param pkt: parsed packet
+ * @param rs: live ruleset
+ * @param egress: the packet is locally generated
+ * @param reason: set to the enum fw_reason behind the verdict
+ * @param rule: set to the filter rule behind the verdict, FW_RULE_NONE if none
+ * returns NF_DROP, NF_ACCEPT or FW_ACTION_RATELIMIT
+ * */
+static unsigned int classify(const struct fw_pkt *pkt, const struct fw_ruleset *rs, bool egress, u8 *reason, u32 *rule) {
+    *rule = FW_RULE_NONE;
+
+    if(pkt->family == NFPROTO_IPV6) {
+        /* the walk gave up before the transport header, so no rule or policy can tell what this
+         * is; a later fragment stops at its fragment header and is judged on what that names */
+        if(ipv6_exthdr(pkt->proto) && pkt->frag != FW_FRAG_LATER) {
+            *reason = FW_REASON_EXTHDRS;
+            return NF_DROP;
+        }
+
+        if(fw_ruleset_blocked6(rs, egress ? &pkt->daddr6 : &pkt->saddr6)) {
+            *reason = FW_REASON_BLOCKLIST;
+            return NF_DROP;
+        }
+
+    /* drop any packets recieved from a blocked prefix (208.80.154.0/24, wikipedia, by default), or
+     * sent to one */
+    } else if(fw_ruleset_blocked(rs, ntohl(egress ? pkt->daddr : pkt->saddr))) {
+        *reason = FW_REASON_BLOCKLIST;
+        return NF_DROP;
+    }
+
+    /* first matching filter rule of the packet's family, in time independent of the number of
+     * rules; both classifiers give indexes into the one rule list */
+    *rule = pkt->family == NFPROTO_IPV6 ? fw_classify6(rs->classifier6, pkt) : fw_classify(rs->classifier, pkt);
+    if(*rule != FW_RULE_NONE) {
+        *reason = FW_REASON_RULE;
+        return rs->rules[*rule].action;
+    }
+
+    /* no rule matched, fall back to the per-class policy */
+    switch(pkt->proto) {
+        case IPPROTO_TCP: // TCP Packet Handling
+            *reason = FW_REASON_TCP;
+
+            return rs->policy[FW_POLICY_TCP];
+    
+        case IPPROTO_UDP: // UDP packet handling
+            if(pkt->sport == 53 || pkt->dport == 53) {
+                *reason = FW_REASON_DNS;
+                return rs->policy[FW_POLICY_DNS];
+            }
+            *reason = FW_REASON_UDP;
+
+            return rs->policy[FW_POLICY_UDP];
+        
+        case IPPROTO_ICMP: // ICMP packet handling
+            *reason = FW_REASON_ICMP;
+            
+            return rs->policy[FW_POLICY_ICMP];
+
+        case IPPROTO_ICMPV6: // ICMPv6 packet handling
+            *reason = FW_REASON_ICMP;
+
+            /* without neighbor discovery and path MTU discovery IPv6 stops working altogether, so
+             * the ICMP policy never drops them; a filter rule still can */
+            if(pkt->icmp_type == ICMPV6_PKT_TOOBIG ||
+               (pkt->icmp_type >= NDISC_ROUTER_SOLICITATION && pkt->icmp_type <= NDISC_REDIRECT)) {
+                return NF_ACCEPT;
+            }
+
+            return rs->policy[FW_POLICY_ICMP];
+    }
+
+    *reason = FW_REASON_OTHER;
+    return rs->policy[FW_POLICY_OTHER];
+}
+
+/* ===============================================================================================
+ * judgement functions
+ * ===============================================================================================*/
+
+/* Function for parsing the transport header of a packet, the part IPv4 and IPv6 have in common.
+ * Headers are read through skb_header_pointer so paged skbs and truncated packets are handled safely.
+ * @param skb: packet to parse
+ * @param pkt: context with the IP header fields filled in, the transport header at pkt->iphlen
+ * returns false if the transport header is cut short
+ * */
+static bool parse_transport(const struct sk_buff *skb, struct fw_pkt *pkt) {
+    struct tcphdr _th, *th;
+    __be16 _ports[2], *ports;
+    u8 _icmp[2], *icmp;
+    unsigned int hlen, avail;
+
+    if(pkt->proto == IPPROTO_TCP) {
+        th = skb_header_pointer(skb, skb_network_offset(skb) + pkt->iphlen, sizeof(_th), &_th);
+        if(!th || th->doff < 5) { return false; }
+
+        pkt->sport = ntohs(th->source);
+        pkt->dport = ntohs(th->dest);
+        pkt->tcp_end = th->fin || th->rst;
+        /* a SYN occupies the first sequence number, its payload starts after it */
+        pkt->seq = ntohl(th->seq) + th->syn;
+
+        /* the payload ends at the IP total length or the end of the skb, whichever comes first */
+        hlen = pkt->iphlen + th->doff * 4;
+        avail = min_t(unsigned int, pkt->len, skb->len - skb_network_offset(skb));
+        if(avail > hlen) {
+            pkt->payload_off = hlen;
+            pkt->payload_len = avail - hlen;
+        }
+
+    /* UDP starts with the source and destination ports as well */
+    } else if(pkt->proto == IPPROTO_UDP) {
+        ports = skb_header_pointer(skb, skb_network_offset(skb) + pkt->iphlen, sizeof(_ports), _ports);
+        if(!ports) { return false; }
+
+        pkt->sport = ntohs(ports[0]);
+        pkt->dport = ntohs(ports[1]);
+
+    /* the ICMP and ICMPv6 type and code are their first two bytes */
+    } else if(pkt->proto == IPPROTO_ICMP || pkt->proto == IPPROTO_ICMPV6) {
+        icmp = skb_header_pointer(skb, skb_network_offset(skb) + pkt->iphlen, sizeof(_icmp), _icmp);
+        if(!icmp) { return false; }
+
+        pkt->icmp_type = icmp[0];
+        pkt->icmp_code = icmp[1];
+    }
+
+    return true;
+}
+
+/* Function for clearing the fields of a per-packet context that the IP header does not set */
+static inline void pkt_reset(struct fw_pkt *pkt) {
+    pkt->sport = 0;
+    pkt->dport = 0;
+    pkt->ifindex = 0;
+    pkt->payload_off = 0;
+    pkt->payload_len = 0;
+    pkt->tcp_end = 0;
+    pkt->icmp_type = 0;
+    pkt->icmp_code = 0;
+    pkt->seq = 0;
+    pkt->truncated = 0;
+}
+
+/* Function for describing a packet whose IP header cannot be read by its family and length alone,
+ * which is all the counters and the event log need of it
+ * returns false, for the parsers to return
+ * */
+static bool pkt_unparsed(const struct sk_buff *skb, struct fw_pkt *pkt, u8 family) {
+    memset(pkt, 0, sizeof(*pkt));
+    pkt->family = family;
+    pkt->len = min_t(unsigned int, skb->len, U16_MAX);
+    return false;
+}
+
+/* Function for parsing the headers the hook looks at into a per-packet context. A packet cut short
+ * inside its transport header is parsed with truncated set and fw_judge drops it: rules cannot
+ * match ports it does not have, and a first fragment without them (RFC 1858) would otherwise take
+ * the rest of its datagram past every port rule.
+ * @param skb: packet to parse
+ * @param pkt: context to fill in
+ * returns false if the IP header is cut short or malformed, pkt then only has the family and length
+ * */
+bool fw_parse_packet(const struct sk_buff *skb, struct fw_pkt *pkt) {
+    struct iphdr _iph, *iph;
+
+    iph = skb_header_pointer(skb, skb_network_offset(skb), sizeof(_iph), &_iph);
+    if(!iph || iph->ihl < 5) { return pkt_unparsed(skb, pkt, NFPROTO_IPV4); }
+
+    pkt_reset(pkt);
+    pkt->family = NFPROTO_IPV4;
+    pkt->saddr = iph->saddr;
+    pkt->daddr = iph->daddr;
+    pkt->proto = iph->protocol;
+    pkt->iphlen = iph->ihl * 4;
+    pkt->len = ntohs(iph->tot_len);
+    pkt->ip_id = ntohs(iph->id);
+    pkt->frag = iph->frag_off & htons(IP_OFFSET) ? FW_FRAG_LATER :
+                iph->frag_off & htons(IP_MF) ? FW_FRAG_FIRST : FW_FRAG_NONE;
+
+    /* a later fragment has payload where the transport header would be, none of it is a port */
+    if(pkt->frag == FW_FRAG_LATER) { return true; }
+
+    pkt->truncated = !parse_transport(skb, pkt);
+    return true;
+}
+
+/* Function for parsing an IPv6 packet into a per-packet context. The extension headers are walked
+ * up to the transport header, at most FW_IPV6_MAX_EXTHDRS of them; a packet with more is left with
+ * the extension header the walk stopped at as its protocol, which classify() drops. ESP and any
+ * header not known to be an extension header end the walk as well. A packet that ends before its
+ * transport header is complete is parsed with truncated set, as in fw_parse_packet.
+ * @param skb: packet to parse
+ * @param pkt: context to fill in
+ * returns false if the IPv6 header is cut short or malformed, pkt then only has the family and length
+ * */
+bool fw_parse_packet6(const struct sk_buff *skb, struct fw_pkt *pkt) {
+    struct ipv6hdr _ip6h, *ip6h;
+    u8 _ext[8], *ext;
+    unsigned int off = sizeof(_ip6h), n;
+    u16 frag_off;
+    u8 nexthdr;
+    bool chain_cut = false;             // the packet ends inside an extension header
+
+    ip6h = skb_header_pointer(skb, skb_network_offset(skb), sizeof(_ip6h), &_ip6h);
+    if(!ip6h || ip6h->version != 6) { return pkt_unparsed(skb, pkt, NFPROTO_IPV6); }
+
+    pkt_reset(pkt);
+    pkt->family = NFPROTO_IPV6;
+    pkt->saddr = 0;
+    pkt->daddr = 0;
+    pkt->saddr6 = ip6h->saddr;
+    pkt->daddr6 = ip6h->daddr;
+    pkt->len = min_t(unsigned int, sizeof(_ip6h) + ntohs(ip6h->payload_len), U16_MAX);
+    pkt->ip_id = 0;
+    pkt->frag = FW_FRAG_NONE;
+    nexthdr = ip6h->nexthdr;
+
+    for(n = 0; n < FW_IPV6_MAX_EXTHDRS; n++) {
+        if(!ipv6_exthdr(nexthdr)) { break; }
+
+        /* every extension header starts with the next header and, but for fragments, its length,
+         * and none is shorter than 8 bytes */
+        ext = skb_header_pointer(skb, skb_network_offset(skb) + off, sizeof(_ext), _ext);
+        if(!ext) {
+            chain_cut = true;
+            break;
+        }
+
+        if(nexthdr == IPPROTO_FRAGMENT) {
+            /* offset in 8 byte units above the M flag, as in IPv4 */
+            frag_off = ext[2] << 8 | ext[3];
+            pkt->frag = frag_off & ~7 ? FW_FRAG_LATER : frag_off & 1 ? FW_FRAG_FIRST : FW_FRAG_NONE;
+            pkt->ip_id = (u32)ext[4] << 24 | ext[5] << 16 | ext[6] << 8 | ext[7];
+            off += 8;
+        } else if(nexthdr == IPPROTO_AH) {
+            off += (ext[1] + 2) * 4;
+        } else {
+            off += (ext[1] + 1) * 8;
+        }
+        nexthdr = ext[0];
+
+        /* the headers of a later fragment are all there is, the rest is payload */
+        if(pkt->frag == FW_FRAG_LATER) { break; }
+    }
+
+    pkt->proto = nexthdr;
+    pkt->iphlen = off;
+
+    if(pkt->frag == FW_FRAG_LATER) { return true; }
+
+    /* a first fragment has to hold the whole header chain (RFC 7112), whichever header it ends in */
+    pkt->truncated = chain_cut || !parse_transport(skb, pkt);
+    return true;
+}
+
+/* Function for taking the verdict on a parsed packet, shared by the PRE_ROUTING and LOCAL_OUT hooks
+ * of both families. Callers run with bottom halves disabled.
+ * @param fn: namespace whose ruleset judges the packet
+ * @param skb: packet being handled
+ * @param pkt: parsed packet
+ * @param dev: input device, or the output device of a locally generated packet
+ * @param egress: the packet is locally generated
+ * @param reason: set to the enum fw_reason behind the verdict
+ * */
+unsigned int fw_judge(struct fw_net *fn, struct sk_buff *skb, const struct fw_pkt *pkt,
+                      const struct net_device *dev, bool egress, u8 *reason) {
+    struct fw_flow_res flow;            // cached verdict of the packet's flow
+    struct fw_frag_res frag;            // cached verdict of the packet's datagram
+    struct fw_stream *stream;           // matcher state of the packet's TCP flow
+    const struct fw_ruleset *rs;        // ruleset generation this packet is judged by
+    unsigned int verdict;
+    u32 sig, scan;                      // signature found, automaton state
+    u32 rule = FW_RULE_NONE;            // filter rule behind the verdict
+    u32 icmp_rate = 0;                  // packets per second of the packet's ICMP type, 0 for no limit
+    u8 mode;                            // enum fw_iface_mode of dev
+    u8 action;                          // enum fw_action of a matching domain
+
+    rcu_read_lock();
+    rs = fw_ruleset_get(fn);
+    mode = dev ? fw_iface_mode(fn, dev->ifindex) : FW_IFACE_FILTER;
+
+    /* blocked interfaces drop and trusted ones accept everything, without any other check */
+    if(mode == FW_IFACE_BLOCKED || mode == FW_IFACE_TRUSTED) {
+        verdict = mode == FW_IFACE_TRUSTED ? NF_ACCEPT : NF_DROP;
+        *reason = FW_REASON_IFACE;
+
+    /* dynamically blocked hosts come before the caches, which may hold an accept from before the
+     * block */
+    } else if(dynblocked(fn, pkt, egress)) {
+        verdict = NF_DROP;
+        *reason = FW_REASON_DYNBLOCK;
+
+    /* a packet too short for its ports could slip past any port rule, and a first fragment would
+     * leave its datagram's later fragments to be judged without them; it goes, and they follow it */
+    } else if(pkt->truncated) {
+        verdict = NF_DROP;
+        *reason = FW_REASON_MALFORMED;
+
+    /* a later fragment follows the first fragment of its datagram; without it, it is judged on
+     * its addresses and protocol, and kept out of the flow cache, which is keyed on ports */
+    } else if(pkt->frag == FW_FRAG_LATER) {
+        if(fw_frag_lookup(pkt, rs->generation, &frag)) {
+            verdict = frag.verdict;
+            *reason = frag.reason;
+        } else {
+            verdict = classify(pkt, rs, egress, reason, &rule);
+        }
+
+    /* packets of a flow we already decided on skip every check below */
+    } else if(fw_flow_lookup(pkt, rs->generation, &flow)) {
+        verdict = flow.verdict;
+        *reason = flow.reason;
+        rule = flow.rule;
+    } else {
+        verdict = classify(pkt, rs, egress, reason, &rule);
+        fw_flow_insert(pkt, rs->generation, verdict, *reason, rule);
+    }
+
+    /* a cached index can come from a generation published after rs was read, keep it in bounds */
+    if(rule < rs->nrules && rs->rule_counters) { fw_stats_rule(rs->rule_counters, rule, pkt); }
+
+    /* the flow key has no room for the ICMP type and code, so ICMP that fell through to the policy
+     * takes its action from its family's type/code table on every packet, cached flow or not: one load */
+    if(*reason == FW_REASON_ICMP && pkt->frag != FW_FRAG_LATER) {
+        if(pkt->proto == IPPROTO_ICMP && rs->icmp_table) {
+            verdict = rs->icmp_table[pkt->icmp_type << 8 | pkt->icmp_code];
+            icmp_rate = rs->icmp_rates[pkt->icmp_type];
+        } else if(pkt->proto == IPPROTO_ICMPV6 && rs->icmp6_table) {
+            verdict = rs->icmp6_table[pkt->icmp_type << 8 | pkt->icmp_code];
+            icmp_rate = rs->icmp6_rates[pkt->icmp_type];
+        }
+    }
+
+    /* the flow cache keeps the action, the source's bucket decides every packet anew */
+    if(verdict == FW_ACTION_RATELIMIT) {
+        verdict = fw_ratelimit(fn, pkt, egress) ? NF_ACCEPT : NF_DROP;
+        if(verdict == NF_DROP) { *reason = FW_REASON_RATELIMIT; }
+    }
+
+    /* a type's rate caps whatever of it gets through, from all sources together */
+    if(icmp_rate && verdict == NF_ACCEPT && !fw_ratelimit_icmp(fn, pkt->family, pkt->icmp_type, icmp_rate)) {
+        verdict = NF_DROP;
+        *reason = FW_REASON_RATELIMIT;
+    }
+
+    /* a domain verdict belongs to one question, and the next query on the same ports can ask for
+     * another name; like signatures it overrides the header verdict and stays out of the flow cache */
+    if(pkt->proto == IPPROTO_UDP && (pkt->sport == 53 || pkt->dport == 53) && rs->domain_trie &&
+       mode == FW_IFACE_FILTER && !verdict_final(*reason)) {
+        action = fw_dns_match(skb, pkt, rs->domain_trie);
+        if(action != FW_DNS_NOMATCH) {
+            if(action != FW_ACTION_FLAG) { verdict = action; }
+            *reason = FW_REASON_DOMAIN;
+        }
+    }
+
+    /* signature verdicts describe one segment, so they never enter the flow cache: every payload
+     * is scanned, cached flow or not, and a hit overrides the header verdict unless the packet came
+     * from a blocked host or went over its rate. Interfaces in any mode but FW_IFACE_FILTER are
+     * never scanned. The scan picks up where the flow's previous in-order segment left off, so a
+     * signature split across segments is still found. */
+    if(pkt->payload_len && rs->matcher && mode == FW_IFACE_FILTER && !verdict_final(*reason)) {
+        scan = fw_stream_begin(pkt, rs->generation, &stream);
+        sig = scan_payload(skb, pkt, rs->matcher, &scan);
+        fw_stream_end(stream, pkt, scan, sig != FW_AC_NOMATCH);
+        if(sig != FW_AC_NOMATCH) {
+            if(rs->sigs[sig].action != FW_ACTION_FLAG) { verdict = rs->sigs[sig].action; }
+            *reason = FW_REASON_SIGNATURE;
+        }
+    }
+
+    /* the rest of the datagram gets whatever its first fragment got, all checks included */
+    if(pkt->frag == FW_FRAG_FIRST) { fw_frag_insert(pkt, rs->generation, verdict, *reason); }
+    rcu_read_unlock();
+
+    return verdict;
+}
+
+/* Function for the checks that need no flow state, cheap enough for the netdev ingress hook: blocked
+ * interfaces and, unless the interface is trusted, the blocked prefixes and dynamic blocks
+ * @param fn: namespace of the input device
+ * @param pkt: parsed packet
+ * @param dev: input device
+ * @param reason: set to the enum fw_reason behind a drop
+ * returns true if the packet is to be dropped
+ * */
+bool fw_judge_early(struct fw_net *fn, const struct fw_pkt *pkt, const struct net_device *dev, u8 *reason) {
+    const struct fw_ruleset *rs;
+    bool drop = true;
+    u8 mode;
+
+    rcu_read_lock();
+    rs = fw_ruleset_get(fn);
+    mode = fw_iface_mode(fn, dev->ifindex);
+    if(mode == FW_IFACE_BLOCKED) {
+        *reason = FW_REASON_IFACE;
+    } else if(mode != FW_IFACE_TRUSTED && pkt->family == NFPROTO_IPV6 && fw_ruleset_blocked6(rs, &pkt->saddr6)) {
+        *reason = FW_REASON_BLOCKLIST;
+    } else if(mode != FW_IFACE_TRUSTED && pkt->family == NFPROTO_IPV4 && fw_ruleset_blocked(rs, ntohl(pkt->saddr))) {
+        *reason = FW_REASON_BLOCKLIST;
+    } else if(mode != FW_IFACE_TRUSTED && dynblocked(fn, pkt, false)) {
+        *reason = FW_REASON_DYNBLOCK;
+    } else {
+        drop = false;
+    }
+    rcu_read_unlock();
+
+    return drop;
+}
+
+// EOF
@@ -0,0 +1,27 @@
+/*************************************************************************************************
+ * Packet judgement -- parses a packet and decides its verdict against the live ruleset of a
+ * namespace. This is the whole of what the hooks do apart from logging and counting, free of
+ * netfilter hook types so it can be driven from outside a hook as well.
+ ************************************************************************************************/
+#ifndef _FW_JUDGE_H
+#define _FW_JUDGE_H
+
+#include <linux/types.h>
+
+#include "fw.h"
+#include "fw-net.h"
+
+#define FW_IPV6_MAX_EXTHDRS 8               // IPv6 extension headers walked before giving up
+
+struct sk_buff;
+struct net_device;
+
+bool fw_parse_packet(const struct sk_buff *skb, struct fw_pkt *pkt);
+bool fw_parse_packet6(const struct sk_buff *skb, struct fw_pkt *pkt);
+
+/* Callers run with bottom halves disabled, the flow cache and stream state are per-CPU */
+unsigned int fw_judge(struct fw_net *fn, struct sk_buff *skb, const struct fw_pkt *pkt,
+                      const struct net_device *dev, bool egress, u8 *reason);
+bool fw_judge_early(struct fw_net *fn, const struct fw_pkt *pkt, const struct net_device *dev, u8 *reason);
+
+#endif /* _FW_JUDGE_H */
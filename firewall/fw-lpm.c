@@ -0,0 +1,315 @@
+/*************************************************************************************************
+ * Longest-prefix-match tables -- builds the DIR-16-8-8 trie used by the firewall hook for IPv4,
+ * and its IPv6 counterpart.
+ *
+ * The root level is indexed by the top 16 bits of an address; /17../24 and /25../32 prefixes hang
+ * 256-entry child tables off it. Prefixes are inserted shortest first, so a longer prefix simply
+ * overwrites the expanded entries of any shorter prefix it nests in and child tables inherit the
+ * entry they replace.
+ *
+ * An IPv6 table has the same root and one more level of child tables per further byte, fourteen in
+ * all. A prefix longer than /16 costs up to one 1 KB child table per byte below the root that it
+ * does not share with another prefix: a /48 three, a /64 six. The tables suit blocklists of
+ * networks; single hosts are cheap to block on IPv4 only.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/inet.h>
+
+#include "fw-lpm.h"
+
+#define LPM_ROOT_SIZE   (1 << 16)
+#define LPM_CHILD_SIZE  (1 << 8)
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+
+/* Sort callback ordering prefixes shortest first */
+static int prefix_cmp(const void *a, const void *b) {
+    const struct lpm_prefix *pa = a, *pb = b;
+
+    return (int)pa->len - (int)pb->len;
+}
+
+/* Function for allocating a child table filled with the entry it replaces
+ * @param t: table being built
+ * @param fill: entry value inherited by all 256 slots
+ * returns the child table index, or -ENOMEM
+ * */
+static int lpm_new_child(struct lpm_table *t, u32 fill) {
+    unsigned int i;
+    u32 *child;
+
+    if(t->ntbl == t->maxtbl) {
+        unsigned int newmax = t->maxtbl ? t->maxtbl * 2 : 64;
+        u32 *tbl;
+
+        if(newmax > LPM_INDEX + 1) { return -ENOMEM; }
+
+        tbl = vmalloc(sizeof(u32) * LPM_CHILD_SIZE * newmax);
+        if(!tbl) { return -ENOMEM; }
+
+        if(t->tbl) {
+            memcpy(tbl, t->tbl, sizeof(u32) * LPM_CHILD_SIZE * t->ntbl);
+            vfree(t->tbl);
+        }
+        t->tbl = tbl;
+        t->maxtbl = newmax;
+    }
+
+    child = &t->tbl[t->ntbl * LPM_CHILD_SIZE];
+    for(i = 0; i < LPM_CHILD_SIZE; i++) {
+        child[i] = fill;
+    }
+
+    return t->ntbl++;
+}
+
+/* Function for descending into (and creating if needed) the child table behind an entry
+ * @param t: table being built
+ * @param entry: current value of the parent entry
+ * returns the child table index, or -ENOMEM
+ * */
+static int lpm_child_of(struct lpm_table *t, u32 entry) {
+    if(entry & LPM_CHILD) { return entry & LPM_INDEX; }
+
+    return lpm_new_child(t, entry);
+}
+
+/* Function for filling a run of expanded entries with a prefix value */
+static void lpm_fill(u32 *e, unsigned int first, unsigned int count, u32 value) {
+    unsigned int i;
+
+    for(i = first; i < first + count; i++) {
+        e[i] = value;
+    }
+}
+
+/* Function for inserting a single prefix; callers insert in ascending length order
+ * @param t: table being built
+ * @param p: prefix to insert
+ * */
+static int lpm_insert(struct lpm_table *t, const struct lpm_prefix *p) {
+    u32 addr = p->len ? p->addr & (~0U << (32 - p->len)) : 0;
+    unsigned int r = addr >> 16;
+    unsigned int m = (addr >> 8) & 0xff;
+    int c1, c2;
+
+    if(p->len <= 16) {
+        lpm_fill(t->root, r, 1U << (16 - p->len), p->value);
+        return 0;
+    }
+
+    /* level 2: /17 - /24 */
+    c1 = lpm_child_of(t, t->root[r]);
+    if(c1 < 0) { return c1; }
+    t->root[r] = LPM_CHILD | c1;
+
+    if(p->len <= 24) {
+        lpm_fill(&t->tbl[c1 * LPM_CHILD_SIZE], m, 1U << (24 - p->len), p->value);
+        return 0;
+    }
+
+    /* level 3: /25 - /32; the pool may move when c2 is allocated so re-index afterwards */
+    c2 = lpm_child_of(t, t->tbl[c1 * LPM_CHILD_SIZE + m]);
+    if(c2 < 0) { return c2; }
+    t->tbl[c1 * LPM_CHILD_SIZE + m] = LPM_CHILD | c2;
+
+    lpm_fill(&t->tbl[c2 * LPM_CHILD_SIZE], addr & 0xff, 1U << (32 - p->len), p->value);
+
+    return 0;
+}
+
+/* Sort callback ordering IPv6 prefixes shortest first */
+static int prefix6_cmp(const void *a, const void *b) {
+    const struct lpm6_prefix *pa = a, *pb = b;
+
+    return (int)pa->len - (int)pb->len;
+}
+
+/* Function for inserting a single IPv6 prefix; callers insert in ascending length order
+ * @param t: table being built
+ * @param p: prefix to insert, host bits clear
+ * */
+static int lpm6_insert(struct lpm_table *t, const struct lpm6_prefix *p) {
+    const u8 *a = p->addr.s6_addr;
+    unsigned int r = a[0] << 8 | a[1], i;
+    int c, next;
+
+    if(p->len <= 16) {
+        lpm_fill(t->root, r, 1U << (16 - p->len), p->value);
+        return 0;
+    }
+
+    c = lpm_child_of(t, t->root[r]);
+    if(c < 0) { return c; }
+    t->root[r] = LPM_CHILD | c;
+
+    /* one level per byte until the one the prefix ends in; the pool may move when a child is
+     * allocated so re-index afterwards */
+    for(i = 2; p->len > (i + 1) * 8; i++) {
+        next = lpm_child_of(t, t->tbl[c * LPM_CHILD_SIZE + a[i]]);
+        if(next < 0) { return next; }
+        t->tbl[c * LPM_CHILD_SIZE + a[i]] = LPM_CHILD | next;
+        c = next;
+    }
+
+    lpm_fill(&t->tbl[c * LPM_CHILD_SIZE], a[i], 1U << ((i + 1) * 8 - p->len), p->value);
+
+    return 0;
+}
+
+/* ===============================================================================================
+ * table functions
+ * ===============================================================================================*/
+
+/* Function for building a table from a prefix list
+ * @param prefixes: prefixes to insert; sorted in place by length
+ * @param count: number of prefixes
+ * returns the new table, or NULL when out of memory
+ * */
+struct lpm_table *lpm_build(struct lpm_prefix *prefixes, unsigned int count) {
+    struct lpm_table *t;
+    unsigned int i;
+
+    t = kzalloc(sizeof(*t), GFP_KERNEL);
+    if(!t) { return NULL; }
+
+    t->root = vzalloc(sizeof(u32) * LPM_ROOT_SIZE);
+    if(!t->root) { goto fail; }
+
+    sort(prefixes, count, sizeof(*prefixes), prefix_cmp, NULL);
+
+    for(i = 0; i < count; i++) {
+        if(lpm_insert(t, &prefixes[i]) < 0) { goto fail; }
+    }
+    t->nprefixes = count;
+
+    return t;
+
+fail:
+    lpm_free(t);
+    return NULL;
+}
+
+/* Function for releasing a table; callers must have waited out an RCU grace period first */
+void lpm_free(struct lpm_table *t) {
+    if(!t) { return; }
+
+    vfree(t->tbl);
+    vfree(t->root);
+    kfree(t);
+}
+
+/* Function for reporting the bytes a table occupies */
+size_t lpm_memory(const struct lpm_table *t) {
+    return sizeof(*t) + sizeof(u32) * (LPM_ROOT_SIZE + (size_t)t->maxtbl * LPM_CHILD_SIZE);
+}
+
+/* Function for parsing "a.b.c.d" or "a.b.c.d/len" into a prefix; value is left untouched
+ * @param buf: text to parse, need not be NUL terminated
+ * @param len: length of buf
+ * @param p: prefix to fill in
+ * */
+int lpm_parse_prefix(const char *buf, size_t len, struct lpm_prefix *p) {
+    const char *end;
+    __be32 addr;
+    unsigned int plen = 32;
+    char lenbuf[4];
+    size_t n;
+
+    if(!in4_pton(buf, len, (u8 *)&addr, '/', &end)) { return -EINVAL; }
+
+    n = len - (end - buf);
+    if(n > 0) {
+        if(*end != '/' || n < 2 || n > sizeof(lenbuf)) { return -EINVAL; }
+
+        memcpy(lenbuf, end + 1, n - 1);
+        lenbuf[n - 1] = '\0';
+        if(kstrtouint(lenbuf, 10, &plen) || plen > 32) { return -EINVAL; }
+    }
+
+    p->addr = ntohl(addr);
+    p->len = plen;
+
+    return 0;
+}
+
+/* Function for building an IPv6 table from a prefix list
+ * @param prefixes: prefixes to insert, host bits clear; sorted in place by length
+ * @param count: number of prefixes
+ * returns the new table, or NULL when out of memory
+ * */
+struct lpm_table *lpm6_build(struct lpm6_prefix *prefixes, unsigned int count) {
+    struct lpm_table *t;
+    unsigned int i;
+
+    t = kzalloc(sizeof(*t), GFP_KERNEL);
+    if(!t) { return NULL; }
+
+    t->root = vzalloc(sizeof(u32) * LPM_ROOT_SIZE);
+    if(!t->root) { goto fail; }
+
+    sort(prefixes, count, sizeof(*prefixes), prefix6_cmp, NULL);
+
+    for(i = 0; i < count; i++) {
+        if(lpm6_insert(t, &prefixes[i]) < 0) { goto fail; }
+    }
+    t->nprefixes = count;
+
+    return t;
+
+fail:
+    lpm_free(t);
+    return NULL;
+}
+
+/* Function for clearing the host bits of an IPv6 address
+ * @param addr: address to mask
+ * @param len: prefix length, 0..128
+ * */
+void lpm6_mask(struct in6_addr *addr, unsigned int len) {
+    unsigned int i;
+
+    for(i = 0; i < 16; i++, len = len > 8 ? len - 8 : 0) {
+        if(len < 8) { addr->s6_addr[i] &= (u8)(0xff00 >> len); }
+    }
+}
+
+/* Function for parsing an IPv6 address with an optional "/len" into a prefix with its host bits
+ * cleared; value is left untouched
+ * @param buf: text to parse, need not be NUL terminated
+ * @param len: length of buf
+ * @param p: prefix to fill in
+ * */
+int lpm6_parse_prefix(const char *buf, size_t len, struct lpm6_prefix *p) {
+    const char *end;
+    unsigned int plen = 128;
+    char lenbuf[5];
+    size_t n;
+
+    if(!in6_pton(buf, len, p->addr.s6_addr, '/', &end)) { return -EINVAL; }
+
+    n = len - (end - buf);
+    if(n > 0) {
+        if(*end != '/' || n < 2 || n > sizeof(lenbuf)) { return -EINVAL; }
+
+        memcpy(lenbuf, end + 1, n - 1);
+        lenbuf[n - 1] = '\0';
+        if(kstrtouint(lenbuf, 10, &plen) || plen > 128) { return -EINVAL; }
+    }
+
+    p->len = plen;
+    lpm6_mask(&p->addr, plen);
+
+    return 0;
+}
+
+// EOF
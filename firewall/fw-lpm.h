@@ -0,0 +1,93 @@
+/*************************************************************************************************
+ * Longest-prefix-match tables -- a DIR-16-8-8 multibit trie for IPv4, and the same trie with
+ * fourteen 8-bit levels below the root for IPv6. A table is built once from a full prefix list and
+ * never modified afterwards, so readers only need the RCU-protected pointer to it; updates build a
+ * new table and swap it in.
+ ************************************************************************************************/
+#ifndef _FW_LPM_H
+#define _FW_LPM_H
+
+#include <linux/types.h>
+#include <linux/in6.h>
+
+/* ===============================================================================================
+ * defines
+ * ===============================================================================================*/
+#define LPM_NOMATCH     0           // value returned when no prefix covers the address
+#define LPM_VALUE_MAX   0x7fffffff  // largest value a prefix may carry
+#define LPM_CHILD       0x80000000  // entry points at a 256-entry child table
+#define LPM_INDEX       0x00ffffff  // child table index bits of an entry
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct lpm_prefix {
+    u32 addr;                       // prefix address, host byte order
+    u8 len;                         // prefix length, 0..32
+    u32 value;                      // value returned on match, 1..LPM_VALUE_MAX
+};
+
+struct lpm6_prefix {
+    struct in6_addr addr;           // prefix address
+    u8 len;                         // prefix length, 0..128
+    u32 value;                      // value returned on match, 1..LPM_VALUE_MAX
+};
+
+/* both families share the layout, an IPv6 table just descends through more child tables */
+struct lpm_table {
+    u32 *root;                      // 2^16 entries indexed by the top 16 bits of the address
+    u32 *tbl;                       // pool of 256-entry child tables for the 8-bit levels
+    unsigned int ntbl;              // child tables in use
+    unsigned int maxtbl;            // child tables allocated
+    unsigned int nprefixes;         // prefixes the table was built from
+};
+
+/* ===============================================================================================
+ * functions
+ * ===============================================================================================*/
+struct lpm_table *lpm_build(struct lpm_prefix *prefixes, unsigned int count);
+void lpm_free(struct lpm_table *t);
+size_t lpm_memory(const struct lpm_table *t);
+int lpm_parse_prefix(const char *buf, size_t len, struct lpm_prefix *p);
+
+struct lpm_table *lpm6_build(struct lpm6_prefix *prefixes, unsigned int count);
+void lpm6_mask(struct in6_addr *addr, unsigned int len);
+int lpm6_parse_prefix(const char *buf, size_t len, struct lpm6_prefix *p);
+
+/* Function for looking up the value of the longest prefix covering an address -- at most three
+ * dependent loads no matter how many prefixes the table holds.
+ * @param t: table to search
+ * @param addr: address in host byte order
+ * */
+static inline u32 lpm_lookup(const struct lpm_table *t, u32 addr) {
+    u32 e = t->root[addr >> 16];
+
+    if(e & LPM_CHILD) {
+        e = t->tbl[((e & LPM_INDEX) << 8) | ((addr >> 8) & 0xff)];
+        if(e & LPM_CHILD) {
+            e = t->tbl[((e & LPM_INDEX) << 8) | (addr & 0xff)];
+        }
+    }
+
+    return e;
+}
+
+/* Function for looking up the value of the longest prefix covering an IPv6 address -- one load
+ * per byte of the longest prefix past the first 16 bits, at most fifteen
+ * @param t: table built by lpm6_build()
+ * @param addr: address to look up
+ * */
+static inline u32 lpm6_lookup(const struct lpm_table *t, const struct in6_addr *addr) {
+    const u8 *a = addr->s6_addr;
+    u32 e = t->root[a[0] << 8 | a[1]];
+    unsigned int i = 2;
+
+    /* no prefix is longer than 128 bits, so the last byte never has a child table behind it */
+    while(e & LPM_CHILD) {
+        e = t->tbl[((e & LPM_INDEX) << 8) | a[i++]];
+    }
+
+    return e;
+}
+
+#endif /* _FW_LPM_H */
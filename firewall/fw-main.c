@@ -0,0 +1,745 @@
+/*************************************************************************************************
+ * Simple netfilter example for mangling IP traffic -- drops all traffic on a chosen interface, all
+ * traffic coming from a list of blocked prefixes (208.80.154.0/24, wikipedia, by default), all
+ * ICMP but "fragmentation needed", and dns queries for blocked domains, and waves through
+ * everything on trusted interfaces. TCP payloads are matched against a set of signatures ("HTTP"
+ * by default).
+ *
+ * IPv4 and IPv6 are filtered in every network namespace, each with its own ruleset and counters:
+ * the hooks are registered per namespace through pernet operations as namespaces come and go. The
+ * initial namespace's files sit at the top of the debugfs directory, those of any other in
+ * netns/<inode number>, e.g. netfilter-firewall/netns/4026532281/stats.
+ *
+ * The module builds against kernels from 4.13 on, current ones included: it only uses kernel API
+ * that every one of them has, e.g. noop_llseek for the write-only debugfs files rather than
+ * no_llseek, which 6.12 removed.
+ ************************************************************************************************/
+#define DEBUG
+#define UDP_HDR_LEN 8
+#define MAX_PARAM_PREFIXES 64       // blocked prefixes settable as a module parameter
+#define PREFIX_LINE_LEN 64          // longest accepted line in the debugfs blocklist file, IPv6 included
+#define MAX_INGRESS_DEVS 16         // interfaces that can get an early-drop ingress hook
+#define MAX_PARAM_IFACES 16         // trusted interfaces settable as a module parameter
+
+/* standard includes */
+#include <linux/module.h>  // Needed by all kernel modules
+#include <linux/kernel.h>  // Needed for loglevels (KERN_WARNING, KERN_EMERG, KERN_INFO, etc.)
+#include <linux/init.h>    // Needed for __init and __exit macros.
+#include <linux/sched/clock.h> // local_clock() for the hook latency histograms
+
+/* netfliter specific includes */
+#include <linux/netfilter.h> 
+#include <linux/netfilter_ipv4.h> 
+#include <linux/netfilter_ipv6.h>
+#include <linux/netdevice.h>
+#include <linux/if_ether.h>
+#include <linux/net.h>
+#include <linux/ip.h>
+#include <linux/icmp.h>
+#include <linux/skbuff.h>
+#include <net/net_namespace.h>
+#include <net/netns/generic.h>
+
+/* blocklist includes */
+#include <linux/rcupdate.h>
+#include <linux/debugfs.h>
+#include <linux/uaccess.h>
+#include <linux/ctype.h>
+#include <linux/vmalloc.h>
+
+#include "fw.h"
+#include "fw-net.h"
+#include "fw-lpm.h"
+#include "fw-ruleset.h"
+#include "fw-image.h"
+#include "fw-events.h"
+#include "fw-flow.h"
+#include "fw-frag.h"
+#include "fw-stream.h"
+#include "fw-stats.h"
+#include "fw-ratelimit.h"
+#include "fw-dynblock.h"
+#include "fw-top.h"
+#include "fw-judge.h"
+#include "fw-nl.h"
+
+/* ===============================================================================================
+ * globals
+ * * ===============================================================================================*/
+static char *blocked_prefixes[MAX_PARAM_PREFIXES] = { "208.80.154.0/24" }; // prefixes blocked at load time
+static int blocked_prefix_count = 1;                    // entries set in blocked_prefixes
+static char *blocked_interface = "";                    // interface we're blocking traffic on at load time
+static char *trusted_interfaces[MAX_PARAM_IFACES];      // interfaces accepted without any check at load time
+static int trusted_interface_count;                     // entries set in trusted_interfaces
+static char *ingress_devs[MAX_INGRESS_DEVS];            // interfaces to drop blocked traffic on at netdev ingress
+static int ingress_dev_count;                           // entries set in ingress_devs
+static bool egress_hook;                                // also judge locally generated packets
+static struct dentry *debugfs_dir;                      // netfilter-firewall debugfs directory
+static struct dentry *netns_dir;                        // its netns directory, one entry per other namespace
+static unsigned int fw_net_id __read_mostly;            // key of struct fw_net in every namespace
+static atomic_t fw_net_count = ATOMIC_INIT(0);          // namespaces set up so far, the next struct fw_net id
+
+/* Everything above is read-only on the packet path; the policy itself lives in the RCU-published
+ * struct fw_ruleset of each namespace and per-packet state in a struct fw_pkt on the hook's stack,
+ * so the hook is reentrant across CPUs. The blocked_ and trusted_ parameters only seed the first
+ * ruleset of the initial namespace, use tools/fwctl to change the policy of a loaded module. Every
+ * hook point of a namespace judges packets by that namespace's ruleset. */
+
+module_param_array(blocked_prefixes, charp, &blocked_prefix_count, 0444);
+MODULE_PARM_DESC(blocked_prefixes, "Source prefixes to drop, e.g. 208.80.154.0/24,10.0.0.0/8,2001:db8::/32");
+module_param(blocked_interface, charp, 0444);
+MODULE_PARM_DESC(blocked_interface, "Drop everything received on this interface, e.g. lo");
+module_param_array(trusted_interfaces, charp, &trusted_interface_count, 0444);
+MODULE_PARM_DESC(trusted_interfaces, "Accept everything on these interfaces without any check, e.g. lo,eth1");
+module_param_array(ingress_devs, charp, &ingress_dev_count, 0444);
+MODULE_PARM_DESC(ingress_devs, "Drop blocked prefixes and blocked interfaces at netdev ingress on these interfaces, e.g. eth0,eth1");
+module_param(egress_hook, bool, 0444);
+MODULE_PARM_DESC(egress_hook, "Also judge locally generated packets at LOCAL_OUT");
+
+/* Function for finding the state of a namespace */
+struct fw_net *fw_net(const struct net *net) {
+    return net_generic(net, fw_net_id);
+}
+
+/* Function for adding a blocked prefix of either family, given as text, to a draft
+ * @param d: draft
+ * @param buf: "a.b.c.d[/len]" or an IPv6 address with an optional "/len", need not be NUL terminated
+ * @param len: length of buf
+ * */
+static int draft_prefix_text(struct fw_draft *d, const char *buf, size_t len) {
+    struct lpm_prefix p;
+    struct lpm6_prefix p6;
+
+    if(memchr(buf, ':', len)) {
+        if(lpm6_parse_prefix(buf, len, &p6) < 0) { return -EINVAL; }
+        return fw_draft_prefix6(d, &p6, true);
+    }
+
+    if(lpm_parse_prefix(buf, len, &p) < 0) { return -EINVAL; }
+
+    return fw_draft_prefix(d, &p, true);
+}
+
+/* ===============================================================================================
+ * debugfs blocklist file -- writing a newline separated list of prefixes, IPv4 and IPv6 mixed,
+ * replaces every blocked prefix of the namespace once the file is closed,
+ * e.g. `cat prefixes.txt > /sys/kernel/debug/netfilter-firewall/blocklist`
+ * ===============================================================================================*/
+struct blocklist_stage {
+    struct fw_net *fn;              // namespace the file belongs to, referenced while open
+    struct fw_draft *draft;         // draft the prefixes are collected in
+    char line[PREFIX_LINE_LEN];     // partial line carried between writes
+    size_t linelen;                 // bytes in line
+    int err;                        // first parse error, the load is abandoned if set
+};
+
+/* Function for adding one line of text to a staged blocklist
+ * @param stage: staged blocklist
+ * @param line: line without its newline
+ * @param len: length of line
+ * */
+static int stage_add_line(struct blocklist_stage *stage, char *line, size_t len) {
+    /* trim whitespace, skip blank lines and comments */
+    while(len && isspace(line[len - 1])) { len--; }
+    while(len && isspace(*line)) { line++; len--; }
+    if(!len || *line == '#') { return 0; }
+
+    return draft_prefix_text(stage->draft, line, len);
+}
+
+static int blocklist_open(struct inode *inode, struct file *file) {
+    struct fw_net *fn = inode->i_private;
+    struct blocklist_stage *stage;
+
+    /* a namespace on its way out takes no more rulesets */
+    if(!maybe_get_net(fn->net)) { return -ENOENT; }
+
+    stage = kzalloc(sizeof(*stage), GFP_KERNEL);
+    if(!stage) {
+        put_net(fn->net);
+        return -ENOMEM;
+    }
+    stage->fn = fn;
+
+    stage->draft = fw_draft_begin(fn);
+    if(!stage->draft) {
+        kfree(stage);
+        put_net(fn->net);
+        return -ENOMEM;
+    }
+    fw_draft_flush_prefixes(stage->draft);
+    file->private_data = stage;
+
+    return 0;
+}
+
+static ssize_t blocklist_write(struct file *file, const char __user *ubuf, size_t len, loff_t *ppos) {
+    struct blocklist_stage *stage = file->private_data;
+    char buf[256];
+    size_t done = 0, n, i;
+
+    if(stage->err) { return stage->err; }
+
+    while(done < len) {
+        n = min(len - done, sizeof(buf));
+        if(copy_from_user(buf, ubuf + done, n)) { return -EFAULT; }
+
+        for(i = 0; i < n; i++) {
+            if(buf[i] == '\n') {
+                stage->err = stage_add_line(stage, stage->line, stage->linelen);
+                stage->linelen = 0;
+            } else if(stage->linelen < sizeof(stage->line)) {
+                stage->line[stage->linelen++] = buf[i];
+            } else {
+                stage->err = -EINVAL;
+            }
+
+            if(stage->err) { return stage->err; }
+        }
+        done += n;
+    }
+    *ppos += len;
+
+    return len;
+}
+
+static int blocklist_release(struct inode *inode, struct file *file) {
+    struct blocklist_stage *stage = file->private_data;
+    int err = stage->err;
+
+    if(!err && stage->linelen) {
+        err = stage_add_line(stage, stage->line, stage->linelen);
+    }
+
+    /* an empty write clears the blocklist, opening read-only leaves it in place */
+    if(!err && (file->f_mode & FMODE_WRITE)) {
+        err = fw_draft_commit(stage->draft);
+    } else {
+        fw_draft_abort(stage->draft);
+    }
+
+    if(err) {
+        printk(KERN_INFO ">>> Blocklist load failed (%d), keeping previous blocklist\n", err);
+    }
+
+    put_net(stage->fn->net);
+    kfree(stage);
+
+    return err;
+}
+
+static const struct file_operations blocklist_fops = {
+    .owner      = THIS_MODULE,
+    .open       = blocklist_open,
+    .write      = blocklist_write,
+    .release    = blocklist_release,
+    .llseek     = noop_llseek,
+};
+
+/* ===============================================================================================
+ * debugfs ruleset_image file -- writing an image compiled by tools/fw-compile replaces the whole
+ * ruleset of the namespace once the file is closed,
+ * e.g. `cat rules.img > /sys/kernel/debug/netfilter-firewall/ruleset_image`
+ * ===============================================================================================*/
+struct image_stage {
+    struct fw_net *fn;              // namespace the file belongs to, referenced while open
+    void *buf;                      // image received so far, vmalloc()ed so sections stay aligned
+    size_t len;                     // bytes in buf
+    size_t max;                     // bytes allocated for buf
+};
+
+static int image_open(struct inode *inode, struct file *file) {
+    struct fw_net *fn = inode->i_private;
+    struct image_stage *stage;
+
+    if(!maybe_get_net(fn->net)) { return -ENOENT; }
+
+    stage = kzalloc(sizeof(*stage), GFP_KERNEL);
+    if(!stage) {
+        put_net(fn->net);
+        return -ENOMEM;
+    }
+    stage->fn = fn;
+    file->private_data = stage;
+
+    return 0;
+}
+
+static ssize_t image_write(struct file *file, const char __user *ubuf, size_t len, loff_t *ppos) {
+    struct image_stage *stage = file->private_data;
+    size_t newmax;
+    void *buf;
+
+    if(len > FW_IMAGE_MAXSIZE - stage->len) { return -EFBIG; }
+
+    if(stage->len + len > stage->max) {
+        newmax = min_t(size_t, max(stage->max * 2, max_t(size_t, stage->len + len, 1 << 20)), FW_IMAGE_MAXSIZE);
+        buf = vmalloc(newmax);
+        if(!buf) { return -ENOMEM; }
+
+        if(stage->buf) {
+            memcpy(buf, stage->buf, stage->len);
+            vfree(stage->buf);
+        }
+        stage->buf = buf;
+        stage->max = newmax;
+    }
+
+    if(copy_from_user(stage->buf + stage->len, ubuf, len)) { return -EFAULT; }
+    stage->len += len;
+    *ppos += len;
+
+    return len;
+}
+
+static int image_release(struct inode *inode, struct file *file) {
+    struct image_stage *stage = file->private_data;
+    int err = 0;
+
+    /* nothing written, nothing replaced */
+    if(stage->len) {
+        err = fw_image_load(stage->fn, stage->buf, stage->len);
+        if(err) {
+            printk(KERN_INFO ">>> Ruleset image load failed (%d), keeping previous ruleset\n", err);
+        }
+    }
+
+    put_net(stage->fn->net);
+    vfree(stage->buf);
+    kfree(stage);
+
+    return err;
+}
+
+static const struct file_operations image_fops = {
+    .owner      = THIS_MODULE,
+    .open       = image_open,
+    .write      = image_write,
+    .release    = image_release,
+    .llseek     = noop_llseek,
+};
+
+/* Function for parsing a packet with the parser of its hook's family
+ * @param state: hook state, NFPROTO_IPV4 or NFPROTO_IPV6
+ * */
+static inline bool parse_packet(const struct nf_hook_state *state, struct sk_buff *skb, struct fw_pkt *pkt) {
+    return state->pf == NFPROTO_IPV6 ? fw_parse_packet6(skb, pkt) : fw_parse_packet(skb, pkt);
+}
+
+/* Hook function for packets of interest, at IPv4 and IPv6 PRE_ROUTING of every namespace.
+ * @param priv:
+ * @param skb: pointer to the sk_buff structure with the packet to be handled.
+ * @param nf_hook_state: 
+ */
+unsigned int hook_func(
+    void *priv,
+    struct sk_buff *skb,
+    const struct nf_hook_state *state
+    ) 
+{
+    struct fw_net *fn = fw_net(state->net);
+    struct fw_pkt pkt;                  // per-packet context, never shared between CPUs
+    unsigned int verdict;
+    u64 start = local_clock();
+    u8 hook = state->pf == NFPROTO_IPV6 ? FW_HOOK_PRE_ROUTING6 : FW_HOOK_PRE_ROUTING;
+    u8 reason;
+
+    if(!skb) { return NF_ACCEPT; }
+
+    /* nothing can judge a packet whose IP header does not parse, it is counted and dropped; one cut
+     * short further in is fw_judge's to drop */
+    if(parse_packet(state, skb, &pkt)) {
+        if(state->in) { pkt.ifindex = state->in->ifindex; }
+        verdict = fw_judge(fn, skb, &pkt, state->in, false, &reason);
+    } else {
+        verdict = NF_DROP;
+        reason = FW_REASON_MALFORMED;
+    }
+
+    /* log the verdict to the per-CPU event ring rather than the console */
+    fw_events_log(&pkt, state->in, hook, verdict, reason);
+    fw_stats_packet(fn, &pkt, hook, verdict, reason, local_clock() - start);
+    /* the heavy hitters are the initial namespace's, the only one with a top file */
+    if(net_eq(state->net, &init_net)) { fw_top_packet(&pkt); }
+
+    return verdict;
+}
+
+/* Hook function for locally generated packets of either family, registered with egress_hook. The
+ * blocklist matches destinations here and filter rules see no input interface.
+ * */
+static unsigned int egress_func(void *priv, struct sk_buff *skb, const struct nf_hook_state *state) {
+    struct fw_net *fn = fw_net(state->net);
+    struct fw_pkt pkt;
+    unsigned int verdict;
+    u64 start = local_clock();
+    u8 hook = state->pf == NFPROTO_IPV6 ? FW_HOOK_LOCAL_OUT6 : FW_HOOK_LOCAL_OUT;
+    u8 reason;
+
+    if(!skb) { return NF_ACCEPT; }
+
+    /* LOCAL_OUT runs in process context too, the per-CPU tables must not be interrupted by the
+     * receive path on the same CPU */
+    local_bh_disable();
+    if(parse_packet(state, skb, &pkt)) {
+        verdict = fw_judge(fn, skb, &pkt, state->out, true, &reason);
+    } else {
+        verdict = NF_DROP;
+        reason = FW_REASON_MALFORMED;
+    }
+    fw_events_log(&pkt, state->out, hook, verdict, reason);
+    fw_stats_packet(fn, &pkt, hook, verdict, reason, local_clock() - start);
+    if(net_eq(state->net, &init_net)) { fw_top_packet(&pkt); }
+    local_bh_enable();
+
+    return verdict;
+}
+
+/* Hook function for the netdev ingress of the ingress_devs interfaces. It runs before IP input
+ * processing and conntrack and only does the checks that need no state: blocked interfaces and
+ * the blocked prefixes. Everything else still happens at PRE_ROUTING, which re-runs both checks.
+ * */
+static unsigned int ingress_func(void *priv, struct sk_buff *skb, const struct nf_hook_state *state) {
+    struct fw_net *fn = fw_net(state->net);
+    struct fw_pkt pkt;
+    u64 start = local_clock();
+    u8 reason = FW_REASON_MALFORMED;
+    bool parsed;
+
+    if(skb->protocol == htons(ETH_P_IP)) {
+        parsed = fw_parse_packet(skb, &pkt);
+    } else if(skb->protocol == htons(ETH_P_IPV6)) {
+        parsed = fw_parse_packet6(skb, &pkt);
+    } else {
+        return NF_ACCEPT;
+    }
+    pkt.ifindex = state->in->ifindex;
+
+    /* an IP header that does not parse is dropped here already, one cut short further in at
+     * PRE_ROUTING with everything else that needs state */
+    if(parsed && !fw_judge_early(fn, &pkt, state->in, &reason)) { return NF_ACCEPT; }
+
+    fw_events_log(&pkt, state->in, FW_HOOK_INGRESS, NF_DROP, reason);
+    fw_stats_packet(fn, &pkt, FW_HOOK_INGRESS, NF_DROP, reason, local_clock() - start);
+    if(net_eq(state->net, &init_net)) { fw_top_packet(&pkt); }
+    return NF_DROP;
+}
+
+/* hooks registered in every namespace: PRE_ROUTING of both families, then LOCAL_OUT of both with
+ * egress_hook */
+static const struct nf_hook_ops fw_nf_ops[] = {
+    {
+        .hook       = hook_func,            //function to call when conditions below met
+        .hooknum    = NF_INET_PRE_ROUTING,  //called right after packet recieved, first hook in Netfilter
+        .pf         = NFPROTO_IPV4,         // IPV4 packets
+        .priority   = NF_IP_PRI_FIRST       // set highest priority over all other hook fuctions
+    },
+    {
+        .hook       = hook_func,
+        .hooknum    = NF_INET_PRE_ROUTING,
+        .pf         = NFPROTO_IPV6,
+        .priority   = NF_IP6_PRI_FIRST
+    },
+    {
+        .hook       = egress_func,
+        .hooknum    = NF_INET_LOCAL_OUT,    // locally generated packets, before routing decides the output
+        .pf         = NFPROTO_IPV4,
+        .priority   = NF_IP_PRI_FIRST
+    },
+    {
+        .hook       = egress_func,
+        .hooknum    = NF_INET_LOCAL_OUT,
+        .pf         = NFPROTO_IPV6,
+        .priority   = NF_IP6_PRI_FIRST
+    },
+};
+
+/* hooks of fw_nf_ops in use */
+static inline unsigned int fw_nf_count(void) {
+    return egress_hook ? ARRAY_SIZE(fw_nf_ops) : 2;
+}
+
+static struct nf_hook_ops ingress_ops[MAX_INGRESS_DEVS]; // .dev set while hooked, one per ingress_devs entry
+
+/* ================================================================================================
+ * device notifier -- interface modes are configured by name and looked up by ifindex, so the
+ * ruleset's map of the device's namespace is resolved again whenever a device registers, goes away
+ * or is renamed. Netdev hooks belong to one device, so they are attached as the named ingress_devs
+ * of the initial namespace register and detached before they go away. Registering the notifier
+ * replays NETDEV_REGISTER for the devices that already exist, unregistering it replays
+ * NETDEV_UNREGISTER.
+ * ================================================================================================*/
+static int netdev_notify(struct notifier_block *nb, unsigned long event, void *ptr) {
+    struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+    int i, err;
+
+    if(event == NETDEV_REGISTER || event == NETDEV_UNREGISTER || event == NETDEV_CHANGENAME) {
+        err = fw_ruleset_resolve_ifaces(fw_net(dev_net(dev)));
+        if(err) {
+            printk(KERN_INFO ">>> Interface modes not updated for %s (%d)\n", dev->name, err);
+        }
+    }
+
+    if(!net_eq(dev_net(dev), &init_net)) { return NOTIFY_DONE; }
+
+    for(i = 0; i < ingress_dev_count; i++) {
+        if(strcmp(dev->name, ingress_devs[i])) { continue; }
+
+        if(event == NETDEV_REGISTER && !ingress_ops[i].dev) {
+            ingress_ops[i].hook = ingress_func;
+            ingress_ops[i].pf = NFPROTO_NETDEV;
+            ingress_ops[i].hooknum = NF_NETDEV_INGRESS;
+            ingress_ops[i].priority = INT_MIN;
+            ingress_ops[i].dev = dev;
+
+            err = nf_register_net_hook(dev_net(dev), &ingress_ops[i]);
+            if(err) {
+                printk(KERN_INFO ">>> No ingress hook on %s (%d), it is only filtered at PRE_ROUTING\n", dev->name, err);
+                ingress_ops[i].dev = NULL;
+            }
+        } else if(event == NETDEV_UNREGISTER && ingress_ops[i].dev == dev) {
+            nf_unregister_net_hook(dev_net(dev), &ingress_ops[i]);
+            ingress_ops[i].dev = NULL;
+        }
+    }
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block netdev_notifier = {
+    .notifier_call = netdev_notify,
+};
+
+/* ================================================================================================
+ * pernet operations -- every namespace, the ones that exist at load time and the ones created
+ * later, gets its ruleset, counters, debugfs files and hooks here, and loses them when it goes
+ * away or the module is unloaded
+ * ================================================================================================*/
+
+/* Function for seeding the first ruleset of a namespace from the module parameters. The prefix
+ * and interface parameters only apply to the initial namespace, the one they were written for;
+ * every namespace lets "fragmentation needed" through.
+ * @param fn: namespace with its initial ruleset published
+ * */
+static int fw_net_seed(struct fw_net *fn) {
+    struct fw_draft *draft;
+    bool initial = net_eq(fn->net, &init_net);
+    int i, err = 0;
+
+    draft = fw_draft_begin(fn);
+    if(!draft) { return -ENOMEM; }
+
+    for(i = 0; initial && i < blocked_prefix_count; i++) {
+        err = draft_prefix_text(draft, blocked_prefixes[i], strlen(blocked_prefixes[i]));
+        if(err) {
+            printk(KERN_INFO ">>> Invalid blocked prefix: %s\n", blocked_prefixes[i]);
+            goto fail;
+        }
+    }
+
+    /* ICMP is dropped by policy, but path MTU discovery breaks without "fragmentation needed" */
+    err = fw_draft_icmp(draft, NFPROTO_IPV4, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, FW_ACTION_ACCEPT, 0, true);
+    if(err) { goto fail; }
+
+    if(initial) {
+        err = *blocked_interface ? fw_draft_iface(draft, blocked_interface, FW_IFACE_BLOCKED) : 0;
+        for(i = 0; !err && i < trusted_interface_count; i++) {
+            err = fw_draft_iface(draft, trusted_interfaces[i], FW_IFACE_TRUSTED);
+        }
+        if(err) {
+            printk(KERN_INFO ">>> Invalid interface parameters (%d)\n", err);
+            goto fail;
+        }
+    }
+
+    return fw_draft_commit(draft);
+
+fail:
+    fw_draft_abort(draft);
+    return err;
+}
+
+static int __net_init fw_net_init(struct net *net) {
+    struct fw_net *fn = fw_net(net);
+    char name[16];
+    int err;
+
+    fn->net = net;
+    fn->id = (u32)atomic_inc_return(&fw_net_count);
+    if(net_eq(net, &init_net)) {
+        fn->dir = debugfs_dir;
+    } else {
+        snprintf(name, sizeof(name), "%u", net->ns.inum);
+        fn->dir = debugfs_create_dir(name, netns_dir);
+    }
+
+    /* start from the default policy, then seed it from the module parameters */
+    err = fw_ruleset_net_init(fn);
+    if(err) { goto fail_ruleset; }
+
+    /* per-CPU counters and hook latency histograms */
+    err = fw_stats_net_init(fn);
+    if(err) { goto fail_stats; }
+
+    err = fw_net_seed(fn);
+    if(err) { goto fail_seed; }
+
+    debugfs_create_file("blocklist", 0200, fn->dir, fn, &blocklist_fops);
+    debugfs_create_file("ruleset_image", 0200, fn->dir, fn, &image_fops);
+    fw_dynblock_net_init(fn);
+
+    err = nf_register_net_hooks(net, fw_nf_ops, fw_nf_count());
+    if(err) { goto fail_seed; }
+
+    return 0;
+
+fail_seed:
+    /* the files go before what they show; those of the initial namespace go with the whole
+     * directory once the module has failed to load */
+    if(fn->dir != debugfs_dir) {
+        debugfs_remove_recursive(fn->dir);
+        fn->dir = NULL;
+    }
+    fw_stats_net_exit(fn);
+fail_stats:
+    fw_ruleset_net_exit(fn);
+fail_ruleset:
+    if(fn->dir != debugfs_dir) { debugfs_remove_recursive(fn->dir); }
+    return err;
+}
+
+static void __net_exit fw_net_exit(struct net *net) {
+    struct fw_net *fn = fw_net(net);
+
+    nf_unregister_net_hooks(net, fw_nf_ops, fw_nf_count());
+    if(fn->dir != debugfs_dir) { debugfs_remove_recursive(fn->dir); }
+    fw_nl_net_exit(fn);
+    fw_dynblock_net_exit(fn);
+    fw_stats_net_exit(fn);
+
+    /* the hooks are gone and no writer is left, nobody else can see the ruleset */
+    fw_ruleset_net_exit(fn);
+}
+
+static struct pernet_operations fw_net_ops = {
+    .init       = fw_net_init,
+    .exit       = fw_net_exit,
+    .id         = &fw_net_id,
+    .size       = sizeof(struct fw_net),
+};
+
+/* ================================================================================================
+ * entry function
+ * ================================================================================================*/
+static int __init onload(void) {
+    int err;
+
+    /* policy actions double as netfilter verdicts */
+    BUILD_BUG_ON(FW_ACTION_DROP != NF_DROP || FW_ACTION_ACCEPT != NF_ACCEPT);
+
+    debugfs_dir = debugfs_create_dir("netfilter-firewall", NULL);
+    netns_dir = debugfs_create_dir("netns", debugfs_dir);
+
+    /* per-CPU event ring, drained by tools/fw-events */
+    err = fw_events_init(debugfs_dir);
+    if(err) { goto fail_events; }
+
+    /* per-CPU flow verdict cache */
+    err = fw_flow_init(debugfs_dir);
+    if(err) { goto fail_flow; }
+
+    /* per-CPU verdicts of first fragments */
+    err = fw_frag_init(debugfs_dir);
+    if(err) { goto fail_frag; }
+
+    /* per-CPU signature matcher state of TCP flows */
+    err = fw_stream_init(debugfs_dir);
+    if(err) { goto fail_stream; }
+
+    /* token buckets of the ratelimit action, shared by all CPUs and namespaces */
+    err = fw_ratelimit_init(debugfs_dir);
+    if(err) { goto fail_ratelimit; }
+
+    /* hosts blocked for a limited time, shared by all CPUs and namespaces */
+    err = fw_dynblock_init(debugfs_dir);
+    if(err) { goto fail_dynblock; }
+
+    /* per-CPU heavy hitter tables of the initial namespace */
+    err = fw_top_init(debugfs_dir);
+    if(err) { goto fail_top; }
+
+    /* rulesets, counters and hooks of every namespace: PRE_ROUTING always, LOCAL_OUT when asked for */
+    err = register_pernet_subsys(&fw_net_ops);
+    if(err) { goto fail_pernet; }
+
+    /* control plane for tools/fwctl */
+    err = fw_nl_init();
+    if(err) { goto fail_nl; }
+
+    /* the device notifier keeps interface modes current and attaches the early-drop hooks */
+    err = register_netdevice_notifier(&netdev_notifier);
+    if(err) { goto fail_notifier; }
+
+    printk(KERN_EMERG "Loadable module initialized\n"); 
+
+    return 0;
+
+fail_notifier:
+    fw_nl_exit();
+fail_nl:
+    unregister_pernet_subsys(&fw_net_ops);
+fail_pernet:
+    fw_top_exit();
+fail_top:
+    fw_dynblock_exit();
+fail_dynblock:
+    fw_ratelimit_exit();
+fail_ratelimit:
+    fw_stream_exit();
+fail_stream:
+    fw_frag_exit();
+fail_frag:
+    fw_flow_exit();
+fail_flow:
+    fw_events_exit();
+fail_events:
+    debugfs_remove_recursive(debugfs_dir);
+    return err;
+}
+
+
+/* ================================================================================================
+ * exit function
+ * ================================================================================================*/
+static void __exit onunload(void) {
+    unregister_netdevice_notifier(&netdev_notifier);
+    fw_nl_exit();
+    unregister_pernet_subsys(&fw_net_ops);
+    fw_top_exit();
+    fw_dynblock_exit();
+    fw_ratelimit_exit();
+    fw_stream_exit();
+    fw_frag_exit();
+    fw_flow_exit();
+    fw_events_exit();
+    debugfs_remove_recursive(debugfs_dir);
+
+    printk(KERN_EMERG "Loadable module removed\n");
+}
+
+
+/* ================================================================================================
+ * register entry/exit functions
+ * ================================================================================================*/
+module_init(onload);
+module_exit(onunload);
+
+
+/* ================================================================================================
+ * metadata
+ * ================================================================================================*/
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Mark Mester <mmester@parrylabs.com>");
+MODULE_DESCRIPTION("A simple skeleton for a loadable Linux kernel module");
+
+// EOF
@@ -0,0 +1,47 @@
+/*************************************************************************************************
+ * Per-namespace state -- every network namespace gets its own ruleset, interface modes, counters
+ * and control plane transaction, kept in a struct fw_net that the module glue hangs off the
+ * namespace. The judgement core only ever sees the struct, never the namespace behind it, so it
+ * runs the same from the hooks, the KUnit suite and the userspace benchmarks.
+ *
+ * Everything per CPU or keyed by address is shared by all namespaces, so a namespace that never
+ * uses it costs nothing: the flow and fragment caches and the stream state, which tell namespaces
+ * apart by ruleset generation (generations are unique across namespaces), and the ratelimit
+ * buckets and dynamic blocks, which key their entries on the namespace's id. A container can
+ * neither use up another namespace's rates nor block its hosts. The heavy hitters only count the
+ * initial namespace, whose debugfs directory has the file; the event log is for the host's
+ * administrator and records every namespace.
+ ************************************************************************************************/
+#ifndef _FW_NET_H
+#define _FW_NET_H
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/atomic.h>
+
+struct net;
+struct dentry;
+struct fw_ruleset;
+struct fw_iface_map;
+struct fw_draft;
+struct fw_stats_cpu;
+
+struct fw_net {
+    struct net *net;                            // namespace the state belongs to
+    u32 id;                                     // tells the namespace's entries apart in the shared
+                                                // tables, never reused while the module is loaded
+    struct fw_ruleset __rcu *ruleset;           // live ruleset read by the hooks
+    struct fw_iface_map __rcu *iface_map;       // interface modes of the live ruleset by ifindex
+    struct fw_stats_cpu __percpu *stats;        // counters and hook latency histograms
+    struct fw_draft *txn;                       // open netlink transaction, NULL if none
+    u32 txn_portid;                             // socket that owns txn
+    struct dentry *dir;                         // debugfs directory of the namespace's files
+    atomic64_t icmp_tat[2][256];                // ICMP and ICMPv6 type buckets of fw_ratelimit_icmp
+};
+
+/* Function for finding the state of a namespace, defined next to the pernet operations in
+ * fw-main.c; every namespace has one for as long as the module is loaded */
+struct fw_net *fw_net(const struct net *net);
+
+#endif /* _FW_NET_H */
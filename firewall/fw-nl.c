@@ -0,0 +1,565 @@
+/*************************************************************************************************
+ * Generic netlink control plane -- the FW_GENL_NAME family.
+ *
+ * Every change is made on a draft of the live ruleset and committed as a new generation, so the
+ * hook only ever sees complete rulesets. A batch that arrives outside a transaction gets its own
+ * draft and is committed (or discarded on the first bad operation) before the reply is sent.
+ * FW_CMD_BEGIN opens a transaction owned by the sending socket; its batches accumulate in one
+ * draft until FW_CMD_COMMIT, which lets a policy too large for a single message still be applied
+ * atomically. A failed batch aborts the whole transaction, and so does closing the socket.
+ * Dynamic blocks bypass all of that and are applied as they arrive.
+ *
+ * The family is usable from every network namespace. A request works on the ruleset of the
+ * namespace its socket lives in, and each namespace has its own transaction slot, so a container
+ * with CAP_NET_ADMIN over its own namespace manages its own rules. Dynamic blocks belong to a
+ * namespace the same way, and blocking a host in one leaves the others alone.
+ *
+ * Only netlink API common to every kernel from 4.13 on is used: one family-wide policy rather than
+ * per-operation ones (5.10+), and no NLA_POLICY_EXACT_LEN (5.2+) for the IPv6 address.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/netlink.h>
+#include <linux/notifier.h>
+#include <linux/netdevice.h>
+#include <linux/in6.h>
+#include <net/net_namespace.h>
+#include <net/netlink.h>
+#include <net/genetlink.h>
+
+#include "fw-nl.h"
+#include "fw-ruleset.h"
+#include "fw-dynblock.h"
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static DEFINE_MUTEX(txn_lock);                          // protects every fw_net's txn against socket release
+
+static const struct nla_policy fw_genl_policy[FW_A_MAX + 1] = {
+    [FW_A_GENERATION]   = { .type = NLA_U32 },
+    [FW_A_OPS]          = { .type = NLA_NESTED },
+    [FW_A_OP]           = { .type = NLA_NESTED },
+    [FW_A_OP_TYPE]      = { .type = NLA_U8 },
+    [FW_A_RULE_KIND]    = { .type = NLA_U8 },
+    [FW_A_PREFIX_ADDR]  = { .type = NLA_U32 },
+    [FW_A_PREFIX_LEN]   = { .type = NLA_U8 },
+    [FW_A_POLICY]       = { .type = NLA_U8 },
+    [FW_A_ACTION]       = { .type = NLA_U8 },
+    [FW_A_IFNAME]       = { .type = NLA_NUL_STRING, .len = IFNAMSIZ - 1 },
+    [FW_A_PROTO]        = { .type = NLA_U8 },
+    [FW_A_DST_ADDR]     = { .type = NLA_U32 },
+    [FW_A_DST_LEN]      = { .type = NLA_U8 },
+    [FW_A_SPORT_MIN]    = { .type = NLA_U16 },
+    [FW_A_SPORT_MAX]    = { .type = NLA_U16 },
+    [FW_A_DPORT_MIN]    = { .type = NLA_U16 },
+    [FW_A_DPORT_MAX]    = { .type = NLA_U16 },
+    [FW_A_PATTERN]      = { .type = NLA_BINARY, .len = FW_SIG_MAXLEN },
+    [FW_A_IFACE_MODE]   = { .type = NLA_U8 },
+    [FW_A_DOMAIN]       = { .type = NLA_NUL_STRING, .len = FW_DOMAIN_MAXLEN + 1 }, // may end in a dot
+    [FW_A_ICMP_TYPE]    = { .type = NLA_U8 },
+    [FW_A_ICMP_CODE]    = { .type = NLA_U8 },
+    [FW_A_ICMP_RATE]    = { .type = NLA_U32 },
+    [FW_A_TTL]          = { .type = NLA_U32 },
+    [FW_A_PREFIX_ADDR6] = { .type = NLA_BINARY, .len = sizeof(struct in6_addr) }, // exact size checked on use
+    [FW_A_DST_ADDR6]    = { .type = NLA_BINARY, .len = sizeof(struct in6_addr) }, // exact size checked on use
+    [FW_A_FAMILY]       = { .type = NLA_U8 },
+};
+
+static struct genl_family fw_genl_family;
+
+/* ===============================================================================================
+ * operations
+ * ===============================================================================================*/
+
+/* Function for reading an optional u16 attribute */
+static inline u16 attr_u16(const struct nlattr *nla, u16 def) {
+    return nla ? nla_get_u16(nla) : def;
+}
+
+/* Function for reading an IPv6 address attribute, which has to be exactly that long */
+static inline int attr_in6(const struct nlattr *nla, struct in6_addr *addr) {
+    if(nla_len(nla) != sizeof(*addr)) { return -EINVAL; }
+    nla_memcpy(addr, nla, sizeof(*addr));
+    return 0;
+}
+
+/* Function for turning the attributes of a FW_RULE_FILTER operation into a rule
+ * @param net: namespace the request came from, the one FW_A_IFNAME is looked up in
+ * @param tb: parsed FW_A_OP attributes
+ * @param r: rule to fill in
+ * */
+static int parse_filter_rule(struct net *net, struct nlattr **tb, struct fw_rule *r) {
+    struct net_device *dev;
+    int err;
+
+    memset(r, 0, sizeof(*r));
+
+    if(!tb[FW_A_ACTION]) { return -EINVAL; }
+    r->action = nla_get_u8(tb[FW_A_ACTION]);
+
+    /* the addresses say the family, which an explicit one may not contradict */
+    if((tb[FW_A_PREFIX_ADDR] || tb[FW_A_DST_ADDR]) && (tb[FW_A_PREFIX_ADDR6] || tb[FW_A_DST_ADDR6])) {
+        return -EINVAL;
+    }
+    if(tb[FW_A_FAMILY]) { r->family = nla_get_u8(tb[FW_A_FAMILY]); }
+    if(tb[FW_A_PREFIX_ADDR] || tb[FW_A_DST_ADDR]) {
+        if(r->family && r->family != NFPROTO_IPV4) { return -EINVAL; }
+        r->family = NFPROTO_IPV4;
+    }
+    if(tb[FW_A_PREFIX_ADDR6] || tb[FW_A_DST_ADDR6]) {
+        if(r->family && r->family != NFPROTO_IPV6) { return -EINVAL; }
+        r->family = NFPROTO_IPV6;
+    }
+
+    if(tb[FW_A_PROTO]) { r->proto = nla_get_u8(tb[FW_A_PROTO]); }
+    if(tb[FW_A_PREFIX_ADDR] || tb[FW_A_PREFIX_ADDR6]) {
+        if(!tb[FW_A_PREFIX_LEN]) { return -EINVAL; }
+        if(tb[FW_A_PREFIX_ADDR]) {
+            r->src = ntohl(nla_get_be32(tb[FW_A_PREFIX_ADDR]));
+        } else {
+            err = attr_in6(tb[FW_A_PREFIX_ADDR6], &r->src6);
+            if(err) { return err; }
+        }
+        r->src_len = nla_get_u8(tb[FW_A_PREFIX_LEN]);
+    }
+    if(tb[FW_A_DST_ADDR] || tb[FW_A_DST_ADDR6]) {
+        if(!tb[FW_A_DST_LEN]) { return -EINVAL; }
+        if(tb[FW_A_DST_ADDR]) {
+            r->dst = ntohl(nla_get_be32(tb[FW_A_DST_ADDR]));
+        } else {
+            err = attr_in6(tb[FW_A_DST_ADDR6], &r->dst6);
+            if(err) { return err; }
+        }
+        r->dst_len = nla_get_u8(tb[FW_A_DST_LEN]);
+    }
+    r->sport_min = attr_u16(tb[FW_A_SPORT_MIN], 0);
+    r->sport_max = attr_u16(tb[FW_A_SPORT_MAX], 0xffff);
+    r->dport_min = attr_u16(tb[FW_A_DPORT_MIN], 0);
+    r->dport_max = attr_u16(tb[FW_A_DPORT_MAX], 0xffff);
+
+    /* rules match on the ifindex, so the interface has to exist when the rule is added */
+    if(tb[FW_A_IFNAME]) {
+        dev = dev_get_by_name(net, nla_data(tb[FW_A_IFNAME]));
+        if(!dev) { return -ENODEV; }
+        r->ifindex = dev->ifindex;
+        dev_put(dev);
+    }
+
+    return 0;
+}
+
+/* Function for applying one FW_A_OP to a draft
+ * @param d: draft
+ * @param nla: the FW_A_OP attribute
+ * */
+static int apply_op(struct fw_draft *d, const struct nlattr *nla) {
+    struct nlattr *tb[FW_A_MAX + 1];
+    struct lpm_prefix p;
+    struct lpm6_prefix p6;
+    struct fw_rule r;
+    u8 type, kind;
+    int err;
+
+    err = nla_parse_nested(tb, FW_A_MAX, nla, fw_genl_policy, NULL);
+    if(err) { return err; }
+
+    if(!tb[FW_A_OP_TYPE] || !tb[FW_A_RULE_KIND]) { return -EINVAL; }
+    type = nla_get_u8(tb[FW_A_OP_TYPE]);
+    kind = nla_get_u8(tb[FW_A_RULE_KIND]);
+
+    switch(kind) {
+        case FW_RULE_PREFIX:
+            if(type == FW_OP_FLUSH) {
+                fw_draft_flush_prefixes(d);
+                return 0;
+            }
+            if(tb[FW_A_PREFIX_ADDR6] && tb[FW_A_PREFIX_LEN]) {
+                err = attr_in6(tb[FW_A_PREFIX_ADDR6], &p6.addr);
+                if(err) { return err; }
+                p6.len = nla_get_u8(tb[FW_A_PREFIX_LEN]);
+                p6.value = 1;
+
+                return fw_draft_prefix6(d, &p6, type == FW_OP_ADD);
+            }
+            if(!tb[FW_A_PREFIX_ADDR] || !tb[FW_A_PREFIX_LEN]) { return -EINVAL; }
+
+            p.addr = ntohl(nla_get_be32(tb[FW_A_PREFIX_ADDR]));
+            p.len = nla_get_u8(tb[FW_A_PREFIX_LEN]);
+            p.value = 1;
+
+            return fw_draft_prefix(d, &p, type == FW_OP_ADD);
+
+        case FW_RULE_POLICY:
+            if(type == FW_OP_FLUSH) { return fw_draft_policy_default(d, FW_POLICY_MAX); }
+            if(!tb[FW_A_POLICY]) { return -EINVAL; }
+            if(type == FW_OP_DEL) { return fw_draft_policy_default(d, nla_get_u8(tb[FW_A_POLICY])); }
+            if(!tb[FW_A_ACTION]) { return -EINVAL; }
+
+            return fw_draft_policy(d, nla_get_u8(tb[FW_A_POLICY]), nla_get_u8(tb[FW_A_ACTION]));
+
+        case FW_RULE_IFACE:
+            if(type == FW_OP_FLUSH || (type == FW_OP_DEL && !tb[FW_A_IFNAME])) {
+                fw_draft_flush_ifaces(d);
+                return 0;
+            }
+            if(!tb[FW_A_IFNAME]) { return -EINVAL; }
+            if(type == FW_OP_DEL) { return fw_draft_iface(d, nla_data(tb[FW_A_IFNAME]), FW_IFACE_FILTER); }
+
+            return fw_draft_iface(d, nla_data(tb[FW_A_IFNAME]),
+                                  tb[FW_A_IFACE_MODE] ? nla_get_u8(tb[FW_A_IFACE_MODE]) : FW_IFACE_BLOCKED);
+
+        case FW_RULE_FILTER:
+            if(type == FW_OP_FLUSH) {
+                fw_draft_flush_rules(d);
+                return 0;
+            }
+            err = parse_filter_rule(d->fn->net, tb, &r);
+            if(err) { return err; }
+
+            return fw_draft_rule(d, &r, type == FW_OP_ADD);
+
+        case FW_RULE_SIGNATURE:
+            if(type == FW_OP_FLUSH) {
+                fw_draft_flush_signatures(d);
+                return 0;
+            }
+            if(!tb[FW_A_PATTERN]) { return -EINVAL; }
+            if(type == FW_OP_ADD && !tb[FW_A_ACTION]) { return -EINVAL; }
+
+            return fw_draft_signature(d, nla_data(tb[FW_A_PATTERN]), nla_len(tb[FW_A_PATTERN]),
+                                      tb[FW_A_ACTION] ? nla_get_u8(tb[FW_A_ACTION]) : 0,
+                                      type == FW_OP_ADD);
+
+        case FW_RULE_DOMAIN:
+            if(type == FW_OP_FLUSH) {
+                fw_draft_flush_domains(d);
+                return 0;
+            }
+            if(!tb[FW_A_DOMAIN]) { return -EINVAL; }
+            if(type == FW_OP_ADD && !tb[FW_A_ACTION]) { return -EINVAL; }
+
+            return fw_draft_domain(d, nla_data(tb[FW_A_DOMAIN]), tb[FW_A_ACTION] ? nla_get_u8(tb[FW_A_ACTION]) : 0,
+                                   type == FW_OP_ADD);
+
+        case FW_RULE_ICMP:
+            if(type == FW_OP_FLUSH) {
+                fw_draft_flush_icmp(d);
+                return 0;
+            }
+            if(!tb[FW_A_ICMP_TYPE]) { return -EINVAL; }
+            if(type == FW_OP_ADD && !tb[FW_A_ACTION]) { return -EINVAL; }
+
+            return fw_draft_icmp(d, tb[FW_A_FAMILY] ? nla_get_u8(tb[FW_A_FAMILY]) : NFPROTO_IPV4,
+                                 nla_get_u8(tb[FW_A_ICMP_TYPE]),
+                                 tb[FW_A_ICMP_CODE] ? nla_get_u8(tb[FW_A_ICMP_CODE]) : FW_ICMP_ANY_CODE,
+                                 tb[FW_A_ACTION] ? nla_get_u8(tb[FW_A_ACTION]) : 0,
+                                 tb[FW_A_ICMP_RATE] ? nla_get_u32(tb[FW_A_ICMP_RATE]) : 0, type == FW_OP_ADD);
+    }
+
+    return -EOPNOTSUPP;
+}
+
+/* Function for applying every operation of a batch to a draft */
+static int apply_ops(struct fw_draft *d, const struct nlattr *ops) {
+    const struct nlattr *op;
+    int rem, err;
+
+    nla_for_each_nested(op, ops, rem) {
+        if(nla_type(op) != FW_A_OP) { return -EINVAL; }
+
+        err = apply_op(d, op);
+        if(err) { return err; }
+    }
+
+    return 0;
+}
+
+/* Function for checking the optional FW_A_GENERATION precondition of a request */
+static int check_generation(const struct fw_draft *d, struct genl_info *info) {
+    if(info->attrs[FW_A_GENERATION] && nla_get_u32(info->attrs[FW_A_GENERATION]) != d->base_generation) {
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+/* Function for adding the interfaces of a ruleset to a reply as FW_A_IFACES */
+static int put_ifaces(struct sk_buff *msg, const struct fw_ruleset *rs) {
+    struct nlattr *list, *iface;
+    unsigned int i;
+
+    list = nla_nest_start(msg, FW_A_IFACES);
+    if(!list) { return -EMSGSIZE; }
+
+    for(i = 0; i < rs->nifaces; i++) {
+        iface = nla_nest_start(msg, FW_A_IFACE);
+        if(!iface ||
+           nla_put_string(msg, FW_A_IFNAME, rs->ifaces[i].name) ||
+           nla_put_u8(msg, FW_A_IFACE_MODE, rs->ifaces[i].mode)) {
+            return -EMSGSIZE;
+        }
+        nla_nest_end(msg, iface);
+    }
+    nla_nest_end(msg, list);
+
+    return 0;
+}
+
+/* ===============================================================================================
+ * command handlers
+ * ===============================================================================================*/
+static int fw_nl_get(struct sk_buff *skb, struct genl_info *info) {
+    struct fw_net *fn = fw_net(genl_info_net(info));
+    const struct fw_ruleset *rs;
+    struct sk_buff *msg;
+    void *hdr;
+    int err = -EMSGSIZE;
+
+    /* room for the counts plus every interface a ruleset can hold */
+    msg = genlmsg_new(NLMSG_DEFAULT_SIZE +
+                      FW_MAX_IFACES * nla_total_size(nla_total_size(IFNAMSIZ) + nla_total_size(1)), GFP_KERNEL);
+    if(!msg) { return -ENOMEM; }
+
+    hdr = genlmsg_put_reply(msg, info, &fw_genl_family, 0, FW_CMD_GET);
+    if(!hdr) { goto fail; }
+
+    rcu_read_lock();
+    rs = fw_ruleset_get(fn);
+    if(nla_put_u32(msg, FW_A_GENERATION, rs->generation) ||
+       nla_put_u32(msg, FW_A_NPREFIXES, rs->nprefixes) ||
+       nla_put_u32(msg, FW_A_NPREFIXES6, rs->nprefixes6) ||
+       nla_put_u32(msg, FW_A_NRULES, rs->nrules) ||
+       nla_put_u32(msg, FW_A_NSIGNATURES, rs->nsigs) ||
+       nla_put_u32(msg, FW_A_NDOMAINS, rs->ndomains) ||
+       nla_put_u32(msg, FW_A_NICMP, rs->nicmp) ||
+       nla_put_u32(msg, FW_A_NICMP6, rs->nicmp6) ||
+       nla_put_u32(msg, FW_A_NDYNBLOCKS, fw_dynblock_count(fn)) ||
+       nla_put(msg, FW_A_POLICIES, sizeof(rs->policy), rs->policy) ||
+       put_ifaces(msg, rs)) {
+        rcu_read_unlock();
+        goto fail;
+    }
+    rcu_read_unlock();
+
+    genlmsg_end(msg, hdr);
+    return genlmsg_reply(msg, info);
+
+fail:
+    nlmsg_free(msg);
+    return err;
+}
+
+static int fw_nl_begin(struct sk_buff *skb, struct genl_info *info) {
+    struct fw_net *fn = fw_net(genl_info_net(info));
+    struct fw_draft *d;
+    int err;
+
+    mutex_lock(&txn_lock);
+    if(fn->txn && fn->txn_portid != info->snd_portid) {
+        mutex_unlock(&txn_lock);
+        return -EBUSY;
+    }
+
+    /* a second BEGIN from the owner restarts its transaction */
+    fw_draft_abort(fn->txn);
+    fn->txn = NULL;
+
+    d = fw_draft_begin(fn);
+    if(!d) {
+        mutex_unlock(&txn_lock);
+        return -ENOMEM;
+    }
+
+    err = check_generation(d, info);
+    if(err) {
+        fw_draft_abort(d);
+    } else {
+        fn->txn = d;
+        fn->txn_portid = info->snd_portid;
+    }
+    mutex_unlock(&txn_lock);
+
+    return err;
+}
+
+static int fw_nl_batch(struct sk_buff *skb, struct genl_info *info) {
+    struct fw_net *fn = fw_net(genl_info_net(info));
+    struct fw_draft *d;
+    int err;
+
+    if(!info->attrs[FW_A_OPS]) { return -EINVAL; }
+
+    mutex_lock(&txn_lock);
+    if(fn->txn && fn->txn_portid == info->snd_portid) {
+        err = apply_ops(fn->txn, info->attrs[FW_A_OPS]);
+        if(err) {
+            fw_draft_abort(fn->txn);
+            fn->txn = NULL;
+        }
+        mutex_unlock(&txn_lock);
+        return err;
+    }
+    mutex_unlock(&txn_lock);
+
+    /* stand-alone batch: its own draft, committed right away */
+    d = fw_draft_begin(fn);
+    if(!d) { return -ENOMEM; }
+
+    err = check_generation(d, info);
+    if(!err) { err = apply_ops(d, info->attrs[FW_A_OPS]); }
+    if(err) {
+        fw_draft_abort(d);
+        return err;
+    }
+
+    return fw_draft_commit(d);
+}
+
+static int fw_nl_commit(struct sk_buff *skb, struct genl_info *info) {
+    struct fw_net *fn = fw_net(genl_info_net(info));
+    struct fw_draft *d = NULL;
+
+    mutex_lock(&txn_lock);
+    if(fn->txn && fn->txn_portid == info->snd_portid) {
+        d = fn->txn;
+        fn->txn = NULL;
+    }
+    mutex_unlock(&txn_lock);
+
+    if(!d) { return -ENOENT; }
+
+    return fw_draft_commit(d);
+}
+
+static int fw_nl_abort(struct sk_buff *skb, struct genl_info *info) {
+    struct fw_net *fn = fw_net(genl_info_net(info));
+    int err = -ENOENT;
+
+    mutex_lock(&txn_lock);
+    if(fn->txn && fn->txn_portid == info->snd_portid) {
+        fw_draft_abort(fn->txn);
+        fn->txn = NULL;
+        err = 0;
+    }
+    mutex_unlock(&txn_lock);
+
+    return err;
+}
+
+static int fw_nl_block(struct sk_buff *skb, struct genl_info *info) {
+    struct fw_net *fn = fw_net(genl_info_net(info));
+    struct in6_addr addr6;
+    int err;
+
+    if((!info->attrs[FW_A_PREFIX_ADDR] && !info->attrs[FW_A_PREFIX_ADDR6]) || !info->attrs[FW_A_TTL] ||
+       !nla_get_u32(info->attrs[FW_A_TTL])) {
+        return -EINVAL;
+    }
+
+    if(info->attrs[FW_A_PREFIX_ADDR6]) {
+        err = attr_in6(info->attrs[FW_A_PREFIX_ADDR6], &addr6);
+        if(err) { return err; }
+        fw_dynblock_add6(fn, &addr6, nla_get_u32(info->attrs[FW_A_TTL]));
+        return 0;
+    }
+    fw_dynblock_add(fn, nla_get_be32(info->attrs[FW_A_PREFIX_ADDR]), nla_get_u32(info->attrs[FW_A_TTL]));
+
+    return 0;
+}
+
+static int fw_nl_unblock(struct sk_buff *skb, struct genl_info *info) {
+    struct fw_net *fn = fw_net(genl_info_net(info));
+    struct in6_addr addr6;
+    int err;
+
+    if(info->attrs[FW_A_PREFIX_ADDR6]) {
+        err = attr_in6(info->attrs[FW_A_PREFIX_ADDR6], &addr6);
+        if(err) { return err; }
+        return fw_dynblock_del6(fn, &addr6) ? 0 : -ENOENT;
+    }
+    if(!info->attrs[FW_A_PREFIX_ADDR]) {
+        fw_dynblock_flush(fn);
+        return 0;
+    }
+
+    return fw_dynblock_del(fn, nla_get_be32(info->attrs[FW_A_PREFIX_ADDR])) ? 0 : -ENOENT;
+}
+
+/* Function for dropping a transaction whose socket went away */
+static int fw_nl_notify(struct notifier_block *nb, unsigned long event, void *ptr) {
+    struct netlink_notify *n = ptr;
+    struct fw_net *fn;
+
+    if(event != NETLINK_URELEASE || n->protocol != NETLINK_GENERIC) { return NOTIFY_DONE; }
+
+    fn = fw_net(n->net);
+    mutex_lock(&txn_lock);
+    if(fn->txn && fn->txn_portid == n->portid) {
+        fw_draft_abort(fn->txn);
+        fn->txn = NULL;
+    }
+    mutex_unlock(&txn_lock);
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block fw_nl_notifier = {
+    .notifier_call = fw_nl_notify,
+};
+
+/* commands that change anything need CAP_NET_ADMIN over the request's namespace */
+static const struct genl_ops fw_genl_ops[] = {
+    { .cmd = FW_CMD_GET,      .doit = fw_nl_get },
+    { .cmd = FW_CMD_BEGIN,    .doit = fw_nl_begin,    .flags = GENL_UNS_ADMIN_PERM },
+    { .cmd = FW_CMD_BATCH,    .doit = fw_nl_batch,    .flags = GENL_UNS_ADMIN_PERM },
+    { .cmd = FW_CMD_COMMIT,   .doit = fw_nl_commit,   .flags = GENL_UNS_ADMIN_PERM },
+    { .cmd = FW_CMD_ABORT,    .doit = fw_nl_abort,    .flags = GENL_UNS_ADMIN_PERM },
+    { .cmd = FW_CMD_BLOCK,    .doit = fw_nl_block,    .flags = GENL_UNS_ADMIN_PERM },
+    { .cmd = FW_CMD_UNBLOCK,  .doit = fw_nl_unblock,  .flags = GENL_UNS_ADMIN_PERM },
+};
+
+static struct genl_family fw_genl_family = {
+    .name       = FW_GENL_NAME,
+    .version    = FW_GENL_VERSION,
+    .maxattr    = FW_A_MAX,
+    .policy     = fw_genl_policy,
+    .netnsok    = true,
+    .module     = THIS_MODULE,
+    .ops        = fw_genl_ops,
+    .n_ops      = ARRAY_SIZE(fw_genl_ops),
+};
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+int fw_nl_init(void) {
+    int err;
+
+    err = netlink_register_notifier(&fw_nl_notifier);
+    if(err) { return err; }
+
+    err = genl_register_family(&fw_genl_family);
+    if(err) { netlink_unregister_notifier(&fw_nl_notifier); }
+
+    return err;
+}
+
+void fw_nl_exit(void) {
+    genl_unregister_family(&fw_genl_family);
+    netlink_unregister_notifier(&fw_nl_notifier);
+}
+
+/* Function for dropping the open transaction of a namespace that goes away, or of every namespace
+ * once the family is unregistered */
+void fw_nl_net_exit(struct fw_net *fn) {
+    mutex_lock(&txn_lock);
+    fw_draft_abort(fn->txn);
+    fn->txn = NULL;
+    mutex_unlock(&txn_lock);
+}
+
+// EOF
@@ -0,0 +1,13 @@
+/*************************************************************************************************
+ * Generic netlink control plane -- batched, atomic ruleset updates from userspace (tools/fwctl).
+ ************************************************************************************************/
+#ifndef _FW_NL_H
+#define _FW_NL_H
+
+#include "fw-net.h"
+
+int fw_nl_init(void);
+void fw_nl_exit(void);
+void fw_nl_net_exit(struct fw_net *fn);
+
+#endif /* _FW_NL_H */
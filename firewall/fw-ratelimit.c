@@ -0,0 +1,361 @@
+/*************************************************************************************************
+ * Per-source rate limiting -- token buckets kept as GCRA (generic cell rate algorithm) state: one
+ * 64-bit "theoretical arrival time" per source, which a packet pushes one emission interval into
+ * the future, and which may run at most ratelimit_burst intervals ahead of the clock. Checking and
+ * charging a bucket is a single cmpxchg, so sources are limited across all CPUs together without a
+ * lock, and a source hitting one CPU (the RSS case) never bounces a cache line.
+ *
+ * Buckets live in one shared 3-way set-associative table of ratelimit_entries sources. A bucket
+ * whose arrival time has fallen behind the clock is full again and holds no information, so it is
+ * free for reuse by any other source. Only when all three ways of a set belong to sources that are
+ * sending right now does a new source go without a bucket; it is then counted in a count-min sketch
+ * of packets per source and second, and limited to ratelimit_rate + ratelimit_burst packets per
+ * one-second window. The sketch never undercounts, so a flood from millions of sources stays
+ * limited in fixed memory; a quiet source that collides with loud ones in every row of the sketch
+ * can be limited along with them. Each counter carries the second it counts, and the first packet
+ * to reach it in a later second starts it over, so a new window costs no more than any other packet.
+ *
+ * ICMP types with a rate of their own get one more bucket each, shared by every source, so a flood
+ * of echo requests from a whole botnet is held to the type's rate while other types pass.
+ *
+ * A source is a namespace and an address: the namespace's id goes into the hash and the bucket of
+ * every source, and into the sketch's keys, so the same address seen by two namespaces has two
+ * buckets and one namespace's traffic never uses up another's rate. The ICMP buckets are kept in
+ * each namespace's struct fw_net.
+ *
+ * With ratelimit_block set, a source with a bucket that goes ratelimit_block_after packets over its
+ * rate without letting up is handed to the dynamic blocks for ratelimit_block seconds, and dropped
+ * before it reaches the limiter again. The count is kept loosely, racing CPUs may lose an increment,
+ * and starts over whenever the source's bucket fills up. Sources in the sketch are never blocked:
+ * the sketch cannot tell them from the sources they collide with. The block is made in the
+ * namespace whose ruleset limited the source, and only drops that namespace's packets.
+ *
+ * IPv6 sources go straight to the sketch, one counter per /64: a host picks addresses from its
+ * whole /64 at will, so buckets per address would limit nothing, and a /64 per bucket would let a
+ * scan across prefixes wipe out the buckets of the IPv4 sources.
+ *
+ *   ratelimit_stats    buckets in use, packets passed and limited per tier
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/atomic.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/netfilter.h>
+
+#include "fw-ratelimit.h"
+#include "fw-dynblock.h"
+#include "fw-net.h"
+
+#define RL_WAYS         3               // buckets per set
+#define RL_ROWS         4               // count-min sketch rows, each with its own hash
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct rl_bucket {
+    __be32 addr;                    // source address, 0 with tat 0 for an unused way
+    u32 net;                        // struct fw_net id of the namespace that sees the source
+    atomic64_t tat;                 // ns at which the bucket is full again
+};
+
+struct rl_set {
+    struct rl_bucket way[RL_WAYS];
+    u32 over[RL_WAYS];              // per way: packets over the rate since the bucket was last full
+} ____cacheline_aligned;
+
+struct rl_stats {
+    u64 passed;                     // packets within their bucket
+    u64 limited;                    // packets over their bucket
+    u64 claimed;                    // buckets handed to a new source
+    u64 sketch_passed;              // packets of sources without a bucket, within the window limit
+    u64 sketch_limited;             // same, over it
+    u64 icmp_passed;                // ICMP packets within their type's rate
+    u64 icmp_limited;               // same, over it
+    u64 blocked;                    // sources handed to the dynamic blocks
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static unsigned int ratelimit_rate = 100;               // packets per second per source
+static unsigned int ratelimit_burst = 50;               // packets a source may send back to back
+static unsigned int ratelimit_entries = 65536;          // buckets, rounded up to a power of two
+static unsigned int ratelimit_sketch = 4096;            // counters per sketch row, rounded up likewise
+static unsigned int ratelimit_block;                    // seconds a source over its rate is blocked, 0 for never
+static unsigned int ratelimit_block_after = 1000;       // packets over the rate that get a source blocked
+static struct rl_set *rl_sets;
+static u32 rl_mask;                                     // number of sets - 1
+static atomic64_t *rl_sketch;                           // RL_ROWS rows of counters, second << 32 | count
+static u32 rl_sketch_mask;                              // counters per row - 1
+static u32 rl_seed __read_mostly;                       // hash seed
+static struct rl_stats __percpu *rl_stats;
+
+module_param(ratelimit_rate, uint, 0644);
+MODULE_PARM_DESC(ratelimit_rate, "Packets per second a source gets through the ratelimit action");
+module_param(ratelimit_burst, uint, 0644);
+MODULE_PARM_DESC(ratelimit_burst, "Packets a source may send back to back under the ratelimit action");
+module_param(ratelimit_entries, uint, 0444);
+MODULE_PARM_DESC(ratelimit_entries, "Sources with an exact token bucket, about 21 bytes each");
+module_param(ratelimit_sketch, uint, 0444);
+MODULE_PARM_DESC(ratelimit_sketch, "Counters per row of the sketch for sources without a bucket");
+module_param(ratelimit_block, uint, 0644);
+MODULE_PARM_DESC(ratelimit_block, "Seconds to block a source that keeps sending over its rate, 0 to never block");
+module_param(ratelimit_block_after, uint, 0644);
+MODULE_PARM_DESC(ratelimit_block_after, "Packets over its rate, without a pause, that get a source blocked");
+
+/* ===============================================================================================
+ * limiter functions
+ * ===============================================================================================*/
+
+/* Function for charging one packet to a bucket
+ * @param tat_p: the bucket's theoretical arrival time
+ * returns true if the bucket had room for it
+ * */
+static bool bucket_charge(atomic64_t *tat_p, u64 now, u64 interval, u64 tolerance) {
+    s64 old = atomic64_read(tat_p), seen, tat;
+
+    for(;;) {
+        tat = max_t(s64, old, now) + interval;
+        if(tat - (s64)now > (s64)tolerance) { return false; }
+
+        seen = atomic64_cmpxchg(tat_p, old, tat);
+        if(seen == old) { return true; }
+
+        /* another CPU charged the bucket in between, try again against its result */
+        old = seen;
+    }
+}
+
+/* Function for counting one packet in a sketch counter
+ * @param cell: the counter, the second it counts in the upper half and the count in the lower
+ * @param window: the current second, shifted to the upper half
+ * returns the count including this packet
+ * */
+static u32 counter_charge(atomic64_t *cell, u64 window) {
+    s64 old = atomic64_read(cell), seen, val;
+
+    for(;;) {
+        /* a count left from an earlier second is stale, the packet starts it over */
+        if(((u64)old & ~0xffffffffULL) != window) { val = window | 1; }
+        else if((u32)old == U32_MAX) { return U32_MAX; }
+        else { val = old + 1; }
+
+        seen = atomic64_cmpxchg(cell, old, val);
+        if(seen == old) { return (u32)val; }
+
+        /* another CPU charged the counter in between, try again against its result */
+        old = seen;
+    }
+}
+
+/* Function for counting a packet of a source without a bucket in the current one-second window
+ * @param key: the source's IPv4 address, or a hash of its IPv6 /64
+ * @param net: id of the namespace that sees the source
+ * returns true if the source is within its rate and burst for the window
+ * */
+static bool sketch_charge(u32 key, u32 net, u64 now) {
+    u64 window = (u64)(u32)div_u64(now, NSEC_PER_SEC) << 32;
+    unsigned int i, est = UINT_MAX;
+
+    for(i = 0; i < RL_ROWS; i++) {
+        u32 h = jhash_2words(key, net, rl_seed + i) & rl_sketch_mask;
+        est = min(est, counter_charge(&rl_sketch[i * (rl_sketch_mask + 1) + h], window));
+    }
+
+    return est <= READ_ONCE(ratelimit_rate) + READ_ONCE(ratelimit_burst);
+}
+
+/* Function for deciding whether a packet of a rate limited class or rule goes through
+ * @param fn: namespace whose ruleset limits the packet
+ * @param pkt: parsed packet
+ * @param egress: the packet is locally generated, limit its destination instead of its source
+ * returns true if the packet is within its source's rate
+ * */
+bool fw_ratelimit(const struct fw_net *fn, const struct fw_pkt *pkt, bool egress) {
+    struct rl_stats *stats = this_cpu_ptr(rl_stats);
+    __be32 addr = egress ? pkt->daddr : pkt->saddr;
+    unsigned int rate = READ_ONCE(ratelimit_rate), burst = READ_ONCE(ratelimit_burst), block;
+    u64 now = ktime_get_mono_fast_ns(), interval, tolerance;
+    struct rl_set *set;
+    struct rl_bucket *b;
+    bool pass;
+    int i, idle = -1;
+
+    if(!rate) {
+        stats->limited++;
+        return false;
+    }
+    interval = div_u64(NSEC_PER_SEC, rate);
+    tolerance = interval * max(burst, 1U);
+
+    if(pkt->family == NFPROTO_IPV6) {
+        const struct in6_addr *a6 = egress ? &pkt->daddr6 : &pkt->saddr6;
+
+        pass = sketch_charge(jhash_2words(a6->s6_addr32[0], a6->s6_addr32[1], rl_seed), fn->id, now);
+        if(pass) { stats->sketch_passed++; } else { stats->sketch_limited++; }
+        return pass;
+    }
+
+    set = &rl_sets[jhash_2words((__force u32)addr, fn->id, rl_seed) & rl_mask];
+    for(i = 0; i < RL_WAYS; i++) {
+        b = &set->way[i];
+
+        if(READ_ONCE(b->addr) == addr && READ_ONCE(b->net) == fn->id) { goto charge; }
+        /* a bucket that has caught up with the clock is full, forgetting it changes nothing */
+        if(idle < 0 && atomic64_read(&b->tat) <= (s64)now) { idle = i; }
+    }
+
+    if(idle < 0) {
+        pass = sketch_charge((__force u32)addr, fn->id, now);
+        if(pass) { stats->sketch_passed++; } else { stats->sketch_limited++; }
+        return pass;
+    }
+
+    /* two CPUs claiming the same way for different sources both go on; the loser's next packet
+     * claims another */
+    i = idle;
+    b = &set->way[i];
+    WRITE_ONCE(b->addr, addr);
+    WRITE_ONCE(b->net, fn->id);
+    atomic64_set(&b->tat, now);
+    stats->claimed++;
+
+charge:
+    /* a full bucket means the source paused, its overrun starts over */
+    if(atomic64_read(&b->tat) <= (s64)now && READ_ONCE(set->over[i])) { WRITE_ONCE(set->over[i], 0); }
+
+    pass = bucket_charge(&b->tat, now, interval, tolerance);
+    if(pass) {
+        stats->passed++;
+        return true;
+    }
+    stats->limited++;
+
+    block = READ_ONCE(ratelimit_block);
+    if(block && READ_ONCE(set->over[i]) + 1 >= READ_ONCE(ratelimit_block_after)) {
+        fw_dynblock_add(fn, addr, block);
+        WRITE_ONCE(set->over[i], 0);
+        stats->blocked++;
+    } else if(block) {
+        WRITE_ONCE(set->over[i], READ_ONCE(set->over[i]) + 1);
+    }
+
+    return false;
+}
+
+/* Function for deciding whether an ICMP or ICMPv6 packet goes through its type's rate
+ * @param fn: namespace whose ruleset gives the type its rate, and which keeps the bucket
+ * @param family: NFPROTO_IPV4 or NFPROTO_IPV6, whose types are counted apart
+ * @param type: ICMP type
+ * @param rate: packets per second of the type, all sources together
+ * returns true if the packet is within the rate
+ * */
+bool fw_ratelimit_icmp(struct fw_net *fn, u8 family, u8 type, u32 rate) {
+    struct rl_stats *stats = this_cpu_ptr(rl_stats);
+    u64 now = ktime_get_mono_fast_ns(), interval = div_u64(NSEC_PER_SEC, rate);
+    bool pass;
+
+    pass = bucket_charge(&fn->icmp_tat[family == NFPROTO_IPV6][type], now, interval, interval * max(READ_ONCE(ratelimit_burst), 1U));
+    if(pass) { stats->icmp_passed++; } else { stats->icmp_limited++; }
+
+    return pass;
+}
+
+/* ===============================================================================================
+ * stats file
+ * ===============================================================================================*/
+static int ratelimit_stats_show(struct seq_file *m, void *v) {
+    struct rl_stats sum = { 0 };
+    u64 now = ktime_get_mono_fast_ns();
+    unsigned int i, busy = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        const struct rl_stats *s = per_cpu_ptr(rl_stats, cpu);
+
+        sum.passed += s->passed;
+        sum.limited += s->limited;
+        sum.claimed += s->claimed;
+        sum.sketch_passed += s->sketch_passed;
+        sum.sketch_limited += s->sketch_limited;
+        sum.icmp_passed += s->icmp_passed;
+        sum.icmp_limited += s->icmp_limited;
+        sum.blocked += s->blocked;
+    }
+
+    for(i = 0; i < (rl_mask + 1) * RL_WAYS; i++) {
+        if(atomic64_read(&rl_sets[i / RL_WAYS].way[i % RL_WAYS].tat) > (s64)now) { busy++; }
+    }
+
+    seq_printf(m, "rate: %u/s\nburst: %u\nbuckets: %u\nbuckets busy: %u\nsketch: %u x %u\nmemory: %zu KB\n",
+               READ_ONCE(ratelimit_rate), READ_ONCE(ratelimit_burst), (rl_mask + 1) * RL_WAYS, busy,
+               RL_ROWS, rl_sketch_mask + 1,
+               ((size_t)(rl_mask + 1) * sizeof(struct rl_set) + (size_t)(rl_sketch_mask + 1) * RL_ROWS * sizeof(atomic64_t)) >> 10);
+    seq_printf(m, "passed: %llu\nlimited: %llu\nclaimed: %llu\nsketch passed: %llu\nsketch limited: %llu\n",
+               sum.passed, sum.limited, sum.claimed, sum.sketch_passed, sum.sketch_limited);
+    seq_printf(m, "icmp passed: %llu\nicmp limited: %llu\n", sum.icmp_passed, sum.icmp_limited);
+    seq_printf(m, "block: %us after %u\nblocked: %llu\n", READ_ONCE(ratelimit_block),
+               READ_ONCE(ratelimit_block_after), sum.blocked);
+
+    return 0;
+}
+
+static int ratelimit_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, ratelimit_stats_show, NULL);
+}
+
+static const struct file_operations ratelimit_stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = ratelimit_stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+int fw_ratelimit_init(struct dentry *dir) {
+    unsigned int nsets = roundup_pow_of_two(max(ratelimit_entries / RL_WAYS, 1U));
+    unsigned int width = roundup_pow_of_two(max(ratelimit_sketch, 64U));
+
+    BUILD_BUG_ON(sizeof(struct rl_set) != 64);
+
+    rl_stats = alloc_percpu(struct rl_stats);
+    rl_sets = vzalloc(sizeof(struct rl_set) * nsets);
+    rl_sketch = vzalloc(sizeof(atomic64_t) * width * RL_ROWS);
+    if(!rl_stats || !rl_sets || !rl_sketch) {
+        fw_ratelimit_exit();
+        return -ENOMEM;
+    }
+    rl_mask = nsets - 1;
+    rl_sketch_mask = width - 1;
+
+    get_random_bytes(&rl_seed, sizeof(rl_seed));
+
+    debugfs_create_file("ratelimit_stats", 0444, dir, NULL, &ratelimit_stats_fops);
+
+    return 0;
+}
+
+void fw_ratelimit_exit(void) {
+    vfree(rl_sketch);
+    vfree(rl_sets);
+    free_percpu(rl_stats);
+    rl_sketch = NULL;
+    rl_sets = NULL;
+    rl_stats = NULL;
+}
+
+// EOF
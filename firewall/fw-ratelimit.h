@@ -0,0 +1,26 @@
+/*************************************************************************************************
+ * Per-source rate limiting -- the FW_ACTION_RATELIMIT action lets each source address through at
+ * up to ratelimit_rate packets per second with bursts of ratelimit_burst, and drops the excess. ICMP
+ * types can be given a rate of their own, shared by all sources. A source that stays over its rate
+ * can be put under a dynamic block. Every namespace limits its sources apart from the others.
+ ************************************************************************************************/
+#ifndef _FW_RATELIMIT_H
+#define _FW_RATELIMIT_H
+
+#include <linux/types.h>
+
+#include "fw.h"
+
+struct dentry;
+struct fw_net;
+
+int fw_ratelimit_init(struct dentry *dir);
+void fw_ratelimit_exit(void);
+
+/* Callers run with bottom halves disabled; buckets are shared between CPUs and updated lock-free,
+ * only the counters are per-CPU.
+ * returns true if the packet is within its source's rate */
+bool fw_ratelimit(const struct fw_net *fn, const struct fw_pkt *pkt, bool egress);
+bool fw_ratelimit_icmp(struct fw_net *fn, u8 family, u8 type, u32 rate);
+
+#endif /* _FW_RATELIMIT_H */
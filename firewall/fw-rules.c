@@ -0,0 +1,1195 @@
+/*************************************************************************************************
+ * Rule engine -- the ordered filter rule list grouped by address pair, pruned by per-field prefix
+ * length tables.
+ *
+ * The source and destination address each go through a table yielding the set of rule prefix
+ * lengths covering the address: one entry per /16, and under the /16s that hold longer prefixes a
+ * short sorted list of the intervals those prefixes cut the remaining 16 bits into. A rule's two
+ * prefix lengths name its (src_len, dst_len) cell, and all rules of a cell with the same two
+ * prefixes form a group; the groups of every cell share one open-addressed hash table keyed on
+ * (cell, src prefix, dst prefix), fronted by a bitmap of the hashes in use that turns most probes
+ * for an absent group away without touching the table. A packet thus costs at most one probe per
+ * nonempty cell whose lengths are in both of its length sets -- there are at most 33 x 33 cells --
+ * however many rules there are.
+ *
+ * A group holds its rules' protocol, interface and port ranges in rule order and stops at the first
+ * one that matches. Groups larger than GROUP_SCAN also get a destination port index: the port line
+ * is cut at every range boundary of the group, each interval lists the rules whose range covers
+ * it, and rules that take any port sit in a separate list, so only the rules that can match the
+ * packet's port are looked at. Groups remember their best rule, and a group that cannot beat the
+ * match found so far is skipped without reading its rules.
+ *
+ * An IPv6 classifier holds the rules for IPv6 packets: those with IPv6 prefixes and those naming
+ * no address at all. Its groups sit in a table of their own, keyed on the full 128-bit prefixes,
+ * and it has no length tables; instead it keeps its nonempty cells in the order of their best rule
+ * and probes them one after the other, stopping at the first cell that cannot beat the match found
+ * so far. A packet costs at most one probe per distinct pair of IPv6 prefix lengths in use, which
+ * real rule sets keep to a handful (/0, /32, /48, /56, /64, /128), however many rules there are.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/bitops.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/netfilter.h>
+#include <net/ipv6.h>
+
+#include "fw-rules.h"
+
+#define LEN_CELLS           33          // prefix lengths 0..32
+#define LEN_CELLS6          129         // IPv6 prefix lengths 0..128
+#define LEN_ROOT            (1 << 16)   // length table entries, one per /16
+#define LEN_CHILD           0x80000000U // length table entry points at ranges
+#define GROUP_SCAN          16          // groups up to this many rules are scanned without a port index
+#define GROUP_NOINDEX       0xffffffff
+#define FILTER_BITS         4           // hash bitmap bits per table slot
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+
+/* the non-address part of a rule, as kept in its group */
+struct rule_rec {
+    u32 rule;                       // rule index
+    u32 proto_ifindex;              // proto in the low 8 bits, ifindex above, 0 = any
+    u16 sport_min, sport_max;
+    u16 dport_min, dport_max;
+};
+
+/* the rules of a group */
+struct group_rules {
+    u32 best;                       // lowest rule index held
+    u32 first;                      // first record in recs, records are in rule order
+    u32 count;                      // number of records
+    u32 index;                      // port index, GROUP_NOINDEX when the group is scanned
+};
+
+/* rules sharing both prefixes, stored in the hash table itself */
+struct rule_group {
+    u32 hash;                       // 0 marks an empty slot
+    u32 src;                        // source prefix, masked
+    u32 dst;                        // destination prefix, masked
+    u32 cell;                       // src_len * LEN_CELLS + dst_len
+    struct group_rules r;
+};
+
+/* the same for IPv6 prefixes */
+struct rule_group6 {
+    u32 hash;                       // 0 marks an empty slot
+    u32 cell;                       // src_len * LEN_CELLS6 + dst_len
+    struct in6_addr src;            // source prefix, masked
+    struct in6_addr dst;            // destination prefix, masked
+    struct group_rules r;
+};
+
+/* nonempty cell of an IPv6 classifier */
+struct cell6 {
+    u32 best;                       // lowest rule index of any of its groups
+    u8 src_len;
+    u8 dst_len;
+};
+
+/* destination port index of a large group */
+struct group_index {
+    u32 nint;                       // port intervals
+    u32 bounds;                     // first of the nint - 1 interval boundaries in bounds
+    u32 offs;                       // first of the nint + 2 list offsets in offs, the last list takes any port
+};
+
+/* interval of the low 16 address bits under a /16 that holds longer prefixes. The first range of a
+ * /16 always starts at 0, so its start holds the number of ranges instead. */
+struct len_range {
+    u32 start;
+    u32 lens;                       // index into lens
+};
+
+/* per-field table mapping an address to the rule prefix lengths that cover it */
+struct len_table {
+    u32 *root;                      // per /16: index into lens, or LEN_CHILD | first range
+    struct len_range *ranges;
+    u64 *lens;                      // distinct length sets, bit n set: a rule prefix of length n covers
+    unsigned int nranges;
+    unsigned int nlens;
+};
+
+struct fw_classifier {
+    u8 family;                      // NFPROTO_IPV4 or NFPROTO_IPV6, the packets it classifies
+    struct len_table src;
+    struct len_table dst;
+    u64 cell_dst[LEN_CELLS];        // per source length, the destination lengths of its nonempty cells
+    struct rule_group *table;       // open-addressed groups
+    struct rule_group6 *table6;     // the same in an IPv6 classifier, which has no table
+    struct cell6 *cells6;           // nonempty cells of an IPv6 classifier by best rule, ncells of them
+    u32 size_mask;                  // table slots - 1
+    unsigned long *filter;          // bit (hash & filter_mask) set: some group has that hash
+    u32 filter_mask;
+    unsigned int ngroups;
+    struct rule_rec *recs;          // one per rule
+    unsigned int nrecs;
+    struct group_index *index;
+    unsigned int nindex;
+    u16 *bounds;                    // first port of each interval but the first
+    u32 *offs;                      // start of each interval's list in cand, plus the end of the last
+    u32 *cand;                      // record indices
+    unsigned int nbounds, noffs, ncand;
+    unsigned int ncells;
+    u32 seed;
+    size_t memory;
+};
+
+/* build time entry, one per rule */
+struct build_entry {
+    u32 cell;
+    u32 src;
+    u32 dst;
+    u32 rule;
+};
+
+/* the same for an IPv6 classifier */
+struct build_entry6 {
+    u32 cell;
+    u32 rule;
+    struct in6_addr src;
+    struct in6_addr dst;
+};
+
+/* build time prefix of one address field */
+struct len_prefix {
+    u32 addr;
+    u32 len;
+};
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+static inline u32 prefix_mask(unsigned int len) {
+    return len ? ~0U << (32 - len) : 0;
+}
+
+static inline bool ports_any(u16 min, u16 max) {
+    return min == 0 && max == 0xffff;
+}
+
+static inline bool rule_has_ports(const struct fw_rule *r) {
+    return !ports_any(r->sport_min, r->sport_max) || !ports_any(r->dport_min, r->dport_max);
+}
+
+static inline bool proto_has_ports(u8 proto) {
+    return proto == IPPROTO_TCP || proto == IPPROTO_UDP;
+}
+
+/* Function for masking an IPv6 address down to a prefix, a 32-bit word at a time */
+static inline void prefix6_mask(struct in6_addr *out, const struct in6_addr *addr, unsigned int len) {
+    unsigned int i;
+
+    for(i = 0; i < 4; i++, len = len > 32 ? len - 32 : 0) {
+        out->s6_addr32[i] = addr->s6_addr32[i] & htonl(prefix_mask(min(len, 32U)));
+    }
+}
+
+static inline u32 group6_hash(u32 cell, const struct in6_addr *src, const struct in6_addr *dst, u32 seed) {
+    const u32 *s = (const u32 *)src->s6_addr32, *d = (const u32 *)dst->s6_addr32;
+    u32 h;
+
+    h = jhash_3words(s[0], s[1], s[2], seed);
+    h = jhash_3words(s[3], d[0], d[1], h);
+    h = jhash_3words(d[2], d[3], cell, h);
+
+    return h ? h : 1;
+}
+
+static inline u32 group_hash(u32 cell, u32 src, u32 dst, u32 seed) {
+    u32 h = jhash_3words(src, dst, cell, seed);
+
+    return h ? h : 1;
+}
+
+static inline bool same_group(const struct build_entry *a, const struct build_entry *b) {
+    return a->cell == b->cell && a->src == b->src && a->dst == b->dst;
+}
+
+static inline bool same_group6(const struct build_entry6 *a, const struct build_entry6 *b) {
+    return a->cell == b->cell && ipv6_addr_equal(&a->src, &b->src) && ipv6_addr_equal(&a->dst, &b->dst);
+}
+
+/* Sort callback ordering entries by cell, prefixes, then rule index */
+static int entry_cmp(const void *a, const void *b) {
+    const struct build_entry *ea = a, *eb = b;
+
+    if(ea->cell != eb->cell) { return ea->cell < eb->cell ? -1 : 1; }
+    if(ea->src != eb->src) { return ea->src < eb->src ? -1 : 1; }
+    if(ea->dst != eb->dst) { return ea->dst < eb->dst ? -1 : 1; }
+    if(ea->rule != eb->rule) { return ea->rule < eb->rule ? -1 : 1; }
+    return 0;
+}
+
+static int entry6_cmp(const void *a, const void *b) {
+    const struct build_entry6 *ea = a, *eb = b;
+    int d;
+
+    if(ea->cell != eb->cell) { return ea->cell < eb->cell ? -1 : 1; }
+    d = memcmp(&ea->src, &eb->src, sizeof(ea->src));
+    if(d) { return d; }
+    d = memcmp(&ea->dst, &eb->dst, sizeof(ea->dst));
+    if(d) { return d; }
+    if(ea->rule != eb->rule) { return ea->rule < eb->rule ? -1 : 1; }
+    return 0;
+}
+
+/* Sort callback ordering cells by their best rule */
+static int cell6_cmp(const void *a, const void *b) {
+    const struct cell6 *ca = a, *cb = b;
+
+    return ca->best < cb->best ? -1 : ca->best > cb->best;
+}
+
+/* Sort callback ordering prefixes by address then length */
+static int prefix_cmp(const void *a, const void *b) {
+    const struct len_prefix *pa = a, *pb = b;
+
+    if(pa->addr != pb->addr) { return pa->addr < pb->addr ? -1 : 1; }
+    return (int)pa->len - (int)pb->len;
+}
+
+static int u64_cmp(const void *a, const void *b) {
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int port_cmp(const void *a, const void *b) {
+    return (int)*(const u16 *)a - (int)*(const u16 *)b;
+}
+
+/* ===============================================================================================
+ * per-field tables
+ * ===============================================================================================*/
+
+/* Function for finding the index of a length set among the sorted distinct ones */
+static u32 lens_find(const struct len_table *lt, u64 set) {
+    unsigned int lo = 0, hi = lt->nlens, mid;
+
+    while(hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if(lt->lens[mid] <= set) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* Function for cutting the low 16 bits of a /16 into ranges by the longer prefixes inside it
+ * @param p: the /16's prefixes longer than 16, sorted and distinct
+ * @param n: number of prefixes
+ * @param base: length set of the whole /16
+ * @param out: ranges to append to, their lens still holding the length set itself
+ * @param sets: length sets of the ranges, in the same order
+ * returns the number of ranges written
+ * */
+static unsigned int len_cut(const struct len_prefix *p, unsigned int n, u64 base, struct len_range *out, u64 *sets) {
+    struct { u32 end; u64 set; } stack[LEN_CELLS];
+    unsigned int i, depth = 0, k = 0;
+    u32 pos = 0, s, e;
+
+/* a range from pos on, merged into the previous one when its set is the same */
+#define LEN_EMIT(set_) do {                                                 \
+        if(!k || sets[k - 1] != (set_)) {                                   \
+            out[k].start = pos;                                             \
+            sets[k++] = (set_);                                             \
+        }                                                                   \
+    } while(0)
+
+    for(i = 0; i < n; i++) {
+        s = p[i].addr & 0xffff;
+        e = s + (1U << (32 - p[i].len));
+
+        /* close the prefixes that end before this one starts */
+        while(depth && stack[depth - 1].end <= s) {
+            if(pos < stack[depth - 1].end) {
+                LEN_EMIT(stack[depth - 1].set);
+                pos = stack[depth - 1].end;
+            }
+            depth--;
+        }
+        if(pos < s) {
+            LEN_EMIT(depth ? stack[depth - 1].set : base);
+            pos = s;
+        }
+
+        stack[depth].end = e;
+        stack[depth].set = (depth ? stack[depth - 1].set : base) | 1ULL << p[i].len;
+        depth++;
+    }
+    while(depth) {
+        if(pos < stack[depth - 1].end) {
+            LEN_EMIT(stack[depth - 1].set);
+            pos = stack[depth - 1].end;
+        }
+        depth--;
+    }
+    if(pos < LEN_ROOT) { LEN_EMIT(base); }
+#undef LEN_EMIT
+
+    return k;
+}
+
+/* Function for building the prefix length table of one address field
+ * @param lt: table to build
+ * @param e: build entries of the rules to take the prefixes from
+ * @param count: number of entries
+ * @param dst: true for the destination field, false for the source
+ * returns the bytes kept after the build, or -ENOMEM
+ * */
+static long len_table_build(struct len_table *lt, const struct build_entry *e, unsigned int count, bool dst) {
+    struct len_prefix *p;
+    u32 *root;
+    u64 *rsets = NULL, *sets = NULL;
+    unsigned int i, j, k, n = 0, nlong = 0, hi;
+    long err = -ENOMEM;
+
+    p = vmalloc(sizeof(*p) * (count + 1));
+    root = vzalloc(sizeof(*root) * LEN_ROOT);
+    lt->root = vzalloc(sizeof(*lt->root) * LEN_ROOT);
+    if(!p || !root || !lt->root) { goto out; }
+
+    for(i = 0; i < count; i++) {
+        p[n].len = dst ? e[i].cell % LEN_CELLS : e[i].cell / LEN_CELLS;
+        p[n].addr = dst ? e[i].dst : e[i].src;
+        n++;
+    }
+    sort(p, n, sizeof(*p), prefix_cmp, NULL);
+
+    /* drop duplicates, spread the /16 and shorter prefixes over the /16s they cover */
+    for(i = 0, k = 0; i < n; i++) {
+        if(k && p[i].addr == p[k - 1].addr && p[i].len == p[k - 1].len) { continue; }
+        p[k++] = p[i];
+
+        if(p[i].len > 16) {
+            nlong++;
+            continue;
+        }
+        for(j = p[i].addr >> 16; j < (p[i].addr >> 16) + (1U << (16 - p[i].len)); j++) {
+            root[j] |= 1U << p[i].len;
+        }
+    }
+    n = k;
+
+    /* every longer prefix cuts at most two more ranges into its /16, which has at least one */
+    lt->ranges = vmalloc(sizeof(*lt->ranges) * (3 * nlong + 1));
+    rsets = vmalloc(sizeof(*rsets) * (3 * nlong + 1));
+    sets = vmalloc(sizeof(*sets) * (LEN_ROOT + 3 * nlong));
+    if(!lt->ranges || !rsets || !sets) { goto out; }
+
+    for(i = 0; i < n; i = j) {
+        hi = p[i].addr >> 16;
+        for(j = i; j < n && p[j].addr >> 16 == hi; j++) {}
+        if(p[j - 1].len <= 16) { continue; }
+
+        /* the /16 itself and its shorter prefixes come first in (addr, len) order */
+        for(k = i; p[k].len <= 16; k++) {}
+        k = len_cut(&p[k], j - k, root[hi], &lt->ranges[lt->nranges], &rsets[lt->nranges]);
+        lt->ranges[lt->nranges].start = k;
+        lt->root[hi] = LEN_CHILD | lt->nranges;
+        lt->nranges += k;
+    }
+
+    /* the distinct length sets, sorted, then every entry and range pointed at its set */
+    for(i = 0, n = 0; i < LEN_ROOT; i++) {
+        if(!i || root[i] != root[i - 1]) { sets[n++] = root[i]; }
+    }
+    memcpy(&sets[n], rsets, sizeof(*rsets) * lt->nranges);
+    n += lt->nranges;
+    sort(sets, n, sizeof(*sets), u64_cmp, NULL);
+    for(i = 1, k = 1; i < n; i++) {
+        if(sets[i] != sets[k - 1]) { sets[k++] = sets[i]; }
+    }
+    lt->nlens = k;
+
+    lt->lens = vmalloc(sizeof(*lt->lens) * lt->nlens);
+    if(!lt->lens) { goto out; }
+    memcpy(lt->lens, sets, sizeof(*lt->lens) * lt->nlens);
+
+    for(i = 0; i < LEN_ROOT; i++) {
+        if(!(lt->root[i] & LEN_CHILD)) { lt->root[i] = lens_find(lt, root[i]); }
+    }
+    for(i = 0; i < lt->nranges; i++) { lt->ranges[i].lens = lens_find(lt, rsets[i]); }
+    err = 0;
+
+out:
+    vfree(p);
+    vfree(root);
+    vfree(rsets);
+    vfree(sets);
+    if(err) { return err; }
+
+    return sizeof(*lt->root) * LEN_ROOT + sizeof(*lt->ranges) * (3 * nlong + 1) + sizeof(*lt->lens) * lt->nlens;
+}
+
+static void len_table_free(struct len_table *lt) {
+    vfree(lt->root);
+    vfree(lt->ranges);
+    vfree(lt->lens);
+}
+
+/* Function for looking up the prefix lengths of a field's rules that cover an address */
+static inline u64 len_table_lookup(const struct len_table *lt, u32 addr) {
+    const struct len_range *r;
+    u32 v = lt->root[addr >> 16], low = addr & 0xffff, lo, hi, mid;
+
+    if(v & LEN_CHILD) {
+        /* the last range starting at or below the address */
+        r = &lt->ranges[v & ~LEN_CHILD];
+        for(lo = 0, hi = r[0].start; hi - lo > 1;) {
+            mid = (lo + hi) / 2;
+            if(r[mid].start <= low) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        v = r[lo].lens;
+    }
+
+    return lt->lens[v];
+}
+
+/* ===============================================================================================
+ * groups
+ * ===============================================================================================*/
+
+/* Function for finding the interval of a port: the number of boundaries at or below it */
+static inline unsigned int bounds_find(const u16 *bounds, unsigned int nbounds, u16 port) {
+    unsigned int lo = 0, hi = nbounds, mid;
+
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        if(bounds[mid] <= port) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+/* Function for collecting the destination port boundaries of a group
+ * @param c: classifier being built
+ * @param g: group
+ * @param out: room for two boundaries per record
+ * returns the number of distinct boundaries, sorted into out
+ * */
+static unsigned int group_cuts(const struct fw_classifier *c, const struct group_rules *g, u16 *out) {
+    unsigned int i, n = 0, k;
+
+    for(i = g->first; i < g->first + g->count; i++) {
+        const struct rule_rec *r = &c->recs[i];
+
+        if(ports_any(r->dport_min, r->dport_max)) { continue; }
+        if(r->dport_min) { out[n++] = r->dport_min; }
+        if(r->dport_max < 0xffff) { out[n++] = r->dport_max + 1; }
+    }
+    sort(out, n, sizeof(*out), port_cmp, NULL);
+
+    for(i = 0, k = 0; i < n; i++) {
+        if(!k || out[i] != out[k - 1]) { out[k++] = out[i]; }
+    }
+
+    return k;
+}
+
+/* Function for counting the list entries the port index of a group takes
+ * @param c: classifier being built
+ * @param g: group
+ * @param cuts: scratch room for two boundaries per record
+ * @param nbounds: set to the number of boundaries
+ * */
+static unsigned long group_index_size(const struct fw_classifier *c, const struct group_rules *g, u16 *cuts,
+                                      unsigned int *nbounds) {
+    unsigned long n = 0;
+    unsigned int i;
+
+    *nbounds = group_cuts(c, g, cuts);
+
+    for(i = g->first; i < g->first + g->count; i++) {
+        const struct rule_rec *r = &c->recs[i];
+
+        if(ports_any(r->dport_min, r->dport_max)) {
+            n++;
+        } else {
+            n += bounds_find(cuts, *nbounds, r->dport_max) - bounds_find(cuts, *nbounds, r->dport_min) + 1;
+        }
+    }
+
+    return n;
+}
+
+/* Function for building the port index of a large group
+ * @param c: classifier being built, with room left in bounds, offs and cand
+ * @param g: group
+ * @param gi: index to fill, its bounds and offs set to where it goes
+ * @param cand: next free entry of c->cand
+ * @param cuts: scratch room for two boundaries per record
+ * @param cur: scratch of nint + 1 list cursors
+ * returns the next free entry of c->cand
+ * */
+static u32 group_index_fill(struct fw_classifier *c, const struct group_rules *g, struct group_index *gi, u32 cand,
+                            u16 *cuts, u32 *cur) {
+    u16 *bounds = &c->bounds[gi->bounds];
+    u32 *offs = &c->offs[gi->offs];
+    unsigned int nb = group_cuts(c, g, cuts), i, j, j0, j1;
+
+    memcpy(bounds, cuts, sizeof(*bounds) * nb);
+    gi->nint = nb + 1;
+
+    /* count each list, then turn the counts into offsets */
+    memset(offs, 0, sizeof(*offs) * (gi->nint + 2));
+    for(i = g->first; i < g->first + g->count; i++) {
+        const struct rule_rec *r = &c->recs[i];
+
+        if(ports_any(r->dport_min, r->dport_max)) {
+            offs[gi->nint + 1]++;
+            continue;
+        }
+        j1 = bounds_find(bounds, nb, r->dport_max);
+        for(j = bounds_find(bounds, nb, r->dport_min); j <= j1; j++) { offs[j + 1]++; }
+    }
+    offs[0] = cand;
+    for(j = 0; j <= gi->nint; j++) {
+        offs[j + 1] += offs[j];
+        cur[j] = offs[j];
+    }
+
+    /* records come in rule order, and so every list keeps it */
+    for(i = g->first; i < g->first + g->count; i++) {
+        const struct rule_rec *r = &c->recs[i];
+
+        if(ports_any(r->dport_min, r->dport_max)) {
+            c->cand[cur[gi->nint]++] = i;
+            continue;
+        }
+        j0 = bounds_find(bounds, nb, r->dport_min);
+        j1 = bounds_find(bounds, nb, r->dport_max);
+        for(j = j0; j <= j1; j++) { c->cand[cur[j]++] = i; }
+    }
+
+    return offs[gi->nint + 1];
+}
+
+/* Function for building the port indexes of every group larger than GROUP_SCAN
+ * @param c: classifier being built
+ * @param groups: its groups
+ * returns 0, -E2BIG when the lists would hold too many entries or -ENOMEM
+ * */
+static int groups_index(struct fw_classifier *c, struct group_rules *groups) {
+    unsigned long total = 0;
+    unsigned int i, nb, maxcount = 0, b = 0, o = 0, n = 0;
+    u32 cand = 0, *cur;
+    u16 *cuts;
+
+    for(i = 0; i < c->ngroups; i++) {
+        groups[i].index = GROUP_NOINDEX;
+        if(groups[i].count <= GROUP_SCAN) { continue; }
+
+        c->nindex++;
+        if(groups[i].count > maxcount) { maxcount = groups[i].count; }
+    }
+    if(!c->nindex) { return 0; }
+
+    cuts = vmalloc(sizeof(*cuts) * 2 * maxcount);
+    cur = vmalloc(sizeof(*cur) * (2 * maxcount + 2));
+    if(!cuts || !cur) { goto nomem; }
+
+    for(i = 0; i < c->ngroups; i++) {
+        if(groups[i].count <= GROUP_SCAN) { continue; }
+
+        total += group_index_size(c, &groups[i], cuts, &nb);
+        if(total > FW_MAX_RULE_ENTRIES) {
+            vfree(cuts);
+            vfree(cur);
+            return -E2BIG;
+        }
+        c->nbounds += nb;
+        c->noffs += nb + 3;
+    }
+    c->ncand = total;
+
+    c->index = vmalloc(sizeof(*c->index) * c->nindex);
+    c->bounds = vmalloc(sizeof(*c->bounds) * (c->nbounds + 1));
+    c->offs = vmalloc(sizeof(*c->offs) * c->noffs);
+    c->cand = vmalloc(sizeof(*c->cand) * c->ncand);
+    if(!c->index || !c->bounds || !c->offs || !c->cand) { goto nomem; }
+    c->memory += sizeof(*c->index) * c->nindex + sizeof(*c->bounds) * c->nbounds + sizeof(*c->offs) * c->noffs +
+                 sizeof(*c->cand) * c->ncand;
+
+    for(i = 0; i < c->ngroups; i++) {
+        struct group_index *gi = &c->index[n];
+
+        if(groups[i].count <= GROUP_SCAN) { continue; }
+
+        groups[i].index = n++;
+        gi->bounds = b;
+        gi->offs = o;
+        cand = group_index_fill(c, &groups[i], gi, cand, cuts, cur);
+        b += gi->nint - 1;
+        o += gi->nint + 2;
+    }
+
+    vfree(cuts);
+    vfree(cur);
+    return 0;
+
+nomem:
+    vfree(cuts);
+    vfree(cur);
+    return -ENOMEM;
+}
+
+/* Function for filling in the record of a rule */
+static void rec_fill(struct rule_rec *rec, const struct fw_rule *r, u32 rule) {
+    rec->rule = rule;
+    rec->proto_ifindex = r->proto | r->ifindex << 8;
+    rec->sport_min = r->sport_min;
+    rec->sport_max = r->sport_max;
+    rec->dport_min = r->dport_min;
+    rec->dport_max = r->dport_max;
+}
+
+/* Function for allocating the records, group bodies and hash table of a classifier once its
+ * groups are counted
+ * @param c: classifier being built, ngroups set
+ * @param count: number of records
+ * @param slot: size of a hash table slot
+ * @param groups: set to ngroups zeroed group bodies, for the caller to free
+ * returns 0 or -ENOMEM
+ * */
+static int groups_alloc(struct fw_classifier *c, unsigned int count, size_t slot, struct group_rules **groups) {
+    void *table;
+
+    c->size_mask = roundup_pow_of_two(c->ngroups * 2) - 1;
+    c->filter_mask = (c->size_mask + 1) * FILTER_BITS - 1;
+
+    *groups = vzalloc(sizeof(**groups) * c->ngroups);
+    c->recs = vmalloc(sizeof(*c->recs) * count);
+    table = vzalloc(slot * (c->size_mask + 1));
+    c->filter = vzalloc(BITS_TO_LONGS(c->filter_mask + 1) * sizeof(unsigned long));
+    if(c->family == NFPROTO_IPV6) { c->table6 = table; } else { c->table = table; }
+    if(!*groups || !c->recs || !table || !c->filter) {
+        vfree(*groups);
+        return -ENOMEM;
+    }
+    c->nrecs = count;
+    c->memory += sizeof(*c->recs) * count + slot * (c->size_mask + 1) +
+                 BITS_TO_LONGS(c->filter_mask + 1) * sizeof(unsigned long);
+
+    return 0;
+}
+
+/* Function for building the groups, their port indexes and their hash table
+ * @param c: classifier being built
+ * @param rules: rules
+ * @param e: one entry per rule, sorted
+ * @param count: number of entries
+ * returns 0, -E2BIG or -ENOMEM
+ * */
+static int groups_build(struct fw_classifier *c, const struct fw_rule *rules, const struct build_entry *e,
+                        unsigned int count) {
+    struct group_rules *groups, *g;
+    struct rule_group *slot;
+    unsigned int i, n;
+    int err;
+
+    for(i = 1, c->ngroups = 1; i < count; i++) {
+        if(!same_group(&e[i], &e[i - 1])) { c->ngroups++; }
+    }
+
+    err = groups_alloc(c, count, sizeof(*c->table), &groups);
+    if(err) { return err; }
+
+    for(i = 0, n = 0; i < count; i++) {
+        if(i && !same_group(&e[i], &e[i - 1])) { n++; }
+        g = &groups[n];
+        if(!g->count) {
+            g->best = e[i].rule;
+            g->first = i;
+        }
+        g->count++;
+        rec_fill(&c->recs[i], &rules[e[i].rule], e[i].rule);
+    }
+
+    err = groups_index(c, groups);
+    if(err) {
+        vfree(groups);
+        return err;
+    }
+
+    /* the table keeps the groups themselves, a hit costs no further lookup */
+    for(i = 0; i < c->ngroups; i++) {
+        const struct build_entry *k = &e[groups[i].first];
+        u32 h = group_hash(k->cell, k->src, k->dst, c->seed);
+
+        for(n = h & c->size_mask; c->table[n].hash; n = (n + 1) & c->size_mask) {}
+        slot = &c->table[n];
+        slot->hash = h;
+        slot->src = k->src;
+        slot->dst = k->dst;
+        slot->cell = k->cell;
+        slot->r = groups[i];
+        __set_bit(h & c->filter_mask, c->filter);
+
+        if(!(c->cell_dst[k->cell / LEN_CELLS] & 1ULL << (k->cell % LEN_CELLS))) { c->ncells++; }
+        c->cell_dst[k->cell / LEN_CELLS] |= 1ULL << (k->cell % LEN_CELLS);
+    }
+    vfree(groups);
+
+    return 0;
+}
+
+/* Function for building the groups, port indexes, hash table and cell list of an IPv6 classifier
+ * @param c: classifier being built
+ * @param rules: rules
+ * @param e: one entry per rule, sorted
+ * @param count: number of entries
+ * returns 0, -E2BIG or -ENOMEM
+ * */
+static int groups_build6(struct fw_classifier *c, const struct fw_rule *rules, const struct build_entry6 *e,
+                         unsigned int count) {
+    struct group_rules *groups, *g;
+    struct rule_group6 *slot;
+    unsigned int i, n;
+    int err;
+
+    for(i = 1, c->ngroups = 1, c->ncells = 1; i < count; i++) {
+        if(!same_group6(&e[i], &e[i - 1])) { c->ngroups++; }
+        if(e[i].cell != e[i - 1].cell) { c->ncells++; }
+    }
+
+    err = groups_alloc(c, count, sizeof(*c->table6), &groups);
+    if(err) { return err; }
+    c->cells6 = vmalloc(sizeof(*c->cells6) * c->ncells);
+    if(!c->cells6) {
+        vfree(groups);
+        return -ENOMEM;
+    }
+    c->memory += sizeof(*c->cells6) * c->ncells;
+
+    /* entries are sorted by cell first, so each cell's entries are one run */
+    for(i = 0, n = 0; i < count; i++) {
+        if(i && !same_group6(&e[i], &e[i - 1])) { n++; }
+        g = &groups[n];
+        if(!g->count) {
+            g->best = e[i].rule;
+            g->first = i;
+        }
+        g->count++;
+        rec_fill(&c->recs[i], &rules[e[i].rule], e[i].rule);
+    }
+
+    err = groups_index(c, groups);
+    if(err) {
+        vfree(groups);
+        return err;
+    }
+
+    for(i = 0, n = 0; i < c->ngroups; i++) {
+        const struct build_entry6 *k = &e[groups[i].first];
+        u32 h = group6_hash(k->cell, &k->src, &k->dst, c->seed), j;
+
+        for(j = h & c->size_mask; c->table6[j].hash; j = (j + 1) & c->size_mask) {}
+        slot = &c->table6[j];
+        slot->hash = h;
+        slot->cell = k->cell;
+        slot->src = k->src;
+        slot->dst = k->dst;
+        slot->r = groups[i];
+        __set_bit(h & c->filter_mask, c->filter);
+
+        if(i && k->cell == e[groups[i - 1].first].cell) {
+            c->cells6[n - 1].best = min(c->cells6[n - 1].best, groups[i].best);
+            continue;
+        }
+        c->cells6[n].best = groups[i].best;
+        c->cells6[n].src_len = k->cell / LEN_CELLS6;
+        c->cells6[n].dst_len = k->cell % LEN_CELLS6;
+        n++;
+    }
+    vfree(groups);
+    sort(c->cells6, c->ncells, sizeof(*c->cells6), cell6_cmp, NULL);
+
+    return 0;
+}
+
+/* ===============================================================================================
+ * rule functions
+ * ===============================================================================================*/
+
+/* Function for checking that a rule is well formed */
+int fw_rule_validate(const struct fw_rule *r) {
+    static const struct in6_addr any6;
+    unsigned int maxlen = r->family == NFPROTO_IPV6 ? 128 : 32;
+
+    if(r->family && r->family != NFPROTO_IPV4 && r->family != NFPROTO_IPV6) { return -EINVAL; }
+    if(r->src_len > maxlen || r->dst_len > maxlen) { return -EINVAL; }
+
+    /* a rule's prefixes are of its own family */
+    if(r->family == NFPROTO_IPV6 ? r->src || r->dst :
+       !ipv6_addr_equal(&r->src6, &any6) || !ipv6_addr_equal(&r->dst6, &any6)) {
+        return -EINVAL;
+    }
+    if(r->sport_min > r->sport_max || r->dport_min > r->dport_max) { return -EINVAL; }
+    if(r->action >= FW_ACTION_MAX || r->action == FW_ACTION_FLAG) { return -EINVAL; }
+    if(r->ifindex > 0xffffff) { return -EINVAL; }
+
+    /* ports restrict a rule to TCP and UDP; anything else can never carry them */
+    if(r->proto && !proto_has_ports(r->proto) && rule_has_ports(r)) { return -EINVAL; }
+
+    return 0;
+}
+
+/* Function for matching a single rule against a packet -- the reference semantics the classifier
+ * must reproduce */
+bool fw_rule_match(const struct fw_rule *r, const struct fw_pkt *pkt) {
+    struct in6_addr a6, p6;
+    u8 family = fw_rule_family(r);
+
+    if(family && family != pkt->family) { return false; }
+    if(r->proto && r->proto != pkt->proto) { return false; }
+    if(rule_has_ports(r) && !proto_has_ports(pkt->proto)) { return false; }
+    if(r->ifindex && r->ifindex != pkt->ifindex) { return false; }
+    if(family == NFPROTO_IPV6) {
+        prefix6_mask(&a6, &pkt->saddr6, r->src_len);
+        prefix6_mask(&p6, &r->src6, r->src_len);
+        if(!ipv6_addr_equal(&a6, &p6)) { return false; }
+        prefix6_mask(&a6, &pkt->daddr6, r->dst_len);
+        prefix6_mask(&p6, &r->dst6, r->dst_len);
+        if(!ipv6_addr_equal(&a6, &p6)) { return false; }
+    } else {
+        if((ntohl(pkt->saddr) ^ r->src) & prefix_mask(r->src_len)) { return false; }
+        if((ntohl(pkt->daddr) ^ r->dst) & prefix_mask(r->dst_len)) { return false; }
+    }
+    if(pkt->sport < r->sport_min || pkt->sport > r->sport_max) { return false; }
+    if(pkt->dport < r->dport_min || pkt->dport > r->dport_max) { return false; }
+
+    return true;
+}
+
+/* Function for evaluating the rule list one rule at a time
+ * returns the index of the first matching rule, or FW_RULE_NONE
+ * */
+u32 fw_classify_linear(const struct fw_rule *rules, unsigned int count, const struct fw_pkt *pkt) {
+    unsigned int i;
+
+    for(i = 0; i < count; i++) {
+        if(fw_rule_match(&rules[i], pkt)) { return i; }
+    }
+
+    return FW_RULE_NONE;
+}
+
+/* ===============================================================================================
+ * classifier functions
+ * ===============================================================================================*/
+
+/* Function for compiling the IPv6 rules of a rule list
+ * @param c: classifier being built
+ * @param rules: validated rules in priority order
+ * @param count: number of rules
+ * returns 0, -E2BIG or -ENOMEM
+ * */
+static int classifier_build6(struct fw_classifier *c, const struct fw_rule *rules, unsigned int count) {
+    struct build_entry6 *e;
+    unsigned int i, n = 0;
+    int err;
+
+    for(i = 0; i < count; i++) {
+        if(fw_rule_family(&rules[i]) != NFPROTO_IPV4) { n++; }
+    }
+    if(!n) { return 0; }
+
+    e = vmalloc(sizeof(*e) * n);
+    if(!e) { return -ENOMEM; }
+
+    for(i = 0, n = 0; i < count; i++) {
+        if(fw_rule_family(&rules[i]) == NFPROTO_IPV4) { continue; }
+
+        e[n].cell = rules[i].src_len * LEN_CELLS6 + rules[i].dst_len;
+        prefix6_mask(&e[n].src, &rules[i].src6, rules[i].src_len);
+        prefix6_mask(&e[n].dst, &rules[i].dst6, rules[i].dst_len);
+        e[n].rule = i;
+        n++;
+    }
+    sort(e, n, sizeof(*e), entry6_cmp, NULL);
+
+    err = groups_build6(c, rules, e, n);
+    vfree(e);
+
+    return err;
+}
+
+/* Function for compiling the IPv4 rules of a rule list, see classifier_build6() */
+static int classifier_build4(struct fw_classifier *c, const struct fw_rule *rules, unsigned int count) {
+    struct build_entry *e;
+    unsigned int i, n = 0;
+    long bytes;
+    int err = 0;
+
+    for(i = 0; i < count; i++) {
+        if(fw_rule_family(&rules[i]) != NFPROTO_IPV6) { n++; }
+    }
+    if(!n) { return 0; }
+
+    e = vmalloc(sizeof(*e) * n);
+    if(!e) { return -ENOMEM; }
+
+    for(i = 0, n = 0; i < count; i++) {
+        if(fw_rule_family(&rules[i]) == NFPROTO_IPV6) { continue; }
+
+        e[n].cell = rules[i].src_len * LEN_CELLS + rules[i].dst_len;
+        e[n].src = rules[i].src & prefix_mask(rules[i].src_len);
+        e[n].dst = rules[i].dst & prefix_mask(rules[i].dst_len);
+        e[n].rule = i;
+        n++;
+    }
+
+    for(i = 0; i < 2 && !err; i++) {
+        bytes = len_table_build(i ? &c->dst : &c->src, e, n, i);
+        if(bytes < 0) {
+            err = bytes;
+        } else {
+            c->memory += bytes;
+        }
+    }
+    if(!err) {
+        sort(e, n, sizeof(*e), entry_cmp, NULL);
+        err = groups_build(c, rules, e, n);
+    }
+    vfree(e);
+
+    return err;
+}
+
+/* Function for compiling a rule list into a classifier for one family's packets: the rules of
+ * that family and those naming no address
+ * @param rules: validated rules in priority order
+ * @param count: number of rules
+ * @param family: NFPROTO_IPV4 or NFPROTO_IPV6
+ * @param out: set to the new classifier
+ * returns 0, -E2BIG when port ranges expand to too many index entries or -ENOMEM
+ * */
+int fw_classifier_build(const struct fw_rule *rules, unsigned int count, u8 family, struct fw_classifier **out) {
+    struct fw_classifier *c;
+    int err;
+
+    c = kzalloc(sizeof(*c), GFP_KERNEL);
+    if(!c) { return -ENOMEM; }
+    get_random_bytes(&c->seed, sizeof(c->seed));
+    c->family = family;
+    c->memory = sizeof(*c);
+
+    err = family == NFPROTO_IPV6 ? classifier_build6(c, rules, count) : classifier_build4(c, rules, count);
+    if(err) {
+        fw_classifier_free(c);
+        return err;
+    }
+
+    *out = c;
+    return 0;
+}
+
+/* Function for releasing a classifier; callers must have waited out an RCU grace period first */
+void fw_classifier_free(struct fw_classifier *c) {
+    if(!c) { return; }
+
+    len_table_free(&c->src);
+    len_table_free(&c->dst);
+    vfree(c->table);
+    vfree(c->table6);
+    vfree(c->cells6);
+    vfree(c->filter);
+    vfree(c->recs);
+    vfree(c->index);
+    vfree(c->bounds);
+    vfree(c->offs);
+    vfree(c->cand);
+    kfree(c);
+}
+
+size_t fw_classifier_memory(const struct fw_classifier *c) {
+    return c->memory;
+}
+
+/* Function for counting the nonempty (src_len, dst_len) cells, the most probes a packet can take */
+unsigned int fw_classifier_subtables(const struct fw_classifier *c) {
+    return c->ncells;
+}
+
+/* Function for matching the non-address part of a rule against a packet */
+static inline bool rec_match(const struct rule_rec *r, const struct fw_pkt *pkt) {
+    u32 proto = r->proto_ifindex & 0xff, ifindex = r->proto_ifindex >> 8;
+
+    if(proto && proto != pkt->proto) { return false; }
+    if(ifindex && ifindex != pkt->ifindex) { return false; }
+    if(!ports_any(r->sport_min, r->sport_max) || !ports_any(r->dport_min, r->dport_max)) {
+        if(!proto_has_ports(pkt->proto)) { return false; }
+        if(pkt->sport < r->sport_min || pkt->sport > r->sport_max) { return false; }
+        if(pkt->dport < r->dport_min || pkt->dport > r->dport_max) { return false; }
+    }
+
+    return true;
+}
+
+/* Function for scanning a list of records in rule order, stopping at the first match or at the
+ * first rule that cannot beat the best one found so far */
+static inline void list_lookup(const struct fw_classifier *c, const u32 *list, const u32 *end,
+                               const struct fw_pkt *pkt, u32 *best) {
+    for(; list < end; list++) {
+        const struct rule_rec *r = &c->recs[*list];
+
+        if(r->rule >= *best) { return; }
+        if(rec_match(r, pkt)) {
+            *best = r->rule;
+            return;
+        }
+    }
+}
+
+/* Function for matching a packet against the rules of a group
+ * @param c: classifier
+ * @param g: group whose prefixes the packet is in
+ * @param pkt: packet
+ * @param best: best rule found so far, lowered on a better match
+ * */
+static inline void group_lookup(const struct fw_classifier *c, const struct group_rules *g, const struct fw_pkt *pkt,
+                                u32 *best) {
+    const struct group_index *gi;
+    const u32 *offs;
+    unsigned int i, j;
+
+    if(g->best >= *best) { return; }
+
+    if(g->index == GROUP_NOINDEX) {
+        for(i = g->first; i < g->first + g->count; i++) {
+            const struct rule_rec *r = &c->recs[i];
+
+            if(r->rule >= *best) { return; }
+            if(rec_match(r, pkt)) {
+                *best = r->rule;
+                return;
+            }
+        }
+        return;
+    }
+
+    /* the rules whose destination ports cover the packet's, then those that take any port */
+    gi = &c->index[g->index];
+    offs = &c->offs[gi->offs];
+    j = bounds_find(&c->bounds[gi->bounds], gi->nint - 1, pkt->dport);
+    list_lookup(c, &c->cand[offs[j]], &c->cand[offs[j + 1]], pkt, best);
+    list_lookup(c, &c->cand[offs[gi->nint]], &c->cand[offs[gi->nint + 1]], pkt, best);
+}
+
+/* Function for finding the group of a cell holding a pair of masked addresses
+ * returns the group, or NULL
+ * */
+static inline const struct rule_group *group_find(const struct fw_classifier *c, u32 cell, u32 src, u32 dst) {
+    u32 h = group_hash(cell, src, dst, c->seed), i;
+    const struct rule_group *g;
+
+    if(!test_bit(h & c->filter_mask, c->filter)) { return NULL; }
+
+    for(i = h & c->size_mask; c->table[i].hash; i = (i + 1) & c->size_mask) {
+        g = &c->table[i];
+        if(g->hash == h && g->src == src && g->dst == dst && g->cell == cell) { return g; }
+    }
+
+    return NULL;
+}
+
+/* Function for finding the first rule matching a packet
+ * returns the rule index, or FW_RULE_NONE
+ * */
+u32 fw_classify(const struct fw_classifier *c, const struct fw_pkt *pkt) {
+    const struct rule_group *g;
+    u32 best = FW_RULE_NONE, src, dst;
+    u64 src_lens, dst_lens;
+
+    if(!c->ngroups) { return FW_RULE_NONE; }
+
+    src = ntohl(pkt->saddr);
+    dst = ntohl(pkt->daddr);
+
+    /* only nonempty cells whose prefix lengths cover both addresses can hold a match */
+    src_lens = len_table_lookup(&c->src, src);
+    dst_lens = len_table_lookup(&c->dst, dst);
+
+    for(; src_lens; src_lens &= src_lens - 1) {
+        unsigned int sl = __ffs64(src_lens);
+        u64 d;
+
+        for(d = dst_lens & c->cell_dst[sl]; d; d &= d - 1) {
+            unsigned int dl = __ffs64(d);
+
+            g = group_find(c, sl * LEN_CELLS + dl, src & prefix_mask(sl), dst & prefix_mask(dl));
+            if(g) { group_lookup(c, &g->r, pkt, &best); }
+        }
+    }
+
+    return best;
+}
+
+/* Function for finding the group of an IPv6 cell holding a pair of masked addresses
+ * returns the group, or NULL
+ * */
+static inline const struct rule_group6 *group6_find(const struct fw_classifier *c, u32 cell, const struct in6_addr *src,
+                                                    const struct in6_addr *dst) {
+    u32 h = group6_hash(cell, src, dst, c->seed), i;
+    const struct rule_group6 *g;
+
+    if(!test_bit(h & c->filter_mask, c->filter)) { return NULL; }
+
+    for(i = h & c->size_mask; c->table6[i].hash; i = (i + 1) & c->size_mask) {
+        g = &c->table6[i];
+        if(g->hash == h && g->cell == cell && ipv6_addr_equal(&g->src, src) && ipv6_addr_equal(&g->dst, dst)) {
+            return g;
+        }
+    }
+
+    return NULL;
+}
+
+/* Function for finding the first rule matching an IPv6 packet
+ * returns the rule index, or FW_RULE_NONE
+ * */
+u32 fw_classify6(const struct fw_classifier *c, const struct fw_pkt *pkt) {
+    const struct rule_group6 *g;
+    struct in6_addr src, dst;
+    u32 best = FW_RULE_NONE;
+    unsigned int i;
+
+    for(i = 0; i < c->ncells; i++) {
+        const struct cell6 *cell = &c->cells6[i];
+
+        /* cells come by best rule, none after this one can beat the match */
+        if(cell->best >= best) { break; }
+
+        prefix6_mask(&src, &pkt->saddr6, cell->src_len);
+        prefix6_mask(&dst, &pkt->daddr6, cell->dst_len);
+        g = group6_find(c, cell->src_len * LEN_CELLS6 + cell->dst_len, &src, &dst);
+        if(g) { group_lookup(c, &g->r, pkt, &best); }
+    }
+
+    return best;
+}
+
+// EOF
@@ -0,0 +1,71 @@
+/*************************************************************************************************
+ * Rule engine -- compiles an ordered list of filter rules (proto, IPv4 or IPv6 src/dst prefix, port
+ * ranges, input interface, action) into one classifier per family whose per-packet cost depends on
+ * the header fields and mask shapes in use, not on the number of rules.
+ ************************************************************************************************/
+#ifndef _FW_RULES_H
+#define _FW_RULES_H
+
+#include <linux/types.h>
+#include <linux/in6.h>
+#include <linux/netfilter.h>
+
+#include "fw.h"
+#include "fw-uapi.h"
+
+/* ===============================================================================================
+ * defines
+ * ===============================================================================================*/
+#define FW_RULE_NONE        0xffffffff  // no rule matched
+#define FW_MAX_RULES        FW_MAX_FILTER_RULES
+#define FW_MAX_RULE_ENTRIES (1 << 24)   // classifier entries once port ranges are split into classes
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+
+/* A filter rule. Rules are matched in list order, the first match wins. Port ranges only apply to
+ * TCP and UDP: a rule with a port range and proto 0 matches TCP and UDP only. The prefixes are
+ * src and dst for an IPv4 rule, src6 and dst6 for an IPv6 one, with src_len and dst_len their
+ * lengths either way. A rule of family 0 is an IPv4 rule if it has a prefix and holds for both
+ * families if it has none. */
+struct fw_rule {
+    u32 src;                        // source prefix, host byte order
+    u32 dst;                        // destination prefix, host byte order
+    u8 src_len;                     // source prefix length, 0 = any
+    u8 dst_len;                     // destination prefix length, 0 = any
+    u8 proto;                       // IP protocol, 0 = any
+    u8 action;                      // enum fw_action
+    u16 sport_min, sport_max;       // source port range, 0-65535 = any
+    u16 dport_min, dport_max;       // destination port range, 0-65535 = any
+    u32 ifindex;                    // input interface, 0 = any
+    u8 family;                      // NFPROTO_IPV4, NFPROTO_IPV6 or 0, see above
+    u8 pad[3];                      // zero, rules are compared whole
+    struct in6_addr src6;           // IPv6 source prefix, network byte order
+    struct in6_addr dst6;           // IPv6 destination prefix, network byte order
+};
+
+struct fw_classifier;
+
+/* Function for telling which packets a rule is for
+ * returns NFPROTO_IPV4 or NFPROTO_IPV6, 0 for both
+ * */
+static inline u8 fw_rule_family(const struct fw_rule *r) {
+    return r->family ? r->family : r->src_len || r->dst_len ? NFPROTO_IPV4 : 0;
+}
+
+/* ===============================================================================================
+ * functions
+ * ===============================================================================================*/
+int fw_rule_validate(const struct fw_rule *r);
+bool fw_rule_match(const struct fw_rule *r, const struct fw_pkt *pkt);
+
+int fw_classifier_build(const struct fw_rule *rules, unsigned int count, u8 family, struct fw_classifier **out);
+void fw_classifier_free(struct fw_classifier *c);
+size_t fw_classifier_memory(const struct fw_classifier *c);
+unsigned int fw_classifier_subtables(const struct fw_classifier *c);
+u32 fw_classify(const struct fw_classifier *c, const struct fw_pkt *pkt);
+u32 fw_classify6(const struct fw_classifier *c, const struct fw_pkt *pkt);
+u32 fw_classify_linear(const struct fw_rule *rules, unsigned int count, const struct fw_pkt *pkt);
+
+#endif /* _FW_RULES_H */
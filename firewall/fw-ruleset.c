@@ -0,0 +1,1140 @@
+/*************************************************************************************************
+ * Rulesets -- drafts, commits and the RCU-published live ruleset.
+ *
+ * Prefix operations are not applied one by one. A draft records them in arrival order and the
+ * commit sorts them, keeps the last operation per prefix and merges the result with the sorted
+ * base list in one pass, so a batch of m changes against n prefixes costs O((n + m) log m)
+ * followed by a single LPM build. IPv6 prefixes and DNS domains are drafted and merged the same way.
+ *
+ * Filter rules are one list for both families. The commit builds a classifier per family from the
+ * rules for it, both leading back to the rules' index in the list, so a rule without an address
+ * counts the packets of both families. ICMP and ICMPv6 entries are lists of their own, each compiled
+ * into a table of one action per type and code.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/netdevice.h>
+#include <linux/icmpv6.h>
+#include <net/net_namespace.h>
+#include <net/ndisc.h>
+
+#include "fw-ruleset.h"
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+struct fw_prefix_op {
+    struct lpm_prefix p;            // canonical prefix, host bits cleared
+    u32 seq;                        // position in the draft, later operations win
+    bool add;
+};
+
+struct fw_prefix6_op {
+    struct lpm6_prefix p;           // canonical prefix, host bits cleared
+    u32 seq;                        // position in the draft, later operations win
+    bool add;
+};
+
+struct fw_domain_op {
+    struct fw_domain dom;           // canonical domain, name in the draft's rs->domain_names
+    const char *name;               // the name itself, only set while the commit sorts
+    u32 seq;                        // position in the draft, later operations win
+    bool add;
+};
+
+static DEFINE_MUTEX(ruleset_lock);                      // serializes commits and interface map updates
+static u32 ruleset_generation;                          // last generation handed out, in any namespace
+
+/* accept TCP, DNS (unless its question matches a domain) and other protocols, drop the rest of
+ * UDP and ICMP */
+static const u8 default_policy[FW_POLICY_MAX] = {
+    [FW_POLICY_TCP]     = FW_ACTION_ACCEPT,
+    [FW_POLICY_UDP]     = FW_ACTION_DROP,
+    [FW_POLICY_DNS]     = FW_ACTION_ACCEPT,
+    [FW_POLICY_ICMP]    = FW_ACTION_DROP,
+    [FW_POLICY_OTHER]   = FW_ACTION_ACCEPT,
+};
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+
+/* Function for freeing a ruleset and everything it owns; callers must have waited out an RCU grace
+ * period if it was ever live */
+void fw_ruleset_free(struct fw_ruleset *rs) {
+    if(!rs) { return; }
+
+    lpm_free(rs->blocklist);
+    fw_hostset_free(rs->hosts);
+    vfree(rs->prefixes);
+    lpm_free(rs->blocklist6);
+    vfree(rs->prefixes6);
+    fw_classifier_free(rs->classifier);
+    fw_classifier_free(rs->classifier6);
+    vfree(rs->rules);
+    fw_stats_rules_free(rs->rule_counters);
+    fw_ac_free(rs->matcher);
+    vfree(rs->sigs);
+    vfree(rs->ifaces);
+    fw_dns_free(rs->domain_trie);
+    vfree(rs->domains);
+    vfree(rs->domain_names);
+    vfree(rs->icmp);
+    vfree(rs->icmp_table);
+    vfree(rs->icmp6);
+    vfree(rs->icmp6_table);
+    kfree(rs);
+}
+
+/* Function for copying the first n elements of an array into a new allocation
+ * @param dst: set to the copy, NULL if n is 0
+ * @param src: array to copy
+ * @param n: elements to copy
+ * @param size: size of an element
+ * */
+static int array_dup(void **dst, const void *src, unsigned int n, size_t size) {
+    *dst = NULL;
+    if(!n) { return 0; }
+
+    *dst = vmalloc(size * n);
+    if(!*dst) { return -ENOMEM; }
+    memcpy(*dst, src, size * n);
+
+    return 0;
+}
+
+/* Function for making room for one more element at the end of an array
+ * @param arr: array, reallocated when full
+ * @param n: elements in use
+ * @param max: elements allocated, updated on growth
+ * @param size: size of an element
+ * @param limit: most elements the array may hold
+ * */
+static int array_grow(void **arr, unsigned int n, unsigned int *max, size_t size, unsigned int limit) {
+    unsigned int newmax;
+    void *p;
+
+    if(n < *max) { return 0; }
+    if(n >= limit) { return -E2BIG; }
+
+    newmax = min_t(unsigned int, *max ? *max * 2 : 64, limit);
+    p = vmalloc(size * newmax);
+    if(!p) { return -ENOMEM; }
+
+    if(*arr) {
+        memcpy(p, *arr, size * n);
+        vfree(*arr);
+    }
+    *arr = p;
+    *max = newmax;
+
+    return 0;
+}
+
+/* Sort callback ordering prefixes by address then length */
+static int prefix_key_cmp(const struct lpm_prefix *a, const struct lpm_prefix *b) {
+    if(a->addr != b->addr) { return a->addr < b->addr ? -1 : 1; }
+    return (int)a->len - (int)b->len;
+}
+
+/* Sort callback ordering operations by prefix, then by arrival */
+static int prefix_op_cmp(const void *a, const void *b) {
+    const struct fw_prefix_op *oa = a, *ob = b;
+    int c = prefix_key_cmp(&oa->p, &ob->p);
+
+    if(c) { return c; }
+    return oa->seq < ob->seq ? -1 : 1;
+}
+
+/* Function for merging a draft's operations into its sorted base prefix list
+ * @param d: draft; d->rs->prefixes is replaced by the merged list
+ * */
+static int draft_merge(struct fw_draft *d) {
+    struct lpm_prefix *base = d->rs->prefixes, *out = NULL;
+    unsigned int nbase = d->rs->nprefixes, i = 0, j = 0, n = 0;
+
+    if(!d->nops) { return 0; }
+
+    sort(d->ops, d->nops, sizeof(*d->ops), prefix_op_cmp, NULL);
+
+    out = vmalloc(sizeof(*out) * (nbase + d->nops));
+    if(!out) { return -ENOMEM; }
+
+    while(i < nbase || j < d->nops) {
+        const struct lpm_prefix *key;
+        const struct fw_prefix_op *last = NULL;
+        bool present = false;
+
+        if(j == d->nops || (i < nbase && prefix_key_cmp(&base[i], &d->ops[j].p) <= 0)) {
+            key = &base[i];
+        } else {
+            key = &d->ops[j].p;
+        }
+
+        if(i < nbase && !prefix_key_cmp(&base[i], key)) {
+            present = true;
+            i++;
+        }
+        while(j < d->nops && !prefix_key_cmp(&d->ops[j].p, key)) {
+            last = &d->ops[j++];
+        }
+        if(last) { present = last->add; }
+
+        if(present) {
+            out[n] = last ? last->p : *key;
+            out[n++].value = 1;
+        }
+    }
+
+    if(n > FW_MAX_PREFIXES) {
+        vfree(out);
+        return -E2BIG;
+    }
+
+    vfree(base);
+    d->rs->prefixes = out;
+    d->rs->nprefixes = n;
+    d->nops = 0;
+
+    return 0;
+}
+
+/* Sort callback ordering IPv6 prefixes by address then length */
+static int prefix6_key_cmp(const struct lpm6_prefix *a, const struct lpm6_prefix *b) {
+    int c = memcmp(&a->addr, &b->addr, sizeof(a->addr));
+
+    return c ? c : (int)a->len - (int)b->len;
+}
+
+/* Sort callback ordering IPv6 operations by prefix, then by arrival */
+static int prefix6_op_cmp(const void *a, const void *b) {
+    const struct fw_prefix6_op *oa = a, *ob = b;
+    int c = prefix6_key_cmp(&oa->p, &ob->p);
+
+    if(c) { return c; }
+    return oa->seq < ob->seq ? -1 : 1;
+}
+
+/* Function for merging a draft's IPv6 prefix operations into its sorted base list, the way
+ * draft_merge does IPv4 prefixes
+ * @param d: draft; d->rs->prefixes6 is replaced by the merged list
+ * */
+static int draft_merge6(struct fw_draft *d) {
+    struct lpm6_prefix *base = d->rs->prefixes6, *out = NULL;
+    unsigned int nbase = d->rs->nprefixes6, i = 0, j = 0, n = 0;
+
+    if(!d->nops6) { return 0; }
+
+    sort(d->ops6, d->nops6, sizeof(*d->ops6), prefix6_op_cmp, NULL);
+
+    out = vmalloc(sizeof(*out) * (nbase + d->nops6));
+    if(!out) { return -ENOMEM; }
+
+    while(i < nbase || j < d->nops6) {
+        const struct lpm6_prefix *key;
+        const struct fw_prefix6_op *last = NULL;
+        bool present = false;
+
+        if(j == d->nops6 || (i < nbase && prefix6_key_cmp(&base[i], &d->ops6[j].p) <= 0)) {
+            key = &base[i];
+        } else {
+            key = &d->ops6[j].p;
+        }
+
+        if(i < nbase && !prefix6_key_cmp(&base[i], key)) {
+            present = true;
+            i++;
+        }
+        while(j < d->nops6 && !prefix6_key_cmp(&d->ops6[j].p, key)) {
+            last = &d->ops6[j++];
+        }
+        if(last) { present = last->add; }
+
+        if(present) {
+            out[n] = last ? last->p : *key;
+            out[n++].value = 1;
+        }
+    }
+
+    if(n > FW_MAX_PREFIXES6) {
+        vfree(out);
+        return -E2BIG;
+    }
+
+    vfree(base);
+    d->rs->prefixes6 = out;
+    d->rs->nprefixes6 = n;
+    d->nops6 = 0;
+
+    return 0;
+}
+
+/* Function for ordering domain names, bytewise */
+static int domain_name_cmp(const char *a, unsigned int alen, const char *b, unsigned int blen) {
+    int c = memcmp(a, b, min(alen, blen));
+
+    return c ? c : (int)alen - (int)blen;
+}
+
+/* Sort callback ordering domain operations by name, then by arrival */
+static int domain_op_cmp(const void *a, const void *b) {
+    const struct fw_domain_op *oa = a, *ob = b;
+    int c = domain_name_cmp(oa->name, oa->dom.len, ob->name, ob->dom.len);
+
+    if(c) { return c; }
+    return oa->seq < ob->seq ? -1 : 1;
+}
+
+/* Function for merging a draft's domain operations into its sorted base list, the way draft_merge
+ * does prefixes, and copying the names that are left into a new list without gaps
+ * @param d: draft; d->rs->domains and d->rs->domain_names are replaced
+ * */
+static int domain_merge(struct fw_draft *d) {
+    struct fw_ruleset *rs = d->rs;
+    const struct fw_domain *base = rs->domains, *keep;
+    const struct fw_domain_op *ops = d->domain_ops, *first, *last;
+    struct fw_domain *out;
+    char *names;
+    unsigned int nbase = rs->ndomains, nops = d->ndomain_ops, i = 0, j = 0, n = 0, len = 0;
+    int c;
+
+    if(!nops) { return 0; }
+
+    for(j = 0; j < nops; j++) { d->domain_ops[j].name = rs->domain_names + ops[j].dom.name; }
+    sort(d->domain_ops, nops, sizeof(*ops), domain_op_cmp, NULL);
+
+    /* what is left never takes more room than the base and every operation together */
+    out = vmalloc(sizeof(*out) * (nbase + nops));
+    names = vmalloc(rs->domain_names_len);
+    if(!out || !names) {
+        vfree(out);
+        vfree(names);
+        return -ENOMEM;
+    }
+
+    j = 0;
+    while(i < nbase || j < nops) {
+        if(i == nbase) {
+            c = 1;
+        } else if(j == nops) {
+            c = -1;
+        } else {
+            c = domain_name_cmp(rs->domain_names + base[i].name, base[i].len, ops[j].name, ops[j].dom.len);
+        }
+
+        keep = c <= 0 ? &base[i++] : NULL;
+        if(c >= 0) {
+            first = last = &ops[j];
+            while(j < nops && !domain_name_cmp(ops[j].name, ops[j].dom.len, first->name, first->dom.len)) {
+                last = &ops[j++];
+            }
+            keep = last->add ? &last->dom : NULL;
+        }
+
+        if(keep) {
+            out[n] = *keep;
+            out[n++].name = len;
+            memcpy(names + len, rs->domain_names + keep->name, keep->len);
+            len += keep->len;
+        }
+    }
+
+    if(n > FW_MAX_DOMAINS) {
+        vfree(out);
+        vfree(names);
+        return -E2BIG;
+    }
+
+    vfree(rs->domains);
+    vfree(rs->domain_names);
+    rs->domains = out;
+    rs->ndomains = n;
+    rs->domain_names = names;
+    rs->domain_names_len = d->maxdomain_names = len;
+    d->ndomain_ops = 0;
+
+    return 0;
+}
+
+/* Function for compiling the payload signatures of a ruleset into one automaton */
+static int ruleset_compile_signatures(struct fw_ruleset *rs) {
+    struct fw_ac_pattern *patterns;
+    unsigned int i;
+    int err;
+
+    if(!rs->nsigs) { return 0; }
+
+    patterns = vmalloc(sizeof(*patterns) * rs->nsigs);
+    if(!patterns) { return -ENOMEM; }
+
+    for(i = 0; i < rs->nsigs; i++) {
+        patterns[i].data = rs->sigs[i].pattern;
+        patterns[i].len = rs->sigs[i].len;
+    }
+    err = fw_ac_build(patterns, rs->nsigs, &rs->matcher);
+    vfree(patterns);
+
+    return err;
+}
+
+/* Function for compiling the blocked prefixes of a ruleset: /32s into the exact-match set, the
+ * rest into the LPM table, which would need a child table for nearly every scattered host */
+static int ruleset_compile_prefixes(struct fw_ruleset *rs) {
+    struct lpm_prefix *tmp = NULL;
+    u32 *hosts = NULL;
+    unsigned int i, nnets = 0, nhosts = 0;
+
+    /* lpm_build reorders its input, keep the canonical sorted list intact */
+    if(rs->nprefixes) {
+        tmp = vmalloc(sizeof(*tmp) * rs->nprefixes);
+        hosts = vmalloc(sizeof(*hosts) * rs->nprefixes);
+        if(!tmp || !hosts) {
+            vfree(tmp);
+            vfree(hosts);
+            return -ENOMEM;
+        }
+    }
+
+    for(i = 0; i < rs->nprefixes; i++) {
+        if(rs->prefixes[i].len == 32) {
+            hosts[nhosts++] = rs->prefixes[i].addr;
+        } else {
+            tmp[nnets++] = rs->prefixes[i];
+        }
+    }
+
+    rs->blocklist = lpm_build(tmp, nnets);
+    rs->hosts = fw_hostset_build(hosts, nhosts);
+    vfree(tmp);
+    vfree(hosts);
+
+    return rs->blocklist && rs->hosts ? 0 : -ENOMEM;
+}
+
+/* Function for compiling the blocked IPv6 prefixes of a ruleset, if it has any */
+static int ruleset_compile_prefixes6(struct fw_ruleset *rs) {
+    struct lpm6_prefix *tmp;
+
+    if(!rs->nprefixes6) { return 0; }
+
+    /* lpm6_build reorders its input as well */
+    tmp = vmalloc(sizeof(*tmp) * rs->nprefixes6);
+    if(!tmp) { return -ENOMEM; }
+    memcpy(tmp, rs->prefixes6, sizeof(*tmp) * rs->nprefixes6);
+
+    rs->blocklist6 = lpm6_build(tmp, rs->nprefixes6);
+    vfree(tmp);
+
+    return rs->blocklist6 ? 0 : -ENOMEM;
+}
+
+/* Function for compiling the ICMP or ICMPv6 entries and policy of a ruleset into one action per
+ * type and code, so the hook finds a packet's with a single load however the entries overlap
+ * @param rs: ruleset, for its policy
+ * @param family: NFPROTO_IPV4 or NFPROTO_IPV6
+ * @param icmp, count: entries of the family
+ * @param table: set to the compiled actions by type << 8 | code, NULL if there are no entries
+ * @param rates: set to the packets per second per type, part of the table
+ * */
+static int ruleset_compile_icmp(const struct fw_ruleset *rs, u8 family, const struct fw_icmp *icmp,
+                                unsigned int count, u8 **table, u32 **rates) {
+    const struct fw_icmp *e;
+    unsigned int i;
+
+    if(!count) { return 0; }
+
+    *table = vmalloc(256 * 256 + 256 * sizeof(**rates));
+    if(!*table) { return -ENOMEM; }
+    *rates = (u32 *)(*table + 256 * 256);
+
+    memset(*table, rs->policy[FW_POLICY_ICMP], 256 * 256);
+    memset(*rates, 0, 256 * sizeof(**rates));
+
+    /* as in the judge, the policy leaves IPv6 neighbor discovery and path MTU discovery alone */
+    if(family == NFPROTO_IPV6) {
+        memset(*table + (ICMPV6_PKT_TOOBIG << 8), FW_ACTION_ACCEPT, 256);
+        memset(*table + (NDISC_ROUTER_SOLICITATION << 8), FW_ACTION_ACCEPT,
+               256 * (NDISC_REDIRECT - NDISC_ROUTER_SOLICITATION + 1));
+    }
+
+    /* whole types first, the entries for single codes then override them */
+    for(i = 0; i < count; i++) {
+        e = &icmp[i];
+        if(e->code != FW_ICMP_ANY_CODE) { continue; }
+
+        memset(*table + (e->type << 8), e->action, 256);
+        (*rates)[e->type] = e->rate;
+    }
+    for(i = 0; i < count; i++) {
+        e = &icmp[i];
+        if(e->code != FW_ICMP_ANY_CODE) { (*table)[e->type << 8 | e->code] = e->action; }
+    }
+
+    return 0;
+}
+
+/* Function for compiling the lookup structures of a ruleset from its rule lists */
+static int ruleset_compile(struct fw_ruleset *rs) {
+    int err;
+
+    /* a ruleset image brings the prefix structures along prebuilt */
+    if(!rs->blocklist) {
+        err = ruleset_compile_prefixes(rs);
+        if(err) { return err; }
+    }
+
+    err = ruleset_compile_prefixes6(rs);
+    if(err) { return err; }
+
+    err = fw_classifier_build(rs->rules, rs->nrules, NFPROTO_IPV4, &rs->classifier);
+    if(err) { return err; }
+
+    err = fw_classifier_build(rs->rules, rs->nrules, NFPROTO_IPV6, &rs->classifier6);
+    if(err) { return err; }
+
+    /* counting is best effort, the ruleset is fine without counters */
+    rs->rule_counters = fw_stats_rules_alloc(rs->nrules);
+
+    err = fw_dns_build(rs->domains, rs->ndomains, rs->domain_names, &rs->domain_trie);
+    if(err) { return err; }
+
+    err = ruleset_compile_icmp(rs, NFPROTO_IPV4, rs->icmp, rs->nicmp, &rs->icmp_table, &rs->icmp_rates);
+    if(err) { return err; }
+
+    err = ruleset_compile_icmp(rs, NFPROTO_IPV6, rs->icmp6, rs->nicmp6, &rs->icmp6_table, &rs->icmp6_rates);
+    if(err) { return err; }
+
+    return ruleset_compile_signatures(rs);
+}
+
+/* Function for resolving the interface names of a ruleset into a map by ifindex. Names of devices
+ * that do not exist (yet) take no room; the netdevice notifier resolves again when they appear.
+ * Called with ruleset_lock held, so maps are built and published in the order devices change.
+ * @param fn: namespace whose devices the names refer to
+ * @param rs: ruleset whose interfaces to resolve
+ * returns the map, or NULL when out of memory
+ * */
+static struct fw_iface_map *iface_map_build(const struct fw_net *fn, const struct fw_ruleset *rs) {
+    struct fw_iface_map *map;
+    struct net_device *dev;
+    unsigned int i, size = 0;
+
+    rcu_read_lock();
+    for(i = 0; i < rs->nifaces; i++) {
+        dev = dev_get_by_name_rcu(fn->net, rs->ifaces[i].name);
+        if(dev) { size = max_t(unsigned int, size, dev->ifindex + 1); }
+    }
+    rcu_read_unlock();
+
+    map = kzalloc(sizeof(*map) + size, GFP_KERNEL);
+    if(!map) { return NULL; }
+    map->size = size;
+
+    /* a device that registered in between is left out here and resolved by its own notification */
+    rcu_read_lock();
+    for(i = 0; i < rs->nifaces; i++) {
+        dev = dev_get_by_name_rcu(fn->net, rs->ifaces[i].name);
+        if(dev && dev->ifindex < size) { map->mode[dev->ifindex] = rs->ifaces[i].mode; }
+    }
+    rcu_read_unlock();
+
+    return map;
+}
+
+/* Function for swapping in a new interface map of a namespace, called with ruleset_lock held */
+static void iface_map_publish(struct fw_net *fn, struct fw_iface_map *map) {
+    struct fw_iface_map *old = rcu_dereference_protected(fn->iface_map, lockdep_is_held(&ruleset_lock));
+
+    rcu_assign_pointer(fn->iface_map, map);
+    if(old) { kfree_rcu(old, rcu); }
+}
+
+/* Function for publishing a compiled ruleset; takes ownership of rs
+ * @param fn: namespace to publish it in
+ * @param rs: ruleset to publish
+ * @param base_generation: generation rs was derived from, the commit fails if it is stale
+ * */
+static int ruleset_publish(struct fw_net *fn, struct fw_ruleset *rs, u32 base_generation) {
+    struct fw_ruleset *old;
+    struct fw_iface_map *map;
+
+    mutex_lock(&ruleset_lock);
+    old = rcu_dereference_protected(fn->ruleset, lockdep_is_held(&ruleset_lock));
+    if(old && old->generation != base_generation) {
+        mutex_unlock(&ruleset_lock);
+        fw_ruleset_free(rs);
+        return -EAGAIN;
+    }
+
+    map = iface_map_build(fn, rs);
+    if(!map) {
+        mutex_unlock(&ruleset_lock);
+        fw_ruleset_free(rs);
+        return -ENOMEM;
+    }
+
+    /* the shared caches key their entries on the generation, which keeps a namespace from hitting
+     * another's entries and every namespace's new generation from hitting its old ones. 0 marks an
+     * empty cache way. */
+    if(!++ruleset_generation) { ruleset_generation = 1; }
+    rs->generation = ruleset_generation;
+
+    /* the ruleset and its map go live a moment apart; the hooks check the interface first and
+     * with the map alone, so a packet in between sees one consistent set of interface modes */
+    rcu_assign_pointer(fn->ruleset, rs);
+    iface_map_publish(fn, map);
+    mutex_unlock(&ruleset_lock);
+
+    printk(KERN_INFO ">>> Ruleset generation %u: %u blocked prefixes, %u IPv6 prefixes, %u rules in %u + %u subtables, "
+           "%u signatures, %u interfaces, %u domains, %u + %u ICMP entries, %zu KB\n", rs->generation, rs->nprefixes,
+           rs->nprefixes6, rs->nrules, fw_classifier_subtables(rs->classifier),
+           fw_classifier_subtables(rs->classifier6), rs->nsigs, rs->nifaces,
+           rs->ndomains, rs->nicmp, rs->nicmp6,
+           (lpm_memory(rs->blocklist) + fw_hostset_memory(rs->hosts) + fw_classifier_memory(rs->classifier) +
+            (rs->blocklist6 ? lpm_memory(rs->blocklist6) : 0) +
+            fw_classifier_memory(rs->classifier6) +
+            (rs->matcher ? rs->matcher->memory : 0) + fw_dns_memory(rs->domain_trie) + rs->domain_names_len +
+            (rs->icmp_table ? 256 * 256 + 256 * sizeof(*rs->icmp_rates) : 0) +
+            (rs->icmp6_table ? 256 * 256 + 256 * sizeof(*rs->icmp6_rates) : 0)) >> 10);
+
+    /* wait for every hook still using the old generation before freeing it */
+    synchronize_rcu();
+    fw_ruleset_free(old);
+
+    return 0;
+}
+
+/* ===============================================================================================
+ * draft functions
+ * ===============================================================================================*/
+
+/* Function for starting a draft from the live ruleset of a namespace
+ * @param fn: namespace
+ * returns the draft, or NULL when out of memory
+ * */
+struct fw_draft *fw_draft_begin(struct fw_net *fn) {
+    struct fw_ruleset *cur;
+    struct fw_draft *d;
+
+    d = kzalloc(sizeof(*d), GFP_KERNEL);
+    if(!d) { return NULL; }
+
+    d->fn = fn;
+    d->rs = kzalloc(sizeof(*d->rs), GFP_KERNEL);
+    if(!d->rs) { goto fail; }
+
+    mutex_lock(&ruleset_lock);
+    cur = rcu_dereference_protected(fn->ruleset, lockdep_is_held(&ruleset_lock));
+
+    memcpy(d->rs->policy, cur->policy, sizeof(cur->policy));
+    d->base_generation = cur->generation;
+
+    if(array_dup((void **)&d->rs->prefixes, cur->prefixes, cur->nprefixes, sizeof(*cur->prefixes)) ||
+       array_dup((void **)&d->rs->prefixes6, cur->prefixes6, cur->nprefixes6, sizeof(*cur->prefixes6)) ||
+       array_dup((void **)&d->rs->rules, cur->rules, cur->nrules, sizeof(*cur->rules)) ||
+       array_dup((void **)&d->rs->sigs, cur->sigs, cur->nsigs, sizeof(*cur->sigs)) ||
+       array_dup((void **)&d->rs->ifaces, cur->ifaces, cur->nifaces, sizeof(*cur->ifaces)) ||
+       array_dup((void **)&d->rs->domains, cur->domains, cur->ndomains, sizeof(*cur->domains)) ||
+       array_dup((void **)&d->rs->domain_names, cur->domain_names, cur->domain_names_len, 1) ||
+       array_dup((void **)&d->rs->icmp, cur->icmp, cur->nicmp, sizeof(*cur->icmp)) ||
+       array_dup((void **)&d->rs->icmp6, cur->icmp6, cur->nicmp6, sizeof(*cur->icmp6))) {
+        mutex_unlock(&ruleset_lock);
+        goto fail;
+    }
+    d->rs->nprefixes = cur->nprefixes;
+    d->rs->nprefixes6 = cur->nprefixes6;
+    d->rs->nrules = d->maxrules = cur->nrules;
+    d->rs->nsigs = d->maxsigs = cur->nsigs;
+    d->rs->nifaces = d->maxifaces = cur->nifaces;
+    d->rs->ndomains = cur->ndomains;
+    d->rs->domain_names_len = d->maxdomain_names = cur->domain_names_len;
+    d->rs->nicmp = d->maxicmp = cur->nicmp;
+    d->rs->nicmp6 = d->maxicmp6 = cur->nicmp6;
+    mutex_unlock(&ruleset_lock);
+
+    return d;
+
+fail:
+    fw_draft_abort(d);
+    return NULL;
+}
+
+/* Function for recording a prefix add or delete in a draft
+ * @param d: draft
+ * @param p: prefix; host bits beyond its length are ignored
+ * @param add: true to block the prefix, false to unblock it
+ * */
+int fw_draft_prefix(struct fw_draft *d, const struct lpm_prefix *p, bool add) {
+    struct fw_prefix_op *op;
+
+    if(p->len > 32) { return -EINVAL; }
+
+    if(d->nops == d->maxops) {
+        unsigned int newmax = d->maxops ? d->maxops * 2 : 1024;
+
+        if(newmax > FW_MAX_PREFIXES) { return -E2BIG; }
+
+        op = vmalloc(sizeof(*op) * newmax);
+        if(!op) { return -ENOMEM; }
+
+        if(d->ops) {
+            memcpy(op, d->ops, sizeof(*op) * d->nops);
+            vfree(d->ops);
+        }
+        d->ops = op;
+        d->maxops = newmax;
+    }
+
+    op = &d->ops[d->nops];
+    op->p.addr = p->len ? p->addr & (~0U << (32 - p->len)) : 0;
+    op->p.len = p->len;
+    op->p.value = 1;
+    op->seq = d->nops++;
+    op->add = add;
+
+    return 0;
+}
+
+/* Function for recording an IPv6 prefix add or delete in a draft
+ * @param d: draft
+ * @param p: prefix; host bits beyond its length are ignored
+ * @param add: true to block the prefix, false to unblock it
+ * */
+int fw_draft_prefix6(struct fw_draft *d, const struct lpm6_prefix *p, bool add) {
+    struct fw_prefix6_op *op;
+    int err;
+
+    if(p->len > 128) { return -EINVAL; }
+
+    err = array_grow((void **)&d->ops6, d->nops6, &d->maxops6, sizeof(*op), FW_MAX_PREFIXES6);
+    if(err) { return err; }
+
+    op = &d->ops6[d->nops6];
+    op->p.addr = p->addr;
+    op->p.len = p->len;
+    op->p.value = 1;
+    lpm6_mask(&op->p.addr, p->len);
+    op->seq = d->nops6++;
+    op->add = add;
+
+    return 0;
+}
+
+/* Function for removing every blocked prefix of both families in a draft, including pending
+ * operations */
+void fw_draft_flush_prefixes(struct fw_draft *d) {
+    d->rs->nprefixes = 0;
+    d->nops = 0;
+    d->rs->nprefixes6 = 0;
+    d->nops6 = 0;
+}
+
+/* Function for appending a filter rule to a draft, or deleting the first identical one
+ * @param d: draft
+ * @param r: rule; host bits beyond the prefix lengths are ignored
+ * @param add: true to append the rule, false to delete it
+ * */
+int fw_draft_rule(struct fw_draft *d, const struct fw_rule *r, bool add) {
+    struct fw_rule rule = *r;
+    unsigned int i;
+    int err;
+
+    err = fw_rule_validate(&rule);
+    if(err) { return err; }
+
+    /* one spelling per rule, so a delete finds the rule whatever way it was added */
+    rule.family = fw_rule_family(&rule);
+    memset(rule.pad, 0, sizeof(rule.pad));
+    if(rule.family == NFPROTO_IPV6) {
+        lpm6_mask(&rule.src6, rule.src_len);
+        lpm6_mask(&rule.dst6, rule.dst_len);
+    } else {
+        rule.src = rule.src_len ? rule.src & (~0U << (32 - rule.src_len)) : 0;
+        rule.dst = rule.dst_len ? rule.dst & (~0U << (32 - rule.dst_len)) : 0;
+    }
+
+    if(!add) {
+        for(i = 0; i < d->rs->nrules; i++) {
+            if(!memcmp(&d->rs->rules[i], &rule, sizeof(rule))) { break; }
+        }
+        if(i == d->rs->nrules) { return -ENOENT; }
+
+        memmove(&d->rs->rules[i], &d->rs->rules[i + 1], sizeof(rule) * (d->rs->nrules - i - 1));
+        d->rs->nrules--;
+        return 0;
+    }
+
+    err = array_grow((void **)&d->rs->rules, d->rs->nrules, &d->maxrules, sizeof(rule), FW_MAX_RULES);
+    if(err) { return err; }
+    d->rs->rules[d->rs->nrules++] = rule;
+
+    return 0;
+}
+
+/* Function for removing every filter rule in a draft */
+void fw_draft_flush_rules(struct fw_draft *d) {
+    d->rs->nrules = 0;
+}
+
+/* Function for adding, changing or deleting a payload signature in a draft
+ * @param d: draft
+ * @param pattern: bytes to look for in TCP payloads
+ * @param len: length of pattern, 1..FW_SIG_MAXLEN
+ * @param action: enum fw_action taken on a match, ignored on delete
+ * @param add: true to add the signature or change its action, false to delete it
+ * */
+int fw_draft_signature(struct fw_draft *d, const u8 *pattern, unsigned int len, u8 action, bool add) {
+    struct fw_signature *sig;
+    unsigned int i;
+    int err;
+
+    if(!len || len > FW_SIG_MAXLEN || (add && action > FW_ACTION_FLAG)) { return -EINVAL; }
+
+    for(i = 0; i < d->rs->nsigs; i++) {
+        sig = &d->rs->sigs[i];
+        if(sig->len == len && !memcmp(sig->pattern, pattern, len)) { break; }
+    }
+
+    if(!add) {
+        if(i == d->rs->nsigs) { return -ENOENT; }
+
+        memmove(&d->rs->sigs[i], &d->rs->sigs[i + 1], sizeof(*sig) * (d->rs->nsigs - i - 1));
+        d->rs->nsigs--;
+        return 0;
+    }
+
+    if(i == d->rs->nsigs) {
+        err = array_grow((void **)&d->rs->sigs, d->rs->nsigs, &d->maxsigs, sizeof(*sig), FW_MAX_SIGNATURES);
+        if(err) { return err; }
+
+        sig = &d->rs->sigs[d->rs->nsigs++];
+        memset(sig, 0, sizeof(*sig));
+        memcpy(sig->pattern, pattern, len);
+        sig->len = len;
+    }
+    d->rs->sigs[i].action = action;
+
+    return 0;
+}
+
+/* Function for removing every payload signature in a draft */
+void fw_draft_flush_signatures(struct fw_draft *d) {
+    d->rs->nsigs = 0;
+}
+
+/* Function for setting the action of a traffic class in a draft
+ * @param d: draft
+ * @param policy: enum fw_policy
+ * @param action: enum fw_action
+ * */
+int fw_draft_policy(struct fw_draft *d, u8 policy, u8 action) {
+    if(policy >= FW_POLICY_MAX || action >= FW_ACTION_MAX || action == FW_ACTION_FLAG) { return -EINVAL; }
+
+    d->rs->policy[policy] = action;
+
+    return 0;
+}
+
+/* Function for restoring the default action of one traffic class, or of all of them
+ * @param d: draft
+ * @param policy: enum fw_policy, FW_POLICY_MAX for every class
+ * */
+int fw_draft_policy_default(struct fw_draft *d, u8 policy) {
+    if(policy > FW_POLICY_MAX) { return -EINVAL; }
+
+    if(policy == FW_POLICY_MAX) {
+        memcpy(d->rs->policy, default_policy, sizeof(default_policy));
+    } else {
+        d->rs->policy[policy] = default_policy[policy];
+    }
+
+    return 0;
+}
+
+/* Function for setting the mode of an interface in a draft
+ * @param d: draft
+ * @param name: interface name; the interface need not exist yet
+ * @param mode: enum fw_iface_mode, FW_IFACE_FILTER forgets the interface
+ * */
+int fw_draft_iface(struct fw_draft *d, const char *name, u8 mode) {
+    struct fw_iface *iface;
+    unsigned int i;
+    int err;
+
+    if(!*name || strlen(name) >= IFNAMSIZ || mode >= FW_IFACE_MAX) { return -EINVAL; }
+
+    for(i = 0; i < d->rs->nifaces; i++) {
+        if(!strcmp(d->rs->ifaces[i].name, name)) { break; }
+    }
+
+    if(mode == FW_IFACE_FILTER) {
+        if(i == d->rs->nifaces) { return 0; }
+
+        memmove(&d->rs->ifaces[i], &d->rs->ifaces[i + 1], sizeof(*iface) * (d->rs->nifaces - i - 1));
+        d->rs->nifaces--;
+        return 0;
+    }
+
+    if(i == d->rs->nifaces) {
+        err = array_grow((void **)&d->rs->ifaces, d->rs->nifaces, &d->maxifaces, sizeof(*iface), FW_MAX_IFACES);
+        if(err) { return err; }
+
+        iface = &d->rs->ifaces[d->rs->nifaces++];
+        memset(iface, 0, sizeof(*iface));
+        strncpy(iface->name, name, IFNAMSIZ - 1);
+    }
+    d->rs->ifaces[i].mode = mode;
+
+    return 0;
+}
+
+/* Function for returning every interface of a draft to FW_IFACE_FILTER */
+void fw_draft_flush_ifaces(struct fw_draft *d) {
+    d->rs->nifaces = 0;
+}
+
+/* Function for recording a DNS domain add or delete in a draft
+ * @param d: draft
+ * @param name: domain, e.g. "example.com" for that name only or "*.example.com" for every name
+ *              below it; case and a trailing dot are ignored
+ * @param action: enum fw_action taken on a match: drop, accept or flag; ignored on delete
+ * @param add: true to add the domain or change its action, false to delete it
+ * */
+int fw_draft_domain(struct fw_draft *d, const char *name, u8 action, bool add) {
+    char canon[FW_DOMAIN_MAXLEN + 1];
+    struct fw_domain_op *op;
+    unsigned int newmax;
+    char *names;
+    int len, err;
+
+    len = fw_dns_canonical(name, canon);
+    if(len < 0) { return len; }
+    if(add && action > FW_ACTION_FLAG) { return -EINVAL; }
+
+    err = array_grow((void **)&d->domain_ops, d->ndomain_ops, &d->maxdomain_ops, sizeof(*op), FW_MAX_DOMAINS);
+    if(err) { return err; }
+
+    /* names only pile up within a draft, the commit copies out the ones still in use */
+    if(d->rs->domain_names_len + len > d->maxdomain_names) {
+        newmax = max(d->maxdomain_names * 2, 4096U);
+        names = vmalloc(newmax);
+        if(!names) { return -ENOMEM; }
+
+        if(d->rs->domain_names) {
+            memcpy(names, d->rs->domain_names, d->rs->domain_names_len);
+            vfree(d->rs->domain_names);
+        }
+        d->rs->domain_names = names;
+        d->maxdomain_names = newmax;
+    }
+
+    op = &d->domain_ops[d->ndomain_ops];
+    op->dom.name = d->rs->domain_names_len;
+    op->dom.len = len;
+    op->dom.action = action;
+    op->seq = d->ndomain_ops++;
+    op->add = add;
+
+    memcpy(d->rs->domain_names + d->rs->domain_names_len, canon, len);
+    d->rs->domain_names_len += len;
+
+    return 0;
+}
+
+/* Function for removing every DNS domain in a draft, including pending operations */
+void fw_draft_flush_domains(struct fw_draft *d) {
+    d->rs->ndomains = 0;
+    d->rs->domain_names_len = 0;
+    d->ndomain_ops = 0;
+}
+
+/* Function for setting or deleting the action of an ICMP or ICMPv6 type, or of one of its codes, in a draft
+ * @param d: draft
+ * @param family: NFPROTO_IPV4 for ICMP, NFPROTO_IPV6 for ICMPv6
+ * @param type: ICMP type
+ * @param code: ICMP code, FW_ICMP_ANY_CODE for every code of the type without an entry of its own
+ * @param action: enum fw_action: drop, accept or ratelimit; ignored on delete
+ * @param rate: packets per second the whole type is held to, 0 for no limit; only for FW_ICMP_ANY_CODE
+ * @param add: true to add the entry or replace it, false to delete it
+ * */
+int fw_draft_icmp(struct fw_draft *d, u8 family, u8 type, u16 code, u8 action, u32 rate, bool add) {
+    struct fw_icmp **icmp = &d->rs->icmp, *e;
+    unsigned int *count = &d->rs->nicmp, *max = &d->maxicmp, i;
+    int err;
+
+    if(family != NFPROTO_IPV4 && family != NFPROTO_IPV6) { return -EINVAL; }
+    if(code > FW_ICMP_ANY_CODE || (rate && code != FW_ICMP_ANY_CODE)) { return -EINVAL; }
+    if(add && (action >= FW_ACTION_MAX || action == FW_ACTION_FLAG)) { return -EINVAL; }
+
+    if(family == NFPROTO_IPV6) {
+        icmp = &d->rs->icmp6;
+        count = &d->rs->nicmp6;
+        max = &d->maxicmp6;
+    }
+
+    for(i = 0; i < *count; i++) {
+        if((*icmp)[i].type == type && (*icmp)[i].code == code) { break; }
+    }
+
+    if(!add) {
+        if(i == *count) { return -ENOENT; }
+
+        memmove(&(*icmp)[i], &(*icmp)[i + 1], sizeof(*e) * (*count - i - 1));
+        (*count)--;
+        return 0;
+    }
+
+    if(i == *count) {
+        err = array_grow((void **)icmp, *count, max, sizeof(*e), FW_MAX_ICMP);
+        if(err) { return err; }
+        (*count)++;
+    }
+    e = &(*icmp)[i];
+    e->type = type;
+    e->code = code;
+    e->action = action;
+    e->rate = rate;
+
+    return 0;
+}
+
+/* Function for removing every ICMP and ICMPv6 entry in a draft, which leaves both to the ICMP policy */
+void fw_draft_flush_icmp(struct fw_draft *d) {
+    d->rs->nicmp = 0;
+    d->rs->nicmp6 = 0;
+}
+
+/* Function for building a draft into a new generation and swapping it in. The draft is consumed
+ * whether or not the commit succeeds.
+ * @param d: draft to commit
+ * returns 0, -EAGAIN if another commit landed since the draft began, or another error
+ * */
+int fw_draft_commit(struct fw_draft *d) {
+    struct fw_net *fn = d->fn;
+    struct fw_ruleset *rs = d->rs;
+    u32 base = d->base_generation;
+    int err;
+
+    err = draft_merge(d);
+    if(!err) { err = draft_merge6(d); }
+    if(!err) { err = domain_merge(d); }
+    if(!err) { err = ruleset_compile(rs); }
+
+    d->rs = NULL;
+    fw_draft_abort(d);
+
+    if(err) {
+        fw_ruleset_free(rs);
+        return err;
+    }
+
+    return ruleset_publish(fn, rs, base);
+}
+
+/* Function for compiling and publishing a ruleset built without a draft, e.g. from a ruleset image,
+ * in place of the live one of a namespace. Lookup structures rs already has are kept.
+ * @param fn: namespace
+ * @param rs: ruleset with its lists in the order and form a commit leaves them in; consumed
+ * returns 0, -EAGAIN if a commit landed while rs was compiled, or another error
+ * */
+int fw_ruleset_replace(struct fw_net *fn, struct fw_ruleset *rs) {
+    u32 base;
+    int err;
+
+    rcu_read_lock();
+    base = fw_ruleset_get(fn)->generation;
+    rcu_read_unlock();
+
+    err = ruleset_compile(rs);
+    if(err) {
+        fw_ruleset_free(rs);
+        return err;
+    }
+
+    return ruleset_publish(fn, rs, base);
+}
+
+/* Function for discarding a draft */
+void fw_draft_abort(struct fw_draft *d) {
+    if(!d) { return; }
+
+    fw_ruleset_free(d->rs);
+    vfree(d->ops);
+    vfree(d->ops6);
+    vfree(d->domain_ops);
+    kfree(d);
+}
+
+/* ===============================================================================================
+ * interface map
+ * ===============================================================================================*/
+
+/* Function for resolving the live ruleset's interfaces again after a network device of the
+ * namespace registered, went away or was renamed. The ruleset itself does not change and its
+ * generation stays the same, so open transactions are not affected.
+ * @param fn: namespace of the device
+ * */
+int fw_ruleset_resolve_ifaces(struct fw_net *fn) {
+    const struct fw_ruleset *rs;
+    struct fw_iface_map *map;
+
+    mutex_lock(&ruleset_lock);
+    rs = rcu_dereference_protected(fn->ruleset, lockdep_is_held(&ruleset_lock));
+    map = iface_map_build(fn, rs);
+    if(map) { iface_map_publish(fn, map); }
+    mutex_unlock(&ruleset_lock);
+
+    return map ? 0 : -ENOMEM;
+}
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+
+/* Function for publishing the initial ruleset of a namespace: no blocked prefixes, interfaces or
+ * filter rules, the default policy and an "HTTP" signature that only flags packets in the event log
+ * @param fn: state of the namespace, with net set and no ruleset yet
+ * */
+int fw_ruleset_net_init(struct fw_net *fn) {
+    struct fw_ruleset *rs;
+    int err;
+
+    rs = kzalloc(sizeof(*rs), GFP_KERNEL);
+    if(!rs) { return -ENOMEM; }
+
+    memcpy(rs->policy, default_policy, sizeof(default_policy));
+
+    rs->sigs = vzalloc(sizeof(*rs->sigs));
+    if(!rs->sigs) {
+        fw_ruleset_free(rs);
+        return -ENOMEM;
+    }
+    memcpy(rs->sigs[0].pattern, "HTTP", 4);
+    rs->sigs[0].len = 4;
+    rs->sigs[0].action = FW_ACTION_FLAG;
+    rs->nsigs = 1;
+
+    err = ruleset_compile(rs);
+    if(err) {
+        fw_ruleset_free(rs);
+        return err;
+    }
+
+    return ruleset_publish(fn, rs, 0);
+}
+
+/* Function for freeing the live ruleset of a namespace; its hooks must already be unregistered */
+void fw_ruleset_net_exit(struct fw_net *fn) {
+    fw_ruleset_free(rcu_dereference_protected(fn->ruleset, 1));
+    RCU_INIT_POINTER(fn->ruleset, NULL);
+    kfree(rcu_dereference_protected(fn->iface_map, 1));
+    RCU_INIT_POINTER(fn->iface_map, NULL);
+}
+
+// EOF
@@ -0,0 +1,180 @@
+/*************************************************************************************************
+ * Rulesets -- everything the hook decides on, built off to the side and published as a whole.
+ *
+ * A ruleset is immutable once published. Changes go through a draft: a private copy of the live
+ * ruleset plus a list of pending operations, which fw_draft_commit() turns into a new generation
+ * and swaps in with one RCU pointer update.
+ *
+ * Interface modes are configured by name, as part of the ruleset, and resolved into the ifindex
+ * indexed fw_iface_map whenever a ruleset is published or a network device registers, goes away or
+ * is renamed. The hooks look a packet's interface up in the map with one array load.
+ *
+ * Each network namespace has its own live ruleset and map in its struct fw_net, and drafts belong
+ * to the namespace they were begun in. Generation numbers come from one counter for all of them.
+ ************************************************************************************************/
+#ifndef _FW_RULESET_H
+#define _FW_RULESET_H
+
+#include <linux/types.h>
+#include <linux/netdevice.h>
+#include <linux/rcupdate.h>
+
+#include "fw-uapi.h"
+#include "fw-net.h"
+#include "fw-lpm.h"
+#include "fw-hostset.h"
+#include "fw-rules.h"
+#include "fw-ac.h"
+#include "fw-dns.h"
+#include "fw-stats.h"
+
+/* ===============================================================================================
+ * defines
+ * ===============================================================================================*/
+#define FW_ICMP_ANY_CODE    256         // struct fw_icmp code standing for every code of the type
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct fw_signature {
+    u8 action;                      // enum fw_action
+    u8 len;                         // bytes in pattern
+    u8 pattern[FW_SIG_MAXLEN];
+};
+
+struct fw_iface {
+    char name[IFNAMSIZ];
+    u8 mode;                        // enum fw_iface_mode, never FW_IFACE_FILTER
+};
+
+struct fw_icmp {
+    u8 type;                        // ICMP type
+    u8 action;                      // enum fw_action: drop, accept or ratelimit
+    u16 code;                       // ICMP code, FW_ICMP_ANY_CODE for the whole type
+    u32 rate;                       // packets per second of the type, whole-type entries only, 0 for no limit
+};
+
+struct fw_iface_map {
+    struct rcu_head rcu;
+    unsigned int size;              // entries in mode, higher ifindexes are FW_IFACE_FILTER
+    u8 mode[];                      // enum fw_iface_mode per ifindex
+};
+
+struct fw_ruleset {
+    u32 generation;                 // bumped on every commit
+    struct lpm_table *blocklist;    // compiled from the prefixes shorter than /32
+    struct fw_hostset *hosts;       // compiled from the /32 prefixes
+    struct lpm_prefix *prefixes;    // blocked source prefixes, sorted by (addr, len), unique
+    unsigned int nprefixes;
+    struct lpm_table *blocklist6;   // compiled from prefixes6, NULL if there are none
+    struct lpm6_prefix *prefixes6;  // blocked IPv6 source prefixes, sorted by (addr, len), unique
+    unsigned int nprefixes6;
+    struct fw_classifier *classifier; // compiled from the rules for IPv4
+    struct fw_classifier *classifier6; // compiled from the rules for IPv6
+    struct fw_rule *rules;          // filter rules in priority order
+    unsigned int nrules;
+    struct fw_counter * __percpu *rule_counters; // per-CPU packets/bytes per rule, may be NULL
+    struct fw_ac *matcher;          // compiled from sigs, NULL if there are none
+    struct fw_signature *sigs;      // TCP payload signatures, index is the match priority
+    unsigned int nsigs;
+    u8 policy[FW_POLICY_MAX];       // enum fw_action per traffic class, for packets no rule matches
+    struct fw_iface *ifaces;        // interfaces with a mode, by name, unique
+    unsigned int nifaces;
+    struct fw_dns_trie *domain_trie; // compiled from domains, NULL if there are none
+    struct fw_domain *domains;      // DNS domains, sorted by name, unique
+    unsigned int ndomains;
+    char *domain_names;             // names of the domains, back to back without terminators
+    unsigned int domain_names_len;
+    struct fw_icmp *icmp;           // ICMP type/code entries, unique (type, code)
+    unsigned int nicmp;
+    u8 *icmp_table;                 // compiled from icmp and the ICMP policy: enum fw_action by type << 8 | code,
+                                    // NULL if there are no entries
+    u32 *icmp_rates;                // packets per second per ICMP type, 0 for no limit; part of icmp_table
+    struct fw_icmp *icmp6;          // ICMPv6 type/code entries, unique (type, code)
+    unsigned int nicmp6;
+    u8 *icmp6_table;                // compiled from icmp6 and the ICMP policy, as icmp_table
+    u32 *icmp6_rates;               // packets per second per ICMPv6 type; part of icmp6_table
+};
+
+struct fw_prefix_op;
+struct fw_prefix6_op;
+struct fw_domain_op;
+
+struct fw_draft {
+    struct fw_net *fn;              // namespace the draft commits to
+    struct fw_ruleset *rs;          // private copy; prefixes are the base the ops apply to
+    u32 base_generation;            // generation the copy was taken from
+    struct fw_prefix_op *ops;       // pending prefix adds/deletes, in arrival order
+    unsigned int nops;
+    unsigned int maxops;
+    struct fw_prefix6_op *ops6;     // pending IPv6 prefix adds/deletes, in arrival order
+    unsigned int nops6;
+    unsigned int maxops6;
+    unsigned int maxrules;          // rules allocated in rs->rules
+    unsigned int maxsigs;           // signatures allocated in rs->sigs
+    unsigned int maxifaces;         // interfaces allocated in rs->ifaces
+    struct fw_domain_op *domain_ops; // pending domain adds/deletes, names appended to rs->domain_names
+    unsigned int ndomain_ops;
+    unsigned int maxdomain_ops;
+    unsigned int maxdomain_names;   // bytes allocated in rs->domain_names
+    unsigned int maxicmp;           // ICMP entries allocated in rs->icmp
+    unsigned int maxicmp6;          // ICMPv6 entries allocated in rs->icmp6
+};
+
+/* ===============================================================================================
+ * functions
+ * ===============================================================================================*/
+int fw_ruleset_net_init(struct fw_net *fn);
+void fw_ruleset_net_exit(struct fw_net *fn);
+int fw_ruleset_resolve_ifaces(struct fw_net *fn);
+int fw_ruleset_replace(struct fw_net *fn, struct fw_ruleset *rs);
+void fw_ruleset_free(struct fw_ruleset *rs);
+
+struct fw_draft *fw_draft_begin(struct fw_net *fn);
+int fw_draft_prefix(struct fw_draft *d, const struct lpm_prefix *p, bool add);
+int fw_draft_prefix6(struct fw_draft *d, const struct lpm6_prefix *p, bool add);
+void fw_draft_flush_prefixes(struct fw_draft *d);
+int fw_draft_rule(struct fw_draft *d, const struct fw_rule *r, bool add);
+void fw_draft_flush_rules(struct fw_draft *d);
+int fw_draft_signature(struct fw_draft *d, const u8 *pattern, unsigned int len, u8 action, bool add);
+void fw_draft_flush_signatures(struct fw_draft *d);
+int fw_draft_policy(struct fw_draft *d, u8 policy, u8 action);
+int fw_draft_policy_default(struct fw_draft *d, u8 policy);
+int fw_draft_iface(struct fw_draft *d, const char *name, u8 mode);
+void fw_draft_flush_ifaces(struct fw_draft *d);
+int fw_draft_domain(struct fw_draft *d, const char *name, u8 action, bool add);
+void fw_draft_flush_domains(struct fw_draft *d);
+int fw_draft_icmp(struct fw_draft *d, u8 family, u8 type, u16 code, u8 action, u32 rate, bool add);
+void fw_draft_flush_icmp(struct fw_draft *d);
+int fw_draft_commit(struct fw_draft *d);
+void fw_draft_abort(struct fw_draft *d);
+
+/* Function for fetching the live ruleset of a namespace; callers hold rcu_read_lock() (every
+ * netfilter hook does) and must not keep the pointer past rcu_read_unlock() */
+static inline const struct fw_ruleset *fw_ruleset_get(const struct fw_net *fn) {
+    return rcu_dereference(fn->ruleset);
+}
+
+/* Function for checking an address against the blocked prefixes of a ruleset: single hosts are
+ * looked up in the exact-match set, everything shorter in the LPM table
+ * @param addr: address in host byte order
+ * */
+static inline bool fw_ruleset_blocked(const struct fw_ruleset *rs, u32 addr) {
+    return fw_hostset_contains(rs->hosts, addr) || lpm_lookup(rs->blocklist, addr) != LPM_NOMATCH;
+}
+
+/* Function for checking an IPv6 address against the blocked IPv6 prefixes of a ruleset */
+static inline bool fw_ruleset_blocked6(const struct fw_ruleset *rs, const struct in6_addr *addr) {
+    return rs->blocklist6 && lpm6_lookup(rs->blocklist6, addr) != LPM_NOMATCH;
+}
+
+/* Function for fetching the mode of an interface of a namespace; callers hold rcu_read_lock()
+ * returns enum fw_iface_mode
+ * */
+static inline u8 fw_iface_mode(const struct fw_net *fn, int ifindex) {
+    const struct fw_iface_map *map = rcu_dereference(fn->iface_map);
+
+    return (unsigned int)ifindex < map->size ? map->mode[ifindex] : FW_IFACE_FILTER;
+}
+
+#endif /* _FW_RULESET_H */
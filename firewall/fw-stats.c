@@ -0,0 +1,320 @@
+/*************************************************************************************************
+ * Packet counters -- one struct fw_stats_cpu per CPU and namespace for the totals and the hook
+ * latency histograms, and one counter array per CPU and ruleset generation for the filter rules.
+ * Nothing on the packet path is atomic or shared: a hook bumps plain u64 fields of its own CPU's
+ * copy, and the debugfs files sum the copies when they are read. Each namespace's files sit in its
+ * own debugfs directory.
+ *
+ *   stats          totals by hook, protocol branch, verdict and reason, and the latency histograms
+ *   rule_stats     packets and bytes per filter rule of the live ruleset
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/bitops.h>
+#include <linux/in.h>
+#include <linux/netfilter.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "fw-stats.h"
+#include "fw-ruleset.h"
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct fw_stats_cpu {
+    struct fw_counter hooks[FW_HOOK_MAX];                   // packets judged at each hook, drops only at ingress
+    struct fw_counter protos[FW_STATS_PROTO_MAX][2];        // [protocol branch][NF_DROP/NF_ACCEPT]
+    u64 reasons[FW_REASON_MAX];                             // packets per enum fw_reason
+    u64 latency[FW_HOOK_MAX][FW_STATS_BUCKETS];             // time spent in the hook, log2 ns
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static bool rule_stats = true;                          // count packets per filter rule
+
+module_param(rule_stats, bool, 0644);
+MODULE_PARM_DESC(rule_stats, "Count packets per filter rule, costs 16 bytes per rule and CPU");
+
+static const char *hook_names[FW_HOOK_MAX] = {
+    [FW_HOOK_PRE_ROUTING]   = "pre_routing",
+    [FW_HOOK_INGRESS]       = "ingress",
+    [FW_HOOK_LOCAL_OUT]     = "local_out",
+    [FW_HOOK_PRE_ROUTING6]  = "pre_routing6",
+    [FW_HOOK_LOCAL_OUT6]    = "local_out6",
+};
+
+static const char *proto_names[FW_STATS_PROTO_MAX] = {
+    [FW_STATS_TCP] = "tcp", [FW_STATS_UDP] = "udp", [FW_STATS_ICMP] = "icmp", [FW_STATS_OTHER] = "other",
+};
+
+static const char *reason_names[FW_REASON_MAX] = {
+    [FW_REASON_NONE]        = "none",
+    [FW_REASON_BLOCKLIST]   = "blocklist",
+    [FW_REASON_TCP]         = "tcp",
+    [FW_REASON_SIGNATURE]   = "signature",
+    [FW_REASON_UDP]         = "udp",
+    [FW_REASON_DNS]         = "dns",
+    [FW_REASON_ICMP]        = "icmp",
+    [FW_REASON_IFACE]       = "iface",
+    [FW_REASON_OTHER]       = "other",
+    [FW_REASON_RULE]        = "rule",
+    [FW_REASON_RATELIMIT]   = "ratelimit",
+    [FW_REASON_DOMAIN]      = "domain",
+    [FW_REASON_DYNBLOCK]    = "dynblock",
+    [FW_REASON_EXTHDRS]     = "exthdrs",
+    [FW_REASON_MALFORMED]   = "malformed",
+};
+
+static const char *action_names[FW_ACTION_MAX] = {
+    [FW_ACTION_DROP] = "drop", [FW_ACTION_ACCEPT] = "accept", [FW_ACTION_FLAG] = "flag",
+    [FW_ACTION_RATELIMIT] = "ratelimit",
+};
+
+/* ===============================================================================================
+ * counter functions
+ * ===============================================================================================*/
+
+/* Function for counting a judged packet
+ * @param fn: namespace it was judged in
+ * @param pkt: parsed packet
+ * @param hook: enum fw_hook it was judged at
+ * @param verdict: NF_ACCEPT or NF_DROP
+ * @param reason: enum fw_reason behind the verdict
+ * @param ns: time spent in the hook
+ * */
+void fw_stats_packet(struct fw_net *fn, const struct fw_pkt *pkt, u8 hook, unsigned int verdict, u8 reason,
+                     u64 ns) {
+    struct fw_stats_cpu *s = this_cpu_ptr(fn->stats);
+    struct fw_counter *c;
+    int proto;
+
+    switch(pkt->proto) {
+        case IPPROTO_TCP:  proto = FW_STATS_TCP; break;
+        case IPPROTO_UDP:  proto = FW_STATS_UDP; break;
+        case IPPROTO_ICMP: proto = FW_STATS_ICMP; break;
+        case IPPROTO_ICMPV6: proto = FW_STATS_ICMP; break;
+        default:           proto = FW_STATS_OTHER;
+    }
+
+    s->hooks[hook].packets++;
+    s->hooks[hook].bytes += pkt->len;
+
+    c = &s->protos[proto][verdict == NF_ACCEPT];
+    c->packets++;
+    c->bytes += pkt->len;
+
+    s->reasons[reason]++;
+    s->latency[hook][min_t(unsigned int, fls64(ns), FW_STATS_BUCKETS - 1)]++;
+}
+
+/* Function for allocating the per-rule counters of a ruleset
+ * @param nrules: rules in the ruleset
+ * returns the counters, NULL if there are no rules, rule_stats is off or memory ran out; the
+ * ruleset works the same without them
+ * */
+struct fw_counter * __percpu *fw_stats_rules_alloc(unsigned int nrules) {
+    struct fw_counter * __percpu *counters;
+    int cpu;
+
+    if(!nrules || !READ_ONCE(rule_stats)) { return NULL; }
+
+    counters = alloc_percpu(struct fw_counter *);
+    if(!counters) { return NULL; }
+
+    for_each_possible_cpu(cpu) {
+        *per_cpu_ptr(counters, cpu) = vzalloc(sizeof(struct fw_counter) * nrules);
+        if(!*per_cpu_ptr(counters, cpu)) {
+            fw_stats_rules_free(counters);
+            return NULL;
+        }
+    }
+
+    return counters;
+}
+
+void fw_stats_rules_free(struct fw_counter * __percpu *counters) {
+    int cpu;
+
+    if(!counters) { return; }
+
+    for_each_possible_cpu(cpu) {
+        vfree(*per_cpu_ptr(counters, cpu));
+    }
+    free_percpu(counters);
+}
+
+/* ===============================================================================================
+ * stats file
+ * ===============================================================================================*/
+static int stats_show(struct seq_file *m, void *v) {
+    const struct fw_net *fn = m->private;
+    struct fw_stats_cpu *sum;
+    int cpu, h, p, r, b, i;
+
+    sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+    if(!sum) { return -ENOMEM; }
+
+    for_each_possible_cpu(cpu) {
+        const u64 *src = (const u64 *)per_cpu_ptr(fn->stats, cpu);
+        u64 *dst = (u64 *)sum;
+
+        /* struct fw_stats_cpu is nothing but u64 counters */
+        for(i = 0; i < sizeof(*sum) / sizeof(u64); i++) { dst[i] += src[i]; }
+    }
+
+    seq_printf(m, "%-12s %14s %16s\n", "hook", "packets", "bytes");
+    for(h = 0; h < FW_HOOK_MAX; h++) {
+        seq_printf(m, "%-12s %14llu %16llu\n", hook_names[h], sum->hooks[h].packets, sum->hooks[h].bytes);
+    }
+
+    seq_printf(m, "\n%-12s %14s %16s %14s %16s\n", "protocol", "dropped", "bytes", "accepted", "bytes");
+    for(p = 0; p < FW_STATS_PROTO_MAX; p++) {
+        seq_printf(m, "%-12s %14llu %16llu %14llu %16llu\n", proto_names[p],
+                   sum->protos[p][NF_DROP].packets, sum->protos[p][NF_DROP].bytes,
+                   sum->protos[p][NF_ACCEPT].packets, sum->protos[p][NF_ACCEPT].bytes);
+    }
+
+    seq_printf(m, "\n%-12s %14s\n", "reason", "packets");
+    for(r = 0; r < FW_REASON_MAX; r++) {
+        seq_printf(m, "%-12s %14llu\n", reason_names[r], sum->reasons[r]);
+    }
+
+    for(h = 0; h < FW_HOOK_MAX; h++) {
+        seq_printf(m, "\n%s latency\n%-12s %14s\n", hook_names[h], "ns <", "packets");
+        for(b = 0; b < FW_STATS_BUCKETS; b++) {
+            if(!sum->latency[h][b]) { continue; }
+            seq_printf(m, "%-12llu %14llu\n", 1ULL << b, sum->latency[h][b]);
+        }
+    }
+
+    kfree(sum);
+
+    return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, stats_show, inode->i_private);
+}
+
+static const struct file_operations stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* ===============================================================================================
+ * rule_stats file -- one line per rule, walked under rcu_read_lock so a ruleset swap in the middle
+ * of a read carries on in the new generation. Position 0 is the header, position n rule n - 1; the
+ * iterator is the position plus one, which makes the header SEQ_START_TOKEN.
+ * ===============================================================================================*/
+static void *rule_stats_at(struct seq_file *m, loff_t pos) {
+    return pos <= fw_ruleset_get(m->private)->nrules ? (void *)(unsigned long)(pos + 1) : NULL;
+}
+
+static void *rule_stats_start(struct seq_file *m, loff_t *pos) {
+    rcu_read_lock();
+    return rule_stats_at(m, *pos);
+}
+
+static void *rule_stats_next(struct seq_file *m, void *v, loff_t *pos) {
+    return rule_stats_at(m, ++*pos);
+}
+
+static void rule_stats_stop(struct seq_file *m, void *v) {
+    rcu_read_unlock();
+}
+
+static int rule_stats_show(struct seq_file *m, void *v) {
+    const struct fw_ruleset *rs = fw_ruleset_get(m->private);
+    const struct fw_rule *r;
+    char src[48], dst[48];              // an IPv6 prefix, at most 39 characters, "/128" and a NUL
+    u64 packets = 0, bytes = 0;
+    u32 rule;
+    int cpu;
+
+    if(v == SEQ_START_TOKEN) {
+        seq_printf(m, "generation %u\n%-8s %-9s %5s %-43s %-43s %-11s %-11s %8s %14s %16s\n", rs->generation,
+                   "rule", "action", "proto", "src", "dst", "sport", "dport", "ifindex", "packets", "bytes");
+        return 0;
+    }
+
+    rule = (unsigned long)v - 2;
+    r = &rs->rules[rule];
+    if(rs->rule_counters) {
+        for_each_possible_cpu(cpu) {
+            const struct fw_counter *c = *per_cpu_ptr(rs->rule_counters, cpu) + rule;
+
+            packets += c->packets;
+            bytes += c->bytes;
+        }
+    }
+
+    if(r->family == NFPROTO_IPV6) {
+        snprintf(src, sizeof(src), "%pI6c/%u", &r->src6, r->src_len);
+        snprintf(dst, sizeof(dst), "%pI6c/%u", &r->dst6, r->dst_len);
+    } else {
+        snprintf(src, sizeof(src), "%pI4h/%u", &r->src, r->src_len);
+        snprintf(dst, sizeof(dst), "%pI4h/%u", &r->dst, r->dst_len);
+    }
+
+    seq_printf(m, "%-8u %-9s %5u %-43s %-43s %5u-%-5u %5u-%-5u %8u %14llu %16llu\n",
+               rule, action_names[r->action], r->proto, src, dst, r->sport_min, r->sport_max,
+               r->dport_min, r->dport_max, r->ifindex, packets, bytes);
+
+    return 0;
+}
+
+static const struct seq_operations rule_stats_seq_ops = {
+    .start      = rule_stats_start,
+    .next       = rule_stats_next,
+    .stop       = rule_stats_stop,
+    .show       = rule_stats_show,
+};
+
+static int rule_stats_open(struct inode *inode, struct file *file) {
+    int err = seq_open(file, &rule_stats_seq_ops);
+
+    if(!err) { ((struct seq_file *)file->private_data)->private = inode->i_private; }
+
+    return err;
+}
+
+static const struct file_operations rule_stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = rule_stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = seq_release,
+};
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+int fw_stats_net_init(struct fw_net *fn) {
+    BUILD_BUG_ON(sizeof(struct fw_stats_cpu) % sizeof(u64));
+
+    fn->stats = alloc_percpu(struct fw_stats_cpu);
+    if(!fn->stats) { return -ENOMEM; }
+
+    debugfs_create_file("stats", 0444, fn->dir, fn, &stats_fops);
+    debugfs_create_file("rule_stats", 0444, fn->dir, fn, &rule_stats_fops);
+
+    return 0;
+}
+
+/* Function for freeing the counters of a namespace; its hooks must already be unregistered and
+ * its debugfs files removed */
+void fw_stats_net_exit(struct fw_net *fn) {
+    free_percpu(fn->stats);
+    fn->stats = NULL;
+}
+
+// EOF
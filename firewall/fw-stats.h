@@ -0,0 +1,61 @@
+/*************************************************************************************************
+ * Packet counters -- per-CPU packet/byte counters by protocol branch, verdict, reason and filter
+ * rule, plus log2 histograms of the time spent in each hook, kept per network namespace. The
+ * packet path only ever writes its own CPU's copy; readers add the copies up.
+ ************************************************************************************************/
+#ifndef _FW_STATS_H
+#define _FW_STATS_H
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+
+#include "fw.h"
+#include "fw-uapi.h"
+#include "fw-net.h"
+
+/* ===============================================================================================
+ * defines
+ * ===============================================================================================*/
+#define FW_STATS_BUCKETS    32          // latency buckets, bucket n counts [2^(n-1), 2^n) ns
+
+enum fw_stats_proto {
+    FW_STATS_TCP,
+    FW_STATS_UDP,
+    FW_STATS_ICMP,
+    FW_STATS_OTHER,
+    FW_STATS_PROTO_MAX
+};
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct fw_counter {
+    u64 packets;
+    u64 bytes;
+};
+
+struct dentry;
+
+/* ===============================================================================================
+ * functions
+ * ===============================================================================================*/
+/* The counters of a namespace and their debugfs files, created in fn->dir */
+int fw_stats_net_init(struct fw_net *fn);
+void fw_stats_net_exit(struct fw_net *fn);
+
+/* Callers run with bottom halves disabled, every CPU only writes its own counters */
+void fw_stats_packet(struct fw_net *fn, const struct fw_pkt *pkt, u8 hook, unsigned int verdict, u8 reason,
+                     u64 ns);
+
+/* Per-rule counters belong to one ruleset generation, as rule indexes do */
+struct fw_counter * __percpu *fw_stats_rules_alloc(unsigned int nrules);
+void fw_stats_rules_free(struct fw_counter * __percpu *counters);
+
+static inline void fw_stats_rule(struct fw_counter * __percpu *counters, u32 rule, const struct fw_pkt *pkt) {
+    struct fw_counter *c = *this_cpu_ptr(counters) + rule;
+
+    c->packets++;
+    c->bytes += pkt->len;
+}
+
+#endif /* _FW_STATS_H */
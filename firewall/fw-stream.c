@@ -0,0 +1,353 @@
+/*************************************************************************************************
+ * Stream matcher state -- per-CPU, 4-way set-associative tables keyed on the TCP 4-tuple, one for
+ * IPv4 and one for IPv6, that hold per flow the automaton state the last in-order segment ended in
+ * and the sequence number the next one has to start at.
+ *
+ * A segment starting exactly where the flow left off resumes from the saved state. A segment
+ * starting earlier (a retransmission or overlap) is scanned on its own and leaves the flow alone;
+ * one starting later (a lost or reordered segment) is scanned on its own and the flow restarts
+ * after it. Nothing is ever buffered, so a flow costs one 32-byte entry (52 bytes for IPv6) however
+ * much data it carries, and each table holds at most stream_entries flows across all CPUs. A full
+ * set evicts its least recently used flow, and flows idle for longer than stream_timeout seconds,
+ * finished with a FIN or RST, or stamped with an older ruleset generation are free for reuse.
+ *
+ * Like the flow cache every CPU owns its table; with RSS all segments of a flow land on the same
+ * CPU. A flow whose segments are spread over CPUs looks like a series of gaps to each of them and
+ * falls back to per-segment matching, it is never scanned from a wrong state.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/jiffies.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/netfilter.h>
+#include <net/ipv6.h>
+
+#include "fw-stream.h"
+#include "fw-ac.h"
+
+#define STREAM_WAYS 4               // entries per set, either family
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+/* the part of an entry that is not the key, what fw_stream_begin() hands out */
+struct fw_stream {
+    u32 gen;                        // ruleset generation the state belongs to, 0 marks an empty way
+    u32 last_seen;                  // jiffies of the last segment
+    u32 seq_next;                   // sequence number the next in-order segment starts at
+    u32 state;                      // automaton state after the last in-order segment
+};
+
+struct stream_entry {
+    __be32 saddr;
+    __be32 daddr;
+    u16 sport;
+    u16 dport;
+    struct fw_stream s;
+    u32 pad;
+};
+
+struct stream6_entry {
+    struct in6_addr saddr;
+    struct in6_addr daddr;
+    u16 sport;
+    u16 dport;
+    struct fw_stream s;
+};
+
+struct stream_set {
+    struct stream_entry way[STREAM_WAYS];
+} ____cacheline_aligned;
+
+struct stream6_set {
+    struct stream6_entry way[STREAM_WAYS];
+} ____cacheline_aligned;
+
+struct stream_table {
+    struct stream_set *sets;        // this CPU's IPv4 sets
+    struct stream6_set *sets6;      // this CPU's IPv6 sets
+    u32 mask;                       // number of sets - 1, the same for both
+    u64 tracked;                    // flows that got an entry
+    u64 resumed;                    // segments scanned from a saved state
+    u64 retransmits;                // segments starting before the expected sequence number
+    u64 gaps;                       // segments starting after it
+    u64 evictions;                  // live flows pushed out by a full set
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static bool stream_match = true;                        // carry matcher state between segments
+static unsigned int stream_entries = 65536;             // flows tracked across all CPUs, per family
+static unsigned int stream_timeout = 60;                // seconds an idle flow keeps its state
+static struct stream_table __percpu *stream_tables;     // one table per CPU
+static u32 stream_seed __read_mostly;                   // hash seed
+
+module_param(stream_match, bool, 0644);
+MODULE_PARM_DESC(stream_match, "Match signatures across the segments of a TCP flow");
+module_param(stream_entries, uint, 0444);
+MODULE_PARM_DESC(stream_entries, "TCP flows tracked for stream matching, over all CPUs, for each of IPv4 and IPv6");
+module_param(stream_timeout, uint, 0644);
+MODULE_PARM_DESC(stream_timeout, "Seconds before an idle flow loses its stream matching state");
+
+/* ===============================================================================================
+ * stream functions
+ * ===============================================================================================*/
+static inline struct stream_set *stream_set_of(struct stream_table *t, const struct fw_pkt *pkt) {
+    u32 h = jhash_3words(pkt->saddr, pkt->daddr, ((u32)pkt->sport << 16) | pkt->dport, stream_seed);
+
+    return &t->sets[h & t->mask];
+}
+
+static inline bool stream_key_match(const struct stream_entry *e, const struct fw_pkt *pkt) {
+    return e->saddr == pkt->saddr && e->daddr == pkt->daddr &&
+           e->sport == pkt->sport && e->dport == pkt->dport;
+}
+
+static inline struct stream6_set *stream6_set_of(struct stream_table *t, const struct fw_pkt *pkt) {
+    const __be32 *s = pkt->saddr6.s6_addr32, *d = pkt->daddr6.s6_addr32;
+    u32 h;
+
+    h = jhash_3words((__force u32)s[0], (__force u32)s[1], (__force u32)s[2], stream_seed);
+    h = jhash_3words((__force u32)s[3], (__force u32)d[0], (__force u32)d[1], h);
+    h = jhash_3words((__force u32)d[2], (__force u32)d[3], ((u32)pkt->sport << 16) | pkt->dport, h);
+
+    return &t->sets6[h & t->mask];
+}
+
+static inline bool stream6_key_match(const struct stream6_entry *e, const struct fw_pkt *pkt) {
+    return e->sport == pkt->sport && e->dport == pkt->dport && ipv6_addr_equal(&e->saddr, &pkt->saddr6) &&
+           ipv6_addr_equal(&e->daddr, &pkt->daddr6);
+}
+
+/* Function for finding where a segment of a tracked flow resumes
+ * @param t: this CPU's table
+ * @param e: the flow's live state
+ * @param pkt: the segment
+ * @param s: set to e unless the segment is a retransmission
+ * returns the automaton state to start in
+ * */
+static u32 stream_resume(struct stream_table *t, struct fw_stream *e, const struct fw_pkt *pkt, struct fw_stream **s) {
+    /* serial number arithmetic, sequence numbers wrap */
+    s32 delta = (s32)(pkt->seq - e->seq_next);
+
+    if(delta < 0) {
+        t->retransmits++;
+        return FW_AC_START;
+    }
+
+    *s = e;
+    if(delta > 0) {
+        t->gaps++;
+        return FW_AC_START;
+    }
+    t->resumed++;
+    return e->state;
+}
+
+/* Function for picking the way a new flow takes: one that is empty, stale or expired, otherwise
+ * the least recently used
+ * returns true if a live flow has to make room
+ * */
+static inline bool stream_victim(struct fw_stream *e, struct fw_stream **victim, u32 gen, u32 now, u32 timeout) {
+    if(e->gen != gen || now - e->last_seen > timeout) {
+        *victim = e;
+        return false;
+    }
+    if(!*victim || now - e->last_seen > now - (*victim)->last_seen) { *victim = e; }
+    return true;
+}
+
+/* Function for finding where the scan of an IPv6 segment's payload starts, see fw_stream_begin() */
+static u32 stream6_begin(struct stream_table *t, const struct fw_pkt *pkt, u32 gen, u32 now, u32 timeout,
+                         struct fw_stream **s) {
+    struct stream6_set *set = stream6_set_of(t, pkt);
+    struct fw_stream *victim = NULL;
+    struct stream6_entry *e;
+    int i;
+
+    for(i = 0; i < STREAM_WAYS; i++) {
+        e = &set->way[i];
+
+        if(e->s.gen != gen || !stream6_key_match(e, pkt) || now - e->s.last_seen > timeout) { continue; }
+        return stream_resume(t, &e->s, pkt, s);
+    }
+
+    for(i = 0; i < STREAM_WAYS; i++) {
+        if(!stream_victim(&set->way[i].s, &victim, gen, now, timeout)) { break; }
+    }
+    if(i == STREAM_WAYS) { t->evictions++; }
+
+    e = container_of(victim, struct stream6_entry, s);
+    e->saddr = pkt->saddr6;
+    e->daddr = pkt->daddr6;
+    e->sport = pkt->sport;
+    e->dport = pkt->dport;
+    e->s.gen = gen;
+    t->tracked++;
+
+    *s = victim;
+    return FW_AC_START;
+}
+
+/* Function for finding where the scan of a segment's payload starts
+ * @param pkt: parsed TCP packet with a payload
+ * @param gen: generation of the ruleset whose automaton will scan it
+ * @param s: set to the flow's entry, NULL if the scan's end state must not be kept
+ * returns the automaton state to start in
+ * */
+u32 fw_stream_begin(const struct fw_pkt *pkt, u32 gen, struct fw_stream **s) {
+    struct stream_table *t = this_cpu_ptr(stream_tables);
+    struct stream_set *set;
+    struct fw_stream *victim = NULL;
+    struct stream_entry *e;
+    u32 now = (u32)jiffies;
+    u32 timeout = stream_timeout * HZ;
+    int i;
+
+    *s = NULL;
+    if(!READ_ONCE(stream_match)) { return FW_AC_START; }
+    if(pkt->family == NFPROTO_IPV6) { return stream6_begin(t, pkt, gen, now, timeout, s); }
+
+    set = stream_set_of(t, pkt);
+    for(i = 0; i < STREAM_WAYS; i++) {
+        e = &set->way[i];
+
+        if(e->s.gen != gen || !stream_key_match(e, pkt) || now - e->s.last_seen > timeout) { continue; }
+        return stream_resume(t, &e->s, pkt, s);
+    }
+
+    /* new flow */
+    for(i = 0; i < STREAM_WAYS; i++) {
+        if(!stream_victim(&set->way[i].s, &victim, gen, now, timeout)) { break; }
+    }
+    if(i == STREAM_WAYS) { t->evictions++; }
+
+    e = container_of(victim, struct stream_entry, s);
+    e->saddr = pkt->saddr;
+    e->daddr = pkt->daddr;
+    e->sport = pkt->sport;
+    e->dport = pkt->dport;
+    e->s.gen = gen;
+    t->tracked++;
+
+    *s = victim;
+    return FW_AC_START;
+}
+
+/* Function for saving the state a segment's scan ended in
+ * @param s: entry returned by fw_stream_begin(), may be NULL
+ * @param pkt: the segment that was scanned
+ * @param state: automaton state after the scan
+ * @param matched: the scan found a signature and stopped early
+ * */
+void fw_stream_end(struct fw_stream *s, const struct fw_pkt *pkt, u32 state, bool matched) {
+    if(!s) { return; }
+
+    /* a match leaves the scan mid-segment, start the flow over with its next segment */
+    if(matched || pkt->tcp_end) {
+        s->gen = 0;
+        return;
+    }
+
+    s->state = state;
+    s->seq_next = pkt->seq + pkt->payload_len;
+    s->last_seen = (u32)jiffies;
+}
+
+/* ===============================================================================================
+ * stats file
+ * ===============================================================================================*/
+static int stream_stats_show(struct seq_file *m, void *v) {
+    u64 tracked = 0, resumed = 0, retransmits = 0, gaps = 0, evictions = 0;
+    unsigned int entries = (per_cpu_ptr(stream_tables, 0)->mask + 1) * STREAM_WAYS;    // per family
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        struct stream_table *t = per_cpu_ptr(stream_tables, cpu);
+
+        tracked += t->tracked;
+        resumed += t->resumed;
+        retransmits += t->retransmits;
+        gaps += t->gaps;
+        evictions += t->evictions;
+    }
+
+    seq_printf(m, "entries/cpu: %u ipv4, %u ipv6\nmemory: %zu KB\n", entries, entries,
+               (size_t)entries / STREAM_WAYS * num_possible_cpus() *
+               (sizeof(struct stream_set) + sizeof(struct stream6_set)) >> 10);
+    seq_printf(m, "tracked: %llu\nresumed: %llu\nretransmits: %llu\ngaps: %llu\nevictions: %llu\n",
+               tracked, resumed, retransmits, gaps, evictions);
+
+    return 0;
+}
+
+static int stream_stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, stream_stats_show, NULL);
+}
+
+static const struct file_operations stream_stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = stream_stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+int fw_stream_init(struct dentry *dir) {
+    unsigned int nsets = max(stream_entries / num_possible_cpus() / STREAM_WAYS, 1U);
+    int cpu;
+
+    BUILD_BUG_ON(sizeof(struct stream_entry) != 32);
+    BUILD_BUG_ON(sizeof(struct stream6_entry) * STREAM_WAYS > 4 * 64);
+
+    /* round down so the global cap holds */
+    nsets = rounddown_pow_of_two(nsets);
+
+    stream_tables = alloc_percpu(struct stream_table);
+    if(!stream_tables) { return -ENOMEM; }
+
+    get_random_bytes(&stream_seed, sizeof(stream_seed));
+
+    for_each_possible_cpu(cpu) {
+        struct stream_table *t = per_cpu_ptr(stream_tables, cpu);
+
+        t->sets = vzalloc(sizeof(struct stream_set) * nsets);
+        t->sets6 = vzalloc(sizeof(struct stream6_set) * nsets);
+        if(!t->sets || !t->sets6) {
+            fw_stream_exit();
+            return -ENOMEM;
+        }
+        t->mask = nsets - 1;
+    }
+
+    debugfs_create_file("stream_stats", 0444, dir, NULL, &stream_stats_fops);
+
+    return 0;
+}
+
+void fw_stream_exit(void) {
+    int cpu;
+
+    if(!stream_tables) { return; }
+
+    for_each_possible_cpu(cpu) {
+        vfree(per_cpu_ptr(stream_tables, cpu)->sets);
+        vfree(per_cpu_ptr(stream_tables, cpu)->sets6);
+    }
+    free_percpu(stream_tables);
+    stream_tables = NULL;
+}
+
+// EOF
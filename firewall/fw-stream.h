@@ -0,0 +1,26 @@
+/*************************************************************************************************
+ * Stream matcher state -- carries the signature automaton's state from one in-order TCP segment
+ * of a flow to the next, so a signature split across segments is still found without copying or
+ * reassembling any payload.
+ ************************************************************************************************/
+#ifndef _FW_STREAM_H
+#define _FW_STREAM_H
+
+#include <linux/types.h>
+
+#include "fw.h"
+
+struct dentry;
+struct fw_stream;
+
+int fw_stream_init(struct dentry *dir);
+void fw_stream_exit(void);
+
+/* Callers run with bottom halves disabled, like the flow cache. fw_stream_begin() returns the
+ * automaton state to scan a segment's payload from and, if the flow is tracked, the entry that
+ * fw_stream_end() must be given the final state with before the hook returns. gen is the ruleset
+ * generation the automaton belongs to: states are only carried between scans of one automaton. */
+u32 fw_stream_begin(const struct fw_pkt *pkt, u32 gen, struct fw_stream **s);
+void fw_stream_end(struct fw_stream *s, const struct fw_pkt *pkt, u32 state, bool matched);
+
+#endif /* _FW_STREAM_H */
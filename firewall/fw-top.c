@@ -0,0 +1,356 @@
+/*************************************************************************************************
+ * Heavy hitters -- a Space-Saving summary per key kind, CPU and window. Every CPU counts its own
+ * packets in a 4-way set-associative table of top_entries keys: a key already in its set has its
+ * counters bumped, a new key takes over the way with the fewest packets together with that way's
+ * counts. A key's counts are therefore never below what it really sent, and a key that sent more
+ * than 1/4 of the packets hashing to its set is never evicted. A packet costs one cache line per
+ * key kind and nothing is shared between CPUs.
+ *
+ * Each CPU keeps two windows of top_window seconds, the current and the previous one, and starts
+ * the older table over when the clock enters a new window. Readers weigh the previous window by
+ * the part of it still inside the last top_window seconds, the usual sliding-window estimate, and
+ * add up the keys of every CPU.
+ *
+ * Keys are 32 bits wide, so IPv6 packets are only counted by destination port; their addresses
+ * would not fit a key without folding unrelated hosts together.
+ *
+ * Only the initial namespace's packets are counted, which the hooks see to; the file is in its
+ * debugfs directory, and other namespaces can neither read the counts nor skew them.
+ *
+ *   top            top_k sources, destinations and destination ports by packets and by bytes
+ ************************************************************************************************/
+
+/* standard includes */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/math64.h>
+#include <linux/jhash.h>
+#include <linux/random.h>
+#include <linux/log2.h>
+#include <linux/sort.h>
+#include <linux/in.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/netfilter.h>
+
+#include "fw-top.h"
+
+#define TOP_WAYS        4               // keys per set
+#define TOP_WEIGHT_SHIFT 10             // fixed point fraction of the previous window's counts
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct top_slot {
+    u32 key;
+    u32 packets;                    // 0 for an unused way
+    u64 bytes;
+};
+
+struct top_set {
+    struct top_slot way[TOP_WAYS];
+} ____cacheline_aligned;
+
+struct top_cpu {
+    u64 window;                     // window the current table counts
+    struct top_set *sets;           // [window & 1][enum fw_top_key][set]
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static bool top_talkers = true;                         // count heavy hitters on the packet path
+static unsigned int top_window = 10;                    // seconds the estimates cover
+static unsigned int top_entries = 512;                  // keys per kind and CPU, rounded up to a power of two
+static unsigned int top_k = 10;                         // lines per list in the top file
+static struct top_cpu __percpu *top_cpus;
+static u32 top_mask;                                    // sets per table - 1
+static u32 top_seed __read_mostly;                      // hash seed
+
+module_param(top_talkers, bool, 0644);
+MODULE_PARM_DESC(top_talkers, "Count the top sources, destinations and destination ports");
+module_param(top_window, uint, 0644);
+MODULE_PARM_DESC(top_window, "Seconds the top talkers are counted over");
+module_param(top_entries, uint, 0444);
+MODULE_PARM_DESC(top_entries, "Keys tracked per kind and CPU, 32 bytes each");
+module_param(top_k, uint, 0644);
+MODULE_PARM_DESC(top_k, "Entries per list in the top file");
+
+static const char *key_names[FW_TOP_KEY_MAX] = {
+    [FW_TOP_SRC] = "sources", [FW_TOP_DST] = "destinations", [FW_TOP_DPORT] = "destination ports",
+};
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+static inline u64 window_ns(void) {
+    return (u64)max(READ_ONCE(top_window), 1U) * NSEC_PER_SEC;
+}
+
+/* Function for finding the table of one key kind in one window of a CPU */
+static inline struct top_set *top_table(const struct top_cpu *t, u64 window, u8 key) {
+    return &t->sets[((window & 1) * FW_TOP_KEY_MAX + key) * (top_mask + 1)];
+}
+
+/* Function for counting a packet against a key, Space-Saving within the key's set */
+static void top_count(struct top_set *table, u32 key, u16 len) {
+    struct top_set *set = &table[jhash_1word(key, top_seed) & top_mask];
+    struct top_slot *min = &set->way[0], *w;
+    int i;
+
+    for(i = 0; i < TOP_WAYS; i++) {
+        w = &set->way[i];
+
+        if(w->key == key && w->packets) { goto count; }
+        if(w->packets < min->packets) { min = w; }
+    }
+
+    /* the new key inherits the counts of the way it takes over, so it is overestimated rather than
+     * the evicted key's traffic being lost from the totals */
+    w = min;
+    w->key = key;
+
+count:
+    w->packets++;
+    w->bytes += len;
+}
+
+/* ===============================================================================================
+ * counter functions
+ * ===============================================================================================*/
+
+/* Function for counting a packet's source, destination and destination port, only the port for IPv6
+ * @param pkt: parsed packet
+ * */
+void fw_top_packet(const struct fw_pkt *pkt) {
+    struct top_cpu *t;
+    u64 window;
+
+    if(!READ_ONCE(top_talkers) || !top_cpus) { return; }
+
+    t = this_cpu_ptr(top_cpus);
+    window = div64_u64(ktime_get_mono_fast_ns(), window_ns());
+
+    /* a new window starts over the table of the one before the last; after a quiet spell both
+     * tables are out of date */
+    if(window != t->window) {
+        memset(top_table(t, window, 0), 0, sizeof(struct top_set) * (top_mask + 1) * FW_TOP_KEY_MAX);
+        if(window != t->window + 1) {
+            memset(top_table(t, window + 1, 0), 0, sizeof(struct top_set) * (top_mask + 1) * FW_TOP_KEY_MAX);
+        }
+        WRITE_ONCE(t->window, window);
+    }
+
+    if(pkt->family == NFPROTO_IPV4) {
+        top_count(top_table(t, window, FW_TOP_SRC), ntohl(pkt->saddr), pkt->len);
+        top_count(top_table(t, window, FW_TOP_DST), ntohl(pkt->daddr), pkt->len);
+    }
+    if(pkt->proto == IPPROTO_TCP || pkt->proto == IPPROTO_UDP) {
+        top_count(top_table(t, window, FW_TOP_DPORT), (u32)pkt->proto << 16 | pkt->dport, pkt->len);
+    }
+}
+
+/* ===============================================================================================
+ * merge functions
+ * ===============================================================================================*/
+static int cmp_key(const void *a, const void *b) {
+    u32 ka = ((const struct fw_top_entry *)a)->key, kb = ((const struct fw_top_entry *)b)->key;
+
+    return ka < kb ? -1 : ka > kb;
+}
+
+static int cmp_packets(const void *a, const void *b) {
+    u64 pa = ((const struct fw_top_entry *)a)->packets, pb = ((const struct fw_top_entry *)b)->packets;
+
+    return pa > pb ? -1 : pa < pb;
+}
+
+static int cmp_bytes(const void *a, const void *b) {
+    u64 ba = ((const struct fw_top_entry *)a)->bytes, bb = ((const struct fw_top_entry *)b)->bytes;
+
+    return ba > bb ? -1 : ba < bb;
+}
+
+/* Function for adding one CPU table to the merge buffer
+ * @param weight: share of the table's counts inside the last top_window seconds, in 1/2^TOP_WEIGHT_SHIFT
+ * returns the new number of entries in the buffer
+ * */
+static unsigned int top_collect(const struct top_set *table, u64 weight, struct fw_top_entry *buf, unsigned int n) {
+    const struct top_slot *w;
+    unsigned int i;
+
+    for(i = 0; i < (top_mask + 1) * TOP_WAYS; i++) {
+        w = &table[i / TOP_WAYS].way[i % TOP_WAYS];
+        if(!READ_ONCE(w->packets)) { continue; }
+
+        buf[n].key = READ_ONCE(w->key);
+        buf[n].packets = (READ_ONCE(w->packets) * weight) >> TOP_WEIGHT_SHIFT;
+        buf[n].bytes = (READ_ONCE(w->bytes) * weight) >> TOP_WEIGHT_SHIFT;
+        if(buf[n].packets) { n++; }
+    }
+
+    return n;
+}
+
+/* Function for reading the heavy hitters of the last top_window seconds. The tables are read
+ * without stopping the CPUs writing them, so counts can be off by the packets of the read.
+ * @param key: enum fw_top_key to rank
+ * @param by_bytes: rank by bytes rather than packets
+ * @param top: filled in with up to k entries, largest first
+ * @param k: entries wanted
+ * returns the number of entries filled in, or a negative errno
+ * */
+int fw_top_read(u8 key, bool by_bytes, struct fw_top_entry *top, unsigned int k) {
+    struct fw_top_entry *buf;
+    const struct top_cpu *t;
+    u64 span = window_ns(), now = ktime_get_mono_fast_ns(), window = div64_u64(now, span), seen, prev;
+    unsigned int n = 0, i, j;
+    int cpu;
+
+    if(key >= FW_TOP_KEY_MAX) { return -EINVAL; }
+
+    buf = vmalloc(sizeof(*buf) * (top_mask + 1) * TOP_WAYS * 2 * num_possible_cpus());
+    if(!buf) { return -ENOMEM; }
+
+    /* the part of the previous window that is still within the last span ns */
+    prev = div64_u64((span - (now - window * span)) << TOP_WEIGHT_SHIFT, span);
+
+    for_each_possible_cpu(cpu) {
+        t = per_cpu_ptr(top_cpus, cpu);
+        seen = READ_ONCE(t->window);
+
+        /* a CPU that saw no packet since the window changed still holds the tables it left */
+        if(seen == window) {
+            n = top_collect(top_table(t, window, key), 1 << TOP_WEIGHT_SHIFT, buf, n);
+            n = top_collect(top_table(t, window - 1, key), prev, buf, n);
+        } else if(seen + 1 == window) {
+            n = top_collect(top_table(t, seen, key), prev, buf, n);
+        }
+    }
+
+    /* the same key can be counted on every CPU */
+    sort(buf, n, sizeof(*buf), cmp_key, NULL);
+    for(i = 0, j = 0; i < n; i++) {
+        if(j && buf[j - 1].key == buf[i].key) {
+            buf[j - 1].packets += buf[i].packets;
+            buf[j - 1].bytes += buf[i].bytes;
+        } else {
+            buf[j++] = buf[i];
+        }
+    }
+
+    sort(buf, j, sizeof(*buf), by_bytes ? cmp_bytes : cmp_packets, NULL);
+    n = min(j, k);
+    memcpy(top, buf, sizeof(*buf) * n);
+    vfree(buf);
+
+    return n;
+}
+
+/* ===============================================================================================
+ * top file
+ * ===============================================================================================*/
+static void top_show_key(struct seq_file *m, u8 key, u32 value) {
+    u16 port = value & 0xffff;
+    u8 proto = value >> 16;
+
+    if(key != FW_TOP_DPORT) {
+        seq_printf(m, "%-18pI4h", &value);
+    } else if(proto == IPPROTO_TCP) {
+        seq_printf(m, "tcp/%-14u", port);
+    } else {
+        seq_printf(m, "udp/%-14u", port);
+    }
+}
+
+static int top_show(struct seq_file *m, void *v) {
+    unsigned int k = clamp(READ_ONCE(top_k), 1U, 1000U);
+    struct fw_top_entry *top;
+    int key, by_bytes, n, i;
+
+    top = kcalloc(k, sizeof(*top), GFP_KERNEL);
+    if(!top) { return -ENOMEM; }
+
+    seq_printf(m, "window: %u s\n", max(READ_ONCE(top_window), 1U));
+    for(key = 0; key < FW_TOP_KEY_MAX; key++) {
+        for(by_bytes = 0; by_bytes < 2; by_bytes++) {
+            n = fw_top_read(key, by_bytes, top, k);
+            if(n < 0) {
+                kfree(top);
+                return n;
+            }
+
+            seq_printf(m, "\n%s by %s\n%-18s %14s %16s\n", key_names[key], by_bytes ? "bytes" : "packets",
+                       key == FW_TOP_DPORT ? "port" : "address", "packets", "bytes");
+            for(i = 0; i < n; i++) {
+                top_show_key(m, key, top[i].key);
+                seq_printf(m, " %14llu %16llu\n", top[i].packets, top[i].bytes);
+            }
+        }
+    }
+
+    kfree(top);
+
+    return 0;
+}
+
+static int top_open(struct inode *inode, struct file *file) {
+    return single_open(file, top_show, NULL);
+}
+
+static const struct file_operations top_fops = {
+    .owner      = THIS_MODULE,
+    .open       = top_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
+};
+
+/* ===============================================================================================
+ * init/exit
+ * ===============================================================================================*/
+int fw_top_init(struct dentry *dir) {
+    unsigned int nsets = roundup_pow_of_two(max(top_entries / TOP_WAYS, 1U));
+    struct top_cpu *t;
+    int cpu;
+
+    BUILD_BUG_ON(sizeof(struct top_set) != 64);
+
+    top_cpus = alloc_percpu(struct top_cpu);
+    if(!top_cpus) { return -ENOMEM; }
+    top_mask = nsets - 1;
+
+    for_each_possible_cpu(cpu) {
+        t = per_cpu_ptr(top_cpus, cpu);
+        t->sets = vzalloc(sizeof(struct top_set) * nsets * FW_TOP_KEY_MAX * 2);
+        if(!t->sets) {
+            fw_top_exit();
+            return -ENOMEM;
+        }
+    }
+
+    get_random_bytes(&top_seed, sizeof(top_seed));
+
+    debugfs_create_file("top", 0444, dir, NULL, &top_fops);
+
+    return 0;
+}
+
+void fw_top_exit(void) {
+    int cpu;
+
+    if(!top_cpus) { return; }
+
+    for_each_possible_cpu(cpu) {
+        vfree(per_cpu_ptr(top_cpus, cpu)->sets);
+    }
+    free_percpu(top_cpus);
+    top_cpus = NULL;
+}
+
+// EOF
@@ -0,0 +1,45 @@
+/*************************************************************************************************
+ * Heavy hitters -- the sources, destinations and destination ports that sent the most packets or
+ * bytes over the last top_window seconds, counted per CPU on the packet path and merged on read.
+ ************************************************************************************************/
+#ifndef _FW_TOP_H
+#define _FW_TOP_H
+
+#include <linux/types.h>
+
+#include "fw.h"
+
+/* ===============================================================================================
+ * defines
+ * ===============================================================================================*/
+enum fw_top_key {
+    FW_TOP_SRC,                     // source address
+    FW_TOP_DST,                     // destination address
+    FW_TOP_DPORT,                   // IP protocol and TCP/UDP destination port
+    FW_TOP_KEY_MAX
+};
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct fw_top_entry {
+    u32 key;                        // address in host byte order, or protocol << 16 | port
+    u64 packets;                    // estimates over the window, never below the true counts
+    u64 bytes;
+};
+
+struct dentry;
+
+/* ===============================================================================================
+ * functions
+ * ===============================================================================================*/
+int fw_top_init(struct dentry *dir);
+void fw_top_exit(void);
+
+/* Callers run with bottom halves disabled, every CPU only writes its own tables */
+void fw_top_packet(const struct fw_pkt *pkt);
+
+/* Merges the tables of every CPU; sleeps, not for the packet path */
+int fw_top_read(u8 key, bool by_bytes, struct fw_top_entry *top, unsigned int k);
+
+#endif /* _FW_TOP_H */
@@ -0,0 +1,325 @@
+/*************************************************************************************************
+ * Definitions shared between the firewall module and its userspace tools. Only fixed-size
+ * __u* types in here so the same header compiles on both sides.
+ ************************************************************************************************/
+#ifndef _FW_UAPI_H
+#define _FW_UAPI_H
+
+#include <linux/types.h>
+
+/* ===============================================================================================
+ * event records -- one per verdict, read from the per-CPU relay files
+ * /sys/kernel/debug/netfilter-firewall/events<cpu>
+ * ===============================================================================================*/
+#define FW_EVENT_VERSION 2
+
+enum fw_reason {
+    FW_REASON_NONE,                 // fell through every check
+    FW_REASON_BLOCKLIST,            // source (destination on egress) matched a blocked prefix
+    FW_REASON_TCP,                  // TCP policy
+    FW_REASON_SIGNATURE,            // TCP payload matched a signature
+    FW_REASON_UDP,                  // UDP policy
+    FW_REASON_DNS,                  // UDP to or from port 53
+    FW_REASON_ICMP,                 // ICMP policy
+    FW_REASON_IFACE,                // received or sent on a blocked or trusted interface
+    FW_REASON_OTHER,                // policy for any other protocol
+    FW_REASON_RULE,                 // matched a filter rule
+    FW_REASON_RATELIMIT,            // over the rate of a ratelimit policy or rule
+    FW_REASON_DOMAIN,               // DNS question matched a domain
+    FW_REASON_DYNBLOCK,             // source (destination on egress) is under a dynamic block
+    FW_REASON_EXTHDRS,              // IPv6 extension headers past FW_IPV6_MAX_EXTHDRS
+    FW_REASON_MALFORMED,            // IP or transport header cut short or malformed
+    FW_REASON_MAX
+};
+
+enum fw_hook {
+    FW_HOOK_PRE_ROUTING,            // IPv4 PRE_ROUTING, every received packet
+    FW_HOOK_INGRESS,                // netdev ingress of an ingress_devs interface, early drops only
+    FW_HOOK_LOCAL_OUT,              // IPv4 LOCAL_OUT, locally generated packets with egress_hook set
+    FW_HOOK_PRE_ROUTING6,           // IPv6 PRE_ROUTING
+    FW_HOOK_LOCAL_OUT6,             // IPv6 LOCAL_OUT, with egress_hook set
+    FW_HOOK_MAX
+};
+
+struct fw_event {
+    __u64 ts_ns;                    // ktime_get_ns() when the verdict was taken
+    __u8 saddr[16];                 // source address, network byte order, IPv4 in the first 4 bytes
+    __u8 daddr[16];                 // destination address, likewise
+    __u16 sport;                    // source port, host byte order
+    __u16 dport;                    // destination port, host byte order
+    __u32 ifindex;                  // input interface, output interface at FW_HOOK_LOCAL_OUT*, 0 if unknown
+    __u32 netns;                    // inode number of the interface's network namespace, 0 if unknown
+    __u16 len;                      // IP total length, IPv6 payload length plus the fixed header
+    __u8 proto;                     // IP protocol, the header after the IPv6 extension headers
+    __u8 verdict;                   // NF_ACCEPT (1) or NF_DROP (0)
+    __u8 reason;                    // enum fw_reason
+    __u8 hook;                      // enum fw_hook
+    __u8 family;                    // 2 for IPv4, 10 for IPv6 (NFPROTO_*)
+    __u8 pad[5];
+};
+
+/* ===============================================================================================
+ * control plane -- generic netlink family FW_GENL_NAME
+ *
+ * FW_CMD_BATCH carries a list of operations in FW_A_OPS. A batch sent outside a transaction is
+ * applied on its own; batches sent between FW_CMD_BEGIN and FW_CMD_COMMIT from the same socket
+ * are collected and applied together. Either way the ops are built into a new ruleset generation
+ * that replaces the live one in a single pointer swap, so packets see all of a change or none.
+ *
+ * Dynamic blocks are not part of the ruleset: FW_CMD_BLOCK and FW_CMD_UNBLOCK take effect at once,
+ * inside a transaction or not, and expire on their own.
+ *
+ * The family works in every network namespace. Rulesets, transactions and dynamic blocks belong
+ * to the namespace of the socket and need CAP_NET_ADMIN there; a block only drops the packets of
+ * the namespace it was made in.
+ * ===============================================================================================*/
+#define FW_GENL_NAME        "nffw"
+#define FW_GENL_VERSION     1
+#define FW_MAX_PREFIXES     (1 << 22)   // blocked prefixes per ruleset
+#define FW_MAX_PREFIXES6    (1 << 16)   // blocked IPv6 prefixes per ruleset
+#define FW_MAX_FILTER_RULES (1 << 17)   // filter rules per ruleset
+#define FW_MAX_SIGNATURES   1024        // payload signatures per ruleset
+#define FW_SIG_MAXLEN       128         // longest payload signature
+#define FW_MAX_IFACES       256         // interfaces with a mode other than FW_IFACE_FILTER
+#define FW_MAX_DOMAINS      (1 << 18)   // DNS domains per ruleset
+#define FW_DOMAIN_MAXLEN    255         // longest domain, "*." and a 253 character name
+#define FW_MAX_ICMP         (256 * 257) // ICMP entries per ruleset, every type and code plus each type's wildcard
+
+enum fw_cmd {
+    FW_CMD_UNSPEC,
+    FW_CMD_GET,                     // reply carries the generation, policies and counts
+    FW_CMD_BEGIN,                   // open a transaction for this socket
+    FW_CMD_BATCH,                   // apply FW_A_OPS, to the open transaction if there is one
+    FW_CMD_COMMIT,                  // build and swap in the transaction's ruleset
+    FW_CMD_ABORT,                   // drop the open transaction
+    FW_CMD_BLOCK,                   // block host FW_A_PREFIX_ADDR, or the /64 of FW_A_PREFIX_ADDR6, for
+                                    // FW_A_TTL seconds, or change its TTL
+    FW_CMD_UNBLOCK,                 // lift the block of FW_A_PREFIX_ADDR or FW_A_PREFIX_ADDR6's /64, of
+                                    // every host of the namespace without either
+    __FW_CMD_MAX
+};
+#define FW_CMD_MAX (__FW_CMD_MAX - 1)
+
+enum fw_attr {
+    FW_A_UNSPEC,
+    FW_A_GENERATION,                // u32: live generation (GET), or generation a change expects
+    FW_A_OPS,                       // nested: list of FW_A_OP
+    FW_A_OP,                        // nested: one operation
+    FW_A_OP_TYPE,                   // u8: enum fw_op
+    FW_A_RULE_KIND,                 // u8: enum fw_rule_kind
+    FW_A_PREFIX_ADDR,               // be32
+    FW_A_PREFIX_LEN,                // u8
+    FW_A_POLICY,                    // u8: enum fw_policy
+    FW_A_ACTION,                    // u8: enum fw_action
+    FW_A_IFNAME,                    // string
+    FW_A_NPREFIXES,                 // u32: blocked prefixes in the live ruleset (GET)
+    FW_A_POLICIES,                  // binary: u8 action per enum fw_policy (GET)
+    FW_A_PROTO,                     // u8: IP protocol, 0 = any
+    FW_A_DST_ADDR,                  // be32
+    FW_A_DST_LEN,                   // u8
+    FW_A_SPORT_MIN,                 // u16
+    FW_A_SPORT_MAX,                 // u16
+    FW_A_DPORT_MIN,                 // u16
+    FW_A_DPORT_MAX,                 // u16
+    FW_A_NRULES,                    // u32: filter rules in the live ruleset (GET)
+    FW_A_PATTERN,                   // binary: payload signature, 1..FW_SIG_MAXLEN bytes
+    FW_A_NSIGNATURES,               // u32: payload signatures in the live ruleset (GET)
+    FW_A_IFACE_MODE,                // u8: enum fw_iface_mode
+    FW_A_IFACES,                    // nested: list of FW_A_IFACE (GET)
+    FW_A_IFACE,                     // nested: FW_A_IFNAME, FW_A_IFACE_MODE
+    FW_A_DOMAIN,                    // string: DNS domain, "*." first for the names below it
+    FW_A_NDOMAINS,                  // u32: DNS domains in the live ruleset (GET)
+    FW_A_ICMP_TYPE,                 // u8: ICMP type
+    FW_A_ICMP_CODE,                 // u8: ICMP code, absent for every code of the type
+    FW_A_ICMP_RATE,                 // u32: packets per second of an ICMP type, all sources together
+    FW_A_NICMP,                     // u32: ICMP entries in the live ruleset (GET)
+    FW_A_TTL,                       // u32: seconds a dynamic block lasts, at least 1
+    FW_A_NDYNBLOCKS,                // u32: live dynamic blocks of the namespace (GET)
+    FW_A_PREFIX_ADDR6,              // binary: 16 byte IPv6 address, network byte order
+    FW_A_NPREFIXES6,                // u32: blocked IPv6 prefixes in the live ruleset (GET)
+    FW_A_DST_ADDR6,                 // binary: 16 byte IPv6 address, network byte order
+    FW_A_FAMILY,                    // u8: NFPROTO_IPV4 (2) or NFPROTO_IPV6 (10)
+    FW_A_NICMP6,                    // u32: ICMPv6 entries in the live ruleset (GET)
+    __FW_A_MAX
+};
+#define FW_A_MAX (__FW_A_MAX - 1)
+
+enum fw_op {
+    FW_OP_ADD,
+    FW_OP_DEL,
+    FW_OP_FLUSH,                    // remove every rule of the given kind
+};
+
+enum fw_rule_kind {
+    FW_RULE_PREFIX,                 // blocked source prefix: FW_A_PREFIX_ADDR or FW_A_PREFIX_ADDR6,
+                                    // FW_A_PREFIX_LEN; flush removes the prefixes of both families
+    FW_RULE_POLICY,                 // action for a traffic class: FW_A_POLICY, FW_A_ACTION
+    FW_RULE_IFACE,                  // mode of interface FW_A_IFNAME: FW_A_IFACE_MODE, blocked if
+                                    // absent; del restores FW_IFACE_FILTER, del without a name
+                                    // or flush does so for every interface
+    FW_RULE_FILTER,                 // filter rule, appended on add, first identical one deleted on
+                                    // del: FW_A_ACTION plus any of FW_A_PROTO, FW_A_PREFIX_ADDR/LEN
+                                    // (source), FW_A_DST_ADDR/LEN, FW_A_SPORT_MIN/MAX,
+                                    // FW_A_DPORT_MIN/MAX, FW_A_IFNAME (input interface),
+                                    // FW_A_FAMILY; FW_A_PREFIX_ADDR6 and FW_A_DST_ADDR6 with the
+                                    // same lengths make an IPv6 rule, a rule without prefixes or
+                                    // family matches both families
+    FW_RULE_SIGNATURE,              // TCP payload signature: FW_A_PATTERN, FW_A_ACTION; adding an
+                                    // existing pattern changes its action
+    FW_RULE_DOMAIN,                 // DNS query name: FW_A_DOMAIN, FW_A_ACTION; "example.com" matches
+                                    // that name, "*.example.com" every name below it, the most
+                                    // specific match wins; adding an existing domain changes its action
+    FW_RULE_ICMP,                   // ICMP type/code: FW_A_ICMP_TYPE, FW_A_ICMP_CODE, FW_A_ACTION, and
+                                    // FW_A_ICMP_RATE on entries for a whole type; decides ICMP that no
+                                    // filter rule matched in place of FW_POLICY_ICMP, a code's entry
+                                    // before its type's; adding an existing entry replaces it;
+                                    // FW_A_FAMILY NFPROTO_IPV6 for an ICMPv6 entry, flush clears both
+};
+
+/* traffic classes, the fallback for packets no filter rule matches */
+enum fw_policy {
+    FW_POLICY_TCP,
+    FW_POLICY_UDP,
+    FW_POLICY_DNS,                  // UDP to or from port 53, checked before FW_POLICY_UDP
+    FW_POLICY_ICMP,
+    FW_POLICY_OTHER,
+    FW_POLICY_MAX
+};
+
+enum fw_action {
+    FW_ACTION_DROP,                 // same values as NF_DROP/NF_ACCEPT
+    FW_ACTION_ACCEPT,
+    FW_ACTION_FLAG,                 // signatures and domains only: mark the packet in the event log, keep the verdict
+    FW_ACTION_RATELIMIT,            // policies, rules and ICMP only: accept within the source's rate, drop the rest
+    FW_ACTION_MAX
+};
+
+/* what the hooks do with packets received on an interface (or sent on it, at LOCAL_OUT). Modes are
+ * configured by name and follow the interface as it goes away and comes back. */
+enum fw_iface_mode {
+    FW_IFACE_FILTER,                // every check, the default
+    FW_IFACE_HEADERS,               // blocklist, rules and policies, but no payload signatures or domains
+    FW_IFACE_TRUSTED,               // accept everything without any check
+    FW_IFACE_BLOCKED,               // drop everything
+    FW_IFACE_MAX
+};
+
+/* ===============================================================================================
+ * ruleset images -- a whole ruleset compiled offline by tools/fw-compile and written to
+ * /sys/kernel/debug/netfilter-firewall/ruleset_image, which replaces the live ruleset with it
+ *
+ * An image is a header, a table of sections and the sections themselves, each at an offset from
+ * the start of the image, so it can be loaded anywhere and copied without fixups. Values are in
+ * the byte order of the machine the image is built for; the magic reads wrong on any other. The
+ * rule lists go in the order a commit leaves them in, and the LPM table and host set of the
+ * blocked prefixes in the very layout the hook searches, ready to be copied into place. Filter
+ * rules name their input interface, which the module looks up when it loads the image.
+ * ===============================================================================================*/
+#define FW_IMAGE_MAGIC      0x4d495746  // "FWIM" in a little-endian image
+#define FW_IMAGE_VERSION    3
+#define FW_IMAGE_MAXSIZE    (1U << 30)  // largest image the module accepts
+#define FW_IMAGE_ALIGN      8           // sections start at multiples of this
+
+struct fw_image_header {
+    __u32 magic;                    // FW_IMAGE_MAGIC
+    __u16 version;                  // FW_IMAGE_VERSION
+    __u16 nsections;                // entries in the section table right after the header
+    __u32 size;                     // bytes in the image, header included
+    __u32 crc;                      // CRC-32 (as in zlib) of the bytes after the header
+};
+
+struct fw_image_section {
+    __u16 type;                     // enum fw_image_section_type, each at most once
+    __u16 pad;
+    __u32 count;                    // records in the section, see below
+    __u32 offset;                   // from the start of the image, a multiple of FW_IMAGE_ALIGN
+    __u32 size;                     // bytes in the section
+};
+
+/* Sections. Only FW_IMAGE_POLICY is required, a missing list is empty. FW_IMAGE_LPM and
+ * FW_IMAGE_HOSTSET go together; without them the module builds both from FW_IMAGE_PREFIXES. The
+ * IPv6 prefixes only come as a list, their table is always built by the module. */
+enum fw_image_section_type {
+    FW_IMAGE_POLICY,                // __u8 enum fw_action per enum fw_policy, count FW_POLICY_MAX
+    FW_IMAGE_PREFIXES,              // struct fw_image_prefix, sorted by (addr, len), unique, host bits clear
+    FW_IMAGE_LPM,                   // the prefixes shorter than /32: __u32 root[65536], then count child
+                                    // tables of 256 __u32 entries, as struct lpm_table in fw-lpm.h
+    FW_IMAGE_HOSTSET,               // the /32 prefixes: struct fw_image_hostset, then its buckets of 16
+                                    // __u32 slots and Bloom blocks of 8 __u64, as struct fw_hostset in
+                                    // fw-hostset.h; count is the number of addresses
+    FW_IMAGE_RULES,                 // struct fw_image_rule, in match order
+    FW_IMAGE_SIGNATURES,            // struct fw_image_signature, in match order
+    FW_IMAGE_IFACES,                // struct fw_image_iface, unique names
+    FW_IMAGE_DOMAINS,               // struct fw_image_domain, sorted by name bytewise, unique
+    FW_IMAGE_DOMAIN_NAMES,          // the canonical names the domains point into, count is the byte count
+    FW_IMAGE_ICMP,                  // struct fw_image_icmp, sorted by (type, code), unique
+    FW_IMAGE_PREFIXES6,             // struct fw_image_prefix6, sorted by (addr, len), unique, host bits clear
+    FW_IMAGE_ICMP6,                 // struct fw_image_icmp for ICMPv6, sorted by (type, code), unique
+    FW_IMAGE_MAX
+};
+
+struct fw_image_prefix {
+    __u32 addr;                     // host byte order
+    __u8 len;
+    __u8 pad[3];
+};
+
+struct fw_image_prefix6 {
+    __u8 addr[16];                  // network byte order
+    __u8 len;
+    __u8 pad[3];
+};
+
+struct fw_image_hostset {
+    __u64 seed;                     // hash seed the slots and Bloom bits were placed with
+    __u32 buckets;                  // power of two
+    __u32 blocks;                   // Bloom blocks, power of two
+    __u8 zero;                      // 0.0.0.0 is in the set
+    __u8 pad[7];
+};
+
+/* rules carry the name of their input interface rather than its ifindex, which only means something
+ * in the namespace that loads the image */
+struct fw_image_rule {
+    __u32 src;                      // host byte order, host bits clear, zero in an IPv6 rule
+    __u32 dst;
+    __u8 src_len;
+    __u8 dst_len;
+    __u8 proto;
+    __u8 action;                    // enum fw_action
+    __u16 sport_min, sport_max;
+    __u16 dport_min, dport_max;
+    __u8 family;                    // NFPROTO_IPV4 for a rule with IPv4 prefixes, NFPROTO_IPV6, or 0
+    __u8 pad[3];
+    __u8 src6[16];                  // network byte order, host bits clear, zero unless IPv6
+    __u8 dst6[16];
+    char iif[16];                   // input interface, NUL terminated, empty for any
+};
+
+struct fw_image_signature {
+    __u8 action;                    // enum fw_action
+    __u8 len;                       // bytes in pattern, 1..FW_SIG_MAXLEN
+    __u8 pattern[FW_SIG_MAXLEN];    // unused bytes zero
+};
+
+struct fw_image_iface {
+    char name[16];                  // NUL terminated
+    __u8 mode;                      // enum fw_iface_mode, never FW_IFACE_FILTER
+    __u8 pad[3];
+};
+
+struct fw_image_domain {
+    __u32 name;                     // offset in FW_IMAGE_DOMAIN_NAMES
+    __u8 len;
+    __u8 action;                    // enum fw_action
+    __u8 pad[2];
+};
+
+struct fw_image_icmp {
+    __u8 type;
+    __u8 action;                    // enum fw_action
+    __u16 code;                     // 256 for the whole type
+    __u32 rate;                     // packets per second, whole-type entries only
+};
+
+#endif /* _FW_UAPI_H */
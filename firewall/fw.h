@@ -0,0 +1,48 @@
+/*************************************************************************************************
+ * Shared firewall definitions -- the per-packet context handed between the stages of the hook.
+ ************************************************************************************************/
+#ifndef _FW_H
+#define _FW_H
+
+#include <linux/types.h>
+#include <linux/in6.h>
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+
+/* where a packet sits in its IP datagram */
+enum fw_frag {
+    FW_FRAG_NONE,                   // not fragmented
+    FW_FRAG_FIRST,                  // first fragment, carries the transport header
+    FW_FRAG_LATER,                  // any other fragment, payload only
+};
+
+/* Per-packet context. It lives on the hook's stack, so softirqs running the hook on different
+ * CPUs at the same time never write to a shared cache line. The IPv4 and IPv6 paths share it; the
+ * fields named after IP headers mean the same in both, with the extension headers of an IPv6
+ * packet counted as part of its IP header. */
+struct fw_pkt {
+    __be32 saddr;                   // source address, network byte order (0 for IPv6)
+    __be32 daddr;                   // destination address, network byte order (0 for IPv6)
+    u16 sport;                      // source port, host byte order (0 unless TCP/UDP, 0 in later fragments)
+    u16 dport;                      // destination port, host byte order (0 unless TCP/UDP, 0 in later fragments)
+    u16 iphlen;                     // IP header length in bytes, IPv6 extension headers included
+    u16 len;                        // IP total length in bytes
+    u16 payload_off;                // TCP payload offset from the IP header
+    u16 payload_len;                // TCP payload bytes present in the skb (0 unless TCP)
+    u8 proto;                       // IP protocol, the IPv6 header after the extension headers
+    u8 tcp_end;                     // FIN or RST set (0 unless TCP)
+    u8 icmp_type;                   // ICMP or ICMPv6 type (0 unless either)
+    u8 icmp_code;                   // ICMP or ICMPv6 code (0 unless either)
+    u32 ifindex;                    // input interface, 0 if none
+    u32 seq;                        // sequence number of the first TCP payload byte, host byte order
+    u32 ip_id;                      // IP or IPv6 fragment header identification, host byte order
+    u8 frag;                        // enum fw_frag
+    u8 family;                      // NFPROTO_IPV4 or NFPROTO_IPV6
+    u8 truncated;                   // the packet ends inside its transport header
+    struct in6_addr saddr6;         // IPv6 source address, only set for NFPROTO_IPV6
+    struct in6_addr daddr6;         // IPv6 destination address, only set for NFPROTO_IPV6
+};
+
+#endif /* _FW_H */
@@ -0,0 +1,1066 @@
+/*************************************************************************************************
+ * KUnit suite for packet judgement -- builds synthetic skbs and runs them through what the
+ * PRE_ROUTING hook does (fw_parse_packet, then fw_judge with bottom halves disabled), checks each
+ * verdict and reason, and reports the cost per case in cycles and nanoseconds.
+ *
+ * Cases cover every protocol branch, the blocklist, filter rules, signatures, DNS query names, ICMP
+ * types and codes, the ratelimit action, dynamic blocks, interface modes, heavy hitter counting, IP
+ * fragments and the verdicts later fragments take over from their first, nonlinear skbs with
+ * headers or payload in page fragments, and truncated or malformed headers, which the hook drops,
+ * tiny first fragments and the rest of their datagram included. IPv6 cases run the same branches through fw_parse_packet6, with
+ * extension headers, fragment headers and ICMPv6. fw-main.c itself is not built: the suite judges
+ * with one struct fw_net of its own for init_net in place of the pernet glue, and stops one call
+ * short of netfilter.
+ *
+ * Under ARCH=um the cycle counts come from the host TSC and include UML's own overhead, so compare
+ * them between cases and builds rather than with numbers from real hardware. See kunit.sh.
+ ************************************************************************************************/
+
+/* standard includes */
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <linux/icmp.h>
+#include <linux/icmpv6.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/inet.h>
+#include <linux/ipv6.h>
+#include <linux/mm.h>
+#include <linux/timekeeping.h>
+#include <linux/debugfs.h>
+#include <net/net_namespace.h>
+#include <net/ndisc.h>
+#include <asm/timex.h>
+
+#include "fw-judge.h"
+#include "fw-ratelimit.h"
+#include "fw-dynblock.h"
+#include "fw-ruleset.h"
+#include "fw-flow.h"
+#include "fw-frag.h"
+#include "fw-stream.h"
+#include "fw-stats.h"
+#include "fw-top.h"
+#include "fw-net.h"
+
+#define TEST_ITERATIONS 1000            // timed runs per case, after one checked cold run
+#define TEST_BUFLEN     256             // largest synthetic packet
+
+#define FRAG_MF         0x2000          // IP "more fragments" flag, host byte order
+#define FRAG_OFFSET     0x1fff          // IP fragment offset in 8 byte units
+
+/* a DNS query for one name of type A, class IN; the names are split into strings so a hex escape
+ * never runs into the label after it */
+#define DNS_HDR             "\x12\x34\x01\x00\x00\x01\x00\x00\x00\x00\x00\x00"
+#define DNS_QUERY(name)     .payload = DNS_HDR name "\x00\x01\x00\x01", \
+                            .plen = sizeof(DNS_HDR name "\x00\x01\x00\x01") - 1
+#define NAME_ADS_TEST       "\x03" "ads" "\x04" "test" "\x00"
+#define NAME_X_ADS_TEST     "\x01" "x" NAME_ADS_TEST
+#define NAME_OK_ADS_TEST    "\x02" "ok" NAME_ADS_TEST
+#define NAME_TRACKER_TEST   "\x07" "Tracker" "\x04" "TEST" "\x00"
+#define NAME_A_TRACKER_TEST "\x01" "a" "\x07" "tracker" "\x04" "test" "\x00"
+
+/* ===============================================================================================
+ * types
+ * ===============================================================================================*/
+struct judge_case {
+    const char *name;
+    u8 proto;                       // IP protocol, TCP/UDP/ICMP/ICMPv6 get a header
+    bool ipv6;                      // IPv6 packet, from saddr6
+    u32 saddr;                      // source address, host byte order, 0 for 10.0.0.1
+    const char *saddr6;             // IPv6 source address, NULL for 2001:db8::1
+    u8 exthdrs;                     // IPv6 hop-by-hop and destination options headers before the rest
+    u16 dport;                      // TCP/UDP destination port
+    u8 icmp_type;                   // ICMP type
+    u8 icmp_code;                   // ICMP code
+    u32 seq;                        // TCP sequence number, 0 for 1000
+    u16 frag_off;                   // IP flags and fragment offset, host byte order; IPv6 gets a
+                                    // fragment header if set
+    u32 id;                         // IP or fragment header identification, 16 bits for IPv4
+    u8 ihl;                         // IP header length in words, 0 for 5
+    const char *payload;            // bytes after the L4 header
+    unsigned int plen;              // bytes in payload, 0 for strlen(payload)
+    unsigned int linear;            // bytes in the skb head, the rest goes to a page fragment, 0 for all
+    unsigned int truncate;          // bytes cut off the end, the IP total length keeps them
+    unsigned int verdict;           // expected NF_ACCEPT/NF_DROP
+    u8 reason;                      // expected enum fw_reason
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static struct dentry *test_dir;
+static struct fw_net test_net = { .net = &init_net, .id = 1 };   // what the pernet glue gives init_net
+static struct fw_net other_net = { .net = &init_net, .id = 2 };  // stands in for a container's namespace
+static struct net_device test_dev = { .name = "fwtest0", .ifindex = 1000 }; // no real device's index
+
+/* Besides the module's defaults: the module's default blocked prefix, a blocked host, a rule
+ * letting UDP to port 5000 through, one dropping TCP to port 23, a signature that drops, the domains *.ads.test (drop),
+ * ok.ads.test (accept) and tracker.test (drop), ICMP echo replies and timestamps accepted, the
+ * latter at 10 per second, and the IPv6 prefix 2001:db8:bad::/48 blocked */
+static const struct judge_case judge_cases[] = {
+    { .name = "tcp", .proto = IPPROTO_TCP, .dport = 80,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_TCP },
+    { .name = "tcp_blocked", .proto = IPPROTO_TCP, .saddr = 0xd0509a07, .dport = 80,
+      .verdict = NF_DROP, .reason = FW_REASON_BLOCKLIST },
+    { .name = "tcp_blocked_host", .proto = IPPROTO_TCP, .saddr = 0xc6336407, .dport = 80,
+      .verdict = NF_DROP, .reason = FW_REASON_BLOCKLIST },
+    { .name = "tcp_host_neighbour", .proto = IPPROTO_TCP, .saddr = 0xc6336408, .dport = 80,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_TCP },
+    { .name = "udp", .proto = IPPROTO_UDP, .dport = 9999,
+      .verdict = NF_DROP, .reason = FW_REASON_UDP },
+    { .name = "udp_dns", .proto = IPPROTO_UDP, .dport = 53,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_DNS },
+    { .name = "dns_wildcard", .proto = IPPROTO_UDP, .dport = 53, DNS_QUERY(NAME_X_ADS_TEST),
+      .verdict = NF_DROP, .reason = FW_REASON_DOMAIN },
+    /* "*.ads.test" covers the names below ads.test, not ads.test itself */
+    { .name = "dns_wildcard_parent", .proto = IPPROTO_UDP, .dport = 53, DNS_QUERY(NAME_ADS_TEST),
+      .verdict = NF_ACCEPT, .reason = FW_REASON_DNS },
+    { .name = "dns_exact_case", .proto = IPPROTO_UDP, .dport = 53, DNS_QUERY(NAME_TRACKER_TEST),
+      .verdict = NF_DROP, .reason = FW_REASON_DOMAIN },
+    { .name = "dns_exact_below", .proto = IPPROTO_UDP, .dport = 53, DNS_QUERY(NAME_A_TRACKER_TEST),
+      .verdict = NF_ACCEPT, .reason = FW_REASON_DNS },
+    /* "ok.ads.test" is more specific than "*.ads.test" */
+    { .name = "dns_most_specific", .proto = IPPROTO_UDP, .dport = 53, DNS_QUERY(NAME_OK_ADS_TEST),
+      .verdict = NF_ACCEPT, .reason = FW_REASON_DOMAIN },
+    /* the last label claims more bytes than the packet has left */
+    { .name = "dns_truncated_name", .proto = IPPROTO_UDP, .dport = 53, DNS_QUERY("\x01" "x" "\x03" "ads" "\x3f" "test"),
+      .verdict = NF_ACCEPT, .reason = FW_REASON_DNS },
+    { .name = "udp_rule", .proto = IPPROTO_UDP, .dport = 5000,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_RULE },
+    { .name = "icmp", .proto = IPPROTO_ICMP, .icmp_type = ICMP_ECHO,
+      .verdict = NF_DROP, .reason = FW_REASON_ICMP },
+    { .name = "icmp_frag_needed", .proto = IPPROTO_ICMP, .icmp_type = ICMP_DEST_UNREACH,
+      .icmp_code = ICMP_FRAG_NEEDED, .verdict = NF_ACCEPT, .reason = FW_REASON_ICMP },
+    /* the entry is for one code, the rest of the type falls back to the policy */
+    { .name = "icmp_port_unreach", .proto = IPPROTO_ICMP, .icmp_type = ICMP_DEST_UNREACH,
+      .icmp_code = ICMP_PORT_UNREACH, .verdict = NF_DROP, .reason = FW_REASON_ICMP },
+    { .name = "icmp_type", .proto = IPPROTO_ICMP, .icmp_type = ICMP_ECHOREPLY,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_ICMP },
+    { .name = "icmp_blocked", .proto = IPPROTO_ICMP, .saddr = 0xd0509a07, .icmp_type = ICMP_ECHOREPLY,
+      .verdict = NF_DROP, .reason = FW_REASON_BLOCKLIST },
+    { .name = "gre", .proto = IPPROTO_GRE,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_OTHER },
+    { .name = "tcp_signature_flag", .proto = IPPROTO_TCP, .dport = 80, .payload = "GET / HTTP/1.1\r\n",
+      .verdict = NF_ACCEPT, .reason = FW_REASON_SIGNATURE },
+    { .name = "tcp_signature_drop", .proto = IPPROTO_TCP, .dport = 80, .payload = "xxEVILxx",
+      .verdict = NF_DROP, .reason = FW_REASON_SIGNATURE },
+    { .name = "tcp_blocked_signature", .proto = IPPROTO_TCP, .saddr = 0xd0509a07, .dport = 80,
+      .payload = "xxEVILxx", .verdict = NF_DROP, .reason = FW_REASON_BLOCKLIST },
+    /* "HTTP" straddles the head and the page fragment */
+    { .name = "nonlinear_payload", .proto = IPPROTO_TCP, .dport = 80, .payload = "GET / HTTP/1.1\r\n",
+      .linear = 20 + 20 + 8, .verdict = NF_ACCEPT, .reason = FW_REASON_SIGNATURE },
+    { .name = "nonlinear_headers", .proto = IPPROTO_TCP, .dport = 80, .linear = 24,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_TCP },
+    { .name = "fragment_first", .proto = IPPROTO_UDP, .dport = 53, .frag_off = FRAG_MF,
+      .payload = "xxxxxxxx", .verdict = NF_ACCEPT, .reason = FW_REASON_DNS },
+    /* a later fragment whose first never came is judged without ports, by the UDP policy */
+    { .name = "fragment_later", .proto = IPPROTO_UDP, .dport = 53, .frag_off = 185, .id = 1,
+      .payload = "xxxxxxxx", .verdict = NF_DROP, .reason = FW_REASON_UDP },
+    /* the scan stops at the end of the skb, not at the IP total length */
+    { .name = "truncated_payload", .proto = IPPROTO_TCP, .dport = 80, .payload = "HTTP/1.1 200 OK\r\n",
+      .truncate = 10, .verdict = NF_ACCEPT, .reason = FW_REASON_SIGNATURE },
+    { .name = "truncated_ip", .proto = IPPROTO_TCP, .dport = 80, .truncate = 20 + 10,
+      .verdict = NF_DROP, .reason = FW_REASON_MALFORMED },
+    { .name = "truncated_tcp", .proto = IPPROTO_TCP, .dport = 80, .truncate = 10,
+      .verdict = NF_DROP, .reason = FW_REASON_MALFORMED },
+    { .name = "truncated_udp", .proto = IPPROTO_UDP, .dport = 53, .truncate = 6,
+      .verdict = NF_DROP, .reason = FW_REASON_MALFORMED },
+    { .name = "bad_ihl", .proto = IPPROTO_TCP, .dport = 80, .ihl = 4,
+      .verdict = NF_DROP, .reason = FW_REASON_MALFORMED },
+    { .name = "tcp6", .ipv6 = true, .proto = IPPROTO_TCP, .dport = 80,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_TCP },
+    { .name = "tcp6_blocked", .ipv6 = true, .proto = IPPROTO_TCP, .saddr6 = "2001:db8:bad::7", .dport = 80,
+      .verdict = NF_DROP, .reason = FW_REASON_BLOCKLIST },
+    { .name = "tcp6_prefix_neighbour", .ipv6 = true, .proto = IPPROTO_TCP, .saddr6 = "2001:db8:bae::7",
+      .dport = 80, .verdict = NF_ACCEPT, .reason = FW_REASON_TCP },
+    { .name = "udp6", .ipv6 = true, .proto = IPPROTO_UDP, .dport = 9999,
+      .verdict = NF_DROP, .reason = FW_REASON_UDP },
+    /* the UDP rule names no addresses, so it holds for IPv6 as well */
+    { .name = "udp6_rule", .ipv6 = true, .proto = IPPROTO_UDP, .dport = 5000,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_RULE },
+    { .name = "udp6_prefix_rule", .ipv6 = true, .proto = IPPROTO_UDP, .saddr6 = "2001:db8:42::9", .dport = 9999,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_RULE },
+    { .name = "udp6_prefix_rule_neighbour", .ipv6 = true, .proto = IPPROTO_UDP, .saddr6 = "2001:db8:43::9",
+      .dport = 9999, .verdict = NF_DROP, .reason = FW_REASON_UDP },
+    { .name = "udp6_exthdrs", .ipv6 = true, .proto = IPPROTO_UDP, .exthdrs = 2, .dport = 5000,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_RULE },
+    /* one options header more than the parser walks hides the transport header */
+    { .name = "udp6_too_many_exthdrs", .ipv6 = true, .proto = IPPROTO_UDP, .exthdrs = FW_IPV6_MAX_EXTHDRS + 1,
+      .dport = 5000, .verdict = NF_DROP, .reason = FW_REASON_EXTHDRS },
+    { .name = "dns6_wildcard", .ipv6 = true, .proto = IPPROTO_UDP, .dport = 53, DNS_QUERY(NAME_X_ADS_TEST),
+      .verdict = NF_DROP, .reason = FW_REASON_DOMAIN },
+    { .name = "tcp6_signature_drop", .ipv6 = true, .proto = IPPROTO_TCP, .exthdrs = 1, .dport = 80,
+      .payload = "xxEVILxx", .verdict = NF_DROP, .reason = FW_REASON_SIGNATURE },
+    /* ICMPv6 has a type table of its own: echo requests are let in, and the IPv4 echo reply entry
+     * does not carry over */
+    { .name = "icmp6_echo_request", .ipv6 = true, .proto = IPPROTO_ICMPV6, .icmp_type = ICMPV6_ECHO_REQUEST,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_ICMP },
+    { .name = "icmp6_echo_reply", .ipv6 = true, .proto = IPPROTO_ICMPV6, .icmp_type = ICMPV6_ECHO_REPLY,
+      .verdict = NF_DROP, .reason = FW_REASON_ICMP },
+    /* neighbour discovery and path MTU discovery get through whatever the policy says, table or not */
+    { .name = "icmp6_ndp", .ipv6 = true, .proto = IPPROTO_ICMPV6, .icmp_type = NDISC_NEIGHBOUR_SOLICITATION,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_ICMP },
+    { .name = "icmp6_too_big", .ipv6 = true, .proto = IPPROTO_ICMPV6, .icmp_type = ICMPV6_PKT_TOOBIG,
+      .verdict = NF_ACCEPT, .reason = FW_REASON_ICMP },
+    { .name = "icmp6_blocked", .ipv6 = true, .proto = IPPROTO_ICMPV6, .saddr6 = "2001:db8:bad::7",
+      .icmp_type = NDISC_NEIGHBOUR_SOLICITATION, .verdict = NF_DROP, .reason = FW_REASON_BLOCKLIST },
+    { .name = "fragment6_first", .ipv6 = true, .proto = IPPROTO_UDP, .dport = 53, .frag_off = FRAG_MF,
+      .payload = "xxxxxxxx", .verdict = NF_ACCEPT, .reason = FW_REASON_DNS },
+    { .name = "truncated_ip6", .ipv6 = true, .proto = IPPROTO_TCP, .dport = 80, .truncate = 20 + 30,
+      .verdict = NF_DROP, .reason = FW_REASON_MALFORMED },
+    /* the options header is cut off before its length */
+    { .name = "truncated_exthdr6", .ipv6 = true, .proto = IPPROTO_UDP, .exthdrs = 1, .dport = 53,
+      .truncate = 8 + 6, .verdict = NF_DROP, .reason = FW_REASON_MALFORMED },
+};
+
+/* ===============================================================================================
+ * helpers
+ * ===============================================================================================*/
+static inline u64 test_cycles(void) {
+#if defined(CONFIG_X86) || defined(CONFIG_UML_X86)
+    return __builtin_ia32_rdtsc();
+#else
+    return get_cycles();            // 0 where there is no cycle counter
+#endif
+}
+
+/* Function for the size of the L4 header a case's packet carries */
+static unsigned int l4_size(const struct judge_case *c) {
+    /* only a first fragment carries the L4 header */
+    if(c->frag_off & FRAG_OFFSET) { return 0; }
+
+    switch(c->proto) {
+        case IPPROTO_TCP:    return sizeof(struct tcphdr);
+        case IPPROTO_UDP:    return sizeof(struct udphdr);
+        case IPPROTO_ICMP:   return sizeof(struct icmphdr);
+        case IPPROTO_ICMPV6: return sizeof(struct icmp6hdr);
+        default:             return 0;
+    }
+}
+
+/* Function for filling in the L4 header of a case's packet
+ * @param l4h: where the header goes, l4_size(c) bytes of zeroes
+ * @param plen: bytes of payload behind it
+ * */
+static void fill_l4(u8 *l4h, const struct judge_case *c, unsigned int plen) {
+    if(!l4_size(c)) { return; }
+
+    if(c->proto == IPPROTO_TCP) {
+        struct tcphdr *th = (struct tcphdr *)l4h;
+
+        th->source = htons(40000);
+        th->dest = htons(c->dport);
+        th->seq = htonl(c->seq ? c->seq : 1000);
+        th->doff = 5;
+        th->ack = 1;
+        th->psh = 1;
+    } else if(c->proto == IPPROTO_UDP) {
+        struct udphdr *uh = (struct udphdr *)l4h;
+
+        uh->source = htons(40000);
+        uh->dest = htons(c->dport);
+        uh->len = htons(sizeof(*uh) + plen);
+    } else if(c->proto == IPPROTO_ICMP) {
+        struct icmphdr *ih = (struct icmphdr *)l4h;
+
+        ih->type = c->icmp_type;
+        ih->code = c->icmp_code;
+    } else if(c->proto == IPPROTO_ICMPV6) {
+        struct icmp6hdr *ih = (struct icmp6hdr *)l4h;
+
+        ih->icmp6_type = c->icmp_type;
+        ih->icmp6_code = c->icmp_code;
+    }
+}
+
+/* Function for turning a built packet into an skb, with all but the first c->linear bytes in a
+ * page fragment
+ * @param buf: the packet from its network header on
+ * @param len: bytes in buf
+ * @param protocol: skb->protocol, ETH_P_IP or ETH_P_IPV6
+ * returns the skb, NULL if memory ran out
+ * */
+static struct sk_buff *skb_from(const u8 *buf, unsigned int len, const struct judge_case *c, u16 protocol) {
+    unsigned int linear = c->linear && c->linear < len ? c->linear : len;
+    struct sk_buff *skb;
+    struct page *page;
+
+    skb = alloc_skb(NET_SKB_PAD + linear, GFP_KERNEL);
+    if(!skb) { return NULL; }
+    skb_reserve(skb, NET_SKB_PAD);
+    skb_reset_network_header(skb);
+    skb->protocol = htons(protocol);
+    skb_put_data(skb, buf, linear);
+
+    if(linear < len) {
+        page = alloc_page(GFP_KERNEL);
+        if(!page) {
+            kfree_skb(skb);
+            return NULL;
+        }
+        memcpy(page_address(page), buf + linear, len - linear);
+        skb_fill_page_desc(skb, 0, page, 0, len - linear);
+        skb->len += len - linear;
+        skb->data_len += len - linear;
+        skb->truesize += PAGE_SIZE;
+    }
+
+    return skb;
+}
+
+/* Function for building the packet of an IPv6 case: the fixed header, c->exthdrs options headers
+ * of 8 bytes each padded with PadN, a fragment header if c->frag_off is set, then L4 and payload
+ * returns the skb, NULL if memory ran out
+ * */
+static struct sk_buff *build_skb6_for(const struct judge_case *c) {
+    u8 buf[TEST_BUFLEN] = { 0 };
+    struct ipv6hdr *ip6h = (struct ipv6hdr *)buf;
+    unsigned int l4 = l4_size(c), plen = c->plen ? c->plen : c->payload ? strlen(c->payload) : 0;
+    unsigned int off = sizeof(*ip6h), i;
+    u8 *next = &ip6h->nexthdr;
+    u16 frag;
+
+    ip6h->version = 6;
+    ip6h->hop_limit = 64;
+    in6_pton(c->saddr6 ? c->saddr6 : "2001:db8::1", -1, ip6h->saddr.s6_addr, -1, NULL);
+    in6_pton("2001:db8:ffff::1", -1, ip6h->daddr.s6_addr, -1, NULL);
+
+    /* hop-by-hop options have to come first, destination options may follow */
+    for(i = 0; i < c->exthdrs; i++) {
+        *next = i ? IPPROTO_DSTOPTS : IPPROTO_HOPOPTS;
+        next = buf + off;
+        buf[off + 2] = 1;           // PadN over the 4 bytes left
+        buf[off + 3] = 4;
+        off += 8;
+    }
+
+    /* offset in 8 byte units above the M flag */
+    if(c->frag_off) {
+        *next = IPPROTO_FRAGMENT;
+        next = buf + off;
+        frag = (c->frag_off & FRAG_OFFSET) << 3 | !!(c->frag_off & FRAG_MF);
+        buf[off + 2] = frag >> 8;
+        buf[off + 3] = frag & 0xff;
+        buf[off + 4] = c->id >> 24;
+        buf[off + 5] = c->id >> 16 & 0xff;
+        buf[off + 6] = c->id >> 8 & 0xff;
+        buf[off + 7] = c->id & 0xff;
+        off += 8;
+    }
+    *next = c->proto;
+
+    fill_l4(buf + off, c, plen);
+    memcpy(buf + off + l4, c->payload, plen);
+    ip6h->payload_len = htons(off - sizeof(*ip6h) + l4 + plen);
+
+    return skb_from(buf, off + l4 + plen - c->truncate, c, ETH_P_IPV6);
+}
+
+/* Function for building the packet of a case
+ * returns the skb, NULL if memory ran out
+ * */
+static struct sk_buff *build_skb_for(const struct judge_case *c) {
+    u8 buf[TEST_BUFLEN] = { 0 };
+    struct iphdr *iph = (struct iphdr *)buf;
+    unsigned int l4 = l4_size(c), plen = c->plen ? c->plen : c->payload ? strlen(c->payload) : 0;
+
+    if(c->ipv6) { return build_skb6_for(c); }
+
+    iph->version = 4;
+    iph->ihl = c->ihl ? c->ihl : 5;
+    iph->tot_len = htons(sizeof(*iph) + l4 + plen);
+    iph->frag_off = htons(c->frag_off);
+    iph->id = htons(c->id);
+    iph->ttl = 64;
+    iph->protocol = c->proto;
+    iph->saddr = htonl(c->saddr ? c->saddr : 0x0a000001);
+    iph->daddr = htonl(0xc0000201);
+
+    fill_l4(buf + sizeof(*iph), c, plen);
+    memcpy(buf + sizeof(*iph) + l4, c->payload, plen);
+
+    return skb_from(buf, sizeof(*iph) + l4 + plen - c->truncate, c, ETH_P_IP);
+}
+
+/* Function for doing what hook_func does up to the verdict
+ * @param dev: input device
+ * @param reason: set to the enum fw_reason behind the verdict
+ * */
+static unsigned int run_hook_on(struct sk_buff *skb, const struct net_device *dev, u8 *reason) {
+    struct fw_pkt pkt;
+    unsigned int verdict;
+
+    if(skb->protocol == htons(ETH_P_IPV6) ? !fw_parse_packet6(skb, &pkt) : !fw_parse_packet(skb, &pkt)) {
+        *reason = FW_REASON_MALFORMED;
+        return NF_DROP;
+    }
+    pkt.ifindex = dev->ifindex;
+
+    /* the flow cache and stream state are per-CPU, as in softirq context */
+    local_bh_disable();
+    verdict = fw_judge(&test_net, skb, &pkt, dev, false, reason);
+    local_bh_enable();
+
+    return verdict;
+}
+
+static unsigned int run_hook(struct sk_buff *skb, u8 *reason) {
+    return run_hook_on(skb, &test_dev, reason);
+}
+
+/* Function for committing a new mode for one interface */
+static void set_iface_mode(struct kunit *test, const char *name, u8 mode) {
+    struct fw_draft *d = fw_draft_begin(&test_net);
+
+    KUNIT_ASSERT_NOT_NULL(test, d);
+    KUNIT_ASSERT_EQ(test, fw_draft_iface(d, name, mode), 0);
+    KUNIT_ASSERT_EQ(test, fw_draft_commit(d), 0);
+}
+
+/* Function for leaving the cached flows behind: they are keyed by ruleset generation, and
+ * committing an empty draft starts a new one */
+static void flush_flows(struct kunit *test) {
+    struct fw_draft *d = fw_draft_begin(&test_net);
+
+    KUNIT_ASSERT_NOT_NULL(test, d);
+    KUNIT_ASSERT_EQ(test, fw_draft_commit(d), 0);
+}
+
+/* ===============================================================================================
+ * tests
+ * ===============================================================================================*/
+static void judge_case_desc(const struct judge_case *c, char *desc) {
+    strscpy(desc, c->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(judge, judge_cases, judge_case_desc);
+
+/* Every case is judged cold (empty flow cache and stream state), then TEST_ITERATIONS times more
+ * with the flow cached, as the packets of a long flow are */
+static void judge_test(struct kunit *test) {
+    const struct judge_case *c = test->param_value;
+    struct sk_buff *skb;
+    unsigned int verdict, i;
+    u64 c0, c1, t0, t1, cold_cycles;
+    u8 reason;
+
+    skb = build_skb_for(c);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+
+    flush_flows(test);
+    c0 = test_cycles();
+    verdict = run_hook(skb, &reason);
+    cold_cycles = test_cycles() - c0;
+
+    KUNIT_EXPECT_EQ(test, verdict, c->verdict);
+    KUNIT_EXPECT_EQ(test, reason, c->reason);
+
+    t0 = ktime_get_ns();
+    c0 = test_cycles();
+    for(i = 0; i < TEST_ITERATIONS; i++) {
+        verdict = run_hook(skb, &reason);
+    }
+    c1 = test_cycles();
+    t1 = ktime_get_ns();
+
+    /* the cached verdict has to be the one computed cold */
+    KUNIT_EXPECT_EQ(test, verdict, c->verdict);
+    KUNIT_EXPECT_EQ(test, reason, c->reason);
+
+    kunit_info(test, "%-22s cold %6llu cycles, warm %6llu cycles %6llu ns per packet\n", c->name,
+               cold_cycles, (c1 - c0) / TEST_ITERATIONS, (t1 - t0) / TEST_ITERATIONS);
+
+    kfree_skb(skb);
+}
+
+/* A signature split between two in-order segments of a flow is found in the second one, in IPv4
+ * and IPv6 flows alike. The flows' sources differ from the judge_test cases so they start without
+ * stream state. */
+static void stream_test(struct kunit *test) {
+    struct judge_case c = { .name = "stream", .proto = IPPROTO_TCP, .saddr = 0x0a000002, .dport = 80 };
+    struct judge_case c6 = { .name = "stream6", .ipv6 = true, .proto = IPPROTO_TCP, .saddr6 = "2001:db8::2",
+                             .dport = 80 };
+    struct judge_case *flows[] = { &c, &c6 };
+    struct sk_buff *first, *second;
+    unsigned int verdict, i;
+    u8 reason;
+
+    for(i = 0; i < ARRAY_SIZE(flows); i++) {
+        flows[i]->payload = "....EV";
+        first = build_skb_for(flows[i]);
+        flows[i]->payload = "IL....";
+        flows[i]->seq = 1000 + 6;
+        second = build_skb_for(flows[i]);
+        KUNIT_ASSERT_NOT_NULL(test, first);
+        KUNIT_ASSERT_NOT_NULL(test, second);
+
+        verdict = run_hook(first, &reason);
+        KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+        KUNIT_EXPECT_EQ(test, reason, FW_REASON_TCP);
+
+        verdict = run_hook(second, &reason);
+        KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+        KUNIT_EXPECT_EQ(test, reason, FW_REASON_SIGNATURE);
+
+        kfree_skb(first);
+        kfree_skb(second);
+    }
+}
+
+/* A source sending faster than ratelimit_rate to a ratelimit rule gets its burst through and is
+ * limited after that. The packets go out back to back, well within one emission interval of the
+ * default 100/s, so the bucket has no time to refill. */
+static void ratelimit_test(struct kunit *test) {
+    struct judge_case c = { .name = "ratelimit", .proto = IPPROTO_UDP, .saddr = 0x0a000003, .dport = 6000 };
+    struct sk_buff *skb;
+    unsigned int verdict, i, passed = 0, limited = 0;
+    u8 reason;
+
+    skb = build_skb_for(&c);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+
+    for(i = 0; i < 200; i++) {
+        verdict = run_hook(skb, &reason);
+        if(verdict == NF_ACCEPT) {
+            KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+            passed++;
+        } else {
+            KUNIT_EXPECT_EQ(test, reason, FW_REASON_RATELIMIT);
+            limited++;
+        }
+    }
+
+    /* the first packet and the burst behind it pass, the rest of the flood does not */
+    KUNIT_EXPECT_GE(test, passed, 1U);
+    KUNIT_EXPECT_LE(test, passed, 60U);
+    KUNIT_EXPECT_GE(test, limited, 140U);
+
+    kfree_skb(skb);
+}
+
+/* An ICMP type with a rate is limited from all sources together: timestamp requests from 200
+ * different sources get the burst through, and no more. */
+static void icmp_rate_test(struct kunit *test) {
+    struct judge_case c = { .name = "icmp_rate", .proto = IPPROTO_ICMP, .icmp_type = ICMP_TIMESTAMP };
+    struct sk_buff *skb;
+    unsigned int verdict, i, passed = 0, limited = 0;
+    u8 reason;
+
+    for(i = 0; i < 200; i++) {
+        c.saddr = 0x0a010000 + i;
+        skb = build_skb_for(&c);
+        KUNIT_ASSERT_NOT_NULL(test, skb);
+
+        verdict = run_hook(skb, &reason);
+        if(verdict == NF_ACCEPT) {
+            KUNIT_EXPECT_EQ(test, reason, FW_REASON_ICMP);
+            passed++;
+        } else {
+            KUNIT_EXPECT_EQ(test, reason, FW_REASON_RATELIMIT);
+            limited++;
+        }
+        kfree_skb(skb);
+    }
+
+    KUNIT_EXPECT_GE(test, passed, 1U);
+    KUNIT_EXPECT_LE(test, passed, 60U);
+    KUNIT_EXPECT_GE(test, limited, 140U);
+}
+
+/* Later fragments follow the verdict taken on their datagram's first fragment, whatever order they
+ * come in after it: the first fragment to port 5000 is accepted by the UDP rule, and so is the rest
+ * of its datagram, while a fragment that arrives ahead of its first, or belongs to another
+ * datagram, falls to the UDP policy. One blocked by a signature takes the rest down with it. IPv6
+ * fragments do the same on their 32 bit identification and both addresses. */
+static void frag_test(struct kunit *test) {
+    struct judge_case first = { .name = "frag_first", .proto = IPPROTO_UDP, .saddr = 0x0a000004, .dport = 5000,
+                                .frag_off = FRAG_MF, .id = 0x1234, .payload = "xxxxxxxx" };
+    struct judge_case later = { .name = "frag_later", .proto = IPPROTO_UDP, .saddr = 0x0a000004,
+                                .frag_off = FRAG_MF | 2, .id = 0x1234, .payload = "xxxxxxxx" };
+    struct judge_case first6 = { .name = "frag6_first", .ipv6 = true, .proto = IPPROTO_UDP, .saddr6 = "2001:db8::4",
+                                 .dport = 5000, .frag_off = FRAG_MF, .id = 0x12345678, .payload = "xxxxxxxx" };
+    struct judge_case later6 = { .name = "frag6_later", .ipv6 = true, .proto = IPPROTO_UDP, .saddr6 = "2001:db8::4",
+                                 .exthdrs = 1, .frag_off = 185, .id = 0x12345678, .payload = "xxxxxxxx" };
+    struct sk_buff *skb;
+    unsigned int verdict;
+    u8 reason;
+
+    /* ahead of its first fragment */
+    skb = build_skb_for(&later);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_UDP);
+    kfree_skb(skb);
+
+    skb = build_skb_for(&first);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+    kfree_skb(skb);
+
+    /* the same fragment again and the last one */
+    skb = build_skb_for(&later);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+    kfree_skb(skb);
+
+    later.frag_off = 3;
+    skb = build_skb_for(&later);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+    kfree_skb(skb);
+
+    /* another datagram between the same hosts */
+    later.id = 0x1235;
+    skb = build_skb_for(&later);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_UDP);
+    kfree_skb(skb);
+
+    /* a TCP first fragment carrying a signature */
+    first.proto = later.proto = IPPROTO_TCP;
+    first.dport = 80;
+    first.id = later.id = 0x1236;
+    first.payload = "..EVIL..";
+    skb = build_skb_for(&first);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_SIGNATURE);
+    kfree_skb(skb);
+
+    skb = build_skb_for(&later);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_SIGNATURE);
+    kfree_skb(skb);
+
+    /* the IPv6 datagram's later fragment, ahead of its first and after it */
+    skb = build_skb_for(&later6);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_UDP);
+    kfree_skb(skb);
+
+    skb = build_skb_for(&first6);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+    kfree_skb(skb);
+
+    skb = build_skb_for(&later6);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+    kfree_skb(skb);
+
+    /* the same identification in its upper half only, and the same one from another host */
+    later6.id = 0x12355678;
+    skb = build_skb_for(&later6);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_UDP);
+    kfree_skb(skb);
+
+    later6.id = first6.id;
+    later6.saddr6 = "2001:db8::5";
+    skb = build_skb_for(&later6);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_UDP);
+    kfree_skb(skb);
+}
+
+/* A first fragment too short for its TCP ports (RFC 1858) is dropped, and its later fragments with
+ * it, where judged on their own they would have got past the rule dropping TCP to port 23 to the
+ * TCP policy. IPv6 does the same for a first fragment that ends inside its transport header. */
+static void tiny_frag_test(struct kunit *test) {
+    struct judge_case first = { .name = "tiny_first", .proto = IPPROTO_TCP, .saddr = 0x0a000008, .dport = 23,
+                                .frag_off = FRAG_MF, .id = 0x2345, .truncate = sizeof(struct tcphdr) - 8 };
+    struct judge_case later = { .name = "tiny_later", .proto = IPPROTO_TCP, .saddr = 0x0a000008,
+                                .frag_off = 1, .id = 0x2345, .payload = "xxxxxxxx" };
+    struct judge_case first6 = { .name = "tiny6_first", .ipv6 = true, .proto = IPPROTO_TCP, .saddr6 = "2001:db8::8",
+                                 .dport = 23, .frag_off = FRAG_MF, .id = 0x23456789,
+                                 .truncate = sizeof(struct tcphdr) - 8 };
+    struct judge_case later6 = { .name = "tiny6_later", .ipv6 = true, .proto = IPPROTO_TCP, .saddr6 = "2001:db8::8",
+                                 .frag_off = 1, .id = 0x23456789, .payload = "xxxxxxxx" };
+    struct judge_case whole = { .name = "tiny_whole", .proto = IPPROTO_TCP, .saddr = 0x0a000008, .dport = 23,
+                                .frag_off = FRAG_MF, .id = 0x2346 };
+    struct sk_buff *skb;
+    unsigned int verdict;
+    u8 reason;
+
+    /* the rule itself, on a first fragment that has its ports */
+    skb = build_skb_for(&whole);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+    kfree_skb(skb);
+
+    skb = build_skb_for(&first);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_MALFORMED);
+    kfree_skb(skb);
+
+    skb = build_skb_for(&later);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_MALFORMED);
+    kfree_skb(skb);
+
+    skb = build_skb_for(&first6);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_MALFORMED);
+    kfree_skb(skb);
+
+    skb = build_skb_for(&later6);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_MALFORMED);
+    kfree_skb(skb);
+}
+
+/* A dynamic block drops a host's packets from the next one on, cached flow or not, and ahead of
+ * payload matches; lifting it lets the flow through again. Other namespaces never see the block. */
+static void dynblock_test(struct kunit *test) {
+    struct judge_case c = { .name = "dynblock", .proto = IPPROTO_UDP, .saddr = 0x0a000006, .dport = 5000 };
+    struct judge_case sig = { .name = "dynblock_sig", .proto = IPPROTO_TCP, .saddr = 0x0a000006, .dport = 80,
+                              .payload = "..EVIL.." };
+    struct sk_buff *skb, *sig_skb;
+    unsigned int verdict;
+    u8 reason;
+
+    skb = build_skb_for(&c);
+    sig_skb = build_skb_for(&sig);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    KUNIT_ASSERT_NOT_NULL(test, sig_skb);
+
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+
+    fw_dynblock_add(&test_net, htonl(0x0a000006), 60);
+    KUNIT_EXPECT_TRUE(test, fw_dynblock_lookup(&test_net, htonl(0x0a000006)));
+    KUNIT_EXPECT_FALSE(test, fw_dynblock_lookup(&test_net, htonl(0x0a000007)));
+    KUNIT_EXPECT_FALSE(test, fw_dynblock_lookup(&other_net, htonl(0x0a000006)));
+    KUNIT_EXPECT_FALSE(test, fw_dynblock_del(&other_net, htonl(0x0a000006)));
+
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_DYNBLOCK);
+
+    verdict = run_hook(sig_skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_DYNBLOCK);
+
+    KUNIT_EXPECT_TRUE(test, fw_dynblock_del(&test_net, htonl(0x0a000006)));
+    KUNIT_EXPECT_FALSE(test, fw_dynblock_del(&test_net, htonl(0x0a000006)));
+
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+
+    kfree_skb(skb);
+    kfree_skb(sig_skb);
+}
+
+/* An IPv6 block covers the host's whole /64 and nothing past it, in its own namespace only */
+static void dynblock6_test(struct kunit *test) {
+    struct judge_case c = { .name = "dynblock6", .ipv6 = true, .proto = IPPROTO_UDP, .saddr6 = "2001:db8:66::1234",
+                            .dport = 5000 };
+    struct in6_addr host, other, neighbour;
+    struct sk_buff *skb;
+    unsigned int verdict;
+    u8 reason;
+
+    in6_pton("2001:db8:66::7", -1, host.s6_addr, -1, NULL);
+    in6_pton("2001:db8:66::ffff:1", -1, other.s6_addr, -1, NULL);
+    in6_pton("2001:db8:66:1::7", -1, neighbour.s6_addr, -1, NULL);
+
+    skb = build_skb_for(&c);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+
+    fw_dynblock_add6(&test_net, &host, 60);
+    KUNIT_EXPECT_TRUE(test, fw_dynblock_lookup6(&test_net, &other));
+    KUNIT_EXPECT_FALSE(test, fw_dynblock_lookup6(&test_net, &neighbour));
+    KUNIT_EXPECT_FALSE(test, fw_dynblock_lookup6(&other_net, &host));
+
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_DYNBLOCK);
+
+    KUNIT_EXPECT_TRUE(test, fw_dynblock_del6(&test_net, &other));
+    KUNIT_EXPECT_FALSE(test, fw_dynblock_del6(&test_net, &host));
+
+    verdict = run_hook(skb, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_RULE);
+
+    kfree_skb(skb);
+}
+
+/* Interface modes are configured by name and take effect on the device's ifindex: a trusted
+ * interface accepts even a blocked source, a blocked one drops everything and a headers one skips
+ * the signatures. Loopback exists in every kernel, so it stands in for a real interface. */
+static void iface_test(struct kunit *test) {
+    struct judge_case c = { .name = "iface", .proto = IPPROTO_TCP, .saddr = 0xd0509a07, .dport = 80 };
+    struct sk_buff *blocked, *evil;
+    struct net_device *lo;
+    unsigned int verdict;
+    u8 reason;
+
+    lo = dev_get_by_name(&init_net, "lo");
+    KUNIT_ASSERT_NOT_NULL(test, lo);
+    blocked = build_skb_for(&c);
+    c.saddr = 0x0a000004;
+    c.payload = "xxEVILxx";
+    evil = build_skb_for(&c);
+    KUNIT_ASSERT_NOT_NULL(test, blocked);
+    KUNIT_ASSERT_NOT_NULL(test, evil);
+
+    set_iface_mode(test, "lo", FW_IFACE_TRUSTED);
+    verdict = run_hook_on(blocked, lo, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_IFACE);
+    verdict = run_hook_on(evil, lo, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_IFACE);
+
+    set_iface_mode(test, "lo", FW_IFACE_BLOCKED);
+    verdict = run_hook_on(evil, lo, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_IFACE);
+
+    set_iface_mode(test, "lo", FW_IFACE_HEADERS);
+    verdict = run_hook_on(blocked, lo, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_BLOCKLIST);
+    verdict = run_hook_on(evil, lo, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_ACCEPT);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_TCP);
+
+    /* back to every check */
+    set_iface_mode(test, "lo", FW_IFACE_FILTER);
+    verdict = run_hook_on(evil, lo, &reason);
+    KUNIT_EXPECT_EQ(test, verdict, NF_DROP);
+    KUNIT_EXPECT_EQ(test, reason, FW_REASON_SIGNATURE);
+
+    dev_put(lo);
+    kfree_skb(blocked);
+    kfree_skb(evil);
+}
+
+/* Function for counting a packet's source, destination and port, as the hooks do after judging it */
+static void count_top(struct kunit *test, struct sk_buff *skb, unsigned int times) {
+    struct fw_pkt pkt;
+    unsigned int i;
+
+    KUNIT_ASSERT_TRUE(test, fw_parse_packet(skb, &pkt));
+
+    local_bh_disable();
+    for(i = 0; i < times; i++) { fw_top_packet(&pkt); }
+    local_bh_enable();
+}
+
+/* One source sends the most packets and another the most bytes, among fifty that send little. The
+ * rankings by packets and by bytes each have their own leader, and the top port is the flood's. */
+static void top_test(struct kunit *test) {
+    static const char big[] = "................................................................"
+                              "................................................................"
+                              "................................................................";
+    struct judge_case c = { .name = "top", .proto = IPPROTO_UDP, .saddr = 0x0a000009, .dport = 7000 };
+    struct fw_top_entry top[3];
+    struct sk_buff *skb;
+    int i, n;
+
+    skb = build_skb_for(&c);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    count_top(test, skb, 100);
+    kfree_skb(skb);
+
+    c.saddr = 0x0a00000a;
+    c.dport = 7001;
+    c.payload = big;
+    skb = build_skb_for(&c);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+    count_top(test, skb, 20);
+    kfree_skb(skb);
+
+    c.proto = IPPROTO_TCP;
+    c.dport = 80;
+    c.payload = NULL;
+    for(i = 0; i < 50; i++) {
+        c.saddr = 0x0a010000 + i;
+        skb = build_skb_for(&c);
+        KUNIT_ASSERT_NOT_NULL(test, skb);
+        count_top(test, skb, 1);
+        kfree_skb(skb);
+    }
+
+    n = fw_top_read(FW_TOP_SRC, false, top, ARRAY_SIZE(top));
+    KUNIT_ASSERT_EQ(test, n, 3);
+    KUNIT_EXPECT_EQ(test, top[0].key, 0x0a000009U);
+    KUNIT_EXPECT_EQ(test, top[1].key, 0x0a00000aU);
+
+    n = fw_top_read(FW_TOP_SRC, true, top, ARRAY_SIZE(top));
+    KUNIT_ASSERT_EQ(test, n, 3);
+    KUNIT_EXPECT_EQ(test, top[0].key, 0x0a00000aU);
+    KUNIT_EXPECT_EQ(test, top[1].key, 0x0a000009U);
+
+    n = fw_top_read(FW_TOP_DPORT, false, top, ARRAY_SIZE(top));
+    KUNIT_ASSERT_EQ(test, n, 3);
+    KUNIT_EXPECT_EQ(test, top[0].key, (u32)IPPROTO_UDP << 16 | 7000);
+}
+
+/* ===============================================================================================
+ * suite
+ * ===============================================================================================*/
+
+/* Function for setting up the module's state the way onload() does, plus the suite's rules,
+ * signature and domains */
+static int judge_suite_init(struct kunit_suite *suite) {
+    static const struct fw_rule udp_rule = {
+        .proto = IPPROTO_UDP, .action = FW_ACTION_ACCEPT,
+        .sport_max = 65535, .dport_min = 5000, .dport_max = 5000,
+    };
+    static const struct fw_rule telnet_rule = {
+        .proto = IPPROTO_TCP, .action = FW_ACTION_DROP,
+        .sport_max = 65535, .dport_min = 23, .dport_max = 23,
+    };
+    static const struct fw_rule ratelimit_rule = {
+        .proto = IPPROTO_UDP, .action = FW_ACTION_RATELIMIT,
+        .sport_max = 65535, .dport_min = 6000, .dport_max = 6000,
+    };
+    /* port 9999 from one IPv6 /48, which IPv4 packets to the port never match */
+    struct fw_rule udp6_rule = {
+        .family = NFPROTO_IPV6, .src_len = 48, .proto = IPPROTO_UDP, .action = FW_ACTION_ACCEPT,
+        .sport_max = 65535, .dport_min = 9999, .dport_max = 9999,
+    };
+    struct fw_draft *d;
+    struct lpm_prefix p;
+    struct lpm6_prefix p6;
+    int err;
+
+    test_dir = debugfs_create_dir("netfilter-firewall-test", NULL);
+    test_net.dir = test_dir;
+
+    err = fw_flow_init(test_dir);
+    if(!err) { err = fw_frag_init(test_dir); }
+    if(!err) { err = fw_stream_init(test_dir); }
+    if(!err) { err = fw_stats_net_init(&test_net); }
+    if(!err) { err = fw_ratelimit_init(test_dir); }
+    if(!err) { err = fw_dynblock_init(test_dir); }
+    if(!err) { err = fw_top_init(test_dir); }
+    if(!err) { err = fw_ruleset_net_init(&test_net); }
+    if(err) { return err; }
+    fw_dynblock_net_init(&test_net);
+
+    d = fw_draft_begin(&test_net);
+    if(!d) { return -ENOMEM; }
+
+    lpm_parse_prefix("208.80.154.0/24", 15, &p);
+    err = fw_draft_prefix(d, &p, true);
+    if(!err) {
+        lpm_parse_prefix("198.51.100.7/32", 15, &p);
+        err = fw_draft_prefix(d, &p, true);
+    }
+    if(!err) {
+        lpm6_parse_prefix("2001:db8:bad::/48", 17, &p6);
+        err = fw_draft_prefix6(d, &p6, true);
+    }
+    if(!err) { err = fw_draft_rule(d, &udp_rule, true); }
+    if(!err) { err = fw_draft_rule(d, &ratelimit_rule, true); }
+    if(!err) { err = fw_draft_rule(d, &telnet_rule, true); }
+    if(!err) {
+        in6_pton("2001:db8:42::", -1, udp6_rule.src6.s6_addr, -1, NULL);
+        err = fw_draft_rule(d, &udp6_rule, true);
+    }
+    if(!err) { err = fw_draft_signature(d, (const u8 *)"EVIL", 4, FW_ACTION_DROP, true); }
+    if(!err) { err = fw_draft_domain(d, "*.ads.test", FW_ACTION_DROP, true); }
+    if(!err) { err = fw_draft_domain(d, "ok.ads.test", FW_ACTION_ACCEPT, true); }
+    if(!err) { err = fw_draft_domain(d, "tracker.test.", FW_ACTION_DROP, true); }
+    if(!err) { err = fw_draft_icmp(d, NFPROTO_IPV4, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, FW_ACTION_ACCEPT, 0, true); }
+    if(!err) { err = fw_draft_icmp(d, NFPROTO_IPV4, ICMP_ECHOREPLY, FW_ICMP_ANY_CODE, FW_ACTION_ACCEPT, 0, true); }
+    if(!err) { err = fw_draft_icmp(d, NFPROTO_IPV4, ICMP_TIMESTAMP, FW_ICMP_ANY_CODE, FW_ACTION_ACCEPT, 10, true); }
+    if(!err) { err = fw_draft_icmp(d, NFPROTO_IPV6, ICMPV6_ECHO_REQUEST, FW_ICMP_ANY_CODE, FW_ACTION_ACCEPT, 0, true); }
+    if(err) {
+        fw_draft_abort(d);
+        return err;
+    }
+
+    return fw_draft_commit(d);
+}
+
+static void judge_suite_exit(struct kunit_suite *suite) {
+    synchronize_rcu();
+    fw_dynblock_net_exit(&test_net);
+    fw_ruleset_net_exit(&test_net);
+    fw_top_exit();
+    fw_dynblock_exit();
+    fw_ratelimit_exit();
+    fw_stats_net_exit(&test_net);
+    fw_stream_exit();
+    fw_frag_exit();
+    fw_flow_exit();
+    debugfs_remove_recursive(test_dir);
+}
+
+static struct kunit_case judge_test_cases[] = {
+    KUNIT_CASE_PARAM(judge_test, judge_gen_params),
+    KUNIT_CASE(stream_test),
+    KUNIT_CASE(ratelimit_test),
+    KUNIT_CASE(icmp_rate_test),
+    KUNIT_CASE(frag_test),
+    KUNIT_CASE(tiny_frag_test),
+    KUNIT_CASE(dynblock_test),
+    KUNIT_CASE(dynblock6_test),
+    KUNIT_CASE(iface_test),
+    KUNIT_CASE(top_test),
+    {}
+};
+
+static struct kunit_suite judge_test_suite = {
+    .name = "netfilter-firewall-judge",
+    .suite_init = judge_suite_init,
+    .suite_exit = judge_suite_exit,
+    .test_cases = judge_test_cases,
+};
+
+kunit_test_suite(judge_test_suite);
+
+MODULE_LICENSE("GPL");
+
+// EOF
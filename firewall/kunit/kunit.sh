@@ -0,0 +1,34 @@
+#!/bin/sh
+#*************************************************************************************************
+# KUnit runner -- builds and runs the packet judgement suite in a User Mode Linux kernel, so the
+# tests need neither root nor a module loaded into the host kernel.
+#
+# kunit.py only builds code inside the kernel tree, so the firewall sources and this directory's
+# Kconfig and kbuild file are symlinked into KDIR/net/netfilter-firewall/ and hooked into
+# net/Kconfig and net/Makefile, once. Edits to the firewall sources are picked up by the next run.
+#
+# usage: kunit.sh [path/to/linux] [kunit.py run options...]     (KDIR=path/to/linux works as well)
+#************************************************************************************************
+set -e
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+SRC=$(dirname "$HERE")
+if [ -n "$1" ] && [ -d "$1" ]; then
+    KDIR=$1
+    shift
+fi
+KDIR=${KDIR:?usage: $0 path/to/linux [kunit.py run options...]}
+DIR=$KDIR/net/netfilter-firewall
+
+mkdir -p "$DIR"
+ln -sf "$SRC"/*.c "$SRC"/*.h "$HERE"/*.c "$DIR"/
+ln -sf "$HERE/Kconfig" "$DIR/Kconfig"
+ln -sf "$HERE/Makefile" "$DIR/Makefile"
+
+grep -q 'net/netfilter-firewall/Kconfig' "$KDIR/net/Kconfig" ||
+    echo 'source "net/netfilter-firewall/Kconfig"' >> "$KDIR/net/Kconfig"
+grep -q 'netfilter-firewall/' "$KDIR/net/Makefile" ||
+    echo 'obj-$(CONFIG_NETFILTER_FIREWALL_KUNIT_TEST) += netfilter-firewall/' >> "$KDIR/net/Makefile"
+
+cd "$KDIR"
+exec ./tools/testing/kunit/kunit.py run --arch=um --kunitconfig="$HERE/.kunitconfig" "$@"
@@ -0,0 +1,616 @@
+/*************************************************************************************************
+ * fw-compile -- compiles a rules file into a ruleset image the module loads in one go.
+ *
+ *   fw-compile [-c] [-o rules.img] rules.txt
+ *   cat rules.img > /sys/kernel/debug/netfilter-firewall/ruleset_image
+ *
+ * The rules file is in `fwctl load` syntax and is applied on top of the module's built-in
+ * ruleset (the default policy and the "HTTP" signature); flush lines start from nothing. It goes
+ * through the module's own draft and commit code, built against the shims in ../bench/compat, so
+ * the image holds exactly what the same file loaded with fwctl would give: the sorted lists and
+ * the LPM table and host set of the blocked prefixes, which the module copies into place instead
+ * of building them. Loading the image replaces the live ruleset of the namespace whose debugfs
+ * file it is written to as a whole, as one commit does. IPv6 prefixes only go in as a list, the
+ * module builds their table.
+ *
+ * A filter rule's input interface goes into the image by name, and the module looks it up in the
+ * namespace that loads the image; an image naming an interface that namespace lacks is refused.
+ * -c loads the finished image back with the code the module runs on a write to ruleset_image and
+ * reports how long the load took.
+ ************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fw-ruleset.h"
+#include "fw-image.h"
+
+#define SECTIONS    FW_IMAGE_MAX    // every section type, each at most once
+#define MAX_DEVS    FW_MAX_IFACES   // interfaces the rules of one file can name
+
+unsigned long jiffies;
+static struct net_device devs[MAX_DEVS];    // what rules name, ifindex the position plus one
+struct net init_net = { .devs = devs };
+static struct fw_net compile_net = { .net = &init_net };    // the one namespace rulesets are built in
+
+static const char *policy_names[FW_POLICY_MAX] = {
+    "tcp", "udp", "dns", "icmp", "other",
+};
+
+static const char *iface_mode_names[FW_IFACE_MAX] = {
+    "filter", "headers", "trusted", "blocked",
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* ===============================================================================================
+ * rules file
+ * ===============================================================================================*/
+
+/* Function for parsing the action of a rule, policy or ICMP entry, returns it or -1 */
+static int parse_action(const char *s) {
+    if(!strcmp(s, "accept")) { return FW_ACTION_ACCEPT; }
+    if(!strcmp(s, "drop")) { return FW_ACTION_DROP; }
+    if(!strcmp(s, "ratelimit")) { return FW_ACTION_RATELIMIT; }
+    return -1;
+}
+
+/* Function for parsing the action of a signature or domain, returns it or -1 */
+static int parse_flag_action(const char *s) {
+    if(!strcmp(s, "flag")) { return FW_ACTION_FLAG; }
+    return !strcmp(s, "ratelimit") ? -1 : parse_action(s);
+}
+
+/* Function for numbering the interfaces rules name. The numbers only tie a rule to its name until
+ * the image is written; the module looks the names up when it loads the image. */
+static int parse_iif(const char *name, u32 *ifindex) {
+    unsigned int i;
+
+    if(!*name || strlen(name) >= IFNAMSIZ) { return -1; }
+
+    for(i = 0; i < init_net.ndevs && strcmp(devs[i].name, name); i++);
+    if(i == init_net.ndevs) {
+        if(i == MAX_DEVS) { return -1; }
+        strcpy(devs[i].name, name);
+        devs[i].ifindex = i + 1;
+        init_net.ndevs++;
+    }
+
+    *ifindex = devs[i].ifindex;
+    return 0;
+}
+
+/* Function for parsing "P" or "P-Q" */
+static int parse_ports(const char *s, u16 *min, u16 *max) {
+    char *end;
+    long lo, hi;
+
+    lo = strtol(s, &end, 10);
+    hi = lo;
+    if(*end == '-') { hi = strtol(end + 1, &end, 10); }
+    if(*end || lo < 0 || hi > 65535 || lo > hi) { return -1; }
+
+    *min = lo;
+    *max = hi;
+    return 0;
+}
+
+static int parse_rule(int argc, char **argv, struct fw_rule *r) {
+    struct lpm6_prefix p6;
+    struct lpm_prefix p;
+    long proto;
+    u8 family;
+    int i;
+
+    memset(r, 0, sizeof(*r));
+    r->sport_max = r->dport_max = 65535;
+
+    for(i = 0; i + 1 < argc; i += 2) {
+        if(!strcmp(argv[i], "proto")) {
+            proto = !strcmp(argv[i + 1], "tcp") ? 6 : !strcmp(argv[i + 1], "udp") ? 17 :
+                    !strcmp(argv[i + 1], "icmp") ? 1 : !strcmp(argv[i + 1], "icmpv6") ? 58 :
+                    strtol(argv[i + 1], NULL, 10);
+            if(proto <= 0 || proto > 255) { return -1; }
+            r->proto = proto;
+        } else if(!strcmp(argv[i], "family")) {
+            if(strcmp(argv[i + 1], "inet") && strcmp(argv[i + 1], "inet6")) { return -1; }
+            family = argv[i + 1][4] == '6' ? NFPROTO_IPV6 : NFPROTO_IPV4;
+            if(r->family && r->family != family) { return -1; }
+            r->family = family;
+        } else if((!strcmp(argv[i], "src") || !strcmp(argv[i], "dst")) && strchr(argv[i + 1], ':')) {
+            if(lpm6_parse_prefix(argv[i + 1], strlen(argv[i + 1]), &p6) < 0) { return -1; }
+            if(r->family == NFPROTO_IPV4) { return -1; }
+            r->family = NFPROTO_IPV6;
+            if(argv[i][0] == 's') {
+                r->src6 = p6.addr;
+                r->src_len = p6.len;
+            } else {
+                r->dst6 = p6.addr;
+                r->dst_len = p6.len;
+            }
+        } else if(!strcmp(argv[i], "src") || !strcmp(argv[i], "dst")) {
+            if(r->family == NFPROTO_IPV6) { return -1; }
+            r->family = NFPROTO_IPV4;
+            if(lpm_parse_prefix(argv[i + 1], strlen(argv[i + 1]), &p) < 0) { return -1; }
+            if(argv[i][0] == 's') {
+                r->src = p.addr;
+                r->src_len = p.len;
+            } else {
+                r->dst = p.addr;
+                r->dst_len = p.len;
+            }
+        } else if(!strcmp(argv[i], "sport")) {
+            if(parse_ports(argv[i + 1], &r->sport_min, &r->sport_max) < 0) { return -1; }
+        } else if(!strcmp(argv[i], "dport")) {
+            if(parse_ports(argv[i + 1], &r->dport_min, &r->dport_max) < 0) { return -1; }
+        } else if(!strcmp(argv[i], "iif")) {
+            if(parse_iif(argv[i + 1], &r->ifindex) < 0) { return -1; }
+        } else {
+            return -1;
+        }
+    }
+    if(i != argc - 1 || parse_action(argv[i]) < 0) { return -1; }
+    r->action = parse_action(argv[i]);
+
+    return 0;
+}
+
+/* Function for decoding a signature with \xHH and \\ escapes, returns its length or -1 */
+static int parse_pattern(const char *s, u8 *out) {
+    int len = 0;
+
+    while(*s) {
+        if(len == FW_SIG_MAXLEN) { return -1; }
+
+        if(*s != '\\') {
+            out[len++] = *s++;
+        } else if(s[1] == '\\') {
+            out[len++] = '\\';
+            s += 2;
+        } else if(s[1] == 'x' && isxdigit((unsigned char)s[2]) && isxdigit((unsigned char)s[3])) {
+            char hex[3] = { s[2], s[3], '\0' };
+
+            out[len++] = strtoul(hex, NULL, 16);
+            s += 4;
+        } else {
+            return -1;
+        }
+    }
+
+    return len ? len : -1;
+}
+
+/* Function for parsing an ICMP or ICMPv6 type "T", "T/C" or one of the names fwctl knows
+ * @param v6: true for ICMPv6, whose names stand for other types
+ * @param code: set to the code, FW_ICMP_ANY_CODE for every code of the type
+ * */
+static int parse_icmp(const char *s, bool v6, int *type, int *code) {
+    static const struct icmp_name { const char *name; int type, code; } names4[] = {
+        { "echo-reply", 0, FW_ICMP_ANY_CODE }, { "unreachable", 3, FW_ICMP_ANY_CODE }, { "frag-needed", 3, 4 },
+        { "redirect", 5, FW_ICMP_ANY_CODE }, { "echo-request", 8, FW_ICMP_ANY_CODE },
+        { "time-exceeded", 11, FW_ICMP_ANY_CODE },
+    }, names6[] = {
+        { "unreachable", 1, FW_ICMP_ANY_CODE }, { "packet-too-big", 2, FW_ICMP_ANY_CODE },
+        { "time-exceeded", 3, FW_ICMP_ANY_CODE }, { "parameter-problem", 4, FW_ICMP_ANY_CODE },
+        { "echo-request", 128, FW_ICMP_ANY_CODE }, { "echo-reply", 129, FW_ICMP_ANY_CODE },
+    };
+    const struct icmp_name *names = v6 ? names6 : names4;
+    unsigned int i, count = v6 ? ARRAY_SIZE(names6) : ARRAY_SIZE(names4);
+    char *end;
+
+    for(i = 0; i < count; i++) {
+        if(!strcmp(s, names[i].name)) {
+            *type = names[i].type;
+            *code = names[i].code;
+            return 0;
+        }
+    }
+
+    *type = strtol(s, &end, 10);
+    *code = FW_ICMP_ANY_CODE;
+    if(*end == '/') { *code = strtol(end + 1, &end, 10); }
+    if(end == s || *end || *type < 0 || *type > 255 || *code < 0 || *code > FW_ICMP_ANY_CODE) { return -1; }
+
+    return 0;
+}
+
+/* Function for applying one command of a rules file to a draft
+ * @param argc, argv: e.g. {"add", "prefix", "10.0.0.0/8"}
+ * returns 0 or a negative errno
+ * */
+static int apply_line(struct fw_draft *d, int argc, char **argv) {
+    struct lpm_prefix p;
+    struct lpm6_prefix p6;
+    struct fw_rule r;
+    u8 pattern[FW_SIG_MAXLEN];
+    int i, len, type, code, action;
+    long rate = 0;
+    bool add, v6;
+
+    if(argc == 2 && !strcmp(argv[0], "flush")) {
+        if(!strcmp(argv[1], "prefix")) { fw_draft_flush_prefixes(d); return 0; }
+        if(!strcmp(argv[1], "rule")) { fw_draft_flush_rules(d); return 0; }
+        if(!strcmp(argv[1], "sig")) { fw_draft_flush_signatures(d); return 0; }
+        if(!strcmp(argv[1], "domain")) { fw_draft_flush_domains(d); return 0; }
+        if(!strcmp(argv[1], "icmp")) { fw_draft_flush_icmp(d); return 0; }
+        return -EINVAL;
+    }
+
+    if(argc >= 3 && (!strcmp(argv[0], "add") || !strcmp(argv[0], "del"))) {
+        add = argv[0][0] == 'a';
+
+        if(!strcmp(argv[1], "prefix") && argc == 3 && strchr(argv[2], ':')) {
+            if(lpm6_parse_prefix(argv[2], strlen(argv[2]), &p6) < 0) { return -EINVAL; }
+            return fw_draft_prefix6(d, &p6, add);
+        }
+        if(!strcmp(argv[1], "prefix") && argc == 3) {
+            if(lpm_parse_prefix(argv[2], strlen(argv[2]), &p) < 0) { return -EINVAL; }
+            return fw_draft_prefix(d, &p, add);
+        }
+        if(!strcmp(argv[1], "rule")) {
+            if(parse_rule(argc - 2, argv + 2, &r) < 0) { return -EINVAL; }
+            return fw_draft_rule(d, &r, add);
+        }
+        if(!strcmp(argv[1], "sig") && argc == (add ? 4 : 3)) {
+            len = parse_pattern(argv[2], pattern);
+            action = add ? parse_flag_action(argv[3]) : 0;
+            if(len < 0 || action < 0) { return -EINVAL; }
+            return fw_draft_signature(d, pattern, len, action, add);
+        }
+        if(!strcmp(argv[1], "domain") && argc == (add ? 4 : 3)) {
+            action = add ? parse_flag_action(argv[3]) : 0;
+            if(action < 0) { return -EINVAL; }
+            return fw_draft_domain(d, argv[2], action, add);
+        }
+        if((!strcmp(argv[1], "icmp") || !strcmp(argv[1], "icmpv6")) && (add ? argc == 4 || argc == 6 : argc == 3)) {
+            v6 = argv[1][4] == 'v';
+            action = add ? parse_action(argv[3]) : 0;
+            if(argc == 6) { rate = strcmp(argv[4], "rate") ? -1 : strtol(argv[5], NULL, 10); }
+            if(action < 0 || rate < 0 || parse_icmp(argv[2], v6, &type, &code) < 0) { return -EINVAL; }
+            return fw_draft_icmp(d, v6 ? NFPROTO_IPV6 : NFPROTO_IPV4, type, code, action, rate, add);
+        }
+        return -EINVAL;
+    }
+
+    if(argc == 3 && !strcmp(argv[0], "policy")) {
+        for(i = 0; i < FW_POLICY_MAX && strcmp(argv[1], policy_names[i]); i++);
+        if(i == FW_POLICY_MAX) { return -EINVAL; }
+        if(!strcmp(argv[2], "default")) { return fw_draft_policy_default(d, i); }
+        if(parse_action(argv[2]) < 0) { return -EINVAL; }
+        return fw_draft_policy(d, i, parse_action(argv[2]));
+    }
+
+    if((argc == 2 || argc == 3) && !strcmp(argv[0], "iface")) {
+        if(!strcmp(argv[1], "none")) {
+            if(argc != 2) { return -EINVAL; }
+            fw_draft_flush_ifaces(d);
+            return 0;
+        }
+        for(i = 0; argc == 3 && i < FW_IFACE_MAX && strcmp(argv[2], iface_mode_names[i]); i++);
+        if(i == FW_IFACE_MAX) { return -EINVAL; }
+        return fw_draft_iface(d, argv[1], argc == 3 ? i : FW_IFACE_BLOCKED);
+    }
+
+    return -EINVAL;
+}
+
+/* Function for building the live (userspace) ruleset from the module's built-in one and a rules
+ * file, "-" for stdin */
+static int compile(const char *path) {
+    FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    struct fw_draft *d;
+    char line[512];
+    unsigned long lineno = 0;
+    int err;
+
+    if(!f) {
+        fprintf(stderr, "Couldn't open %s: %s\n", path, strerror(errno));
+        return -errno;
+    }
+
+    err = fw_ruleset_net_init(&compile_net);
+    d = err ? NULL : fw_draft_begin(&compile_net);
+    if(!d) {
+        fprintf(stderr, "Out of memory\n");
+        return -ENOMEM;
+    }
+
+    while(fgets(line, sizeof(line), f)) {
+        char *argv[16], *tok, *save = NULL;
+        int argc = 0;
+
+        lineno++;
+        for(tok = strtok_r(line, " \t\r\n", &save); tok && argc < 16; tok = strtok_r(NULL, " \t\r\n", &save)) {
+            argv[argc++] = tok;
+        }
+        if(!argc || argv[0][0] == '#') { continue; }
+
+        err = apply_line(d, argc, argv);
+        if(err) {
+            fprintf(stderr, "%s:%lu: %s\n", path, lineno, strerror(-err));
+            break;
+        }
+    }
+    if(f != stdin) { fclose(f); }
+
+    if(err) {
+        fw_draft_abort(d);
+        return err;
+    }
+
+    err = fw_draft_commit(d);
+    if(err) { fprintf(stderr, "Commit failed: %s\n", strerror(-err)); }
+
+    return err;
+}
+
+/* ===============================================================================================
+ * image
+ * ===============================================================================================*/
+struct image {
+    u8 *buf;
+    size_t size;
+    struct fw_image_section *sec;   // section table
+    unsigned int nsec;
+};
+
+/* Function for reserving the next section of an image
+ * @param img: image being laid out; with buf NULL only the size is worked out
+ * @param type: enum fw_image_section_type
+ * @param count: records in the section
+ * @param size: bytes in the section
+ * returns where the section's bytes go, NULL while only sizing
+ * */
+static void *image_section(struct image *img, u16 type, u32 count, size_t size) {
+    size_t off = (img->size + FW_IMAGE_ALIGN - 1) & ~(size_t)(FW_IMAGE_ALIGN - 1);
+
+    img->size = off + size;
+    if(!img->buf) { return NULL; }
+
+    img->sec[img->nsec].type = type;
+    img->sec[img->nsec].count = count;
+    img->sec[img->nsec].offset = off;
+    img->sec[img->nsec].size = size;
+    img->nsec++;
+
+    return img->buf + off;
+}
+
+/* Sort callback ordering ICMP entries by type, then code */
+static int icmp_cmp(const void *a, const void *b) {
+    const struct fw_image_icmp *ia = a, *ib = b;
+
+    if(ia->type != ib->type) { return (int)ia->type - (int)ib->type; }
+    return (int)ia->code - (int)ib->code;
+}
+
+/* Function for writing the ICMP or ICMPv6 entries of a ruleset into an image section, sorted
+ * @param img: image being laid out
+ * @param type: FW_IMAGE_ICMP or FW_IMAGE_ICMP6
+ * @param e, count: entries of the family
+ * */
+static void image_icmp(struct image *img, u16 type, const struct fw_icmp *e, unsigned int count) {
+    struct fw_image_icmp *icmp = image_section(img, type, count, sizeof(*icmp) * count);
+    unsigned int i;
+
+    for(i = 0; icmp && i < count; i++) {
+        icmp[i].type = e[i].type;
+        icmp[i].code = e[i].code;
+        icmp[i].action = e[i].action;
+        icmp[i].rate = e[i].rate;
+    }
+    if(icmp) { qsort(icmp, count, sizeof(*icmp), icmp_cmp); }
+}
+
+/* Function for writing the sections of a ruleset into an image, or just sizing them
+ * @param img: image being laid out, size starts past the header and section table
+ * @param rs: compiled ruleset
+ * */
+static void image_fill(struct image *img, const struct fw_ruleset *rs) {
+    const struct lpm_table *lpm = rs->blocklist;
+    const struct fw_hostset *hosts = rs->hosts;
+    struct fw_image_prefix *p;
+    struct fw_image_prefix6 *p6;
+    struct fw_image_hostset *h;
+    struct fw_image_rule *r;
+    struct fw_image_signature *sig;
+    struct fw_image_iface *iface;
+    struct fw_image_domain *dom;
+    size_t nslots = (size_t)FW_HOSTSET_SLOTS * (hosts->mask + 1);
+    size_t nbloom = (size_t)FW_HOSTSET_BLOCK / 64 * (hosts->bloom_mask + 1);
+    unsigned int i;
+    u8 *b;
+
+    b = image_section(img, FW_IMAGE_POLICY, FW_POLICY_MAX, FW_POLICY_MAX);
+    if(b) { memcpy(b, rs->policy, FW_POLICY_MAX); }
+
+    p = image_section(img, FW_IMAGE_PREFIXES, rs->nprefixes, sizeof(*p) * rs->nprefixes);
+    for(i = 0; p && i < rs->nprefixes; i++) {
+        p[i].addr = rs->prefixes[i].addr;
+        p[i].len = rs->prefixes[i].len;
+    }
+
+    p6 = image_section(img, FW_IMAGE_PREFIXES6, rs->nprefixes6, sizeof(*p6) * rs->nprefixes6);
+    for(i = 0; p6 && i < rs->nprefixes6; i++) {
+        memcpy(p6[i].addr, &rs->prefixes6[i].addr, sizeof(p6[i].addr));
+        p6[i].len = rs->prefixes6[i].len;
+    }
+
+    b = image_section(img, FW_IMAGE_LPM, lpm->ntbl, sizeof(u32) * ((1 << 16) + 256 * (size_t)lpm->ntbl));
+    if(b) {
+        memcpy(b, lpm->root, sizeof(u32) << 16);
+        memcpy(b + (sizeof(u32) << 16), lpm->tbl, sizeof(u32) * 256 * (size_t)lpm->ntbl);
+    }
+
+    h = image_section(img, FW_IMAGE_HOSTSET, hosts->count, sizeof(*h) + sizeof(u32) * nslots + sizeof(u64) * nbloom);
+    if(h) {
+        h->seed = hosts->seed;
+        h->buckets = hosts->mask + 1;
+        h->blocks = hosts->bloom_mask + 1;
+        h->zero = hosts->zero;
+        memcpy(h + 1, hosts->slots, sizeof(u32) * nslots);
+        memcpy((u8 *)(h + 1) + sizeof(u32) * nslots, hosts->bloom, sizeof(u64) * nbloom);
+    }
+
+    r = image_section(img, FW_IMAGE_RULES, rs->nrules, sizeof(*r) * rs->nrules);
+    for(i = 0; r && i < rs->nrules; i++) {
+        r[i].src = rs->rules[i].src;
+        r[i].dst = rs->rules[i].dst;
+        r[i].src_len = rs->rules[i].src_len;
+        r[i].dst_len = rs->rules[i].dst_len;
+        r[i].proto = rs->rules[i].proto;
+        r[i].action = rs->rules[i].action;
+        r[i].sport_min = rs->rules[i].sport_min;
+        r[i].sport_max = rs->rules[i].sport_max;
+        r[i].dport_min = rs->rules[i].dport_min;
+        r[i].dport_max = rs->rules[i].dport_max;
+        r[i].family = rs->rules[i].family;
+        memcpy(r[i].src6, &rs->rules[i].src6, sizeof(r[i].src6));
+        memcpy(r[i].dst6, &rs->rules[i].dst6, sizeof(r[i].dst6));
+        if(rs->rules[i].ifindex) { memcpy(r[i].iif, devs[rs->rules[i].ifindex - 1].name, sizeof(r[i].iif)); }
+    }
+
+    sig = image_section(img, FW_IMAGE_SIGNATURES, rs->nsigs, sizeof(*sig) * rs->nsigs);
+    for(i = 0; sig && i < rs->nsigs; i++) {
+        sig[i].action = rs->sigs[i].action;
+        sig[i].len = rs->sigs[i].len;
+        memcpy(sig[i].pattern, rs->sigs[i].pattern, rs->sigs[i].len);
+    }
+
+    iface = image_section(img, FW_IMAGE_IFACES, rs->nifaces, sizeof(*iface) * rs->nifaces);
+    for(i = 0; iface && i < rs->nifaces; i++) {
+        memcpy(iface[i].name, rs->ifaces[i].name, sizeof(iface[i].name));
+        iface[i].mode = rs->ifaces[i].mode;
+    }
+
+    dom = image_section(img, FW_IMAGE_DOMAINS, rs->ndomains, sizeof(*dom) * rs->ndomains);
+    for(i = 0; dom && i < rs->ndomains; i++) {
+        dom[i].name = rs->domains[i].name;
+        dom[i].len = rs->domains[i].len;
+        dom[i].action = rs->domains[i].action;
+    }
+
+    b = image_section(img, FW_IMAGE_DOMAIN_NAMES, rs->domain_names_len, rs->domain_names_len);
+    if(b && rs->domain_names_len) { memcpy(b, rs->domain_names, rs->domain_names_len); }
+
+    /* drafts keep ICMP entries in the order they were added, images sorted */
+    image_icmp(img, FW_IMAGE_ICMP, rs->icmp, rs->nicmp);
+    image_icmp(img, FW_IMAGE_ICMP6, rs->icmp6, rs->nicmp6);
+}
+
+/* Function for building the image of a compiled ruleset
+ * @param rs: ruleset to write out
+ * @param img: set to the image, buf from calloc()
+ * */
+static int image_build(const struct fw_ruleset *rs, struct image *img) {
+    struct fw_image_header *hdr;
+    size_t table = sizeof(*hdr) + sizeof(struct fw_image_section) * SECTIONS;
+
+    memset(img, 0, sizeof(*img));
+    img->size = table;
+    image_fill(img, rs);
+    if(img->size > FW_IMAGE_MAXSIZE) { return -EFBIG; }
+
+    /* aligned_alloc() keeps the sections as aligned in memory as they are in the image */
+    img->buf = aligned_alloc(FW_IMAGE_ALIGN, (img->size + FW_IMAGE_ALIGN - 1) & ~(size_t)(FW_IMAGE_ALIGN - 1));
+    if(!img->buf) { return -ENOMEM; }
+    memset(img->buf, 0, img->size);
+    img->sec = (struct fw_image_section *)(img->buf + sizeof(*hdr));
+    img->size = table;
+    image_fill(img, rs);
+
+    hdr = (struct fw_image_header *)img->buf;
+    hdr->magic = FW_IMAGE_MAGIC;
+    hdr->version = FW_IMAGE_VERSION;
+    hdr->nsections = img->nsec;
+    hdr->size = img->size;
+    hdr->crc = crc32_le(~0U, img->buf + sizeof(*hdr), img->size - sizeof(*hdr)) ^ ~0U;
+
+    return 0;
+}
+
+/* Function for loading an image back the way the module does and comparing the outcome */
+static int image_check(const struct image *img, const struct fw_ruleset *want) {
+    const struct fw_ruleset *got;
+    double t0;
+    int err;
+
+    t0 = now_ms();
+    err = fw_image_load(&compile_net, img->buf, img->size);
+    if(err) {
+        fprintf(stderr, "Image rejected: %s\n", strerror(-err));
+        return err;
+    }
+    printf("loaded in %.1f ms\n", now_ms() - t0);
+
+    got = fw_ruleset_get(&compile_net);
+    if(got->nprefixes != want->nprefixes || got->nprefixes6 != want->nprefixes6 || got->nrules != want->nrules || got->nsigs != want->nsigs ||
+       got->nifaces != want->nifaces || got->ndomains != want->ndomains || got->nicmp != want->nicmp ||
+       got->nicmp6 != want->nicmp6) {
+        fprintf(stderr, "Loaded ruleset differs from the compiled one\n");
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *out = "rules.img";
+    struct fw_ruleset want;
+    const struct fw_ruleset *rs;
+    struct image img;
+    bool check = false;
+    double t0;
+    FILE *f;
+    int opt, err;
+
+    while((opt = getopt(argc, argv, "co:")) != -1) {
+        switch(opt) {
+            case 'c': check = true; break;
+            case 'o': out = optarg; break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if(optind != argc - 1) {
+        fprintf(stderr, "Usage:  %s [-c] [-o rules.img] rules.txt|-\n", argv[0]);
+        return 1;
+    }
+
+    t0 = now_ms();
+    if(compile(argv[optind])) { return 1; }
+    rs = fw_ruleset_get(&compile_net);
+    printf("%u prefixes, %u IPv6 prefixes, %u rules, %u signatures, %u interfaces, %u domains, %u + %u ICMP entries "
+           "compiled in %.1f ms\n", rs->nprefixes, rs->nprefixes6, rs->nrules, rs->nsigs, rs->nifaces, rs->ndomains, rs->nicmp,
+           rs->nicmp6, now_ms() - t0);
+
+    err = image_build(rs, &img);
+    if(err) {
+        fprintf(stderr, "Couldn't build the image: %s\n", strerror(-err));
+        return 1;
+    }
+
+    f = fopen(out, "w");
+    if(!f || fwrite(img.buf, 1, img.size, f) != img.size || fclose(f)) {
+        fprintf(stderr, "Couldn't write %s: %s\n", out, strerror(errno));
+        return 1;
+    }
+    printf("%s: %zu bytes\n", out, img.size);
+
+    /* the load frees the compiled ruleset, keep its counts */
+    want = *rs;
+    if(check && image_check(&img, &want)) { return 1; }
+
+    free(img.buf);
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*************************************************************************************************
+ * fw-events -- drains the firewall's per-CPU event rings and prints one line per verdict, or a
+ * per-second summary with -s. Each CPU's relay file is read in large batches; a read never blocks
+ * the hook, records the reader could not keep up with show up in the module's events_stats.
+ * Events of every network namespace come through the same rings; each line names the namespace
+ * of its interface by inode number, as in /proc/<pid>/ns/net.
+ ************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "../fw-uapi.h"
+
+#define MAX_CPUS 1024
+#define BATCH 4096                      // records read per read() call
+
+static const char *reason_names[FW_REASON_MAX] = {
+    [FW_REASON_NONE]        = "none",
+    [FW_REASON_BLOCKLIST]   = "blocklist",
+    [FW_REASON_TCP]         = "tcp",
+    [FW_REASON_SIGNATURE]   = "signature",
+    [FW_REASON_UDP]         = "udp",
+    [FW_REASON_DNS]         = "dns",
+    [FW_REASON_ICMP]        = "icmp",
+    [FW_REASON_IFACE]       = "iface",
+    [FW_REASON_OTHER]       = "other",
+    [FW_REASON_RULE]        = "rule",
+    [FW_REASON_RATELIMIT]   = "ratelimit",
+    [FW_REASON_DOMAIN]      = "domain",
+    [FW_REASON_DYNBLOCK]    = "dynblock",
+    [FW_REASON_EXTHDRS]     = "exthdrs",
+    [FW_REASON_MALFORMED]   = "malformed",
+};
+
+static const char *hook_names[FW_HOOK_MAX] = {
+    [FW_HOOK_PRE_ROUTING]   = "pre",
+    [FW_HOOK_INGRESS]       = "ingress",
+    [FW_HOOK_LOCAL_OUT]     = "out",
+    [FW_HOOK_PRE_ROUTING6]  = "pre6",
+    [FW_HOOK_LOCAL_OUT6]    = "out6",
+};
+
+static unsigned long long totals[2][FW_REASON_MAX]; // [verdict][reason] since the last summary
+
+/* Function for printing a single event
+ * @param cpu: CPU whose ring the event came from
+ * @param ev: event record
+ * */
+static void print_event(int cpu, const struct fw_event *ev) {
+    char src[INET6_ADDRSTRLEN + 2], dst[INET6_ADDRSTRLEN + 2];
+    int af = ev->family == 10 ? AF_INET6 : AF_INET;
+
+    /* IPv6 addresses go in brackets so the port stays readable */
+    inet_ntop(af, ev->saddr, src + 1, sizeof(src) - 2);
+    inet_ntop(af, ev->daddr, dst + 1, sizeof(dst) - 2);
+    if(af == AF_INET6) {
+        src[0] = dst[0] = '[';
+        strcat(src, "]");
+        strcat(dst, "]");
+    }
+
+    printf("%llu.%09llu cpu%d %s if%u ns%u proto %u %s:%u -> %s:%u len %u %s (%s)\n",
+           (unsigned long long)(ev->ts_ns / 1000000000), (unsigned long long)(ev->ts_ns % 1000000000),
+           cpu, ev->hook < FW_HOOK_MAX ? hook_names[ev->hook] : "?", ev->ifindex, ev->netns, ev->proto,
+           af == AF_INET6 ? src : src + 1, ev->sport, af == AF_INET6 ? dst : dst + 1, ev->dport, ev->len,
+           ev->verdict ? "ACCEPT" : "DROP",
+           ev->reason < FW_REASON_MAX ? reason_names[ev->reason] : "?");
+}
+
+/* Function for printing and resetting the per-reason totals */
+static void print_summary(void) {
+    int v, r;
+
+    printf("---- %ld\n", (long)time(NULL));
+    for(v = 0; v < 2; v++) {
+        for(r = 0; r < FW_REASON_MAX; r++) {
+            if(totals[v][r]) {
+                printf("%-6s %-10s %llu\n", v ? "ACCEPT" : "DROP", reason_names[r], totals[v][r]);
+            }
+        }
+    }
+    memset(totals, 0, sizeof(totals));
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = "/sys/kernel/debug/netfilter-firewall";
+    struct pollfd pfd[MAX_CPUS];
+    int cpu_of[MAX_CPUS];
+    static struct fw_event batch[BATCH];
+    int summary = 0, nfd = 0, opt, i, cpu;
+    long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    time_t last = time(NULL);
+
+    while((opt = getopt(argc, argv, "d:s")) != -1) {
+        switch(opt) {
+            case 'd': dir = optarg; break;
+            case 's': summary = 1; break;
+            default:
+                fprintf(stderr, "Usage:  %s [-d debugfs_dir] [-s]\n", argv[0]);
+                exit(1);
+        }
+    }
+
+    /* one relay file per CPU: events0, events1, ... */
+    for(cpu = 0; cpu < ncpus && nfd < MAX_CPUS; cpu++) {
+        char path[256];
+
+        snprintf(path, sizeof(path), "%s/events%d", dir, cpu);
+        pfd[nfd].fd = open(path, O_RDONLY | O_NONBLOCK);
+        if(pfd[nfd].fd < 0) { continue; }
+
+        pfd[nfd].events = POLLIN;
+        cpu_of[nfd++] = cpu;
+    }
+
+    if(!nfd) {
+        fprintf(stderr, "No event files under %s: %s\n", dir, strerror(errno));
+        exit(1);
+    }
+
+    for(;;) {
+        if(poll(pfd, nfd, 1000) < 0 && errno != EINTR) {
+            fprintf(stderr, "poll failed: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        for(i = 0; i < nfd; i++) {
+            ssize_t n;
+
+            /* drain this CPU completely before moving on */
+            while((n = read(pfd[i].fd, batch, sizeof(batch))) > 0) {
+                size_t k, count = n / sizeof(struct fw_event);
+
+                for(k = 0; k < count; k++) {
+                    if(summary) {
+                        if(batch[k].reason < FW_REASON_MAX) {
+                            totals[batch[k].verdict ? 1 : 0][batch[k].reason]++;
+                        }
+                    } else {
+                        print_event(cpu_of[i], &batch[k]);
+                    }
+                }
+            }
+        }
+
+        if(summary && time(NULL) != last) {
+            last = time(NULL);
+            print_summary();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,826 @@
+/*************************************************************************************************
+ * fwctl -- changes the policy of the loaded firewall module over generic netlink.
+ *
+ *   fwctl show
+ *   fwctl add prefix 10.0.0.0/8          fwctl del prefix 10.0.0.0/8          fwctl flush prefix
+ *   fwctl add prefix 2001:db8::/32       fwctl del prefix 2001:db8::/32
+ *   fwctl add rule proto tcp src 10.0.0.0/8 dport 1024-65535 iif eth0 drop
+ *   fwctl add rule proto icmpv6 src 2001:db8::/32 accept     fwctl add rule family inet6 dport 53 drop
+ *   fwctl del rule ...                   fwctl flush rule
+ *   fwctl add sig 'GET /admin' drop      fwctl del sig 'GET /admin'           fwctl flush sig
+ *   fwctl add domain '*.ads.test' drop   fwctl del domain '*.ads.test'        fwctl flush domain
+ *   fwctl add icmp 3/4 accept            fwctl del icmp 3/4                   fwctl flush icmp
+ *   fwctl add icmp echo-request accept rate 100                 fwctl add icmpv6 echo-request drop
+ *   fwctl policy udp accept|drop|ratelimit|default (classes: tcp udp dns icmp other)
+ *   fwctl iface eth1 [blocked|trusted|headers|filter]       fwctl iface none
+ *   fwctl load rules.txt                 one command per line, '-' reads stdin
+ *   fwctl block 192.0.2.7 600            fwctl unblock 192.0.2.7              fwctl unblock
+ *
+ * Filter rules take any of family, proto, src, dst, sport, dport and iif followed by accept, drop or
+ * ratelimit; they are matched in the order they were added and the first match wins. ratelimit
+ * lets each source through at the module's ratelimit_rate and ratelimit_burst, as a policy too.
+ * Interfaces are blocked (the default), trusted (everything accepted without a check), headers
+ * (every check but the payload signatures and domains) or filter (every check, what unnamed
+ * interfaces get); `iface none` returns all of them to filter. Modes follow an interface by name.
+ * Signatures are matched anywhere in TCP payloads and take drop, accept or flag (log only); \xHH
+ * and \\ escapes allow any byte. Where several match, the one added first wins.
+ * Domains are matched against the question of DNS packets and take drop, accept or flag:
+ * "example.com" matches that name, "*.example.com" every name below it, and the most specific
+ * domain that matches wins. DNS that no domain matches gets the dns policy, accept by default.
+ * ICMP entries decide ICMP that no filter rule matched, by type or TYPE/CODE (numbers, or one of
+ * echo-reply, unreachable, frag-needed, redirect, echo-request, time-exceeded), in place of the
+ * icmp policy; a code's entry overrides its type's. A whole type may take "rate N", which holds it
+ * to N packets per second from all sources together. ICMPv6 entries work alike with "icmpv6" and the
+ * names echo-request, echo-reply, unreachable, packet-too-big, time-exceeded and parameter-problem;
+ * `flush icmp` removes the entries of both.
+ * A single command is one batch. `load` opens a transaction, streams the file in as many batches
+ * as it takes and commits once at the end, so the whole file takes effect atomically or not at all.
+ * -g GEN makes the change conditional on the live ruleset still being generation GEN.
+ * Blocked prefixes and filter rule addresses may be IPv4 or IPv6. A rule with addresses matches
+ * their family, one with "family inet" or "family inet6" that family, and any other rule both
+ * families; src and dst of a rule are of one family. Every command works on the ruleset of the
+ * network namespace fwctl runs in, so inside a container it changes that container's rules.
+ * block drops everything from (and, with the egress hook, to) a host for the given number of
+ * seconds, or changes how long an existing block lasts; unblock lifts it early, or lifts every
+ * block without an address. An IPv6 address blocks and unblocks its whole /64. Blocks belong to
+ * the namespace like the ruleset does, but are not part of it, so they take effect at once,
+ * ignore -g and transactions, and cannot appear in a `load` file.
+ ************************************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ctype.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+
+#include "../fw-uapi.h"
+
+#define MSG_SIZE    (64 * 1024)
+#define BATCH_SIZE  (MSG_SIZE - 1024)       // flush a batch before it outgrows the message
+
+struct nlmsg {
+    struct nlmsghdr *nlh;
+    char buf[MSG_SIZE];
+};
+
+static int sock;                            // netlink socket
+static int family;                          // resolved id of FW_GENL_NAME
+static unsigned int seq;                    // request sequence number
+static long expect_gen = -1;                // -g precondition
+
+static const char *policy_names[FW_POLICY_MAX] = {
+    [FW_POLICY_TCP] = "tcp", [FW_POLICY_UDP] = "udp", [FW_POLICY_DNS] = "dns",
+    [FW_POLICY_ICMP] = "icmp", [FW_POLICY_OTHER] = "other",
+};
+
+static const char *action_names[FW_ACTION_MAX] = {
+    [FW_ACTION_DROP] = "drop", [FW_ACTION_ACCEPT] = "accept", [FW_ACTION_FLAG] = "flag",
+    [FW_ACTION_RATELIMIT] = "ratelimit",
+};
+
+static const char *iface_mode_names[FW_IFACE_MAX] = {
+    [FW_IFACE_FILTER] = "filter", [FW_IFACE_HEADERS] = "headers", [FW_IFACE_TRUSTED] = "trusted",
+    [FW_IFACE_BLOCKED] = "blocked",
+};
+
+/* ===============================================================================================
+ * netlink helpers
+ * ===============================================================================================*/
+static void msg_init(struct nlmsg *m, int type, int cmd) {
+    struct genlmsghdr *g;
+
+    memset(m->buf, 0, NLMSG_HDRLEN + GENL_HDRLEN);
+    m->nlh = (struct nlmsghdr *)m->buf;
+    m->nlh->nlmsg_len = NLMSG_HDRLEN + GENL_HDRLEN;
+    m->nlh->nlmsg_type = type;
+    m->nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    m->nlh->nlmsg_seq = ++seq;
+
+    g = NLMSG_DATA(m->nlh);
+    g->cmd = cmd;
+    g->version = type == GENL_ID_CTRL ? 1 : FW_GENL_VERSION;
+}
+
+static struct nlattr *msg_put(struct nlmsg *m, int type, const void *data, int len) {
+    struct nlattr *a = (struct nlattr *)(m->buf + NLMSG_ALIGN(m->nlh->nlmsg_len));
+
+    a->nla_type = type;
+    a->nla_len = NLA_HDRLEN + len;
+    if(len) { memcpy((char *)a + NLA_HDRLEN, data, len); }
+    m->nlh->nlmsg_len = NLMSG_ALIGN(m->nlh->nlmsg_len) + NLA_ALIGN(a->nla_len);
+
+    return a;
+}
+
+static void msg_put_u8(struct nlmsg *m, int type, __u8 v) { msg_put(m, type, &v, sizeof(v)); }
+static void msg_put_u16(struct nlmsg *m, int type, __u16 v) { msg_put(m, type, &v, sizeof(v)); }
+static void msg_put_u32(struct nlmsg *m, int type, __u32 v) { msg_put(m, type, &v, sizeof(v)); }
+
+static struct nlattr *nest_start(struct nlmsg *m, int type) {
+    return msg_put(m, type | NLA_F_NESTED, NULL, 0);
+}
+
+static void nest_end(struct nlmsg *m, struct nlattr *a) {
+    a->nla_len = m->buf + m->nlh->nlmsg_len - (char *)a;
+}
+
+/* Function for sending a request and waiting for its ack; replies are handed to cb
+ * returns 0 or a negative errno from the kernel
+ * */
+static int msg_send(struct nlmsg *m, void (*cb)(struct nlmsghdr *)) {
+    static char rbuf[MSG_SIZE];
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    struct nlmsghdr *h;
+    int n;
+
+    if(sendto(sock, m->buf, m->nlh->nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0) {
+        return -errno;
+    }
+
+    for(;;) {
+        n = recv(sock, rbuf, sizeof(rbuf), 0);
+        if(n < 0) { return -errno; }
+
+        for(h = (struct nlmsghdr *)rbuf; NLMSG_OK(h, n); h = NLMSG_NEXT(h, n)) {
+            if(h->nlmsg_seq != seq) { continue; }
+            if(h->nlmsg_type == NLMSG_ERROR) {
+                return ((struct nlmsgerr *)NLMSG_DATA(h))->error;
+            }
+            if(cb) { cb(h); }
+        }
+    }
+}
+
+/* Function for walking the attributes of a generic netlink reply */
+#define for_each_attr(a, h, rem) \
+    for(a = (struct nlattr *)((char *)NLMSG_DATA(h) + GENL_HDRLEN), rem = h->nlmsg_len - NLMSG_HDRLEN - GENL_HDRLEN; \
+        rem >= NLA_HDRLEN && a->nla_len >= NLA_HDRLEN && a->nla_len <= rem; \
+        rem -= NLA_ALIGN(a->nla_len), a = (struct nlattr *)((char *)a + NLA_ALIGN(a->nla_len)))
+
+#define ATTR_DATA(a) ((void *)((char *)(a) + NLA_HDRLEN))
+
+/* Function for walking the attributes nested in attribute n */
+#define for_each_nested(a, n, rem) \
+    for(a = (struct nlattr *)ATTR_DATA(n), rem = (n)->nla_len - NLA_HDRLEN; \
+        rem >= NLA_HDRLEN && a->nla_len >= NLA_HDRLEN && a->nla_len <= rem; \
+        rem -= NLA_ALIGN(a->nla_len), a = (struct nlattr *)((char *)a + NLA_ALIGN(a->nla_len)))
+
+static void family_cb(struct nlmsghdr *h) {
+    struct nlattr *a;
+    int rem;
+
+    for_each_attr(a, h, rem) {
+        if(a->nla_type == CTRL_ATTR_FAMILY_ID) { family = *(__u16 *)ATTR_DATA(a); }
+    }
+}
+
+static void nl_open(void) {
+    struct sockaddr_nl local = { .nl_family = AF_NETLINK };
+    static struct nlmsg m;
+    int err;
+
+    sock = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
+    if(sock < 0 || bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "Couldn't open netlink socket! %s\n", strerror(errno));
+        exit(1);
+    }
+
+    msg_init(&m, GENL_ID_CTRL, CTRL_CMD_GETFAMILY);
+    msg_put(&m, CTRL_ATTR_FAMILY_NAME, FW_GENL_NAME, strlen(FW_GENL_NAME) + 1);
+    err = msg_send(&m, family_cb);
+    if(err || !family) {
+        fprintf(stderr, "Firewall module not loaded? %s\n", strerror(err ? -err : ENOENT));
+        exit(1);
+    }
+}
+
+/* ===============================================================================================
+ * commands
+ * ===============================================================================================*/
+/* Function for printing the FW_A_IFACES list of a GET reply */
+static void show_ifaces(struct nlattr *list) {
+    struct nlattr *iface, *a;
+    int rem, frem, n = 0;
+
+    for_each_nested(iface, list, rem) {
+        const char *name = "?";
+        int mode = -1;
+
+        for_each_nested(a, iface, frem) {
+            if((a->nla_type & NLA_TYPE_MASK) == FW_A_IFNAME) { name = ATTR_DATA(a); }
+            if((a->nla_type & NLA_TYPE_MASK) == FW_A_IFACE_MODE) { mode = *(__u8 *)ATTR_DATA(a); }
+        }
+        printf("interface %s: %s\n", name, mode >= 0 && mode < FW_IFACE_MAX ? iface_mode_names[mode] : "?");
+        n++;
+    }
+    if(!n) { printf("interfaces: all filter\n"); }
+}
+
+static void show_cb(struct nlmsghdr *h) {
+    struct nlattr *a;
+    int rem, i;
+
+    for_each_attr(a, h, rem) {
+        switch(a->nla_type & NLA_TYPE_MASK) {
+            case FW_A_GENERATION:
+                printf("generation: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_NPREFIXES:
+                printf("blocked prefixes: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_NPREFIXES6:
+                printf("blocked ipv6 prefixes: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_NRULES:
+                printf("filter rules: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_NSIGNATURES:
+                printf("payload signatures: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_NDOMAINS:
+                printf("domains: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_NICMP:
+                printf("icmp entries: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_NICMP6:
+                printf("icmpv6 entries: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_NDYNBLOCKS:
+                printf("dynamic blocks: %u\n", *(__u32 *)ATTR_DATA(a));
+                break;
+            case FW_A_IFACES:
+                show_ifaces(a);
+                break;
+            case FW_A_POLICIES:
+                for(i = 0; i < FW_POLICY_MAX && i < a->nla_len - NLA_HDRLEN; i++) {
+                    __u8 action = ((__u8 *)ATTR_DATA(a))[i];
+
+                    printf("policy %s: %s\n", policy_names[i], action < FW_ACTION_MAX ? action_names[action] : "?");
+                }
+                break;
+        }
+    }
+}
+
+/* Function for parsing "a.b.c.d" or "a.b.c.d/len"
+ * @param s: text to parse
+ * @param addr: set to the address, network byte order
+ * @param len: set to the prefix length
+ * */
+static int parse_prefix(const char *s, __u32 *addr, __u8 *len) {
+    char buf[32], *slash;
+    struct in_addr in;
+    long plen = 32;
+
+    if(strlen(s) >= sizeof(buf)) { return -1; }
+    snprintf(buf, sizeof(buf), "%s", s);
+    slash = strchr(buf, '/');
+    if(slash) {
+        *slash = '\0';
+        plen = strtol(slash + 1, NULL, 10);
+    }
+    if(inet_pton(AF_INET, buf, &in) != 1 || plen < 0 || plen > 32) { return -1; }
+
+    *addr = in.s_addr;
+    *len = plen;
+    return 0;
+}
+
+/* Function for parsing an IPv6 address with an optional "/len"
+ * @param s: text to parse
+ * @param addr: set to the address, network byte order
+ * @param len: set to the prefix length
+ * */
+static int parse_prefix6(const char *s, struct in6_addr *addr, __u8 *len) {
+    char buf[64], *slash;
+    long plen = 128;
+
+    if(strlen(s) >= sizeof(buf)) { return -1; }
+    snprintf(buf, sizeof(buf), "%s", s);
+    slash = strchr(buf, '/');
+    if(slash) {
+        *slash = '\0';
+        plen = strtol(slash + 1, NULL, 10);
+    }
+    if(inet_pton(AF_INET6, buf, addr) != 1 || plen < 0 || plen > 128) { return -1; }
+
+    *len = plen;
+    return 0;
+}
+
+/* Function for parsing the action of a rule or policy, returns the enum fw_action or -1 */
+static int parse_action(const char *s) {
+    if(!strcmp(s, "accept")) { return FW_ACTION_ACCEPT; }
+    if(!strcmp(s, "drop")) { return FW_ACTION_DROP; }
+    if(!strcmp(s, "ratelimit")) { return FW_ACTION_RATELIMIT; }
+    return -1;
+}
+
+/* Function for parsing "port" or "min-max" */
+static int parse_ports(const char *s, __u16 *min, __u16 *max) {
+    char *end;
+    long lo, hi;
+
+    lo = strtol(s, &end, 10);
+    hi = lo;
+    if(*end == '-') { hi = strtol(end + 1, &end, 10); }
+    if(*end || lo < 0 || hi > 65535 || lo > hi) { return -1; }
+
+    *min = lo;
+    *max = hi;
+    return 0;
+}
+
+/* Function for appending the match fields and action of a filter rule
+ * @param m: batch being built
+ * @param argc, argv: e.g. {"proto", "tcp", "dport", "22", "accept"}
+ * */
+static int put_filter_rule(struct nlmsg *m, int argc, char **argv) {
+    struct in6_addr addr6;
+    __u32 addr;
+    __u16 min, max;
+    __u8 len;
+    int i;
+
+    for(i = 0; i + 1 < argc; i += 2) {
+        if(!strcmp(argv[i], "proto")) {
+            long proto = !strcmp(argv[i + 1], "tcp") ? 6 : !strcmp(argv[i + 1], "udp") ? 17 :
+                         !strcmp(argv[i + 1], "icmp") ? 1 : !strcmp(argv[i + 1], "icmpv6") ? 58 :
+                         strtol(argv[i + 1], NULL, 10);
+
+            if(proto <= 0 || proto > 255) { goto bad; }
+            msg_put_u8(m, FW_A_PROTO, proto);
+        } else if(!strcmp(argv[i], "family")) {
+            if(strcmp(argv[i + 1], "inet") && strcmp(argv[i + 1], "inet6")) { goto bad; }
+            msg_put_u8(m, FW_A_FAMILY, argv[i + 1][4] == '6' ? 10 : 2);
+        } else if((!strcmp(argv[i], "src") || !strcmp(argv[i], "dst")) && strchr(argv[i + 1], ':')) {
+            if(parse_prefix6(argv[i + 1], &addr6, &len) < 0) { goto bad; }
+            msg_put(m, argv[i][0] == 's' ? FW_A_PREFIX_ADDR6 : FW_A_DST_ADDR6, &addr6, sizeof(addr6));
+            msg_put_u8(m, argv[i][0] == 's' ? FW_A_PREFIX_LEN : FW_A_DST_LEN, len);
+        } else if(!strcmp(argv[i], "src") || !strcmp(argv[i], "dst")) {
+            if(parse_prefix(argv[i + 1], &addr, &len) < 0) { goto bad; }
+            msg_put_u32(m, argv[i][0] == 's' ? FW_A_PREFIX_ADDR : FW_A_DST_ADDR, addr);
+            msg_put_u8(m, argv[i][0] == 's' ? FW_A_PREFIX_LEN : FW_A_DST_LEN, len);
+        } else if(!strcmp(argv[i], "sport") || !strcmp(argv[i], "dport")) {
+            if(parse_ports(argv[i + 1], &min, &max) < 0) { goto bad; }
+            msg_put_u16(m, argv[i][0] == 's' ? FW_A_SPORT_MIN : FW_A_DPORT_MIN, min);
+            msg_put_u16(m, argv[i][0] == 's' ? FW_A_SPORT_MAX : FW_A_DPORT_MAX, max);
+        } else if(!strcmp(argv[i], "iif")) {
+            msg_put(m, FW_A_IFNAME, argv[i + 1], strlen(argv[i + 1]) + 1);
+        } else {
+            fprintf(stderr, "Unknown rule field: %s\n", argv[i]);
+            return -1;
+        }
+    }
+
+    if(i != argc - 1 || parse_action(argv[i]) < 0) {
+        fprintf(stderr, "Expected: rule [family inet|inet6] [proto P] [src A/L] [dst A/L] [sport P[-Q]] [dport P[-Q]] "
+                "[iif NAME] accept|drop|ratelimit\n");
+        return -1;
+    }
+    msg_put_u8(m, FW_A_ACTION, parse_action(argv[i]));
+
+    return 0;
+
+bad:
+    fprintf(stderr, "Bad %s: %s\n", argv[i], argv[i + 1]);
+    return -1;
+}
+
+/* Function for decoding a payload signature, "\xHH" and "\\" stand for one byte
+ * @param s: text to decode
+ * @param out: FW_SIG_MAXLEN bytes
+ * returns the length of the signature, -1 if it is empty, too long or badly escaped
+ * */
+static int parse_pattern(const char *s, __u8 *out) {
+    int len = 0;
+
+    while(*s) {
+        if(len == FW_SIG_MAXLEN) { return -1; }
+
+        if(*s != '\\') {
+            out[len++] = *s++;
+        } else if(s[1] == '\\') {
+            out[len++] = '\\';
+            s += 2;
+        } else if(s[1] == 'x' && isxdigit((unsigned char)s[2]) && isxdigit((unsigned char)s[3])) {
+            char hex[3] = { s[2], s[3], '\0' };
+
+            out[len++] = strtoul(hex, NULL, 16);
+            s += 4;
+        } else {
+            return -1;
+        }
+    }
+
+    return len ? len : -1;
+}
+
+/* Function for appending the pattern and action of a payload signature
+ * @param m: batch being built
+ * @param type: enum fw_op, deletes take no action
+ * @param argc, argv: e.g. {"GET /admin", "drop"}
+ * */
+static int put_signature(struct nlmsg *m, __u8 type, int argc, char **argv) {
+    __u8 pattern[FW_SIG_MAXLEN];
+    int len;
+
+    if(argc != (type == FW_OP_ADD ? 2 : 1) || (len = parse_pattern(argv[0], pattern)) < 0) {
+        fprintf(stderr, "Expected: sig PATTERN%s (1-%d bytes, \\xHH escapes)\n",
+                type == FW_OP_ADD ? " drop|accept|flag" : "", FW_SIG_MAXLEN);
+        return -1;
+    }
+    msg_put(m, FW_A_PATTERN, pattern, len);
+
+    if(type == FW_OP_ADD) {
+        if(strcmp(argv[1], "drop") && strcmp(argv[1], "accept") && strcmp(argv[1], "flag")) {
+            fprintf(stderr, "Unknown action: %s\n", argv[1]);
+            return -1;
+        }
+        msg_put_u8(m, FW_A_ACTION, !strcmp(argv[1], "drop") ? FW_ACTION_DROP :
+                                   !strcmp(argv[1], "accept") ? FW_ACTION_ACCEPT : FW_ACTION_FLAG);
+    }
+
+    return 0;
+}
+
+/* Function for appending the name and action of a DNS domain
+ * @param m: batch being built
+ * @param type: enum fw_op, deletes take no action
+ * @param argc, argv: e.g. {"*.example.com", "drop"}
+ * */
+static int put_domain(struct nlmsg *m, __u8 type, int argc, char **argv) {
+    if(argc != (type == FW_OP_ADD ? 2 : 1) || !*argv[0] || strlen(argv[0]) > FW_DOMAIN_MAXLEN + 1) {
+        fprintf(stderr, "Expected: domain NAME%s (*.NAME for the names below NAME)\n",
+                type == FW_OP_ADD ? " drop|accept|flag" : "");
+        return -1;
+    }
+    msg_put(m, FW_A_DOMAIN, argv[0], strlen(argv[0]) + 1);
+
+    if(type == FW_OP_ADD) {
+        if(strcmp(argv[1], "drop") && strcmp(argv[1], "accept") && strcmp(argv[1], "flag")) {
+            fprintf(stderr, "Unknown action: %s\n", argv[1]);
+            return -1;
+        }
+        msg_put_u8(m, FW_A_ACTION, !strcmp(argv[1], "drop") ? FW_ACTION_DROP :
+                                   !strcmp(argv[1], "accept") ? FW_ACTION_ACCEPT : FW_ACTION_FLAG);
+    }
+
+    return 0;
+}
+
+/* Function for parsing an ICMP type "T", "T/C" or one of a few names
+ * @param s: text to parse
+ * @param v6: nonzero for ICMPv6, whose names stand for other types
+ * @param type: set to the type
+ * @param code: set to the code, -1 for every code of the type
+ * */
+static int parse_icmp(const char *s, int v6, int *type, int *code) {
+    static const struct icmp_name { const char *name; int type, code; } names4[] = {
+        { "echo-reply", 0, -1 }, { "unreachable", 3, -1 }, { "frag-needed", 3, 4 },
+        { "redirect", 5, -1 }, { "echo-request", 8, -1 }, { "time-exceeded", 11, -1 },
+    }, names6[] = {
+        { "unreachable", 1, -1 }, { "packet-too-big", 2, -1 }, { "time-exceeded", 3, -1 },
+        { "parameter-problem", 4, -1 }, { "echo-request", 128, -1 }, { "echo-reply", 129, -1 },
+    };
+    const struct icmp_name *names = v6 ? names6 : names4;
+    unsigned int i, count = v6 ? sizeof(names6) / sizeof(names6[0]) : sizeof(names4) / sizeof(names4[0]);
+    char *end;
+
+    for(i = 0; i < count; i++) {
+        if(!strcmp(s, names[i].name)) {
+            *type = names[i].type;
+            *code = names[i].code;
+            return 0;
+        }
+    }
+
+    *type = strtol(s, &end, 10);
+    *code = -1;
+    if(*end == '/') { *code = strtol(end + 1, &end, 10); }
+    if(end == s || *end || *type < 0 || *type > 255 || *code < -1 || *code > 255) { return -1; }
+
+    return 0;
+}
+
+/* Function for appending the family, type, code, action and rate of an ICMP or ICMPv6 entry
+ * @param m: batch being built
+ * @param type: enum fw_op, deletes take no action
+ * @param v6: nonzero for an ICMPv6 entry
+ * @param argc, argv: e.g. {"echo-request", "accept", "rate", "100"}
+ * */
+static int put_icmp(struct nlmsg *m, __u8 type, int v6, int argc, char **argv) {
+    int icmp_type, icmp_code, action = -1;
+    long rate = 0;
+
+    if(argc >= 2 && type == FW_OP_ADD) { action = parse_action(argv[1]); }
+    if(argc == 4 && !strcmp(argv[2], "rate")) { rate = strtol(argv[3], NULL, 10); }
+    if((type == FW_OP_ADD ? action < 0 || (argc != 2 && argc != 4) || rate < 0 : argc != 1) ||
+       parse_icmp(argv[0], v6, &icmp_type, &icmp_code) < 0 || (rate && icmp_code >= 0)) {
+        fprintf(stderr, "Expected: %s TYPE[/CODE]%s\n", v6 ? "icmpv6" : "icmp",
+                type == FW_OP_ADD ? " accept|drop|ratelimit [rate N] (rate for whole types only)" : "");
+        return -1;
+    }
+
+    if(v6) { msg_put_u8(m, FW_A_FAMILY, 10); }     // NFPROTO_IPV6, as "family inet6"
+    msg_put_u8(m, FW_A_ICMP_TYPE, icmp_type);
+    if(icmp_code >= 0) { msg_put_u8(m, FW_A_ICMP_CODE, icmp_code); }
+    if(type == FW_OP_ADD) { msg_put_u8(m, FW_A_ACTION, action); }
+    if(rate) { msg_put_u32(m, FW_A_ICMP_RATE, rate); }
+
+    return 0;
+}
+
+/* Function for appending one operation, given as command words, to a batch
+ * @param m: batch being built
+ * @param argc, argv: e.g. {"add", "prefix", "10.0.0.0/8"}
+ * returns 0, or -1 after printing what was wrong
+ * */
+static int put_op(struct nlmsg *m, int argc, char **argv) {
+    struct nlattr *op;
+    __u8 type, kind;
+    int i;
+
+    if(argc < 1) { return -1; }
+
+    op = nest_start(m, FW_A_OP);
+
+    if(!strcmp(argv[0], "add") || !strcmp(argv[0], "del") || !strcmp(argv[0], "flush")) {
+        type = !strcmp(argv[0], "add") ? FW_OP_ADD : !strcmp(argv[0], "del") ? FW_OP_DEL : FW_OP_FLUSH;
+
+        if(argc >= 2 && !strcmp(argv[1], "rule")) {
+            msg_put_u8(m, FW_A_OP_TYPE, type);
+            msg_put_u8(m, FW_A_RULE_KIND, FW_RULE_FILTER);
+            if(type != FW_OP_FLUSH && put_filter_rule(m, argc - 2, argv + 2) < 0) { return -1; }
+
+            nest_end(m, op);
+            return 0;
+        }
+
+        if(argc >= 2 && !strcmp(argv[1], "sig")) {
+            msg_put_u8(m, FW_A_OP_TYPE, type);
+            msg_put_u8(m, FW_A_RULE_KIND, FW_RULE_SIGNATURE);
+            if(type != FW_OP_FLUSH && put_signature(m, type, argc - 2, argv + 2) < 0) { return -1; }
+
+            nest_end(m, op);
+            return 0;
+        }
+
+        if(argc >= 2 && !strcmp(argv[1], "domain")) {
+            msg_put_u8(m, FW_A_OP_TYPE, type);
+            msg_put_u8(m, FW_A_RULE_KIND, FW_RULE_DOMAIN);
+            if(type != FW_OP_FLUSH && put_domain(m, type, argc - 2, argv + 2) < 0) { return -1; }
+
+            nest_end(m, op);
+            return 0;
+        }
+
+        if(argc >= 2 && (!strcmp(argv[1], "icmp") || (type != FW_OP_FLUSH && !strcmp(argv[1], "icmpv6")))) {
+            msg_put_u8(m, FW_A_OP_TYPE, type);
+            msg_put_u8(m, FW_A_RULE_KIND, FW_RULE_ICMP);
+            if(type != FW_OP_FLUSH && put_icmp(m, type, !strcmp(argv[1], "icmpv6"), argc - 2, argv + 2) < 0) {
+                return -1;
+            }
+
+            nest_end(m, op);
+            return 0;
+        }
+
+        if(argc < 2 || strcmp(argv[1], "prefix")) {
+            fprintf(stderr, "Expected: %s prefix ADDR[/LEN] | %s rule ... | %s sig ... | %s domain ... | %s icmp ...\n",
+                    argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return -1;
+        }
+        kind = FW_RULE_PREFIX;
+        msg_put_u8(m, FW_A_OP_TYPE, type);
+        msg_put_u8(m, FW_A_RULE_KIND, kind);
+
+        if(type != FW_OP_FLUSH && argc >= 3 && strchr(argv[2], ':')) {
+            struct in6_addr addr6;
+            __u8 len;
+
+            if(parse_prefix6(argv[2], &addr6, &len) < 0) {
+                fprintf(stderr, "Expected: %s prefix ADDR[/LEN]\n", argv[0]);
+                return -1;
+            }
+            msg_put(m, FW_A_PREFIX_ADDR6, &addr6, sizeof(addr6));
+            msg_put_u8(m, FW_A_PREFIX_LEN, len);
+        } else if(type != FW_OP_FLUSH) {
+            __u32 addr;
+            __u8 len;
+
+            if(argc < 3 || parse_prefix(argv[2], &addr, &len) < 0) {
+                fprintf(stderr, "Expected: %s prefix ADDR[/LEN]\n", argv[0]);
+                return -1;
+            }
+            msg_put_u32(m, FW_A_PREFIX_ADDR, addr);
+            msg_put_u8(m, FW_A_PREFIX_LEN, len);
+        }
+    } else if(!strcmp(argv[0], "policy")) {
+        if(argc < 3) {
+            fprintf(stderr, "Expected: policy CLASS accept|drop|default\n");
+            return -1;
+        }
+        for(i = 0; i < FW_POLICY_MAX && strcmp(argv[1], policy_names[i]); i++);
+        if(i == FW_POLICY_MAX) {
+            fprintf(stderr, "Unknown traffic class: %s\n", argv[1]);
+            return -1;
+        }
+        msg_put_u8(m, FW_A_OP_TYPE, strcmp(argv[2], "default") ? FW_OP_ADD : FW_OP_DEL);
+        msg_put_u8(m, FW_A_RULE_KIND, FW_RULE_POLICY);
+        msg_put_u8(m, FW_A_POLICY, i);
+        if(strcmp(argv[2], "default")) {
+            if(parse_action(argv[2]) < 0) {
+                fprintf(stderr, "Unknown action: %s\n", argv[2]);
+                return -1;
+            }
+            msg_put_u8(m, FW_A_ACTION, parse_action(argv[2]));
+        }
+    } else if(!strcmp(argv[0], "iface")) {
+        for(i = 0; argc == 3 && i < FW_IFACE_MAX && strcmp(argv[2], iface_mode_names[i]); i++);
+        if(argc < 2 || argc > 3 || i == FW_IFACE_MAX || (argc == 3 && !strcmp(argv[1], "none"))) {
+            fprintf(stderr, "Expected: iface NAME [blocked|trusted|headers|filter] | iface none\n");
+            return -1;
+        }
+        if(!strcmp(argv[1], "none")) {
+            msg_put_u8(m, FW_A_OP_TYPE, FW_OP_FLUSH);
+            msg_put_u8(m, FW_A_RULE_KIND, FW_RULE_IFACE);
+        } else {
+            msg_put_u8(m, FW_A_OP_TYPE, argc == 3 && i == FW_IFACE_FILTER ? FW_OP_DEL : FW_OP_ADD);
+            msg_put_u8(m, FW_A_RULE_KIND, FW_RULE_IFACE);
+            msg_put(m, FW_A_IFNAME, argv[1], strlen(argv[1]) + 1);
+            msg_put_u8(m, FW_A_IFACE_MODE, argc == 3 ? i : FW_IFACE_BLOCKED);
+        }
+    } else {
+        fprintf(stderr, "Unknown command: %s\n", argv[0]);
+        return -1;
+    }
+
+    nest_end(m, op);
+    return 0;
+}
+
+/* Function for building the request that blocks a host for a while, or lifts blocks
+ * @param m: request to build
+ * @param argc, argv: {"block", ADDR, SECONDS}, {"unblock", ADDR} or {"unblock"}
+ * */
+static int put_dynblock(struct nlmsg *m, int argc, char **argv) {
+    char *end;
+    unsigned long ttl = 0;
+    struct in6_addr addr6;
+    __u32 addr;
+    __u8 len;
+    int block = !strcmp(argv[0], "block"), v6 = argc >= 2 && strchr(argv[1], ':');
+
+    if(block && argc == 3) { ttl = strtoul(argv[2], &end, 10); }
+    if((block && (argc != 3 || *end || !ttl || ttl > 0xffffffffUL)) || (!block && argc > 2) ||
+       (argc >= 2 && !v6 && (parse_prefix(argv[1], &addr, &len) < 0 || len != 32)) ||
+       (v6 && (parse_prefix6(argv[1], &addr6, &len) < 0 || len != 128))) {
+        fprintf(stderr, "Expected: block ADDR SECONDS | unblock [ADDR]\n");
+        return -1;
+    }
+
+    msg_init(m, family, block ? FW_CMD_BLOCK : FW_CMD_UNBLOCK);
+    if(v6) {
+        msg_put(m, FW_A_PREFIX_ADDR6, &addr6, sizeof(addr6));
+    } else if(argc >= 2) {
+        msg_put_u32(m, FW_A_PREFIX_ADDR, addr);
+    }
+    if(block) { msg_put_u32(m, FW_A_TTL, ttl); }
+
+    return 0;
+}
+
+static void batch_init(struct nlmsg *m) {
+    msg_init(m, family, FW_CMD_BATCH);
+}
+
+static int simple_cmd(int cmd) {
+    static struct nlmsg m;
+
+    msg_init(&m, family, cmd);
+    if(cmd == FW_CMD_BEGIN && expect_gen >= 0) { msg_put_u32(&m, FW_A_GENERATION, expect_gen); }
+
+    return msg_send(&m, NULL);
+}
+
+/* Function for streaming a rules file into one transaction
+ * @param path: file with one command per line, "-" for stdin
+ * */
+static int load(const char *path) {
+    static struct nlmsg m;
+    struct nlattr *ops;
+    FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    char line[512];
+    unsigned long lineno = 0, nops = 0;
+    int err;
+
+    if(!f) {
+        fprintf(stderr, "Couldn't open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    err = simple_cmd(FW_CMD_BEGIN);
+    if(err) { goto out; }
+
+    batch_init(&m);
+    ops = nest_start(&m, FW_A_OPS);
+
+    while(fgets(line, sizeof(line), f)) {
+        char *argv[16], *tok, *save = NULL;
+        int argc = 0;
+
+        lineno++;
+        for(tok = strtok_r(line, " \t\r\n", &save); tok && argc < 16; tok = strtok_r(NULL, " \t\r\n", &save)) {
+            argv[argc++] = tok;
+        }
+        if(!argc || argv[0][0] == '#') { continue; }
+
+        if(put_op(&m, argc, argv) < 0) {
+            fprintf(stderr, "%s:%lu: rejected\n", path, lineno);
+            simple_cmd(FW_CMD_ABORT);
+            err = -EINVAL;
+            goto out;
+        }
+        nops++;
+
+        if(m.nlh->nlmsg_len > BATCH_SIZE) {
+            nest_end(&m, ops);
+            err = msg_send(&m, NULL);
+            if(err) { goto out; }
+
+            batch_init(&m);
+            ops = nest_start(&m, FW_A_OPS);
+        }
+    }
+
+    nest_end(&m, ops);
+    err = msg_send(&m, NULL);
+    if(!err) { err = simple_cmd(FW_CMD_COMMIT); }
+    if(!err) { printf("%lu operations committed\n", nops); }
+
+out:
+    if(f != stdin) { fclose(f); }
+    return err;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct nlmsg m;
+    struct nlattr *ops;
+    int opt, err;
+
+    while((opt = getopt(argc, argv, "g:")) != -1) {
+        switch(opt) {
+            case 'g': expect_gen = strtol(optarg, NULL, 10); break;
+            default: goto usage;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if(argc < 1) { goto usage; }
+
+    nl_open();
+
+    if(!strcmp(argv[0], "show")) {
+        msg_init(&m, family, FW_CMD_GET);
+        err = msg_send(&m, show_cb);
+    } else if(!strcmp(argv[0], "load")) {
+        if(argc < 2) { goto usage; }
+        err = load(argv[1]);
+    } else if(!strcmp(argv[0], "block") || !strcmp(argv[0], "unblock")) {
+        if(put_dynblock(&m, argc, argv) < 0) { exit(1); }
+        err = msg_send(&m, NULL);
+    } else {
+        batch_init(&m);
+        if(expect_gen >= 0) { msg_put_u32(&m, FW_A_GENERATION, expect_gen); }
+        ops = nest_start(&m, FW_A_OPS);
+        if(put_op(&m, argc, argv) < 0) { exit(1); }
+        nest_end(&m, ops);
+        err = msg_send(&m, NULL);
+    }
+
+    if(err) {
+        fprintf(stderr, "Failed: %s\n", strerror(-err));
+        exit(1);
+    }
+
+    close(sock);
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage:  %s [-g generation] show | add|del prefix ADDR[/LEN] | flush prefix |\n"
+                    "        add|del rule [family inet|inet6] [proto P] [src A/L] [dst A/L] [sport P[-Q]] [dport P[-Q]] [iif NAME] accept|drop|ratelimit |\n"
+                    "        flush rule | add|del sig PATTERN drop|accept|flag | flush sig |\n"
+                    "        add|del domain [*.]NAME drop|accept|flag | flush domain |\n"
+                    "        add|del icmp|icmpv6 TYPE[/CODE] accept|drop|ratelimit [rate N] | flush icmp |\n"
+                    "        policy tcp|udp|dns|icmp|other accept|drop|ratelimit|default | iface NAME [MODE]|none | load FILE |\n"
+                    "        block ADDR SECONDS | unblock [ADDR]\n",
+            argv[0] ? argv[0] : "fwctl");
+    exit(1);
+}
@@ -1,50 +1,258 @@
 /*************************************************************************************************
- * A Simple netfilter example -- drops all IP packets and logs to /var/log/messages
+ * A simple netfilter probe -- the baseline the firewall's per-packet cost is measured against.
+ *
+ * The probe registers a near-empty hook at a selectable hook point and priority that counts the
+ * packet and stamps get_cycles(), and, unless span=0, a second hook at end_priority on the same
+ * hook point that closes the span and adds its length to a per-CPU log2 histogram of cycles. Both
+ * hooks pass packets on (verdict=drop drops them at the first, as this module did originally).
+ * They are registered for IPv4 and, unless ipv6=0, IPv6 in every network namespace, present and
+ * future, as the firewall's are; packets of all namespaces and both families share the counters.
+ *
+ *   insmod netfilter-simple.ko                             bare cost of two hooks, FIRST to LAST
+ *   insmod netfilter-firewall.ko; insmod netfilter-simple.ko
+ *                                                          the same plus the firewall's PRE_ROUTING
+ *                                                          hook, which runs inside the span
+ *   insmod netfilter-simple.ko hook=input priority=-300 end_priority=0 ...
+ *   insmod netfilter-simple.ko ipv6=0                      IPv4 only
+ *
+ * The firewall's hook has the probe's default priority, NF_IP_PRI_FIRST, the lowest there is, so
+ * the load order decides which of the two runs first. From Linux 4.16 on a hook runs ahead of the
+ * ones already registered at its priority, so the probe is loaded second, as above. Before 4.16 it
+ * ran behind them, and the probe has to be loaded first and the firewall second.
+ * Loaded the wrong way round, the firewall runs before the span opens and the two histograms come
+ * out the same.
+ *
+ * The difference between the first two histograms is what the firewall costs per packet, in the
+ * same unit and with the same timer overhead on both sides. A packet dropped, stolen or queued
+ * between the hooks, or one that moved to another CPU, never closes its span and is counted as
+ * lost. Counters start at zero when the module is loaded.
+ *
+ *   /sys/kernel/debug/netfilter-simple/stats   configuration, packets per CPU, cycle histogram
  ************************************************************************************************/
 
 // standard includes
 #include <linux/module.h>  /* Needed by all kernel modules */
 #include <linux/kernel.h>  /* Needed for loglevels (KERN_WARNING, KERN_EMERG, KERN_INFO, etc.) */
 #include <linux/init.h>    /* Needed for __init and __exit macros. */
+#include <linux/percpu.h>
+#include <linux/bitops.h>
+#include <linux/timex.h>   /* get_cycles() */
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 // netfliter specific includes
-#include <linux/netfilter.h> 
-#include <linux/netfilter_ipv4.h> 
+#include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
+#include <linux/netfilter_ipv6.h>
 #include <linux/net.h>
-#include <linux/in.h>
 #include <linux/skbuff.h>
-#include <linux/ip.h>
-#include <linux/tcp.h>
+#include <net/net_namespace.h>
 
+#define PROBE_BUCKETS 40            // bucket n counts spans of [2^(n-1), 2^n) cycles
 
 /* ===============================================================================================
- * module functions
+ * types
+ * ===============================================================================================*/
+struct probe_cpu {
+    u64 packets;                    // seen by the first hook
+    u64 spanned;                    // of those, seen by the second hook on the same CPU
+    const struct sk_buff *skb;      // packet between the hooks, NULL if none
+    cycles_t start;                 // when it passed the first hook
+    u64 cycles[PROBE_BUCKETS];      // spans, log2 cycles
+};
+
+/* ===============================================================================================
+ * globals
+ * ===============================================================================================*/
+static char *hook = "prerouting";
+static int priority = NF_IP_PRI_FIRST;
+static int end_priority = NF_IP_PRI_LAST;
+static bool span = true;
+static char *verdict = "accept";
+static bool ipv6 = true;
+
+module_param(hook, charp, 0444);
+MODULE_PARM_DESC(hook, "Hook point: prerouting, input, forward, output or postrouting");
+module_param(priority, int, 0444);
+MODULE_PARM_DESC(priority, "Priority of the first hook, default NF_IP_PRI_FIRST");
+module_param(end_priority, int, 0444);
+MODULE_PARM_DESC(end_priority, "Priority of the second hook, default NF_IP_PRI_LAST");
+module_param(span, bool, 0444);
+MODULE_PARM_DESC(span, "Register the second hook and record the cycles between the two");
+module_param(verdict, charp, 0444);
+MODULE_PARM_DESC(verdict, "accept, or drop everything at the first hook");
+module_param(ipv6, bool, 0444);
+MODULE_PARM_DESC(ipv6, "Probe IPv6 packets as well as IPv4");
+
+static const char * const hook_names[NF_INET_NUMHOOKS] = {
+    [NF_INET_PRE_ROUTING]   = "prerouting",
+    [NF_INET_LOCAL_IN]      = "input",
+    [NF_INET_FORWARD]       = "forward",
+    [NF_INET_LOCAL_OUT]     = "output",
+    [NF_INET_POST_ROUTING]  = "postrouting",
+};
+
+static struct probe_cpu __percpu *probe_cpus;
+static unsigned int probe_verdict = NF_ACCEPT;
+static struct dentry *debugfs_dir;
+
+/* ===============================================================================================
+ * hook functions
  * ===============================================================================================*/
 
 unsigned int hook_func(
     void *priv,
     struct sk_buff *skb,
     const struct nf_hook_state *state
-    ) 
+    )
 {
-    printk(KERN_INFO "packet dropped\n"); //log to var/log/messages
-    return NF_DROP;                       //drops the packet
+    struct probe_cpu *p = this_cpu_ptr(probe_cpus);
+
+    p->packets++;
+    p->skb = skb;
+    p->start = get_cycles();
+
+    return probe_verdict;
+}
+
+unsigned int end_hook_func(
+    void *priv,
+    struct sk_buff *skb,
+    const struct nf_hook_state *state
+    )
+{
+    cycles_t end = get_cycles();
+    struct probe_cpu *p = this_cpu_ptr(probe_cpus);
+
+    if(p->skb == skb) {
+        p->cycles[min_t(unsigned int, fls64(end - p->start), PROBE_BUCKETS - 1)]++;
+        p->spanned++;
+        p->skb = NULL;
+    }
+
+    return NF_ACCEPT;
+}
+
+/* first and, with span, second hook of each family, filled in from the parameters at load time */
+static struct nf_hook_ops nfho[4];
+static unsigned int nfho_count;
+
+/* ===============================================================================================
+ * namespaces
+ * ===============================================================================================*/
+static int __net_init probe_net_init(struct net *net) {
+    return nf_register_net_hooks(net, nfho, nfho_count);
+}
+
+static void __net_exit probe_net_exit(struct net *net) {
+    nf_unregister_net_hooks(net, nfho, nfho_count);
 }
 
-static struct nf_hook_ops nfho = { // struct holding set of hook function options
-    .hook       = hook_func, //function to call when conditions below met
-    .hooknum    = NF_INET_PRE_ROUTING, //called right after packet recieved, first hook in Netfilter
-    .pf         = PF_INET, // IPV4 packets
-    .priority   = NF_IP_PRI_FIRST // set highest priority over all other hook fuctions
+static struct pernet_operations probe_net_ops = {
+    .init   = probe_net_init,
+    .exit   = probe_net_exit,
+};
+
+/* Function for adding a family's hooks to nfho */
+static void add_hooks(u8 pf, unsigned int hooknum) {
+    nfho[nfho_count++] = (struct nf_hook_ops){
+        .hook = hook_func, .pf = pf, .hooknum = hooknum, .priority = priority,
+    };
+    if(span) {
+        nfho[nfho_count++] = (struct nf_hook_ops){
+            .hook = end_hook_func, .pf = pf, .hooknum = hooknum, .priority = end_priority,
+        };
+    }
+}
+
+/* ===============================================================================================
+ * stats file
+ * ===============================================================================================*/
+static int stats_show(struct seq_file *m, void *v) {
+    u64 cycles[PROBE_BUCKETS] = { 0 }, packets = 0, spanned = 0;
+    const struct probe_cpu *p;
+    int cpu, b;
+
+    seq_printf(m, "hook: %s\npriority: %d\n", hook_names[nfho[0].hooknum], nfho[0].priority);
+    if(span) {
+        seq_printf(m, "end_priority: %d\n", nfho[1].priority);
+    } else {
+        seq_printf(m, "end_priority: off\n");
+    }
+    seq_printf(m, "verdict: %s\n", probe_verdict == NF_DROP ? "drop" : "accept");
+    seq_printf(m, "families: %s\n\n", ipv6 ? "ipv4 ipv6" : "ipv4");
+
+    seq_printf(m, "%-12s %14s %14s %14s\n", "cpu", "packets", "spanned", "lost");
+    for_each_possible_cpu(cpu) {
+        p = per_cpu_ptr(probe_cpus, cpu);
+        if(!p->packets) { continue; }
+
+        seq_printf(m, "%-12d %14llu %14llu %14llu\n", cpu, p->packets, p->spanned, p->packets - p->spanned);
+        packets += p->packets;
+        spanned += p->spanned;
+        for(b = 0; b < PROBE_BUCKETS; b++) { cycles[b] += p->cycles[b]; }
+    }
+    seq_printf(m, "%-12s %14llu %14llu %14llu\n", "total", packets, spanned, packets - spanned);
+
+    seq_printf(m, "\n%-12s %14s\n", "cycles <", "packets");
+    for(b = 0; b < PROBE_BUCKETS; b++) {
+        if(!cycles[b]) { continue; }
+        seq_printf(m, "%-12llu %14llu\n", 1ULL << b, cycles[b]);
+    }
+
+    return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file) {
+    return single_open(file, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+    .owner      = THIS_MODULE,
+    .open       = stats_open,
+    .read       = seq_read,
+    .llseek     = seq_lseek,
+    .release    = single_release,
 };
 
 /* ================================================================================================
  * entry function
  * ================================================================================================*/
 static int __init onload(void) {
-    nf_register_hook(&nfho);          //register hook
+    int h, err;
+
+    for(h = 0; h < NF_INET_NUMHOOKS; h++) {
+        if(!strcmp(hook, hook_names[h])) { break; }
+    }
+    if(h == NF_INET_NUMHOOKS) {
+        printk(KERN_ERR ">>> Unknown hook %s\n", hook);
+        return -EINVAL;
+    }
+
+    if(!strcmp(verdict, "drop")) {
+        probe_verdict = NF_DROP;
+    } else if(strcmp(verdict, "accept")) {
+        printk(KERN_ERR ">>> Unknown verdict %s\n", verdict);
+        return -EINVAL;
+    }
+
+    add_hooks(NFPROTO_IPV4, h);
+    if(ipv6) { add_hooks(NFPROTO_IPV6, h); }
+
+    probe_cpus = alloc_percpu(struct probe_cpu);
+    if(!probe_cpus) { return -ENOMEM; }
+
+    debugfs_dir = debugfs_create_dir("netfilter-simple", NULL);
+    debugfs_create_file("stats", 0444, debugfs_dir, NULL, &stats_fops);
+
+    err = register_pernet_subsys(&probe_net_ops);          //register hooks in every namespace
+    if(err) {
+        debugfs_remove_recursive(debugfs_dir);
+        free_percpu(probe_cpus);
+        return err;
+    }
 
-    printk(KERN_EMERG "Loadable module initialized\n"); 
+    printk(KERN_EMERG "Loadable module initialized\n");
 
     return 0;
 }
@@ -54,7 +262,9 @@ static int __init onload(void) {
  * exit function
  * ================================================================================================*/
 static void __exit onunload(void) {
-    nf_unregister_hook(&nfho);
+    unregister_pernet_subsys(&probe_net_ops);
+    debugfs_remove_recursive(debugfs_dir);
+    free_percpu(probe_cpus);
     printk(KERN_EMERG "Loadable module removed\n");
 }
 
@@ -71,6 +281,6 @@ module_exit(onunload);
  * ================================================================================================*/
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Mark Mester <mmester@parrylabs.com>");
-MODULE_DESCRIPTION("A simple skeleton for a loadable Linux kernel module");
+MODULE_DESCRIPTION("Netfilter hook cost probe, a baseline for netfilter-firewall");
 
 // EOF